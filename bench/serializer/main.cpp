@@ -0,0 +1,196 @@
+/**
+ * @file main.cpp
+ * @author Christoff Linde
+ * @brief Native benchmark of the generated batch writers against ArduinoJson and printf
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * Serializes the same batches of UPLOAD_BATCH_SIZE readings as a JSON envelope, through an ArduinoJson
+ * document as sendData did before and through the writer generated from ReadingSchema, and as CSV lines,
+ * with snprintf float formatting and with the generated writer. Reports records/s and bytes per record
+ * of each, after checking that both envelopes decode to the same readings.
+ *
+ * Code size is compared on the device instead, see the d1_mini_arduinojson environment.
+ *
+ * Run with: pio run -e native_bench -t exec
+ * Without ArduinoJson, its row and the envelope check are left out, see README.md.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#if __has_include(<ArduinoJson.h>)
+#include <ArduinoJson.h>
+#define BENCH_ARDUINOJSON 1
+#else
+#define BENCH_ARDUINOJSON 0
+#endif
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "ReadingSchema.h"
+
+/// Readings per batch, matches UPLOAD_BATCH_SIZE of the firmware
+#define BATCH_SIZE 24
+
+#define BATCH_COUNT 2000
+
+#define ROUNDS 20
+
+/// Output buffer, large enough for any batch
+struct BufferSink
+{
+  char data[4096];
+  size_t len;
+
+  size_t write(const uint8_t* buf, size_t size)
+  {
+    memcpy(data + len, buf, size);
+    len += size;
+    return size;
+  }
+};
+
+#if BENCH_ARDUINOJSON
+static size_t documentEnvelope(const LogRecord* records, size_t count, uint32_t firstSeq, char* out, size_t size)
+{
+  StaticJsonDocument<2048> doc;
+
+  doc["device"] = "e1f0c2";
+  doc["firmware"] = "0.4";
+  doc["encoding"] = UPLOAD_ENCODING;
+  doc.createNestedArray("sensors").add(SENSOR_ID);
+  JsonArray seq = doc.createNestedArray("seq");
+  seq.add(firstSeq);
+  seq.add(firstSeq + count - 1);
+
+  JsonArray readings = doc.createNestedArray("readings");
+  for (size_t i = 0; i < count; i++)
+  {
+    JsonObject readingObject = readings.createNestedObject();
+    readingObject["timestamp"] = records[i].timestamp;
+    readingObject["humidity"] = records[i].humidity / 100.0f;
+    readingObject["temperature"] = records[i].temperature / 100.0f;
+    if (records[i].node != 0)
+    {
+      char node[9];
+      snprintf(node, sizeof(node), "%x", records[i].node);
+      readingObject["node"] = node;
+    }
+  }
+  return serializeJson(doc, out, size);
+}
+#endif
+
+static size_t printfCsv(const LogRecord* records, size_t count, uint32_t firstSeq, char* out, size_t size)
+{
+  size_t len = snprintf(out, size, "seq,timestamp,humidity,temperature,node\n");
+  for (size_t i = 0; i < count; i++)
+  {
+    len += snprintf(out + len, size - len, "%u,%u,%.2f,%.2f,", static_cast<unsigned>(firstSeq + i),
+      static_cast<unsigned>(records[i].timestamp), records[i].humidity / 100.0f, records[i].temperature / 100.0f);
+    if (records[i].node != 0)
+    {
+      len += snprintf(out + len, size - len, "%x", static_cast<unsigned>(records[i].node));
+    }
+    out[len++] = '\n';
+  }
+  return len;
+}
+
+#if BENCH_ARDUINOJSON
+/// Check that the generated envelope decodes to the readings it was written from
+static bool checkEnvelope(const LogRecord* records, size_t count)
+{
+  BufferSink sink = {};
+  writeEnvelope(sink, "e1f0c2", "0.4", records, count, 0);
+  DynamicJsonDocument doc(8192);
+  if (deserializeJson(doc, sink.data, sink.len))
+  {
+    return false;
+  }
+  JsonArray readings = doc["readings"];
+  for (size_t i = 0; i < count; i++)
+  {
+    JsonObject reading = readings[i];
+    uint32_t node = reading.containsKey("node") ? strtoul(reading["node"], nullptr, 16) : 0;
+    if (reading["timestamp"] != records[i].timestamp ||
+        lround(reading["humidity"].as<double>() * 100) != records[i].humidity ||
+        lround(reading["temperature"].as<double>() * 100) != records[i].temperature || node != records[i].node)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
+template <typename Serialize>
+static void measure(const char* name, const std::vector<LogRecord>& records, Serialize serialize)
+{
+  size_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    for (size_t b = 0; b < BATCH_COUNT; b++)
+    {
+      bytes += serialize(&records[b * BATCH_SIZE], BATCH_SIZE, b * BATCH_SIZE);
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  double count = static_cast<double>(ROUNDS) * BATCH_COUNT * BATCH_SIZE;
+  printf("%-22s %12.0f records/s  %6.1f bytes/record\n", name, count / elapsed.count(), bytes / count);
+}
+
+int main()
+{
+  // Readings of a gateway, relaying a leaf in every other slot
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> noise(-20, 20);
+  std::vector<LogRecord> records(BATCH_COUNT * BATCH_SIZE);
+  int32_t humidity = 6000;
+  int32_t temperature = 150;
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    humidity += noise(random);
+    temperature += noise(random);
+    records[i] = { 0, 1617000000 + static_cast<uint32_t>(i / 2) * 900, humidity, temperature,
+      i % 2 == 1 ? 0x8e1f0cu : 0u };
+  }
+
+#if BENCH_ARDUINOJSON
+  if (!checkEnvelope(records.data(), BATCH_SIZE))
+  {
+    printf("Generated envelope does not match its readings\n");
+    return 1;
+  }
+#else
+  printf("Built without ArduinoJson, its row and the envelope check are left out\n");
+#endif
+
+  static char out[4096];
+  static BufferSink sink;
+#if BENCH_ARDUINOJSON
+  measure("envelope ArduinoJson", records, [](const LogRecord* batch, size_t count, uint32_t firstSeq) {
+    return documentEnvelope(batch, count, firstSeq, out, sizeof(out));
+  });
+#endif
+  measure("envelope generated", records, [](const LogRecord* batch, size_t count, uint32_t firstSeq) {
+    sink.len = 0;
+    writeEnvelope(sink, "e1f0c2", "0.4", batch, count, firstSeq);
+    return sink.len;
+  });
+  measure("csv snprintf", records, [](const LogRecord* batch, size_t count, uint32_t firstSeq) {
+    return printfCsv(batch, count, firstSeq, out, sizeof(out));
+  });
+  measure("csv generated", records, [](const LogRecord* batch, size_t count, uint32_t firstSeq) {
+    sink.len = 0;
+    writeCsvBatch(sink, batch, count, firstSeq);
+    return sink.len;
+  });
+  return 0;
+}
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Time full and resumed TLS handshakes against the stand-in server in --tls mode.
+
+Starts tools/stand_in_server.py on a throwaway certificate of each key type
+the firmware can pin, then connects ROUNDS times without a session and ROUNDS
+times resuming the session of the last connection, as uploadConnect() does.
+Reports the median handshake time seen by the client and by the server.
+
+These are host figures. The handshake time and heap of the device are
+printed by its stats command, see README.md.
+
+Usage: python3 bench/tls/handshake.py [ROUNDS]
+"""
+
+import os
+import socket
+import ssl
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "tools"))
+import stand_in_server  # noqa: E402
+
+KEYS = [
+    ("EC P-256", ["-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:prime256v1"]),
+    ("RSA 2048", ["-newkey", "rsa:2048"]),
+]
+
+
+def make_certificate(directory, options):
+    cert = os.path.join(directory, "cert.pem")
+    key = os.path.join(directory, "key.pem")
+    subprocess.run(["openssl", "req", "-x509", *options, "-nodes", "-days", "1", "-subj", "/CN=localhost",
+                    "-keyout", key, "-out", cert], check=True, capture_output=True)
+    return cert, key
+
+
+def handshake(context, port, session):
+    """Connect, returning (milliseconds, session, reused)."""
+    raw = socket.create_connection(("localhost", port), timeout=5)
+    start = time.perf_counter()
+    sock = context.wrap_socket(raw, server_hostname="localhost", session=session)
+    elapsed = (time.perf_counter() - start) * 1000
+    result = (elapsed, sock.session, sock.session_reused)
+    sock.close()
+    return result
+
+
+def measure(name, options, rounds):
+    with tempfile.TemporaryDirectory() as directory:
+        cert, key = make_certificate(directory, options)
+        server = stand_in_server.make_server(directory, 0, tls=(cert, key))
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        port = server.server_address[1]
+        context = ssl.create_default_context(cafile=cert)
+
+        full = [handshake(context, port, None)[0] for _ in range(rounds)]
+        _, session, _ = handshake(context, port, None)
+        resumed = []
+        for _ in range(rounds):
+            elapsed, session, reused = handshake(context, port, session)
+            if not reused:
+                sys.exit("%s: session was not resumed" % name)
+            resumed.append(elapsed)
+        time.sleep(0.1)
+        server_full = [ms for ms, reused in server.handshakes if not reused]
+        server_resumed = [ms for ms, reused in server.handshakes if reused]
+        server.shutdown()
+        server.server_close()
+
+    for kind, client, served in (("full", full, server_full), ("resumed", resumed, server_resumed)):
+        print("%-9s %-8s client %6.2f ms  server %6.2f ms" % (name, kind, statistics.median(client),
+                                                              statistics.median(served)))
+
+
+def main(argv):
+    rounds = int(argv[1]) if len(argv) > 1 else 50
+    sys.stderr = open(os.devnull, "w")
+    for name, options in KEYS:
+        measure(name, options, rounds)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
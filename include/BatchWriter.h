@@ -0,0 +1,394 @@
+/**
+ * @file BatchWriter.h
+ * @author Christoff Linde
+ * @brief Schema specialised text serialization of fixed layout records
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * A record schema is a list of field types, declared with BATCH_FIELD. Each field knows at compile
+ * time its key, how to read it from the record and how to encode it. BatchSchema expands the list into
+ * straight line code writing a record as a JSON object or as a CSV row, without building a document
+ * first. Keys are written as precomputed fragments such as ,"humidity": in a single copy.
+ *
+ * Numbers are formatted with integer arithmetic only. Fixed point values carry their number of decimals
+ * in the field type, so the divisions by powers of ten are by constants.
+ *
+ * Output goes through a small buffer to any sink with a write(const uint8_t*, size_t) method, such as
+ * Print. Nothing here depends on the Arduino core, so it also builds natively.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef BATCH_WRITER_H
+#define BATCH_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Size of the buffer in front of the sink
+#define TEXT_WRITER_BUFFER 128
+
+/// Pairs of decimal digits "00" to "99", so numbers are formatted two digits per division
+inline const char* decimalPairs()
+{
+  static const char pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  return pairs;
+}
+
+/**
+ * @brief Format an unsigned number, right aligned at end
+ *
+ * @param value the number to format
+ * @param end the end of a buffer of at least 10 characters
+ * @return char* - the first character of the number
+ */
+inline char* formatUint(uint32_t value, char* end)
+{
+  const char* pairs = decimalPairs();
+  while (value >= 100)
+  {
+    uint32_t pair = (value % 100) * 2;
+    value /= 100;
+    *--end = pairs[pair + 1];
+    *--end = pairs[pair];
+  }
+  if (value >= 10)
+  {
+    *--end = pairs[value * 2 + 1];
+    *--end = pairs[value * 2];
+  }
+  else
+  {
+    *--end = static_cast<char>('0' + value);
+  }
+  return end;
+}
+
+/// Powers of ten for fixed point values
+template <uint8_t Decimals>
+struct DecimalScale
+{
+  static const uint32_t value = 10 * DecimalScale<Decimals - 1>::value;
+};
+
+template <>
+struct DecimalScale<0>
+{
+  static const uint32_t value = 1;
+};
+
+/**
+ * @brief Buffered text output
+ *
+ * @details The buffer is handed to the sink when it is full, on flush() and on destruction.
+ *
+ * @tparam Sink any type with a size_t write(const uint8_t*, size_t) method
+ */
+template <typename Sink>
+class TextWriter
+{
+public:
+  explicit TextWriter(Sink& sink) : _sink(sink), _len(0)
+  {
+  }
+
+  ~TextWriter()
+  {
+    flush();
+  }
+
+  TextWriter(const TextWriter&) = delete;
+  TextWriter& operator=(const TextWriter&) = delete;
+
+  void write(const char* data, size_t len)
+  {
+    if (_len + len > sizeof(_buf))
+    {
+      flush();
+      if (len > sizeof(_buf))
+      {
+        _sink.write(reinterpret_cast<const uint8_t*>(data), len);
+        return;
+      }
+    }
+    memcpy(_buf + _len, data, len);
+    _len += len;
+  }
+
+  /// Write a string literal, its length is known at compile time
+  template <size_t N>
+  void literal(const char (&text)[N])
+  {
+    write(text, N - 1);
+  }
+
+  void writeString(const char* text)
+  {
+    write(text, strlen(text));
+  }
+
+  void writeChar(char ch)
+  {
+    if (_len == sizeof(_buf))
+    {
+      flush();
+    }
+    _buf[_len++] = ch;
+  }
+
+  void writeUint(uint32_t value)
+  {
+    char digits[10];
+    char* start = formatUint(value, digits + sizeof(digits));
+    write(start, digits + sizeof(digits) - start);
+  }
+
+  /**
+   * @brief Write a fixed point value
+   *
+   * @tparam Decimals the number of decimals, the value is in units of 10^-Decimals
+   * @param value the value to write
+   */
+  template <uint8_t Decimals>
+  void writeFixed(int32_t value)
+  {
+    // Widened before negating, so INT32_MIN is written correctly too
+    uint32_t magnitude = value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+    char digits[12 + Decimals];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    if (Decimals > 0)
+    {
+      uint32_t fraction = magnitude % DecimalScale<Decimals>::value;
+      magnitude /= DecimalScale<Decimals>::value;
+      for (uint8_t i = 0; i < Decimals; i++)
+      {
+        *--start = static_cast<char>('0' + fraction % 10);
+        fraction /= 10;
+      }
+      *--start = '.';
+    }
+    start = formatUint(magnitude, start);
+    if (value < 0)
+    {
+      *--start = '-';
+    }
+    write(start, end - start);
+  }
+
+  /// Write a number in lower case hexadecimal, without leading zeros
+  void writeHex(uint32_t value)
+  {
+    static const char hexDigits[] = "0123456789abcdef";
+    char digits[8];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    do
+    {
+      *--start = hexDigits[value & 0xF];
+      value >>= 4;
+    } while (value != 0);
+    write(start, end - start);
+  }
+
+  void flush()
+  {
+    if (_len > 0)
+    {
+      _sink.write(reinterpret_cast<const uint8_t*>(_buf), _len);
+      _len = 0;
+    }
+  }
+
+private:
+  Sink& _sink;
+  char _buf[TEXT_WRITER_BUFFER];
+  size_t _len;
+};
+
+/// An unsigned number
+struct UintEncoding
+{
+};
+
+/// A fixed point number with the given number of decimals
+template <uint8_t Decimals>
+struct FixedEncoding
+{
+};
+
+/// A chip id in hex, left out when 0. Quoted in JSON
+struct OptionalHexEncoding
+{
+};
+
+template <typename W>
+inline void writeJsonValue(W& out, uint32_t value, UintEncoding)
+{
+  out.writeUint(value);
+}
+
+template <typename W, uint8_t Decimals>
+inline void writeJsonValue(W& out, int32_t value, FixedEncoding<Decimals>)
+{
+  out.template writeFixed<Decimals>(value);
+}
+
+template <typename W>
+inline void writeJsonValue(W& out, uint32_t value, OptionalHexEncoding)
+{
+  out.writeChar('"');
+  out.writeHex(value);
+  out.writeChar('"');
+}
+
+template <typename W, typename T, typename Encoding>
+inline void writeCsvValue(W& out, T value, Encoding encoding)
+{
+  writeJsonValue(out, value, encoding);
+}
+
+template <typename W>
+inline void writeCsvValue(W& out, uint32_t value, OptionalHexEncoding)
+{
+  if (value != 0)
+  {
+    out.writeHex(value);
+  }
+}
+
+template <typename T, typename Encoding>
+inline bool isOmitted(T, Encoding)
+{
+  return false;
+}
+
+inline bool isOmitted(uint32_t value, OptionalHexEncoding)
+{
+  return value == 0;
+}
+
+/**
+ * @brief Declare a field of a record schema
+ *
+ * @param Name the name of the field type
+ * @param Record the record type
+ * @param member the member of the record, also used as the key
+ * @param Encoding the encoding of the value
+ */
+#define BATCH_FIELD(Name, Record, member, Encoding)                       \
+  struct Name                                                             \
+  {                                                                       \
+    typedef Encoding encoding;                                            \
+    static auto get(const Record& record) -> decltype(record.member)      \
+    {                                                                     \
+      return record.member;                                               \
+    }                                                                     \
+    template <typename W>                                                 \
+    static void key(W& out, bool first)                                   \
+    {                                                                     \
+      if (first)                                                          \
+      {                                                                   \
+        out.literal("\"" #member "\":");                                  \
+      }                                                                   \
+      else                                                                \
+      {                                                                   \
+        out.literal(",\"" #member "\":");                                 \
+      }                                                                   \
+    }                                                                     \
+    template <typename W>                                                 \
+    static void name(W& out)                                              \
+    {                                                                     \
+      out.literal(#member);                                               \
+    }                                                                     \
+  }
+
+/**
+ * @brief A record schema, the fields in output order
+ */
+template <typename... Fields>
+struct BatchSchema;
+
+template <>
+struct BatchSchema<>
+{
+  template <typename W, typename R>
+  static void jsonFields(W&, const R&, bool)
+  {
+  }
+
+  template <typename W, typename R>
+  static void csvFields(W&, const R&)
+  {
+  }
+
+  template <typename W>
+  static void csvNames(W&)
+  {
+  }
+};
+
+template <typename Field, typename... Rest>
+struct BatchSchema<Field, Rest...>
+{
+  /// Write a record as a JSON object. Omitted fields are left out together with their key
+  template <typename W, typename R>
+  static void writeJson(W& out, const R& record)
+  {
+    out.writeChar('{');
+    jsonFields(out, record, true);
+    out.writeChar('}');
+  }
+
+  /// Write a record as a CSV row, without the line end. Omitted fields are left empty
+  template <typename W, typename R>
+  static void writeCsv(W& out, const R& record)
+  {
+    writeCsvValue(out, Field::get(record), typename Field::encoding());
+    BatchSchema<Rest...>::csvFields(out, record);
+  }
+
+  /// Write the field names as a CSV header row, without the line end
+  template <typename W>
+  static void writeCsvHeader(W& out)
+  {
+    Field::name(out);
+    BatchSchema<Rest...>::csvNames(out);
+  }
+
+  template <typename W, typename R>
+  static void jsonFields(W& out, const R& record, bool first)
+  {
+    auto value = Field::get(record);
+    if (!isOmitted(value, typename Field::encoding()))
+    {
+      Field::key(out, first);
+      writeJsonValue(out, value, typename Field::encoding());
+      first = false;
+    }
+    BatchSchema<Rest...>::jsonFields(out, record, first);
+  }
+
+  template <typename W, typename R>
+  static void csvFields(W& out, const R& record)
+  {
+    out.writeChar(',');
+    writeCsvValue(out, Field::get(record), typename Field::encoding());
+    BatchSchema<Rest...>::csvFields(out, record);
+  }
+
+  template <typename W>
+  static void csvNames(W& out)
+  {
+    out.writeChar(',');
+    Field::name(out);
+    BatchSchema<Rest...>::csvNames(out);
+  }
+};
+
+#endif
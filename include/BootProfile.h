@@ -0,0 +1,67 @@
+/**
+ * @file BootProfile.h
+ * @author Christoff Linde
+ * @brief Timing instrumentation for the boot sequence
+ * @version 0.1
+ * @date 2021-03-21
+ *
+ * Each boot phase records when it started and how long it took, relative to reset. Phases may
+ * overlap, e.g. the WiFi association runs in the background while storage and sensors start.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef BOOT_PROFILE_H
+#define BOOT_PROFILE_H
+
+#include <Arduino.h>
+
+/// The phases of the boot sequence, in the order they are reported
+enum BootPhase : uint8_t
+{
+  BOOT_STORAGE,
+  BOOT_SENSORS,
+  BOOT_WIFI,
+  BOOT_UDP,
+  BOOT_DNS,
+  BOOT_NTP,
+  BOOT_FIRST_SAMPLE,
+  BOOT_PHASE_COUNT
+};
+
+/**
+ * @brief Mark the start of a boot phase
+ *
+ * @param phase the phase that started
+ */
+void bootPhaseStart(BootPhase phase);
+
+/**
+ * @brief Mark the end of a boot phase
+ *
+ * @details Phases that were never started are treated as starting at reset. Ending a phase more
+ * than once keeps the first end time.
+ *
+ * @param phase the phase that ended
+ */
+void bootPhaseEnd(BootPhase phase);
+
+/**
+ * @brief Check whether all boot phases have ended
+ *
+ * @return true if every phase has ended
+ */
+bool bootComplete();
+
+/**
+ * @brief Print the boot phase breakdown
+ *
+ * @details Prints the start offset and duration of each phase in milliseconds, followed by the
+ * time to first sample.
+ *
+ * @param out the Print to write the report to
+ */
+void printBootReport(Print& out);
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file Console.h
+ * @author Christoff Linde
+ * @brief Line based command console, read without blocking
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * Input is collected a byte at a time as it arrives, and a line is only run once its end arrived, so
+ * waiting for a command never holds up the main loop. A line is a command name, followed by its
+ * arguments, separated by spaces.
+ *
+ * Handlers write their output to a Print, and get the arguments as a string, so the same handlers can
+ * serve any transport that hands over a line and takes the output, @see consoleRun.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <Arduino.h>
+
+/// Longest line taken, longer lines are dropped
+#define CONSOLE_LINE_SIZE 64
+
+/**
+ * @brief Runs a command
+ *
+ * @param out the Print to write the output to
+ * @param args the arguments, without leading spaces, empty if there are none
+ */
+typedef void (*CommandHandler)(Print& out, const char* args);
+
+struct ConsoleCommand
+{
+  const char* name;
+  /// Arguments and purpose, shown by help
+  const char* help;
+  CommandHandler handler;
+};
+
+/**
+ * @brief Set the commands of the console
+ *
+ * @details The console adds a help command, which lists them.
+ *
+ * @param commands the commands, which must outlive the console
+ * @param count the number of commands
+ */
+void consoleBegin(const ConsoleCommand* commands, size_t count);
+
+/**
+ * @brief Take the input available, and run the lines it completes
+ *
+ * @param in the Stream to read from
+ * @param out the Print to write the output to
+ */
+void consolePoll(Stream& in, Print& out);
+
+/**
+ * @brief Run a line
+ *
+ * @param line the command name and its arguments
+ * @param out the Print to write the output to
+ * @return true if the command was found
+ */
+bool consoleRun(const char* line, Print& out);
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * @file CpuBoost.h
+ * @author Christoff Linde
+ * @brief Raising the CPU clock for compute bound phases only
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * The ESP8266 runs at 80 MHz, and can switch to 160 MHz at any time. Most of the time it waits for the
+ * sensor, the network or the flash, where a faster clock only costs power. Compute bound phases, such as
+ * a TLS handshake, encoding a batch or applying a delta patch, are wrapped in cpuBoostStart() and
+ * cpuBoostEnd(), which run them at CPU_BOOST_MHZ and drop back once no boosted phase is left.
+ *
+ * Every phase accounts the CPU cycles and the wall time spent in it. Phases may nest, the time of an
+ * inner phase is also counted in the outer one.
+ *
+ * Only the CPU clock changes. millis(), micros(), delays and the UART do not depend on it, conversions
+ * of ESP.getCycleCount() with F_CPU do.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef CPU_BOOST_H
+#define CPU_BOOST_H
+
+#include <Arduino.h>
+
+/// CPU clock during boosted phases
+#ifndef CPU_BOOST_MHZ
+#define CPU_BOOST_MHZ 160
+#endif
+
+/// The compute bound phases, in the order they are reported
+enum CpuPhase : uint8_t
+{
+  CPU_TLS,
+  CPU_ENCODE,
+  CPU_PATCH,
+  CPU_PHASE_COUNT
+};
+
+/**
+ * @brief Enter a compute bound phase, at CPU_BOOST_MHZ
+ *
+ * @param phase the phase that started
+ */
+void cpuBoostStart(CpuPhase phase);
+
+/**
+ * @brief Leave a compute bound phase, and account its cycles and time
+ *
+ * @details The clock drops back to F_CPU once no boosted phase is left.
+ *
+ * @param phase the phase that ended
+ */
+void cpuBoostEnd(CpuPhase phase);
+
+/**
+ * @brief Print the runs, time and cycles of every phase
+ *
+ * @param out the Print to write the statistics to
+ */
+void printCpuStats(Print& out);
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * @file DHT22.h
+ * @author Christoff Linde
+ * @brief A lean, allocation-free driver for the DHT-22 Temperature and Humidity Sensor
+ * @version 0.1
+ * @date 2021-03-20
+ *
+ * The DHT-22 answers a start signal with a 40 bit frame: 16 bits humidity, 16 bits temperature
+ * and an 8 bit checksum, all in tenths. Each bit is a ~50us low pulse followed by a high pulse
+ * of ~27us (0) or ~70us (1).
+ *
+ * The pulse capture and the protocol decoding are kept separate. The decoder lives in DHT22Decode.cpp,
+ * which has no dependency on the Arduino core, and is tested on the host in test/test_dht22_decode:
+ * pio test -e native.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef DHT22_H
+#define DHT22_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Number of data bits in a DHT-22 frame
+#define DHT22_FRAME_BITS 40
+
+/// Minimum time between two transactions, as specified in the datasheet
+#define DHT22_MIN_INTERVAL 2000UL
+
+/// Result of a DHT-22 transaction
+enum class DHT22Status : uint8_t
+{
+  Ok,
+  Timeout,
+  Checksum,
+  TooSoon
+};
+
+/**
+ * @brief A single DHT-22 reading
+ *
+ * @details Values are kept in the fixed point format transmitted by the sensor, i.e. in tenths
+ * of a degree Celsius and tenths of a percent relative humidity.
+ */
+struct DHT22Reading
+{
+  int16_t temperature;
+  uint16_t humidity;
+};
+
+/**
+ * @brief Decode captured pulse widths into a raw frame
+ *
+ * @details Each data bit is encoded as a low pulse followed by a high pulse. A bit is 1 when its
+ * high pulse is longer than its low pulse, which keeps the decoder independent of the absolute
+ * timing of a particular sensor.
+ *
+ * @param lowUs the low pulse widths in microseconds, DHT22_FRAME_BITS entries
+ * @param highUs the high pulse widths in microseconds, DHT22_FRAME_BITS entries
+ * @param frame the 5 byte output frame
+ */
+void dht22DecodePulses(const uint16_t* lowUs, const uint16_t* highUs, uint8_t frame[5]);
+
+/**
+ * @brief Validate a raw frame and convert it to a reading
+ *
+ * @param frame the 5 byte frame received from the sensor
+ * @param reading the decoded reading, only written when the checksum matches
+ * @return DHT22Status - DHT22Status::Ok or DHT22Status::Checksum
+ */
+DHT22Status dht22DecodeFrame(const uint8_t frame[5], DHT22Reading& reading);
+
+/**
+ * @brief Decode a captured response into a reading
+ *
+ * @details A capture ends early when a pulse times out, so fewer than DHT22_FRAME_BITS pulses mean the
+ * sensor stopped answering part way.
+ *
+ * @param lowUs the low pulse widths in microseconds
+ * @param highUs the high pulse widths in microseconds
+ * @param count the number of pulses captured
+ * @param reading the decoded reading, only written on success
+ * @return DHT22Status - DHT22Status::Ok, DHT22Status::Timeout for a short capture, or DHT22Status::Checksum
+ */
+DHT22Status dht22DecodeCapture(const uint16_t* lowUs, const uint16_t* highUs, size_t count, DHT22Reading& reading);
+
+/**
+ * @brief Get a printable name for a DHT22Status
+ *
+ * @param status the status to be named
+ * @return const char* - the status name
+ */
+const char* dht22StatusName(DHT22Status status);
+
+/**
+ * @brief DHT-22 sensor on a single GPIO
+ *
+ * @details The driver keeps no buffers beyond a single frame of pulse widths on the stack while
+ * reading. The time critical part of the transaction runs with interrupts disabled, so WiFi
+ * interrupts cannot stretch the measured pulses.
+ */
+class DHT22
+{
+public:
+  /**
+   * @brief Construct a DHT22 driver
+   *
+   * @param pin the GPIO the sensor data line is connected to
+   */
+  explicit DHT22(uint8_t pin);
+
+  /**
+   * @brief Configure the data pin
+   *
+   * @details Releases the data line so the sensor can settle before the first transaction.
+   */
+  void begin();
+
+  /**
+   * @brief Read temperature and humidity from the sensor
+   *
+   * @details Sends the start signal, captures the 40 bit response and decodes it. A transaction
+   * takes roughly 5ms. Calls made within DHT22_MIN_INTERVAL of the previous transaction do not
+   * touch the sensor.
+   *
+   * @param reading the decoded reading, only written on success
+   * @return DHT22Status - the result of the transaction
+   */
+  DHT22Status read(DHT22Reading& reading);
+
+  /**
+   * @brief Send the start signal of a transaction, to be completed with @see finish
+   *
+   * @details Pulls the data line low and returns. The sensor needs the line low for 1 to 10ms before
+   * finish() is called, which lets a timer take the start signal's place instead of busy waiting.
+   *
+   * @return DHT22Status - DHT22Status::Ok, or DHT22Status::TooSoon without touching the sensor
+   */
+  DHT22Status start();
+
+  /**
+   * @brief Complete a transaction begun with @see start
+   *
+   * @details Releases the data line, captures the 40 bit response and decodes it, which takes roughly
+   * 5ms with interrupts disabled.
+   *
+   * @param reading the decoded reading, only written on success
+   * @return DHT22Status - the result of the transaction
+   */
+  DHT22Status finish(DHT22Reading& reading);
+
+private:
+  /**
+   * @brief Wait for the data line to leave the given level
+   *
+   * @param level the level the line is currently expected at
+   * @return uint32_t - the pulse width in microseconds, or 0 on timeout
+   */
+  uint32_t expectPulse(bool level);
+
+  uint8_t _pin;
+  uint32_t _lastRead;
+  bool _hasRead;
+};
+
+#endif
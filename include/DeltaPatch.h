@@ -0,0 +1,169 @@
+/**
+ * @file DeltaPatch.h
+ * @author Christoff Linde
+ * @brief Streaming decoder for binary delta patches between two firmware images
+ * @version 0.1
+ * @date 2021-03-26
+ *
+ * A patch rebuilds a new image from the running (old) image, in the spirit of bsdiff. It is applied
+ * as it is received, so neither the patch nor the new image is ever held in RAM.
+ *
+ * Patch layout, all integers little endian:
+ *
+ *     header   "MDP1", old size (u32), new size (u32), MD5 of the old image (32 hex characters)
+ *     record   diff length (varint), extra length (varint), old seek (zigzag varint),
+ *              diff tokens covering diff length bytes, extra length literal bytes
+ *
+ * Diff bytes are added (mod 256) to the old image at the current old position. Since most of them
+ * are zero, they are sent as tokens: a varint t, where t & 1 means (t >> 1) explicit diff bytes
+ * follow, otherwise (t >> 1) bytes are copied from the old image unchanged. After the diff, the old
+ * position is moved by the seek value. Records repeat until the new image is complete.
+ *
+ * Patches are generated on the host by tools/delta.py.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Size of the patch header in bytes
+#define DELTA_HEADER_SIZE 44
+
+/// Size of the buffer used to read the old image
+#define DELTA_OLD_CHUNK 256
+
+/// Result of feeding data to a DeltaPatcher
+enum class DeltaStatus : uint8_t
+{
+  Ok,
+  Done,
+  BadHeader,
+  Corrupt,
+  ReadFailed,
+  WriteFailed
+};
+
+/**
+ * @brief Read bytes from the old image
+ *
+ * @return true if len bytes at offset were read into buf
+ */
+typedef bool (*DeltaReadOld)(uint32_t offset, uint8_t* buf, size_t len, void* context);
+
+/**
+ * @brief Write bytes of the new image
+ *
+ * @return true if all len bytes were written
+ */
+typedef bool (*DeltaWriteNew)(const uint8_t* buf, size_t len, void* context);
+
+/**
+ * @brief Applies a delta patch as it is received
+ *
+ * @details Data may be fed in chunks of any size, including chunks that split a varint or a token.
+ * The patcher holds only its parser state and a DELTA_OLD_CHUNK byte buffer.
+ */
+class DeltaPatcher
+{
+public:
+  /**
+   * @brief Construct a DeltaPatcher
+   *
+   * @param readOld called to read the old image
+   * @param writeNew called with the bytes of the new image, in order
+   * @param context passed to both callbacks
+   */
+  DeltaPatcher(DeltaReadOld readOld, DeltaWriteNew writeNew, void* context);
+
+  /**
+   * @brief Set the old image the patch must have been generated against
+   *
+   * @details If set, a patch for a different old image is rejected with DeltaStatus::BadHeader before
+   * any output is written.
+   *
+   * @param size the size of the old image
+   * @param md5 the MD5 of the old image as 32 hex characters
+   */
+  void expectOld(uint32_t size, const char* md5);
+
+  /**
+   * @brief Feed the next chunk of the patch
+   *
+   * @param data the patch bytes
+   * @param len the number of bytes in data
+   * @return DeltaStatus - DeltaStatus::Ok while more data is expected, DeltaStatus::Done once the new
+   * image is complete, or the error that stopped the patcher
+   */
+  DeltaStatus write(const uint8_t* data, size_t len);
+
+  /**
+   * @brief Get the size of the new image
+   *
+   * @return uint32_t - the size from the patch header, or 0 before the header was received
+   */
+  uint32_t newSize() const { return _newSize; }
+
+  /**
+   * @brief Get the number of bytes of the new image written so far
+   */
+  uint32_t written() const { return _written; }
+
+private:
+  enum State : uint8_t
+  {
+    HEADER,
+    DIFF_LENGTH,
+    EXTRA_LENGTH,
+    SEEK,
+    TOKEN,
+    DIFF_COPY,
+    DIFF_ADD,
+    EXTRA,
+    DONE,
+    FAILED
+  };
+
+  /// Accumulate one varint byte, returning true once the varint is complete
+  bool varintByte(uint8_t byte, uint32_t& value);
+  /// Move on after a run of diff tokens
+  void endRun();
+  /// Move to the next part of the record after the diff tokens
+  void endDiff();
+  /// Move to the next record after the extra bytes
+  void endRecord();
+  DeltaStatus parseHeader();
+  DeltaStatus fail(DeltaStatus status);
+
+  DeltaReadOld _readOld;
+  DeltaWriteNew _writeNew;
+  void* _context;
+
+  uint32_t _expectedOldSize;
+  const char* _expectedOldMD5;
+
+  State _state;
+  DeltaStatus _error;
+  uint8_t _header[DELTA_HEADER_SIZE];
+  uint8_t _headerLength;
+
+  uint32_t _varint;
+  uint8_t _varintShift;
+
+  uint32_t _oldSize;
+  uint32_t _newSize;
+  uint32_t _oldPos;
+  uint32_t _written;
+  uint32_t _diffRemaining;
+  uint32_t _extraRemaining;
+  uint32_t _run;
+  int32_t _seek;
+
+  uint8_t _old[DELTA_OLD_CHUNK];
+};
+
+#endif
@@ -0,0 +1,181 @@
+/**
+ * @file EspNowLink.h
+ * @author Christoff Linde
+ * @brief ESP-NOW link between leaf nodes and a gateway
+ * @version 0.1
+ * @date 2021-04-02
+ *
+ * Leaf nodes never associate with an Access Point. They send each reading to a mains powered gateway
+ * over ESP-NOW, which is connectionless, and the gateway logs and uploads the readings of all its
+ * leaves along with its own.
+ *
+ * The gateway answers every reading with a time beacon, so leaves keep time without NTP. The beacon
+ * echoes the sequence number of the reading and the time the gateway held it, so the leaf can take
+ * half the remaining round trip as the transit time of the beacon.
+ *
+ * ESP-NOW only works between radios on the same channel, so LINK_CHANNEL must match the channel of the
+ * Access Point the gateway is connected to.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef ESP_NOW_LINK_H
+#define ESP_NOW_LINK_H
+
+#include <Arduino.h>
+
+#include "DHT22.h"
+
+#ifndef LINK_CHANNEL
+#define LINK_CHANNEL 1
+#endif
+
+/// MAC address of the gateway. Defaults to broadcast, which needs no pairing
+#ifndef LINK_GATEWAY_MAC
+#define LINK_GATEWAY_MAC { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }
+#endif
+
+/// Version of the link messages, increased on incompatible changes
+#define LINK_VERSION 2
+
+/// Number of received readings buffered on the gateway until the main loop picks them up, a power of two
+#define LINK_QUEUE_SIZE 16
+
+/// Number of unencrypted peers the ESP-NOW stack takes. Beyond it, the gateway evicts the leaf it
+/// answered least recently
+#define LINK_MAX_PEERS 20
+
+/// Type of a link message
+enum LinkMessageType : uint8_t
+{
+  LINK_READING = 1,
+  LINK_TIME = 2
+};
+
+/// A reading sent from a leaf to the gateway
+struct __attribute__((packed)) LinkReading
+{
+  uint8_t type;
+  uint8_t version;
+  uint16_t seq;
+  /// Chip id of the leaf
+  uint32_t node;
+  /// UNIX time at which the reading was taken, or 0 if the leaf has no time yet
+  uint32_t timestamp;
+  /// Milliseconds between taking the reading and sending it
+  uint32_t age;
+  int16_t temperature;
+  uint16_t humidity;
+};
+
+/// A time beacon sent from the gateway to a leaf
+struct __attribute__((packed)) LinkTime
+{
+  uint8_t type;
+  uint8_t version;
+  /// Sequence number of the reading this beacon answers
+  uint16_t seq;
+  /// UNIX time at which the beacon was sent
+  uint32_t seconds;
+  uint16_t milliseconds;
+  /// Milliseconds between receiving the reading and sending the beacon
+  uint16_t hold;
+};
+
+/// A reading received by the gateway
+struct LinkPacket
+{
+  LinkReading reading;
+  /// MAC address of the leaf
+  uint8_t mac[6];
+  /// millis() at which the reading was received
+  uint32_t received;
+};
+
+/**
+ * @brief Start ESP-NOW on a leaf node
+ *
+ * @details Puts the radio on LINK_CHANNEL and adds the gateway as a peer. WiFi must be in station mode
+ * and not associated.
+ *
+ * @return true if ESP-NOW started
+ */
+bool linkBeginLeaf();
+
+/**
+ * @brief Get the time distributed by the gateway
+ *
+ * @param time the current UNIX time, only written once a beacon was received
+ * @return true if the leaf has time
+ */
+bool linkCurrentTime(uint32_t& time);
+
+/**
+ * @brief Send a reading to the gateway
+ *
+ * @details The reading is timestamped with the time distributed by the gateway, if there is one.
+ *
+ * @param reading the reading to send
+ * @param age milliseconds since the reading was taken
+ * @return true if the reading was handed to the radio
+ */
+bool linkSendReading(const DHT22Reading& reading, uint32_t age);
+
+/**
+ * @brief Check whether the gateway answered the last reading sent
+ *
+ * @details A beacon answering the reading shows that the gateway received it.
+ *
+ * @return true once the beacon for the last reading sent arrived
+ */
+bool linkAnswered();
+
+/**
+ * @brief Start ESP-NOW on the gateway
+ *
+ * @details Received readings are queued from the WiFi callback, and picked up with @see linkReceive.
+ *
+ * @return true if ESP-NOW started
+ */
+bool linkBeginGateway();
+
+/**
+ * @brief Take the next received reading from the queue
+ *
+ * @param packet the received reading
+ * @return true if a reading was available
+ */
+bool linkReceive(LinkPacket& packet);
+
+/**
+ * @brief Get the time since a received reading was taken
+ *
+ * @details The age sent by the leaf plus the time the reading waited on the gateway, measured against
+ * millis() now, as packet.received may be later than a timestamp taken at the start of the loop.
+ *
+ * @param packet the received reading
+ * @return uint32_t - milliseconds since the reading was taken
+ */
+uint32_t linkPacketAge(const LinkPacket& packet);
+
+/**
+ * @brief Answer a received reading with a time beacon
+ *
+ * @details The leaf is added as a peer first, @see LINK_MAX_PEERS. If it cannot be added, no beacon is
+ * sent.
+ *
+ * @param packet the reading to answer
+ * @param seconds the current UNIX time
+ * @param milliseconds the milliseconds within the current second
+ */
+void linkSendTime(const LinkPacket& packet, uint32_t seconds, uint16_t milliseconds);
+
+/**
+ * @brief Print link statistics
+ *
+ * @param out the Print to write the statistics to
+ */
+void printLinkStats(Print& out);
+
+#endif
@@ -0,0 +1,205 @@
+/**
+ * @file ExportProtocol.h
+ * @author Christoff Linde
+ * @brief Framing of the serial log export, shared by the firmware and the host receiver
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * Every message is a frame:
+ *
+ *   magic (A5 5A) | type (1) | seq (2) | length (2) | payload (length) | CRC-32 (4)
+ *
+ * Integers are little endian. The CRC-32 (IEEE) covers type to payload. A receiver scans for the magic,
+ * so bytes between frames, such as log output, are skipped, and a frame with a bad CRC is dropped.
+ *
+ * The host starts an export with a START frame, which the device answers with READY. If START asks for
+ * another baud rate, the device switches after READY, and waits for START again at the new rate. The
+ * device then sends DATA frames, each holding the offset of its block, up to the size announced in
+ * READY, followed by END. A host that misses a frame sends START again with the offset it has, and the
+ * device restarts from there. The same resumes an export interrupted earlier.
+ *
+ * The header only depends on the C++ standard library, so the host receiver in tools/collector builds
+ * it too.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EXPORT_PROTOCOL_H
+#define EXPORT_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EXPORT_MAGIC0 0xA5
+#define EXPORT_MAGIC1 0x5A
+
+/// Bytes in front of the payload: magic, type, seq and length
+#define EXPORT_HEADER_SIZE 7
+
+/// Bytes behind the payload: the CRC-32
+#define EXPORT_TRAILER_SIZE 4
+
+/// Bytes of the log in a DATA frame
+#define EXPORT_BLOCK_SIZE 1024
+
+/// Payload of a DATA frame: the offset and a block
+#define EXPORT_MAX_PAYLOAD (4 + EXPORT_BLOCK_SIZE)
+
+/// Type of an export frame
+enum ExportFrameType : uint8_t
+{
+  /// Host to device: offset, baud rate or 0 to keep it
+  EXPORT_START = 1,
+  /// Device to host: offset, size of the log, baud rate
+  EXPORT_READY = 2,
+  /// Device to host: offset, block
+  EXPORT_DATA = 3,
+  /// Device to host: size of the log
+  EXPORT_END = 4,
+  /// Either way: the export is given up
+  EXPORT_ABORT = 5
+};
+
+inline uint32_t exportCrc32(uint32_t crc, const uint8_t* data, size_t len)
+{
+  // Half byte table, small enough for flash and still four times faster than bit by bit
+  static const uint32_t table[16] = { 0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+    0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4,
+    0xA00AE278, 0xBDBDF21C };
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+inline void exportPut16(uint8_t* data, uint16_t value)
+{
+  data[0] = value;
+  data[1] = value >> 8;
+}
+
+inline void exportPut32(uint8_t* data, uint32_t value)
+{
+  data[0] = value;
+  data[1] = value >> 8;
+  data[2] = value >> 16;
+  data[3] = value >> 24;
+}
+
+inline uint16_t exportGet16(const uint8_t* data)
+{
+  return data[0] | (data[1] << 8);
+}
+
+inline uint32_t exportGet32(const uint8_t* data)
+{
+  return data[0] | (data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+ * @brief Complete a frame whose payload was written to frame + EXPORT_HEADER_SIZE
+ *
+ * @param frame the frame, with room for the payload and the trailer
+ * @param type the type of the frame
+ * @param seq the sequence number of the frame
+ * @param length the length of the payload
+ * @return size_t - the size of the frame
+ */
+inline size_t exportFrame(uint8_t* frame, ExportFrameType type, uint16_t seq, uint16_t length)
+{
+  frame[0] = EXPORT_MAGIC0;
+  frame[1] = EXPORT_MAGIC1;
+  frame[2] = type;
+  exportPut16(frame + 3, seq);
+  exportPut16(frame + 5, length);
+  exportPut32(frame + EXPORT_HEADER_SIZE + length, exportCrc32(0, frame + 2, EXPORT_HEADER_SIZE - 2 + length));
+  return EXPORT_HEADER_SIZE + length + EXPORT_TRAILER_SIZE;
+}
+
+/**
+ * @brief Incremental parser of export frames
+ *
+ * @details Bytes are fed one at a time, as they arrive, so the parser never waits for a frame to
+ * complete. Frames with a payload longer than MaxPayload are skipped.
+ */
+template <size_t MaxPayload>
+class ExportParser
+{
+public:
+  /**
+   * @brief Feed the next received byte
+   *
+   * @param byte the byte
+   * @return true if it completed a frame with a valid CRC, available until the next call
+   */
+  bool feed(uint8_t byte)
+  {
+    if (_pos == 0 && byte != EXPORT_MAGIC0)
+    {
+      return false;
+    }
+    if (_pos == 1 && byte != EXPORT_MAGIC1)
+    {
+      _pos = byte == EXPORT_MAGIC0 ? 1 : 0;
+      return false;
+    }
+    _frame[_pos++] = byte;
+    if (_pos < EXPORT_HEADER_SIZE)
+    {
+      return false;
+    }
+    if (length() > MaxPayload)
+    {
+      _pos = 0;
+      return false;
+    }
+    if (_pos < (size_t)(EXPORT_HEADER_SIZE + length() + EXPORT_TRAILER_SIZE))
+    {
+      return false;
+    }
+    _pos = 0;
+    if (exportCrc32(0, _frame + 2, EXPORT_HEADER_SIZE - 2 + length()) != exportGet32(payload() + length()))
+    {
+      _crcErrors++;
+      return false;
+    }
+    return true;
+  }
+
+  ExportFrameType type() const
+  {
+    return static_cast<ExportFrameType>(_frame[2]);
+  }
+
+  uint16_t seq() const
+  {
+    return exportGet16(_frame + 3);
+  }
+
+  uint16_t length() const
+  {
+    return exportGet16(_frame + 5);
+  }
+
+  const uint8_t* payload() const
+  {
+    return _frame + EXPORT_HEADER_SIZE;
+  }
+
+  /// Number of frames dropped for a bad CRC
+  uint32_t crcErrors() const
+  {
+    return _crcErrors;
+  }
+
+private:
+  uint8_t _frame[EXPORT_HEADER_SIZE + MaxPayload + EXPORT_TRAILER_SIZE];
+  size_t _pos = 0;
+  uint32_t _crcErrors = 0;
+};
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file NodeQueue.h
+ * @author Christoff Linde
+ * @brief Per-node store-and-forward queues on the gateway
+ * @version 0.1
+ * @date 2021-04-05
+ *
+ * Each leaf node gets its own bounded queue, so a chatty or backlogged node cannot starve the others.
+ * Readings are appended to a spill file per node as they arrive, and read back in order into a RAM
+ * queue of NODE_QUEUE_DEPTH as it drains. Queues are drained round-robin, one reading per node per
+ * round, into the upload batches.
+ *
+ * The offset of the first reading not forwarded yet is kept per node in a state file, written once
+ * per drain, after the drained readings went to the upload log. At boot @see nodeQueueBegin restores
+ * the queues from it, so a reset neither loses nor reorders spilled readings. A reset between the
+ * drain and the state write forwards the readings of that drain again.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef NODE_QUEUE_H
+#define NODE_QUEUE_H
+
+#include <Arduino.h>
+
+/// Number of leaf nodes a gateway can hold readings for at once, about 130 bytes of RAM each. More
+/// than LINK_MAX_PEERS, as a gateway serves more leaves than the ESP-NOW stack holds peers. Once all
+/// are taken, a new node takes over the slot of the node idle longest that has nothing left to forward
+#define NODE_QUEUE_NODES 32
+
+/// Number of readings kept in RAM per node
+#define NODE_QUEUE_DEPTH 8
+
+/// Number of readings spilled to flash per node before new readings are dropped
+#define NODE_SPILL_MAX 1024
+
+/// With 0, readings are only spilled once the RAM queue of their node is full, which saves a flash
+/// write per reading, but loses up to NODE_QUEUE_DEPTH readings per node on a reset
+#ifndef NODE_QUEUE_DURABLE
+#define NODE_QUEUE_DURABLE 1
+#endif
+
+/// A reading waiting to be forwarded, in the fixed point format sent by the leaf
+struct QueuedReading
+{
+  uint32_t timestamp;
+  int16_t temperature;
+  uint16_t humidity;
+};
+
+/// Called for every reading taken from the queues
+typedef void (*NodeReadingHandler)(uint32_t node, const QueuedReading& reading);
+
+/**
+ * @brief Restore the queues of the spill files left by the previous boot
+ *
+ * @details Called once from setup(), before the first reading is queued.
+ */
+void nodeQueueBegin();
+
+/**
+ * @brief Queue a reading received from a leaf node
+ *
+ * @details The reading is appended to the node's spill file. Without NODE_QUEUE_DURABLE, it is kept in
+ * RAM instead if the node's queue has room and nothing of the node is spilled, so readings stay in
+ * order.
+ *
+ * @param node chip id of the leaf
+ * @param reading the reading to queue
+ * @return true if the reading was queued, false if it was dropped
+ */
+bool nodeQueuePush(uint32_t node, const QueuedReading& reading);
+
+/**
+ * @brief Take readings from the queues, round-robin over the nodes
+ *
+ * @details Each round takes at most one reading per node. The node that starts a round rotates between
+ * calls, so no node is favoured when max is reached part way through a round.
+ *
+ * @param max the maximum number of readings to take
+ * @param handler called for every reading taken, in order per node
+ * @return size_t - the number of readings taken
+ */
+size_t nodeQueueDrain(size_t max, NodeReadingHandler handler);
+
+/**
+ * @brief Print per-node queue statistics
+ *
+ * @details For each node prints the number of queued readings, the lag of the oldest reading not
+ * forwarded yet, spilled ones included, and the number of readings forwarded and dropped.
+ *
+ * @param out the Print to write the statistics to
+ * @param now the current UNIX time, to compute the lag against
+ */
+void printNodeQueueStats(Print& out, uint32_t now);
+
+#endif
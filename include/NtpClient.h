@@ -0,0 +1,80 @@
+/**
+ * @file NtpClient.h
+ * @author Christoff Linde
+ * @brief Event driven NTP client on the raw lwIP UDP API
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * Replies are handled by an lwIP receive callback instead of being polled for with WiFiUDP from every
+ * pass of the main loop. The callback runs as soon as the loop yields, also in the middle of a delay()
+ * or an upload, and timestamps the reply there. The result is handed to the main loop through an
+ * SpscQueue, so however late the loop picks it up, the time is as of the arrival of the reply.
+ *
+ * Every request carries a nonce in its transmit timestamp, which the server echoes as the originate
+ * timestamp. Replies that do not echo the nonce of the last request, such as late replies to an earlier
+ * one, are dropped. The transit time of the reply is taken as half the round trip, less the time the
+ * server held the request.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef NTP_CLIENT_H
+#define NTP_CLIENT_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+#define NTP_PORT 123
+
+/// NTP timestamp is in the first 48 bytes of the message
+#define NTP_PACKET_SIZE 48
+
+/// Number of replies buffered until the main loop picks them up, a power of two
+#define NTP_QUEUE_SIZE 2
+
+/// The time told by an NTP reply
+struct NtpSample
+{
+  /// UNIX time at receivedAt
+  uint32_t seconds;
+  uint16_t milliseconds;
+  /// millis() at which the reply arrived
+  uint32_t receivedAt;
+  /// Round trip of the request, less the time the server held it, in us
+  uint32_t roundTrip;
+};
+
+/**
+ * @brief Open the UDP socket and register the receive callback
+ *
+ * @return true if the socket is open
+ */
+bool ntpBegin();
+
+/**
+ * @brief Send an NTP request
+ *
+ * @details A reply to an earlier request is no longer accepted once this one is sent.
+ *
+ * @param server the IP Address of the NTP server
+ * @return true if the request was sent
+ */
+bool ntpRequest(const IPAddress& server);
+
+/**
+ * @brief Take the oldest reply, from the main loop
+ *
+ * @param sample set to the time told by the reply
+ * @return true if a reply was taken
+ */
+bool ntpPoll(NtpSample& sample);
+
+/**
+ * @brief Print the number of requests and replies, and the last round trip
+ *
+ * @param out the Print to write the statistics to
+ */
+void printNtpStats(Print& out);
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * @file Ota.h
+ * @author Christoff Linde
+ * @brief HTTP firmware updates with resumable downloads and rollback
+ * @version 0.1
+ * @date 2021-03-24
+ *
+ * The update server publishes a manifest at OTA_BASE_URL/manifest.txt holding a single line:
+ *
+ *     <version> <size> <md5>
+ *
+ * The matching image is served at OTA_BASE_URL/firmware-<version>.bin. If the server also publishes a
+ * delta patch from the running version at OTA_BASE_URL/patch-<running>-<version>.bin, the patch is
+ * downloaded and applied against the running image instead. The server must honour Range requests
+ * for interrupted downloads to be resumed.
+ *
+ * An installed update stays pending until @see otaConfirm is called. If the new firmware fails to
+ * confirm within OTA_MAX_BOOTS boots, the previous image is downloaded again and the bad version is
+ * skipped from then on.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef OTA_H
+#define OTA_H
+
+#include <Arduino.h>
+
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION "unknown"
+#endif
+
+#ifndef OTA_BASE_URL
+#define OTA_BASE_URL "http://192.168.0.108:5000/firmware"
+#endif
+
+/// Size of the buffer used to stream the image to flash
+#define OTA_CHUNK_SIZE 1024
+
+/// Number of times a download is resumed before the update is abandoned
+#define OTA_MAX_ATTEMPTS 5
+
+/// Time without data after which a download is resumed with a new request
+#define OTA_STALL_TIMEOUT 10000UL
+
+/// Number of unconfirmed boots after which an update is rolled back
+#define OTA_MAX_BOOTS 3
+
+/**
+ * @brief Track boots of a pending update
+ *
+ * @details This method must be called once from setup(). If an update is pending, its boot counter
+ * is incremented, so a firmware that keeps crashing before it confirms is rolled back.
+ */
+void otaBegin();
+
+/**
+ * @brief Check whether the running firmware must be rolled back
+ *
+ * @return true if a pending update exceeded OTA_MAX_BOOTS without being confirmed
+ */
+bool otaRollbackRequired();
+
+/**
+ * @brief Check for and install a firmware update
+ *
+ * @details This method rolls back a failed update if required. Otherwise the manifest is fetched, and
+ * if it advertises a different version than the running firmware, a delta patch or otherwise the full
+ * image is downloaded in OTA_CHUNK_SIZE chunks straight to flash. An interrupted download is resumed with a Range request.
+ * The image is only activated if its MD5 matches the manifest, after which the device restarts.
+ *
+ * @return true if an update was installed. The device restarts before returning in that case
+ */
+bool otaCheck();
+
+/**
+ * @brief Mark the running firmware as good
+ *
+ * @details This method clears a pending update. It should be called once the firmware has proven
+ * itself, e.g. after the first successful upload.
+ */
+void otaConfirm();
+
+#endif
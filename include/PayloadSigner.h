@@ -0,0 +1,78 @@
+/**
+ * @file PayloadSigner.h
+ * @author Christoff Linde
+ * @brief HMAC-SHA256 signing of upload bodies
+ * @version 0.1
+ * @date 2021-03-29
+ *
+ * On trusted networks, uploads can be protected by a signature instead of TLS. Each upload carries
+ * two headers:
+ *  \li X-Device-Counter - a counter that increases with every upload, also across reboots
+ *  \li X-Signature - the hex HMAC-SHA256 of "<counter>\n" followed by the body
+ *
+ * The key of each device is HMAC-SHA256(UPLOAD_HMAC_KEY, "<chip id>"), with the chip id in lower case
+ * hex, so a single firmware image serves the whole fleet while the server can still derive every
+ * device key. The server rejects signatures that do not match, and counters that are not larger than
+ * the last one accepted for the device.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef PAYLOAD_SIGNER_H
+#define PAYLOAD_SIGNER_H
+
+#include <Arduino.h>
+#include <bearssl/bearssl.h>
+
+/// Length of a signature in hex, excluding the terminating null
+#define SIGNATURE_HEX_LENGTH 64
+
+/// Number of counter values reserved with a single flash write
+#define COUNTER_BLOCK 16
+
+/**
+ * @brief Get the counter for the next upload
+ *
+ * @details Counters are reserved from flash in blocks of COUNTER_BLOCK, so only every COUNTER_BLOCK-th
+ * upload writes to flash. Values left in a block at reboot are skipped, never reused. No counter is
+ * handed out while the next block cannot be written, as it could be handed out again after a reboot.
+ *
+ * @param counter the counter value
+ * @return true if a counter was reserved
+ */
+bool nextUploadCounter(uint32_t& counter);
+
+/**
+ * @brief A Print that signs everything written through it
+ *
+ * @details All data is forwarded to the wrapped Print unchanged, while the HMAC is updated along the
+ * way. The body is therefore signed while it is serialized, without a second pass or buffer.
+ */
+class PayloadSigner : public Print
+{
+public:
+  /**
+   * @brief Construct a PayloadSigner
+   *
+   * @param out the Print the signed data is forwarded to
+   * @param counter the upload counter, which is signed ahead of the body
+   */
+  PayloadSigner(Print& out, uint32_t counter);
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+
+  /**
+   * @brief Get the signature of everything written so far
+   *
+   * @param hex buffer receiving the signature as SIGNATURE_HEX_LENGTH hex characters and a null
+   */
+  void signature(char hex[SIGNATURE_HEX_LENGTH + 1]);
+
+private:
+  Print& _out;
+  br_hmac_context _hmac;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * @file Pipeline.h
+ * @author Christoff Linde
+ * @brief Stages connected at compile time into a processing pipeline
+ * @version 0.1
+ * @date 2021-04-16
+ *
+ * Pipeline<A, B, C> holds one instance of each stage, and pushes what A emits into B, and what B emits
+ * into C. The connections are resolved at compile time, so a push is a chain of direct, inlinable calls,
+ * without virtual dispatch or allocation. A stage keeps whatever it buffers in fixed size members, so
+ * the size of a pipeline is known at compile time too.
+ *
+ * A stage is a class with:
+ * - static const char* name(), used in the statistics
+ * - template <typename Emit> void process(const In& item, Emit& emit), which calls emit(out) for each
+ *   item it passes on, zero or more times. The item type may differ from stage to stage
+ * - template <typename Emit> void flush(Emit& emit), which passes on anything held back. PipelineStage
+ *   provides an empty one
+ *
+ * Every stage counts the items it received and emitted, so it can be seen where items are dropped.
+ * Nothing here depends on the Arduino core.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+
+/// Items received and emitted by a stage
+struct StageStats
+{
+  uint32_t in;
+  uint32_t out;
+};
+
+/// Base of stages that hold nothing back
+struct PipelineStage
+{
+  template <typename Emit>
+  void flush(Emit&)
+  {
+  }
+};
+
+template <typename... Stages>
+class Pipeline;
+
+/// End of a pipeline, anything emitted by the last stage is discarded
+template <>
+class Pipeline<>
+{
+public:
+  template <typename T>
+  void push(const T&)
+  {
+  }
+
+  void flush()
+  {
+  }
+
+  template <typename Out>
+  void printStats(Out&) const
+  {
+  }
+};
+
+template <typename Stage, typename... Rest>
+class Pipeline<Stage, Rest...>
+{
+public:
+  Pipeline() : _stats()
+  {
+  }
+
+  /// Hand an item to the first stage
+  template <typename T>
+  void push(const T& item)
+  {
+    _stats.in++;
+    Emitter emit(*this);
+    _stage.process(item, emit);
+  }
+
+  /// Pass on everything held back, stage by stage from the first
+  void flush()
+  {
+    Emitter emit(*this);
+    _stage.flush(emit);
+    _rest.flush();
+  }
+
+  /// The first stage
+  Stage& stage()
+  {
+    return _stage;
+  }
+
+  /// The pipeline after the first stage
+  Pipeline<Rest...>& rest()
+  {
+    return _rest;
+  }
+
+  const StageStats& stats() const
+  {
+    return _stats;
+  }
+
+  /**
+   * @brief Print a line with the counts of every stage
+   *
+   * @param out any type with a printf method, such as Print
+   */
+  template <typename Out>
+  void printStats(Out& out) const
+  {
+    out.printf("Stage %-10s %8u in %8u out\r\n", Stage::name(), _stats.in, _stats.out);
+    _rest.printStats(out);
+  }
+
+private:
+  /// Counts what the stage emits and pushes it into the rest of the pipeline
+  class Emitter
+  {
+  public:
+    explicit Emitter(Pipeline& pipeline) : _pipeline(pipeline)
+    {
+    }
+
+    template <typename T>
+    void operator()(const T& item)
+    {
+      _pipeline._stats.out++;
+      _pipeline._rest.push(item);
+    }
+
+  private:
+    Pipeline& _pipeline;
+  };
+
+  Stage _stage;
+  StageStats _stats;
+  Pipeline<Rest...> _rest;
+};
+
+#endif
@@ -0,0 +1,342 @@
+/**
+ * @file ReadingPipeline.h
+ * @author Christoff Linde
+ * @brief The stages readings pass through from the sensor to the upload log
+ * @version 0.1
+ * @date 2021-04-16
+ *
+ * Readings of the DHT-22 are taken by samplePipeline:
+ *
+ *   sensor -> outlier -> deadband -> aggregate -> encode -> storage -> network
+ *
+ * Readings relayed for leaf nodes already passed their own checks, and only go through the last three
+ * stages, in relayPipeline. The filters are configured with build flags, see below, and compile down to
+ * a pass-through where they are disabled.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef READING_PIPELINE_H
+#define READING_PIPELINE_H
+
+#include <Arduino.h>
+
+#include "Pipeline.h"
+#include "ReadingSchema.h"
+#include "Sampler.h"
+#include "UploadSinks.h"
+
+/// Largest accepted change of humidity since the last accepted reading, in hundredths
+#ifndef PIPELINE_MAX_HUMIDITY_STEP
+#define PIPELINE_MAX_HUMIDITY_STEP 2000
+#endif
+
+/// Largest accepted change of temperature since the last accepted reading, in hundredths
+#ifndef PIPELINE_MAX_TEMPERATURE_STEP
+#define PIPELINE_MAX_TEMPERATURE_STEP 1000
+#endif
+
+/// Consecutive readings rejected as outliers, after which the next reading is accepted as the new level
+#define OUTLIER_MAX_REJECTS 2
+
+/// Change of humidity, in hundredths, below which a reading is not logged. 0 logs every reading
+#ifndef PIPELINE_DEADBAND_HUMIDITY
+#define PIPELINE_DEADBAND_HUMIDITY 0
+#endif
+
+/// Change of temperature, in hundredths, below which a reading is not logged. 0 logs every reading
+#ifndef PIPELINE_DEADBAND_TEMPERATURE
+#define PIPELINE_DEADBAND_TEMPERATURE 0
+#endif
+
+/// Readings in a row the deadband may suppress, so the server still hears from a steady sensor
+#ifndef PIPELINE_DEADBAND_MAX_SKIP
+#define PIPELINE_DEADBAND_MAX_SKIP 4
+#endif
+
+/// Number of readings averaged into one logged reading
+#ifndef PIPELINE_AGGREGATE
+#define PIPELINE_AGGREGATE 1
+#endif
+
+/// A log line, with the reading it was encoded from
+struct LogLine
+{
+  LogRecord record;
+  char data[LOG_LINE_SIZE];
+  size_t len;
+
+  size_t write(const uint8_t* buf, size_t size)
+  {
+    size = min(size, sizeof(data) - len);
+    memcpy(data + len, buf, size);
+    len += size;
+    return size;
+  }
+};
+
+inline int32_t absDifference(int32_t a, int32_t b)
+{
+  return a > b ? a - b : b - a;
+}
+
+/**
+ * @brief Turns timed samples of the DHT-22, @see Sampler.h, into readings
+ */
+class SensorSource : public PipelineStage
+{
+public:
+  static const char* name()
+  {
+    return "sensor";
+  }
+
+  template <typename Emit>
+  void process(const Sample& sample, Emit& emit)
+  {
+    if (sample.status != DHT22Status::Ok)
+    {
+      Serial.printf("DHT22 read failed: %s\n", dht22StatusName(sample.status));
+      return;
+    }
+    // The sensor reports tenths, the log keeps hundredths
+    LogRecord record = { 0, sample.timestamp, sample.reading.humidity * 10, sample.reading.temperature * 10, 0 };
+    emit(record);
+  }
+};
+
+/**
+ * @brief Drops readings outside the range of the sensor, and single spikes
+ *
+ * @details A reading that changed by more than the maximum step since the last accepted reading is
+ * rejected. After OUTLIER_MAX_REJECTS rejections in a row the level is taken to have really changed,
+ * and the next reading is accepted.
+ */
+template <int32_t MaxHumidityStep, int32_t MaxTemperatureStep>
+class OutlierFilter : public PipelineStage
+{
+public:
+  static const char* name()
+  {
+    return "outlier";
+  }
+
+  template <typename Emit>
+  void process(const LogRecord& record, Emit& emit)
+  {
+    // Specified range of the DHT-22
+    if (record.humidity < 0 || record.humidity > 10000 || record.temperature < -4000 || record.temperature > 8000)
+    {
+      return;
+    }
+    if (_hasLast && _rejects < OUTLIER_MAX_REJECTS &&
+        (absDifference(record.humidity, _last.humidity) > MaxHumidityStep ||
+         absDifference(record.temperature, _last.temperature) > MaxTemperatureStep))
+    {
+      _rejects++;
+      return;
+    }
+    _rejects = 0;
+    _last = record;
+    _hasLast = true;
+    emit(record);
+  }
+
+private:
+  LogRecord _last;
+  bool _hasLast = false;
+  uint8_t _rejects = 0;
+};
+
+/**
+ * @brief Drops readings that changed less than a band since the last reading passed on
+ *
+ * @details A reading is passed on if either value changed by at least its band, or MaxSkip readings in
+ * a row were dropped. With both bands 0 every reading is passed on.
+ */
+template <int32_t HumidityBand, int32_t TemperatureBand, uint8_t MaxSkip>
+class Deadband : public PipelineStage
+{
+public:
+  static const char* name()
+  {
+    return "deadband";
+  }
+
+  template <typename Emit>
+  void process(const LogRecord& record, Emit& emit)
+  {
+    if (_hasLast && _skipped < MaxSkip && absDifference(record.humidity, _last.humidity) < HumidityBand &&
+        absDifference(record.temperature, _last.temperature) < TemperatureBand)
+    {
+      _skipped++;
+      return;
+    }
+    _skipped = 0;
+    _last = record;
+    _hasLast = true;
+    emit(record);
+  }
+
+private:
+  LogRecord _last;
+  bool _hasLast = false;
+  uint8_t _skipped = 0;
+};
+
+/**
+ * @brief Averages every Window readings into one, timestamped halfway between the first and the last
+ *
+ * @details A partial window is only passed on by flush().
+ */
+template <uint8_t Window>
+class Aggregator
+{
+public:
+  static const char* name()
+  {
+    return "aggregate";
+  }
+
+  template <typename Emit>
+  void process(const LogRecord& record, Emit& emit)
+  {
+    if (_count == 0)
+    {
+      _first = record.timestamp;
+    }
+    _last = record.timestamp;
+    _humidity += record.humidity;
+    _temperature += record.temperature;
+    if (++_count == Window)
+    {
+      flush(emit);
+    }
+  }
+
+  /// Pass on the average of a partial window
+  template <typename Emit>
+  void flush(Emit& emit)
+  {
+    if (_count == 0)
+    {
+      return;
+    }
+    LogRecord record = { 0, _first + (_last - _first) / 2, roundedMean(_humidity), roundedMean(_temperature), 0 };
+    _count = 0;
+    _humidity = 0;
+    _temperature = 0;
+    emit(record);
+  }
+
+private:
+  int32_t roundedMean(int32_t sum) const
+  {
+    return sum >= 0 ? (sum + _count / 2) / _count : (sum - _count / 2) / _count;
+  }
+
+  uint32_t _first = 0;
+  uint32_t _last = 0;
+  int32_t _humidity = 0;
+  int32_t _temperature = 0;
+  int32_t _count = 0;
+};
+
+/**
+ * @brief Encodes readings as log lines, @see writeLogLine
+ */
+class LogEncoder : public PipelineStage
+{
+public:
+  static const char* name()
+  {
+    return "encode";
+  }
+
+  template <typename Emit>
+  void process(const LogRecord& record, Emit& emit)
+  {
+    LogLine line;
+    line.record = record;
+    line.len = 0;
+    writeLogLine(line, record);
+    emit(line);
+  }
+};
+
+/**
+ * @brief Append a line to the upload log
+ *
+ * @return true if the line was written
+ */
+bool appendLogLine(const LogLine& line);
+
+/**
+ * @brief Appends log lines to the upload log, UPLOAD_LOG_PATH
+ */
+class StorageSink : public PipelineStage
+{
+public:
+  static const char* name()
+  {
+    return "storage";
+  }
+
+  template <typename Emit>
+  void process(const LogLine& line, Emit& emit)
+  {
+    if (appendLogLine(line))
+    {
+      emit(line);
+    }
+  }
+};
+
+/**
+ * @brief Tells the upload sinks about every reading logged, @see uploadLogged
+ */
+class NetworkSink : public PipelineStage
+{
+public:
+  static const char* name()
+  {
+    return "network";
+  }
+
+  template <typename Emit>
+  void process(const LogLine& line, Emit& emit)
+  {
+    uploadLogged(millis());
+    emit(line);
+  }
+};
+
+typedef Pipeline<SensorSource, OutlierFilter<PIPELINE_MAX_HUMIDITY_STEP, PIPELINE_MAX_TEMPERATURE_STEP>,
+  Deadband<PIPELINE_DEADBAND_HUMIDITY, PIPELINE_DEADBAND_TEMPERATURE, PIPELINE_DEADBAND_MAX_SKIP>,
+  Aggregator<PIPELINE_AGGREGATE>, LogEncoder, StorageSink, NetworkSink>
+  SamplePipeline;
+
+typedef Pipeline<LogEncoder, StorageSink, NetworkSink> RelayPipeline;
+
+/// Takes every Sample, with its timestamp filled in
+extern SamplePipeline samplePipeline;
+
+/// Takes the LogRecord of every relayed reading
+extern RelayPipeline relayPipeline;
+
+/**
+ * @brief Pass on what the stages of both pipelines hold back, such as a partial aggregate window
+ *
+ * @details Called before a restart, so the readings averaged so far are logged instead of lost.
+ */
+void flushPipelines();
+
+/**
+ * @brief Print the counts of every stage of both pipelines
+ *
+ * @param out the Print to write the statistics to
+ */
+void printPipelineStats(Print& out);
+
+#endif
@@ -0,0 +1,224 @@
+/**
+ * @file ReadingSchema.h
+ * @author Christoff Linde
+ * @brief Layout of a logged reading, and its log line, CSV and JSON envelope encodings
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * Readings are kept in fixed point from the sensor to the wire: humidity and temperature are in
+ * hundredths, so a log line is parsed and serialized again without going through float. The writers are
+ * generated from one schema with BatchWriter.h, and do not depend on the Arduino core.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef READING_SCHEMA_H
+#define READING_SCHEMA_H
+
+#include <stdlib.h>
+
+#include "BatchWriter.h"
+
+#define READING_STR(x) #x
+#define READING_XSTR(x) READING_STR(x)
+
+/// Version of the upload envelope, increased on incompatible changes
+#define UPLOAD_ENCODING 1
+
+/// Identifier of the sensor the readings are taken from
+#define SENSOR_ID "dht22"
+
+/// Size of a buffer holding any log line, with its line end
+#define LOG_LINE_SIZE 48
+
+/// Number of buckets of the sampling deadline jitter histogram, @see Sampler.h
+#define SAMPLER_JITTER_BUCKETS 6
+
+/// Sampling statistics since boot, sent with the envelope
+struct SamplerTelemetry
+{
+  /// Largest time from a sampling deadline to its timer callback, in us
+  uint32_t jitterMaxUs;
+  /// Deadlines per jitter bucket: under 100us, 1ms, 10ms, 100ms, 1s, and the rest
+  uint32_t jitter[SAMPLER_JITTER_BUCKETS];
+  /// Samples lost to a full queue
+  uint32_t lost;
+};
+
+/// A reading parsed from the log
+struct LogRecord
+{
+  /// Byte offset of the reading in the log
+  uint32_t offset;
+  uint32_t timestamp;
+  /// Relative humidity in hundredths of a percent
+  int32_t humidity;
+  /// Temperature in hundredths of a degree Celsius
+  int32_t temperature;
+  /// Chip id of the leaf the reading came from, or 0 for this device
+  uint32_t node;
+};
+
+BATCH_FIELD(TimestampField, LogRecord, timestamp, UintEncoding);
+BATCH_FIELD(HumidityField, LogRecord, humidity, FixedEncoding<2>);
+BATCH_FIELD(TemperatureField, LogRecord, temperature, FixedEncoding<2>);
+BATCH_FIELD(NodeField, LogRecord, node, OptionalHexEncoding);
+
+/// Fields of a reading, in log, CSV and envelope order
+typedef BatchSchema<TimestampField, HumidityField, TemperatureField, NodeField> ReadingSchema;
+
+/**
+ * @brief Write a reading as a "timestamp,humidity,temperature,node" log line
+ *
+ * @details node is left empty for the readings of this device.
+ */
+template <typename Sink>
+void writeLogLine(Sink& sink, const LogRecord& record)
+{
+  TextWriter<Sink> out(sink);
+  ReadingSchema::writeCsv(out, record);
+  out.writeChar('\n');
+}
+
+/**
+ * @brief Write readings as a JSON batch envelope, see README.md
+ *
+ * @param sink the output
+ * @param device chip id of this device in hex
+ * @param firmware firmware version
+ * @param records the readings
+ * @param count the number of readings
+ * @param firstSeq the sequence number of the first reading
+ * @param sampler sampling statistics of this device, left out if nullptr
+ */
+template <typename Sink>
+void writeEnvelope(Sink& sink, const char* device, const char* firmware, const LogRecord* records, size_t count,
+  uint32_t firstSeq, const SamplerTelemetry* sampler = nullptr)
+{
+  TextWriter<Sink> out(sink);
+  out.literal("{\"device\":\"");
+  out.writeString(device);
+  out.literal("\",\"firmware\":\"");
+  out.writeString(firmware);
+  out.literal("\",\"encoding\":" READING_XSTR(UPLOAD_ENCODING) ",\"sensors\":[\"" SENSOR_ID "\"],\"seq\":[");
+  if (count > 0)
+  {
+    out.writeUint(firstSeq);
+    out.writeChar(',');
+    out.writeUint(firstSeq + count - 1);
+  }
+  out.literal("],\"readings\":[");
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i > 0)
+    {
+      out.writeChar(',');
+    }
+    ReadingSchema::writeJson(out, records[i]);
+  }
+  out.writeChar(']');
+  if (sampler != nullptr)
+  {
+    out.literal(",\"sampling\":{\"jitter_max_us\":");
+    out.writeUint(sampler->jitterMaxUs);
+    out.literal(",\"jitter\":[");
+    for (size_t i = 0; i < SAMPLER_JITTER_BUCKETS; i++)
+    {
+      if (i > 0)
+      {
+        out.writeChar(',');
+      }
+      out.writeUint(sampler->jitter[i]);
+    }
+    out.literal("],\"lost\":");
+    out.writeUint(sampler->lost);
+    out.writeChar('}');
+  }
+  out.writeChar('}');
+}
+
+/**
+ * @brief Write readings as CSV, one "seq,timestamp,humidity,temperature,node" line each after a header
+ */
+template <typename Sink>
+void writeCsvBatch(Sink& sink, const LogRecord* records, size_t count, uint32_t firstSeq)
+{
+  TextWriter<Sink> out(sink);
+  out.literal("seq,");
+  ReadingSchema::writeCsvHeader(out);
+  out.writeChar('\n');
+  for (size_t i = 0; i < count; i++)
+  {
+    out.writeUint(firstSeq + i);
+    out.writeChar(',');
+    ReadingSchema::writeCsv(out, records[i]);
+    out.writeChar('\n');
+  }
+}
+
+/**
+ * @brief Parse a decimal number into hundredths
+ *
+ * @details Further decimals are truncated.
+ *
+ * @param text the number
+ * @param end set to the character after the number
+ * @return int32_t - the number in hundredths
+ */
+inline int32_t parseCenti(const char* text, const char** end)
+{
+  bool negative = *text == '-';
+  if (negative)
+  {
+    text++;
+  }
+  int32_t value = 0;
+  while (*text >= '0' && *text <= '9')
+  {
+    value = value * 10 + (*text++ - '0');
+  }
+  value *= 100;
+  if (*text == '.')
+  {
+    text++;
+    for (int32_t scale = 10; scale > 0 && *text >= '0' && *text <= '9'; scale /= 10)
+    {
+      value += (*text++ - '0') * scale;
+    }
+    while (*text >= '0' && *text <= '9')
+    {
+      text++;
+    }
+  }
+  *end = text;
+  return negative ? -value : value;
+}
+
+/**
+ * @brief Parse a log line, as written by @see writeLogLine
+ *
+ * @param line the line, without its line end
+ * @param record set to the reading, except for its offset
+ * @return true if the line holds a reading
+ */
+inline bool parseLogLine(const char* line, LogRecord& record)
+{
+  char* field;
+  record.timestamp = strtoul(line, &field, 10);
+  if (field == line || *field != ',')
+  {
+    return false;
+  }
+  const char* next;
+  record.humidity = parseCenti(field + 1, &next);
+  if (*next != ',')
+  {
+    return false;
+  }
+  record.temperature = parseCenti(next + 1, &next);
+  record.node = *next == ',' ? strtoul(next + 1, nullptr, 16) : 0;
+  return true;
+}
+
+#endif
@@ -0,0 +1,87 @@
+/**
+ * @file Sampler.h
+ * @author Christoff Linde
+ * @brief Timer driven DHT-22 sampling, independent of how often loop() comes around
+ * @version 0.1
+ * @date 2021-04-17
+ *
+ * A periodic Ticker sends the start signal of a transaction at every sampling deadline, and a one-shot
+ * Ticker completes it SAMPLER_START_MS later. Timer callbacks run whenever the main loop yields, which
+ * it does throughout an upload or a delay(), so a blocked loop no longer makes a reading late. The
+ * result is handed to the main loop through an SpscQueue.
+ *
+ * The time from every deadline to its callback is measured, and kept in a histogram that is printed by
+ * the stats command and sent with every upload envelope.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <Arduino.h>
+
+#include "DHT22.h"
+#include "ReadingSchema.h"
+
+/// Time the start signal is held, the DHT-22 needs 1 to 10ms
+#define SAMPLER_START_MS 2
+
+/// Longest time between samples in ms. Deadlines are kept in 32 bit micros(), which holds just over
+/// an hour, and the SDK limits a Ticker period to about 6870 s
+#define SAMPLER_MAX_INTERVAL 3600000UL
+
+/// Number of samples buffered until the main loop picks them up, a power of two
+#define SAMPLER_QUEUE_SIZE 4
+
+/// The result of a timed DHT-22 transaction
+struct Sample
+{
+  /// millis() at the start of the transaction
+  uint32_t takenAt;
+  /// UNIX time of takenAt, for the consumer to fill in
+  uint32_t timestamp;
+  DHT22Status status;
+  /// Only valid if status is DHT22Status::Ok
+  DHT22Reading reading;
+};
+
+/**
+ * @brief Start sampling
+ *
+ * @details The first sample is taken DHT22_MIN_INTERVAL from now, so the sensor has settled. Later
+ * samples follow every interval, counted from the first deadline, so the schedule does not drift.
+ * Calling it again restarts the schedule with the new interval.
+ *
+ * @param sensor the sensor to read
+ * @param interval the time between samples in ms, at most SAMPLER_MAX_INTERVAL
+ */
+void samplerBegin(DHT22& sensor, unsigned long interval);
+
+/// True once sampling has been started
+bool samplerRunning();
+
+/**
+ * @brief Take the oldest sample, from the main loop
+ *
+ * @param sample set to the sample
+ * @return true if a sample was taken
+ */
+bool samplerPoll(Sample& sample);
+
+/**
+ * @brief Get the deadline jitter histogram and the number of samples lost, for the upload envelope
+ *
+ * @param telemetry set to the statistics since boot
+ */
+void samplerTelemetry(SamplerTelemetry& telemetry);
+
+/**
+ * @brief Print the deadline jitter histogram and the number of samples lost to a full queue
+ *
+ * @param out the Print to write the statistics to
+ */
+void printSamplerStats(Print& out);
+
+#endif
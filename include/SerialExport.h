@@ -0,0 +1,56 @@
+/**
+ * @file SerialExport.h
+ * @author Christoff Linde
+ * @brief Export of the upload log over Serial, for devices without network coverage
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * The log is sent in CRC checked frames, @see ExportProtocol.h, optionally at a higher baud rate, and
+ * an interrupted export resumes from the last offset received. The host side is the export_receiver
+ * tool in tools/collector.
+ *
+ * The export never blocks the main loop: frames are only written as far as the UART has room, and
+ * requests are parsed a byte at a time as they arrive. Log output printed meanwhile lands between
+ * frames, or corrupts one, which the receiver then asks for again.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SERIAL_EXPORT_H
+#define SERIAL_EXPORT_H
+
+#include <Arduino.h>
+
+/// Time the device waits for a START frame, before giving the export up
+#define EXPORT_TIMEOUT 3000UL
+
+/**
+ * @brief Wait for a START frame from the host, on Serial
+ *
+ * @details Until the export ends, Serial input is read by @see serialExportPoll, not by the console
+ * commands.
+ *
+ * @param path the file to export
+ */
+void serialExportStart(const char* path);
+
+/// True from serialExportStart until the export ended or was given up
+bool serialExportActive();
+
+/**
+ * @brief Advance the export, from every pass of the main loop
+ *
+ * @details Reads the frames the host sent and writes as much of the next frame as the UART takes.
+ * Returns without waiting for either.
+ */
+void serialExportPoll();
+
+/**
+ * @brief Print the number of exports, frames sent and requests dropped for a bad CRC
+ *
+ * @param out the Print to write the statistics to
+ */
+void printExportStats(Print& out);
+
+#endif
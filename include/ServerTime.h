@@ -0,0 +1,63 @@
+/**
+ * @file ServerTime.h
+ * @author Christoff Linde
+ * @brief Time told by the Date header of HTTP responses
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * Every upload and firmware check already gets a response from a server, which carries the time in its
+ * Date header. The header is kept as a fallback time source, for devices whose NTP traffic is blocked.
+ * It is only precise to the second, so it is weighed less than an NTP reply, @see updateServerTime in
+ * main.cpp.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SERVER_TIME_H
+#define SERVER_TIME_H
+
+#include <Arduino.h>
+#include <ESP8266HTTPClient.h>
+
+/// The time told by a Date header
+struct ServerTime
+{
+  /// UNIX time of the header, truncated to the second
+  uint32_t seconds;
+  /// millis() at which the response was received
+  uint32_t receivedAt;
+};
+
+/**
+ * @brief Parse an HTTP date in the IMF-fixdate format, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+ *
+ * @param date the header value
+ * @param seconds set to the UNIX time
+ * @return true if the date was parsed
+ */
+bool parseHttpDate(const char* date, uint32_t& seconds);
+
+/**
+ * @brief Ask an HTTPClient to keep the Date header of its response, before sending the request
+ *
+ * @param http the client to collect the header of
+ */
+void serverTimeCollect(HTTPClient& http);
+
+/**
+ * @brief Note the Date header of a response, after the request was sent
+ *
+ * @param http the client the request was sent with
+ */
+void serverTimeRecord(HTTPClient& http);
+
+/**
+ * @brief Take the time of the latest response
+ *
+ * @param time set to the time of the response
+ * @return true if a response was recorded since the last call
+ */
+bool serverTimePoll(ServerTime& time);
+
+#endif
@@ -0,0 +1,110 @@
+/**
+ * @file SpscQueue.h
+ * @author Christoff Linde
+ * @brief Fixed capacity, lock-free single producer, single consumer queue
+ * @version 0.1
+ * @date 2021-04-17
+ *
+ * Hands items from a callback, such as a timer or a WiFi callback, to the main loop without allocating,
+ * locking or disabling interrupts. The producer only writes the head index and the consumer only writes
+ * the tail index. An item is written before the head is released past it, and read before the tail is
+ * released past it, so each side sees the other's slots complete.
+ *
+ * The indices run freely and are masked into the buffer, so all of Capacity can be used and full and
+ * empty are told apart without a spare slot. Capacity must be a power of two.
+ *
+ * On the ESP8266 the atomics compile to plain 32 bit loads and stores with memory barriers, which keep
+ * the compiler and the write buffer from reordering the slot and index writes. A push to a full queue
+ * is counted and fails, the queue never overwrites unread items.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  SpscQueue() : _head(0), _tail(0), _overflows(0)
+  {
+  }
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  /**
+   * @brief Append an item, from the producer only
+   *
+   * @param item the item to append
+   * @return true if it was appended, false if the queue was full
+   */
+  bool push(const T& item)
+  {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) == Capacity)
+    {
+      // Only the producer writes the counter
+      _overflows.store(_overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+    _items[head & (Capacity - 1)] = item;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Take the oldest item, from the consumer only
+   *
+   * @param item set to the item taken
+   * @return true if an item was taken
+   */
+  bool pop(T& item)
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (_head.load(std::memory_order_acquire) == tail)
+    {
+      return false;
+    }
+    item = _items[tail & (Capacity - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Number of items queued. Only a snapshot while the other side is active
+  size_t size() const
+  {
+    // The tail is read first, so a pop in between cannot take it past the head read
+    uint32_t tail = _tail.load(std::memory_order_acquire);
+    return _head.load(std::memory_order_acquire) - tail;
+  }
+
+  /// Number of pushes that failed because the queue was full
+  uint32_t overflows() const
+  {
+    return _overflows.load(std::memory_order_relaxed);
+  }
+
+  static constexpr size_t capacity()
+  {
+    return Capacity;
+  }
+
+private:
+  T _items[Capacity];
+  /// Index of the next item to push, written by the producer
+  std::atomic<uint32_t> _head;
+  /// Index of the next item to pop, written by the consumer
+  std::atomic<uint32_t> _tail;
+  std::atomic<uint32_t> _overflows;
+};
+
+#endif
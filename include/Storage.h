@@ -0,0 +1,135 @@
+/**
+ * @file Storage.h
+ * @author Christoff Linde
+ * @brief LittleFS helpers with a lazily mounted file system and a cached directory index
+ * @version 0.1
+ * @date 2021-03-22
+ *
+ * The file system is only mounted the first time it is used. File names and sizes are kept in a
+ * small index file, so listing the contents never requires a scan of the flash.
+ *
+ * New and deleted files are written to the index file at once. Size changes are only kept in RAM, and
+ * written when the directory is listed, FS_INDEX_FLUSH_INTERVAL after the first one, or by
+ * @see flushIndex before a restart, so appending a reading does not cost a second flash write. After a
+ * crash the index may show older sizes, until the next rescan.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <Arduino.h>
+
+/// Maximum number of files tracked in the directory index
+#define FS_INDEX_SIZE 16
+
+/// Maximum length of a file name tracked in the directory index
+#define FS_NAME_LENGTH 32
+
+/// Longest a size change stays out of the index file
+#define FS_INDEX_FLUSH_INTERVAL 600000UL
+
+/**
+ * @brief Start the LittleFS file system
+ *
+ * @details This method mounts the file system on first use and loads the directory index. Calling
+ * it again once mounted returns immediately, so it is called in front of every file access. If the
+ * index file is missing, it is rebuilt from a single scan of the root directory.
+ *
+ * @see LittleFS
+ * @see listDirectory
+ *
+ * @return true if the file system is mounted
+ */
+bool startLittleFS();
+
+/**
+ * @brief Convert sizes in bytes to KB and MB
+ *
+ * @details This helper method converts the passed in data to a more human readable format i.e. into KB and MB.
+ * The result is written to the given buffer, so no heap allocation takes place.
+ *
+ * @see listDirectory
+ *
+ * @param bytes size_t size to be formated
+ * @param buf the buffer the formated string is written to
+ * @param len the size of buf
+ * @returns const char* - buf
+ */
+const char* formatBytes(size_t bytes, char* buf, size_t len);
+
+/**
+ * @brief List contents of the root directory
+ *
+ * @details This method prints each file by name and size from the directory index. The flash is only
+ * scanned if a rescan is requested, in which case the index is rebuilt first.
+ *
+ * @param out the Print to write the listing to
+ * @param rescan rebuild the index from the file system before listing
+ */
+void listDirectory(Print& out, bool rescan);
+
+/**
+ * @brief Record the size of a file in the directory index
+ *
+ * @details This method must be called after a file has been written, so the index stays in step with
+ * the file system. Only a new file is written to the index file at once, size changes are written
+ * later, @see indexPoll.
+ *
+ * @param path the relative filepath of the written file
+ * @param size the new size of the file
+ */
+void indexFile(const char* path, size_t size);
+
+/**
+ * @brief Write size changes to the index file, once they are FS_INDEX_FLUSH_INTERVAL old
+ *
+ * @details Called from every pass of the main loop.
+ *
+ * @param now the current millis()
+ */
+void indexPoll(unsigned long now);
+
+/**
+ * @brief Write size changes to the index file now, such as before a restart
+ */
+void flushIndex();
+
+/**
+ * @brief Read contents of the specified file
+ *
+ * @details This method reads all contents of the file at the specified filepath. If the file
+ * does not exist,
+ *  \li the file will not be created automatically.
+ * If the file exists,
+ * \li all contents will be printed to the Serial console.
+ *
+ * @param path the relative filepath to the requested file
+ */
+void readFile(const char* path);
+
+/**
+ * @brief Print a range of lines of a text file
+ *
+ * @param path the relative filepath to the requested file
+ * @param out the Print to write the lines to
+ * @param first the index of the first line printed, from 0
+ * @param count the number of lines printed
+ * @return size_t - the number of lines printed
+ */
+size_t dumpLines(const char* path, Print& out, size_t first, size_t count);
+
+/**
+ * @brief Delete the specified file
+ *
+ * @details This method deletes the file at the given filepath and removes it from the directory index.
+ * If the file does not exist, the delete will fail and a error message will accordingly be printed to
+ * the console.
+ *
+ * @param path the relative filepath to the requested file
+ */
+void deleteFile(const char* path);
+
+#endif
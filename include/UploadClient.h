@@ -0,0 +1,77 @@
+/**
+ * @file UploadClient.h
+ * @author Christoff Linde
+ * @brief Connection management for uploads to the API, over plain HTTP or TLS
+ * @version 0.1
+ * @date 2021-03-28
+ *
+ * Defining UPLOAD_TLS switches uploads to HTTPS. A full BearSSL handshake costs seconds of CPU and
+ * a large part of the heap, so the TLS client is set up to keep that cost down:
+ *  \li the session is kept between uploads, so later handshakes are resumed
+ *  \li the server is validated against a pinned public key (UPLOAD_TLS_PUBKEY) or certificate
+ *      fingerprint (UPLOAD_TLS_FINGERPRINT) instead of a certificate chain
+ *  \li if the server supports maximum fragment length negotiation, the record buffers are reduced
+ *      to UPLOAD_TLS_BUFFER_SIZE bytes
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef UPLOAD_CLIENT_H
+#define UPLOAD_CLIENT_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#ifndef UPLOAD_HOST
+#define UPLOAD_HOST "192.168.0.108"
+#endif
+
+#ifndef UPLOAD_PATH
+#define UPLOAD_PATH "/api/DataEntries/list"
+#endif
+
+#ifdef UPLOAD_TLS
+#ifndef UPLOAD_PORT
+#define UPLOAD_PORT 443
+#endif
+#if !defined(UPLOAD_TLS_PUBKEY) && !defined(UPLOAD_TLS_FINGERPRINT)
+#error "UPLOAD_TLS requires UPLOAD_TLS_PUBKEY or UPLOAD_TLS_FINGERPRINT"
+#endif
+#define UPLOAD_HTTPS true
+#else
+#ifndef UPLOAD_PORT
+#define UPLOAD_PORT 5000
+#endif
+#define UPLOAD_HTTPS false
+#endif
+
+/// Record buffer size requested through maximum fragment length negotiation
+#define UPLOAD_TLS_BUFFER_SIZE 512
+
+/**
+ * @brief Open the connection for an upload
+ *
+ * @details This method connects to the given host. A secure connection needs UPLOAD_TLS, and is
+ * validated against the key or fingerprint pinned for UPLOAD_HOST, so only sinks on that host can use
+ * it. The handshake is done here, resuming the previous session where possible. The duration and heap
+ * use of the connection are recorded.
+ *
+ * @param host the host to connect to
+ * @param port the port to connect to
+ * @param secure connect over TLS
+ * @return WiFiClient* - the connected client, or nullptr if the connection failed
+ */
+WiFiClient* uploadConnect(const char* host, uint16_t port, bool secure);
+
+/**
+ * @brief Print connection statistics
+ *
+ * @details Prints the number of connections, and with UPLOAD_TLS the duration and heap cost of the
+ * first and the last handshake, and whether the record buffers were reduced.
+ *
+ * @param out the Print to write the statistics to
+ */
+void printUploadStats(Print& out);
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ * @file UploadSinks.h
+ * @author Christoff Linde
+ * @brief Fan-out of the reading log to several upload endpoints
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * Readings are appended to a single log, UPLOAD_LOG_PATH, and uploaded to one or more named sinks.
+ * Every sink has its own format, cadence and retry backoff, and its own cursor into the log: the byte
+ * offset of the first reading it has not received yet, together with the sequence number of that
+ * reading. Cursors are persisted per sink, so a sink that is down or slow only holds back itself.
+ *
+ * Sinks that are due are served from a batch read once from flash, starting at the lowest due cursor.
+ * Every due sink whose cursor lies within the batch gets the readings from its cursor on. The log is
+ * deleted once every sink has received all of it.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef UPLOAD_SINKS_H
+#define UPLOAD_SINKS_H
+
+#include <Arduino.h>
+
+#include "ReadingSchema.h"
+
+/// Log the readings are appended to
+#define UPLOAD_LOG_PATH "/data.txt"
+
+/// Maximum number of readings read from the log and uploaded at once
+#define UPLOAD_BATCH_SIZE 24
+
+/// First retry delay after a failed upload, doubled on every further failure
+#define UPLOAD_RETRY_MIN 60000UL
+
+/// Body format of a sink
+enum class SinkFormat : uint8_t
+{
+  /// JSON batch envelope, see README.md
+  Envelope,
+  /// One "seq,timestamp,humidity,temperature,node" line per reading, after a header line
+  Csv
+};
+
+/// Configuration of an upload endpoint
+struct UploadSink
+{
+  /// Short name, used for the cursor file
+  const char* name;
+  const char* host;
+  uint16_t port;
+  const char* path;
+  bool https;
+  SinkFormat format;
+  /// Time between uploads while the sink is caught up
+  unsigned long interval;
+  /// Upper bound of the retry delay after failed uploads
+  unsigned long retryMax;
+};
+
+/**
+ * @brief Check whether any sink is due for an upload
+ *
+ * @param now the current millis()
+ * @return true if at least one sink is due
+ */
+bool uploadDue(unsigned long now);
+
+/**
+ * @brief Get the time until the next sink is due
+ *
+ * @param now the current millis()
+ * @return unsigned long - the time in ms, 0 if a sink is due
+ */
+unsigned long uploadIdleTime(unsigned long now);
+
+/**
+ * @brief Note a reading appended to the log
+ *
+ * @details A sink with a full batch of readings waiting is made due right away, instead of after its
+ * interval. Sinks backing off after a failure keep their schedule.
+ *
+ * @param now the current millis()
+ */
+void uploadLogged(unsigned long now);
+
+/**
+ * @brief Make every sink due right away, also those backing off after a failure
+ *
+ * @param now the current millis()
+ */
+void uploadForce(unsigned long now);
+
+/**
+ * @brief Upload the log to every sink that is due
+ *
+ * @details A sink that is caught up after its upload is next due after its interval. A sink with more
+ * readings left in the log is due again immediately, so a backlog is sent batch by batch. A failed
+ * upload is retried after UPLOAD_RETRY_MIN, doubling up to the sink's retryMax.
+ *
+ * @param now the current millis()
+ */
+void uploadRun(unsigned long now);
+
+/**
+ * @brief Send readings to a sink
+ *
+ * @details This method initialises a HTTPClient on the connection opened by @see uploadConnect, and
+ * posts the readings in the format of the sink, written straight from the records by the writers of
+ * ReadingSchema.h. If UPLOAD_HMAC_KEY is defined, the body is signed while it is serialized, @see
+ * PayloadSigner. Building with UPLOAD_ARDUINOJSON serializes the envelope through an ArduinoJson document
+ * instead, to compare code size and speed.
+ *
+ * @param sink the sink to send to
+ * @param records the readings to send
+ * @param count the number of readings
+ * @param firstSeq the sequence number of the first reading
+ * @return int - the HTTP response code
+ */
+int sendData(const UploadSink& sink, const LogRecord* records, size_t count, uint32_t firstSeq);
+
+/**
+ * @brief Print the cursor and upload counts of every sink
+ *
+ * @param out the Print to write the statistics to
+ */
+void printSinkStats(Print& out);
+
+#endif
@@ -0,0 +1,86 @@
+/**
+ * @file BootProfile.cpp
+ * @author Christoff Linde
+ * @brief Boot phase timing implementation
+ * @version 0.1
+ * @date 2021-03-21
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "BootProfile.h"
+
+/// Start and end of a single phase in microseconds since reset
+struct BootPhaseTiming
+{
+  uint32_t start;
+  uint32_t end;
+  bool started;
+  bool ended;
+};
+
+static BootPhaseTiming bootPhases[BOOT_PHASE_COUNT];
+
+static const char* const bootPhaseNames[BOOT_PHASE_COUNT] = {
+  "storage",
+  "sensors",
+  "wifi",
+  "udp",
+  "dns",
+  "ntp",
+  "first sample",
+};
+
+void bootPhaseStart(BootPhase phase)
+{
+  if (bootPhases[phase].started)
+  {
+    return;
+  }
+  bootPhases[phase].start = micros();
+  bootPhases[phase].started = true;
+}
+
+void bootPhaseEnd(BootPhase phase)
+{
+  if (bootPhases[phase].ended)
+  {
+    return;
+  }
+  bootPhases[phase].end = micros();
+  bootPhases[phase].started = true;
+  bootPhases[phase].ended = true;
+}
+
+bool bootComplete()
+{
+  for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++)
+  {
+    if (!bootPhases[i].ended)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void printBootReport(Print& out)
+{
+  out.println("Boot phases (start / duration):");
+  for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++)
+  {
+    const BootPhaseTiming& timing = bootPhases[i];
+    if (!timing.ended)
+    {
+      out.printf("\t%-12s pending\r\n", bootPhaseNames[i]);
+      continue;
+    }
+    out.printf("\t%-12s %6u ms / %6u ms\r\n", bootPhaseNames[i],
+      timing.start / 1000, (timing.end - timing.start) / 1000);
+  }
+  if (bootPhases[BOOT_FIRST_SAMPLE].ended)
+  {
+    out.printf("Time to first sample: %u ms\r\n", bootPhases[BOOT_FIRST_SAMPLE].end / 1000);
+  }
+}
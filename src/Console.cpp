@@ -0,0 +1,107 @@
+/**
+ * @file Console.cpp
+ * @author Christoff Linde
+ * @brief Command console implementation
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "Console.h"
+
+static const ConsoleCommand* consoleCommands = nullptr;
+static size_t consoleCommandCount = 0;
+
+/// The line being received
+static char line[CONSOLE_LINE_SIZE];
+static size_t lineLength = 0;
+/// True while the rest of a line that was too long is skipped
+static bool lineOverflow = false;
+
+static void printHelp(Print& out)
+{
+  for (size_t i = 0; i < consoleCommandCount; i++)
+  {
+    out.printf("%-8s %s\r\n", consoleCommands[i].name, consoleCommands[i].help);
+  }
+  out.printf("%-8s %s\r\n", "help", "list the commands");
+}
+
+void consoleBegin(const ConsoleCommand* commands, size_t count)
+{
+  consoleCommands = commands;
+  consoleCommandCount = count;
+}
+
+bool consoleRun(const char* input, Print& out)
+{
+  while (*input == ' ')
+  {
+    input++;
+  }
+  size_t nameLength = strcspn(input, " ");
+  const char* args = input + nameLength;
+  while (*args == ' ')
+  {
+    args++;
+  }
+
+  if (nameLength == 4 && strncmp(input, "help", 4) == 0)
+  {
+    printHelp(out);
+    return true;
+  }
+  for (size_t i = 0; i < consoleCommandCount; i++)
+  {
+    const char* name = consoleCommands[i].name;
+    if (strlen(name) == nameLength && strncmp(input, name, nameLength) == 0)
+    {
+      consoleCommands[i].handler(out, args);
+      return true;
+    }
+  }
+  out.printf("Unknown command: %.*s, try help\r\n", (int)nameLength, input);
+  return false;
+}
+
+void consolePoll(Stream& in, Print& out)
+{
+  while (in.available())
+  {
+    int c = in.read();
+    if (c == '\r' || c == '\n')
+    {
+      if (lineOverflow)
+      {
+        out.println("Line too long");
+      }
+      else if (lineLength > 0)
+      {
+        line[lineLength] = '\0';
+        lineLength = 0;
+        consoleRun(line, out);
+        // A command may have started something that reads the input from now on, such as an export
+        return;
+      }
+      lineLength = 0;
+      lineOverflow = false;
+    }
+    else if (c == '\b' || c == 0x7F)
+    {
+      if (lineLength > 0)
+      {
+        lineLength--;
+      }
+    }
+    else if (lineLength < sizeof(line) - 1)
+    {
+      line[lineLength++] = c;
+    }
+    else
+    {
+      lineOverflow = true;
+    }
+  }
+}
@@ -0,0 +1,87 @@
+/**
+ * @file CpuBoost.cpp
+ * @author Christoff Linde
+ * @brief CPU clock boost implementation
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "CpuBoost.h"
+
+extern "C"
+{
+#include <user_interface.h>
+}
+
+/// CPU clock outside boosted phases
+#define CPU_BASE_MHZ (F_CPU / 1000000L)
+
+/// Accounting of a single phase
+struct CpuPhaseStats
+{
+  uint32_t startCycles;
+  uint32_t startMicros;
+  bool active;
+  uint32_t runs;
+  uint64_t cycles;
+  uint64_t micros;
+};
+
+static CpuPhaseStats cpuPhases[CPU_PHASE_COUNT];
+static uint8_t boostDepth = 0;
+
+static const char* const cpuPhaseNames[CPU_PHASE_COUNT] = {
+  "tls",
+  "encode",
+  "patch",
+};
+
+void cpuBoostStart(CpuPhase phase)
+{
+  CpuPhaseStats& stats = cpuPhases[phase];
+  if (stats.active)
+  {
+    return;
+  }
+  if (boostDepth++ == 0 && CPU_BOOST_MHZ != CPU_BASE_MHZ)
+  {
+    system_update_cpu_freq(CPU_BOOST_MHZ);
+  }
+  stats.active = true;
+  stats.startMicros = micros();
+  stats.startCycles = ESP.getCycleCount();
+}
+
+void cpuBoostEnd(CpuPhase phase)
+{
+  uint32_t cycles = ESP.getCycleCount();
+  uint32_t now = micros();
+  CpuPhaseStats& stats = cpuPhases[phase];
+  if (!stats.active)
+  {
+    return;
+  }
+  // The cycle counter wraps after 26s at 160 MHz, longer phases are undercounted
+  stats.cycles += cycles - stats.startCycles;
+  stats.micros += now - stats.startMicros;
+  stats.runs++;
+  stats.active = false;
+  if (--boostDepth == 0 && CPU_BOOST_MHZ != CPU_BASE_MHZ)
+  {
+    system_update_cpu_freq(CPU_BASE_MHZ);
+  }
+}
+
+void printCpuStats(Print& out)
+{
+  out.printf("CPU phases at %u MHz (runs / time / cycles):\r\n", CPU_BOOST_MHZ);
+  for (uint8_t i = 0; i < CPU_PHASE_COUNT; i++)
+  {
+    const CpuPhaseStats& stats = cpuPhases[i];
+    out.printf("\t%-8s %6u / %8u ms / %8u Mcycles\r\n", cpuPhaseNames[i], stats.runs,
+      (uint32_t)(stats.micros / 1000), (uint32_t)(stats.cycles / 1000000));
+  }
+}
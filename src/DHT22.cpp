@@ -0,0 +1,117 @@
+/**
+ * @file DHT22.cpp
+ * @author Christoff Linde
+ * @brief DHT-22 driver implementation
+ * @version 0.1
+ * @date 2021-03-20
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <Arduino.h>
+
+#include "DHT22.h"
+
+/// Maximum width of any single pulse in the response
+#define DHT22_PULSE_TIMEOUT_US 1000
+
+/// Width of the start signal. The datasheet asks for at least 1ms
+#define DHT22_START_US 1100
+
+/// Time to wait after releasing the line before the sensor pulls it low
+#define DHT22_RELEASE_US 55
+
+DHT22::DHT22(uint8_t pin)
+  : _pin(pin), _lastRead(0), _hasRead(false)
+{
+}
+
+void DHT22::begin()
+{
+  pinMode(_pin, INPUT_PULLUP);
+  _lastRead = millis();
+  _hasRead = true;
+}
+
+DHT22Status DHT22::read(DHT22Reading& reading)
+{
+  DHT22Status status = start();
+  if (status != DHT22Status::Ok)
+  {
+    return status;
+  }
+  delayMicroseconds(DHT22_START_US);
+  return finish(reading);
+}
+
+DHT22Status DHT22::start()
+{
+  uint32_t now = millis();
+  if (_hasRead && now - _lastRead < DHT22_MIN_INTERVAL)
+  {
+    return DHT22Status::TooSoon;
+  }
+  _lastRead = now;
+  _hasRead = true;
+
+  // Start signal, held until finish()
+  pinMode(_pin, OUTPUT);
+  digitalWrite(_pin, LOW);
+  return DHT22Status::Ok;
+}
+
+DHT22Status DHT22::finish(DHT22Reading& reading)
+{
+  uint16_t lowUs[DHT22_FRAME_BITS];
+  uint16_t highUs[DHT22_FRAME_BITS];
+
+  DHT22Status status = DHT22Status::Ok;
+  noInterrupts();
+
+  pinMode(_pin, INPUT_PULLUP);
+  delayMicroseconds(DHT22_RELEASE_US);
+
+  // Response: ~80us low followed by ~80us high
+  if (expectPulse(LOW) == 0 || expectPulse(HIGH) == 0)
+  {
+    status = DHT22Status::Timeout;
+  }
+
+  size_t captured = 0;
+  while (captured < DHT22_FRAME_BITS && status == DHT22Status::Ok)
+  {
+    uint32_t low = expectPulse(LOW);
+    uint32_t high = low != 0 ? expectPulse(HIGH) : 0;
+    if (low == 0 || high == 0)
+    {
+      break;
+    }
+    lowUs[captured] = low;
+    highUs[captured] = high;
+    captured++;
+  }
+
+  interrupts();
+
+  if (status != DHT22Status::Ok)
+  {
+    return status;
+  }
+  return dht22DecodeCapture(lowUs, highUs, captured, reading);
+}
+
+uint32_t DHT22::expectPulse(bool level)
+{
+  const uint32_t timeout = microsecondsToClockCycles(DHT22_PULSE_TIMEOUT_US);
+  uint32_t start = ESP.getCycleCount();
+  while (digitalRead(_pin) == level)
+  {
+    if (ESP.getCycleCount() - start > timeout)
+    {
+      return 0;
+    }
+  }
+  uint32_t width = clockCyclesToMicroseconds(ESP.getCycleCount() - start);
+  return width > 0 ? width : 1;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file DHT22Decode.cpp
+ * @author Christoff Linde
+ * @brief DHT-22 protocol decoding, independent of the Arduino core
+ * @version 0.1
+ * @date 2021-03-20
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <string.h>
+
+#include "DHT22.h"
+
+void dht22DecodePulses(const uint16_t* lowUs, const uint16_t* highUs, uint8_t frame[5])
+{
+  memset(frame, 0, 5);
+  for (size_t i = 0; i < DHT22_FRAME_BITS; i++)
+  {
+    frame[i / 8] <<= 1;
+    if (highUs[i] > lowUs[i])
+    {
+      frame[i / 8] |= 1;
+    }
+  }
+}
+
+DHT22Status dht22DecodeFrame(const uint8_t frame[5], DHT22Reading& reading)
+{
+  uint8_t checksum = frame[0] + frame[1] + frame[2] + frame[3];
+  if (checksum != frame[4])
+  {
+    return DHT22Status::Checksum;
+  }
+
+  reading.humidity = ((uint16_t)frame[0] << 8) | frame[1];
+
+  // Temperature is sign and magnitude, not two's complement
+  int16_t temperature = ((uint16_t)(frame[2] & 0x7F) << 8) | frame[3];
+  reading.temperature = (frame[2] & 0x80) ? -temperature : temperature;
+
+  return DHT22Status::Ok;
+}
+
+DHT22Status dht22DecodeCapture(const uint16_t* lowUs, const uint16_t* highUs, size_t count, DHT22Reading& reading)
+{
+  if (count < DHT22_FRAME_BITS)
+  {
+    return DHT22Status::Timeout;
+  }
+  uint8_t frame[5];
+  dht22DecodePulses(lowUs, highUs, frame);
+  return dht22DecodeFrame(frame, reading);
+}
+
+const char* dht22StatusName(DHT22Status status)
+{
+  switch (status)
+  {
+  case DHT22Status::Ok: return "ok";
+  case DHT22Status::Timeout: return "timeout";
+  case DHT22Status::Checksum: return "checksum";
+  case DHT22Status::TooSoon: return "too soon";
+  }
+  return "unknown";
+}
@@ -0,0 +1,277 @@
+/**
+ * @file DeltaPatch.cpp
+ * @author Christoff Linde
+ * @brief Streaming delta patch decoder implementation
+ * @version 0.1
+ * @date 2021-03-26
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "DeltaPatch.h"
+
+static uint32_t readLE32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t minOf(uint32_t a, uint32_t b)
+{
+  return a < b ? a : b;
+}
+
+DeltaPatcher::DeltaPatcher(DeltaReadOld readOld, DeltaWriteNew writeNew, void* context)
+  : _readOld(readOld), _writeNew(writeNew), _context(context),
+  _expectedOldSize(0), _expectedOldMD5(nullptr),
+  _state(HEADER), _error(DeltaStatus::Ok), _headerLength(0),
+  _varint(0), _varintShift(0),
+  _oldSize(0), _newSize(0), _oldPos(0), _written(0),
+  _diffRemaining(0), _extraRemaining(0), _run(0), _seek(0)
+{
+}
+
+void DeltaPatcher::expectOld(uint32_t size, const char* md5)
+{
+  _expectedOldSize = size;
+  _expectedOldMD5 = md5;
+}
+
+DeltaStatus DeltaPatcher::fail(DeltaStatus status)
+{
+  _state = FAILED;
+  _error = status;
+  return status;
+}
+
+DeltaStatus DeltaPatcher::parseHeader()
+{
+  if (memcmp(_header, "MDP1", 4) != 0)
+  {
+    return DeltaStatus::BadHeader;
+  }
+  _oldSize = readLE32(_header + 4);
+  _newSize = readLE32(_header + 8);
+
+  if (_expectedOldMD5 != nullptr)
+  {
+    if (_oldSize != _expectedOldSize || strlen(_expectedOldMD5) != 32)
+    {
+      return DeltaStatus::BadHeader;
+    }
+    for (uint8_t i = 0; i < 32; i++)
+    {
+      if (tolower(_header[12 + i]) != tolower(_expectedOldMD5[i]))
+      {
+        return DeltaStatus::BadHeader;
+      }
+    }
+  }
+  return DeltaStatus::Ok;
+}
+
+bool DeltaPatcher::varintByte(uint8_t byte, uint32_t& value)
+{
+  _varint |= (uint32_t)(byte & 0x7F) << _varintShift;
+  if (byte & 0x80)
+  {
+    _varintShift += 7;
+    if (_varintShift > 28)
+    {
+      fail(DeltaStatus::Corrupt);
+    }
+    return false;
+  }
+  value = _varint;
+  _varint = 0;
+  _varintShift = 0;
+  return true;
+}
+
+void DeltaPatcher::endRun()
+{
+  if (_diffRemaining == 0)
+  {
+    endDiff();
+  }
+  else
+  {
+    _state = TOKEN;
+  }
+}
+
+void DeltaPatcher::endDiff()
+{
+  if ((_seek < 0 && (uint32_t)-_seek > _oldPos) || (_seek > 0 && _oldPos + _seek > _oldSize))
+  {
+    fail(DeltaStatus::Corrupt);
+    return;
+  }
+  _oldPos += _seek;
+
+  if (_extraRemaining > 0)
+  {
+    _state = EXTRA;
+  }
+  else
+  {
+    endRecord();
+  }
+}
+
+void DeltaPatcher::endRecord()
+{
+  _state = _written == _newSize ? DONE : DIFF_LENGTH;
+}
+
+DeltaStatus DeltaPatcher::write(const uint8_t* data, size_t len)
+{
+  size_t i = 0;
+  // Copy runs need no input, so they are finished even when the chunk is used up
+  while (i < len || _state == DIFF_COPY)
+  {
+    uint32_t value;
+    switch (_state)
+    {
+    case HEADER:
+      _header[_headerLength++] = data[i++];
+      if (_headerLength == DELTA_HEADER_SIZE)
+      {
+        DeltaStatus status = parseHeader();
+        if (status != DeltaStatus::Ok)
+        {
+          return fail(status);
+        }
+        endRecord();
+      }
+      break;
+
+    case DIFF_LENGTH:
+      if (varintByte(data[i++], value))
+      {
+        _diffRemaining = value;
+        _state = EXTRA_LENGTH;
+      }
+      break;
+
+    case EXTRA_LENGTH:
+      if (varintByte(data[i++], value))
+      {
+        _extraRemaining = value;
+        _state = SEEK;
+      }
+      break;
+
+    case SEEK:
+      if (varintByte(data[i++], value))
+      {
+        _seek = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+        if (_diffRemaining + _extraRemaining > _newSize - _written || _diffRemaining > _oldSize - _oldPos)
+        {
+          return fail(DeltaStatus::Corrupt);
+        }
+        if (_diffRemaining > 0)
+        {
+          _state = TOKEN;
+        }
+        else
+        {
+          endDiff();
+        }
+      }
+      break;
+
+    case TOKEN:
+      if (varintByte(data[i++], value))
+      {
+        _run = value >> 1;
+        if (_run == 0 || _run > _diffRemaining)
+        {
+          return fail(DeltaStatus::Corrupt);
+        }
+        _state = (value & 1) ? DIFF_ADD : DIFF_COPY;
+      }
+      break;
+
+    case DIFF_COPY:
+      while (_run > 0)
+      {
+        uint32_t n = minOf(_run, DELTA_OLD_CHUNK);
+        if (!_readOld(_oldPos, _old, n, _context))
+        {
+          return fail(DeltaStatus::ReadFailed);
+        }
+        if (!_writeNew(_old, n, _context))
+        {
+          return fail(DeltaStatus::WriteFailed);
+        }
+        _oldPos += n;
+        _written += n;
+        _diffRemaining -= n;
+        _run -= n;
+      }
+      endRun();
+      break;
+
+    case DIFF_ADD:
+    {
+      uint32_t n = minOf(minOf(_run, DELTA_OLD_CHUNK), len - i);
+      if (!_readOld(_oldPos, _old, n, _context))
+      {
+        return fail(DeltaStatus::ReadFailed);
+      }
+      for (uint32_t k = 0; k < n; k++)
+      {
+        _old[k] += data[i + k];
+      }
+      if (!_writeNew(_old, n, _context))
+      {
+        return fail(DeltaStatus::WriteFailed);
+      }
+      i += n;
+      _oldPos += n;
+      _written += n;
+      _diffRemaining -= n;
+      _run -= n;
+      if (_run == 0)
+      {
+        endRun();
+      }
+      break;
+    }
+
+    case EXTRA:
+    {
+      uint32_t n = minOf(_extraRemaining, len - i);
+      if (!_writeNew(data + i, n, _context))
+      {
+        return fail(DeltaStatus::WriteFailed);
+      }
+      i += n;
+      _written += n;
+      _extraRemaining -= n;
+      if (_extraRemaining == 0)
+      {
+        endRecord();
+      }
+      break;
+    }
+
+    case DONE:
+      // Trailing data after a complete image
+      return fail(DeltaStatus::Corrupt);
+
+    case FAILED:
+      return _error;
+    }
+  }
+
+  if (_state == FAILED)
+  {
+    return _error;
+  }
+  return _state == DONE ? DeltaStatus::Done : DeltaStatus::Ok;
+}
@@ -0,0 +1,271 @@
+/**
+ * @file EspNowLink.cpp
+ * @author Christoff Linde
+ * @brief ESP-NOW link implementation
+ * @version 0.1
+ * @date 2021-04-02
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <ESP8266WiFi.h>
+#include <espnow.h>
+
+#include "EspNowLink.h"
+#include "SpscQueue.h"
+
+static uint8_t gatewayMac[6] = LINK_GATEWAY_MAC;
+
+static uint16_t linkSeq = 0;
+static uint32_t linkSent = 0;
+static uint32_t linkSendFailures = 0;
+static uint32_t linkReceived = 0;
+
+/// Time from the last beacon, valid at millis() timeSyncedAt
+static uint32_t timeSeconds = 0;
+static uint16_t timeMilliseconds = 0;
+static uint32_t timeSyncedAt = 0;
+static bool timeSynced = false;
+/// Sequence number and send time of the last reading, to match beacons against
+static uint16_t lastSentSeq = 0;
+static uint32_t lastSentAt = 0;
+static bool lastAnswered = false;
+
+/// Received readings, pushed by the WiFi callback and popped by the main loop
+static SpscQueue<LinkPacket, LINK_QUEUE_SIZE> linkQueue;
+
+/// A leaf added as a peer of the gateway, to send it beacons
+struct LinkPeer
+{
+  uint8_t mac[6];
+  /// millis() of the last beacon sent to the leaf
+  uint32_t lastUsed;
+};
+
+static LinkPeer linkPeers[LINK_MAX_PEERS];
+static uint8_t linkPeerCount = 0;
+static uint32_t linkPeerEvictions = 0;
+static uint32_t linkPeerFailures = 0;
+
+static void onSent(uint8_t*, uint8_t status)
+{
+  if (status != 0)
+  {
+    linkSendFailures++;
+  }
+}
+
+static void onTime(uint8_t*, uint8_t* data, uint8_t len)
+{
+  uint32_t now = millis();
+  LinkTime beacon;
+  if (len != sizeof(LinkTime) || data[0] != LINK_TIME || data[1] != LINK_VERSION)
+  {
+    return;
+  }
+  memcpy(&beacon, data, sizeof(beacon));
+  if (beacon.seq != lastSentSeq)
+  {
+    return;
+  }
+
+  uint32_t roundTrip = now - lastSentAt;
+  uint32_t transit = roundTrip > beacon.hold ? (roundTrip - beacon.hold) / 2 : 0;
+  uint32_t milliseconds = beacon.milliseconds + transit;
+  timeSeconds = beacon.seconds + milliseconds / 1000;
+  timeMilliseconds = milliseconds % 1000;
+  timeSyncedAt = now;
+  timeSynced = true;
+  lastAnswered = true;
+}
+
+static void onReceive(uint8_t* mac, uint8_t* data, uint8_t len)
+{
+  if (len != sizeof(LinkReading) || data[0] != LINK_READING || data[1] != LINK_VERSION)
+  {
+    return;
+  }
+  linkReceived++;
+
+  LinkPacket packet;
+  memcpy(&packet.reading, data, sizeof(LinkReading));
+  memcpy(packet.mac, mac, sizeof(packet.mac));
+  packet.received = millis();
+  linkQueue.push(packet);
+}
+
+bool linkBeginLeaf()
+{
+  wifi_set_channel(LINK_CHANNEL);
+  if (esp_now_init() != 0)
+  {
+    Serial.println("ESP-NOW init failed");
+    return false;
+  }
+  esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+  esp_now_register_send_cb(onSent);
+  esp_now_register_recv_cb(onTime);
+  if (esp_now_add_peer(gatewayMac, ESP_NOW_ROLE_COMBO, LINK_CHANNEL, nullptr, 0) != 0)
+  {
+    Serial.println("ESP-NOW gateway peer failed");
+    return false;
+  }
+  return true;
+}
+
+bool linkCurrentTime(uint32_t& time)
+{
+  if (!timeSynced)
+  {
+    return false;
+  }
+  time = timeSeconds + (timeMilliseconds + (millis() - timeSyncedAt)) / 1000;
+  return true;
+}
+
+bool linkSendReading(const DHT22Reading& reading, uint32_t age)
+{
+  LinkReading message;
+  message.type = LINK_READING;
+  message.version = LINK_VERSION;
+  message.seq = linkSeq++;
+  message.node = ESP.getChipId();
+  message.timestamp = 0;
+  message.age = age;
+  uint32_t time;
+  if (linkCurrentTime(time))
+  {
+    message.timestamp = time - age / 1000;
+  }
+  message.temperature = reading.temperature;
+  message.humidity = reading.humidity;
+
+  lastSentSeq = message.seq;
+  lastSentAt = millis();
+  lastAnswered = false;
+  if (esp_now_send(gatewayMac, reinterpret_cast<uint8_t*>(&message), sizeof(message)) != 0)
+  {
+    linkSendFailures++;
+    return false;
+  }
+  linkSent++;
+  return true;
+}
+
+bool linkAnswered()
+{
+  return lastAnswered;
+}
+
+bool linkBeginGateway()
+{
+  if (esp_now_init() != 0)
+  {
+    Serial.println("ESP-NOW init failed");
+    return false;
+  }
+  esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+  esp_now_register_recv_cb(onReceive);
+  return true;
+}
+
+bool linkReceive(LinkPacket& packet)
+{
+  return linkQueue.pop(packet);
+}
+
+uint32_t linkPacketAge(const LinkPacket& packet)
+{
+  return packet.reading.age + (millis() - packet.received);
+}
+
+/**
+ * @brief Remove the leaf answered least recently from the peers
+ */
+static void evictPeer(uint32_t now)
+{
+  uint8_t oldest = 0;
+  for (uint8_t i = 1; i < linkPeerCount; i++)
+  {
+    if (now - linkPeers[i].lastUsed > now - linkPeers[oldest].lastUsed)
+    {
+      oldest = i;
+    }
+  }
+  esp_now_del_peer(linkPeers[oldest].mac);
+  linkPeers[oldest] = linkPeers[--linkPeerCount];
+  linkPeerEvictions++;
+}
+
+/**
+ * @brief Make a leaf a peer, evicting another one if the ESP-NOW stack has no room
+ *
+ * @return true if the leaf is a peer
+ */
+static bool addPeer(uint8_t mac[6], uint32_t now)
+{
+  for (uint8_t i = 0; i < linkPeerCount; i++)
+  {
+    if (memcmp(linkPeers[i].mac, mac, sizeof(linkPeers[i].mac)) == 0)
+    {
+      linkPeers[i].lastUsed = now;
+      return true;
+    }
+  }
+
+  if (linkPeerCount == LINK_MAX_PEERS)
+  {
+    evictPeer(now);
+  }
+  int result = esp_now_add_peer(mac, ESP_NOW_ROLE_COMBO, LINK_CHANNEL, nullptr, 0);
+  if (result != 0 && linkPeerCount > 0)
+  {
+    // The stack may hold fewer peers than LINK_MAX_PEERS, so make room and try once more
+    evictPeer(now);
+    result = esp_now_add_peer(mac, ESP_NOW_ROLE_COMBO, LINK_CHANNEL, nullptr, 0);
+  }
+  if (result != 0)
+  {
+    linkPeerFailures++;
+    return false;
+  }
+
+  LinkPeer& peer = linkPeers[linkPeerCount++];
+  memcpy(peer.mac, mac, sizeof(peer.mac));
+  peer.lastUsed = now;
+  return true;
+}
+
+void linkSendTime(const LinkPacket& packet, uint32_t seconds, uint16_t milliseconds)
+{
+  uint8_t mac[6];
+  memcpy(mac, packet.mac, sizeof(mac));
+  if (!addPeer(mac, millis()))
+  {
+    return;
+  }
+
+  LinkTime beacon;
+  beacon.type = LINK_TIME;
+  beacon.version = LINK_VERSION;
+  beacon.seq = packet.reading.seq;
+  beacon.seconds = seconds;
+  beacon.milliseconds = milliseconds;
+  uint32_t hold = millis() - packet.received;
+  beacon.hold = hold > UINT16_MAX ? UINT16_MAX : hold;
+
+  if (esp_now_send(mac, reinterpret_cast<uint8_t*>(&beacon), sizeof(beacon)) != 0)
+  {
+    linkSendFailures++;
+    return;
+  }
+  linkSent++;
+}
+
+void printLinkStats(Print& out)
+{
+  out.printf("Link: %u sent, %u send failures, %u received, %u dropped, %u peers, %u evicted, %u not added\r\n",
+    linkSent, linkSendFailures, linkReceived, linkQueue.overflows(), linkPeerCount, linkPeerEvictions,
+    linkPeerFailures);
+}
@@ -0,0 +1,415 @@
+/**
+ * @file NodeQueue.cpp
+ * @author Christoff Linde
+ * @brief Per-node store-and-forward queue implementation
+ * @version 0.1
+ * @date 2021-04-05
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <LittleFS.h>
+
+#include "NodeQueue.h"
+#include "Storage.h"
+
+/// File listing the nodes with a spill file, and the offset of their first reading not forwarded yet
+static const char* nodeStatePath = "/nodes.txt";
+
+/// Queue of a single node
+struct NodeQueue
+{
+  uint32_t node;
+  QueuedReading ring[NODE_QUEUE_DEPTH];
+  /// Offset in the spill file just past each reading in ring, or 0 for a reading only held in RAM
+  uint32_t ringEnd[NODE_QUEUE_DEPTH];
+  uint8_t head;
+  uint8_t count;
+  /// True while the node is listed in the state file, from before its spill file is created
+  bool listed;
+  /// Readings in the spill file that have not been read back yet
+  uint32_t spilled;
+  /// Offset of the first reading in the spill file that has not been read back yet
+  uint32_t spillOffset;
+  /// Offset of the first reading in the spill file that has not been forwarded yet
+  uint32_t forwardOffset;
+  /// Timestamp of the oldest reading not forwarded yet, valid while any is pending
+  uint32_t oldest;
+  /// millis() of the last reading queued, to find the slot idle longest
+  uint32_t lastSeen;
+  uint32_t forwarded;
+  uint32_t dropped;
+};
+
+static NodeQueue nodeQueues[NODE_QUEUE_NODES];
+static uint8_t nodeCount = 0;
+static uint8_t drainStart = 0;
+/// Readings dropped because all node slots were taken
+static uint32_t unknownDropped = 0;
+/// Slots taken over from idle nodes
+static uint32_t recycled = 0;
+
+static void spillPath(const NodeQueue& queue, char* path, size_t len)
+{
+  snprintf(path, len, "/n%x.txt", queue.node);
+}
+
+/// True while a node has readings that were not forwarded yet
+static bool pending(const NodeQueue& queue)
+{
+  return queue.count > 0 || queue.spilled > 0;
+}
+
+static NodeQueue* findQueue(uint32_t node)
+{
+  for (uint8_t i = 0; i < nodeCount; i++)
+  {
+    if (nodeQueues[i].node == node)
+    {
+      return &nodeQueues[i];
+    }
+  }
+
+  NodeQueue* queue = nullptr;
+  if (nodeCount < NODE_QUEUE_NODES)
+  {
+    queue = &nodeQueues[nodeCount++];
+  }
+  else
+  {
+    // Take over the slot of the node idle longest, once it has nothing left to forward
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < nodeCount; i++)
+    {
+      NodeQueue& candidate = nodeQueues[i];
+      if (!pending(candidate) && !candidate.listed
+        && (queue == nullptr || now - candidate.lastSeen > now - queue->lastSeen))
+      {
+        queue = &candidate;
+      }
+    }
+    if (queue == nullptr)
+    {
+      return nullptr;
+    }
+    recycled++;
+  }
+  memset(queue, 0, sizeof(NodeQueue));
+  queue->node = node;
+  return queue;
+}
+
+static void saveState()
+{
+  File file = LittleFS.open(nodeStatePath, "w");
+  if (!file)
+  {
+    Serial.println("Failed to write node queue state");
+    return;
+  }
+  for (uint8_t i = 0; i < nodeCount; i++)
+  {
+    if (nodeQueues[i].listed)
+    {
+      file.printf("%x %u\n", nodeQueues[i].node, nodeQueues[i].forwardOffset);
+    }
+  }
+  indexFile(nodeStatePath, file.size());
+  file.close();
+}
+
+static bool spill(NodeQueue& queue, const QueuedReading& reading)
+{
+  if (queue.spilled >= NODE_SPILL_MAX || !startLittleFS())
+  {
+    return false;
+  }
+  if (!queue.listed)
+  {
+    // Listed before the file exists, so a file left by a reset is always found again
+    queue.listed = true;
+    saveState();
+  }
+
+  char path[16];
+  spillPath(queue, path, sizeof(path));
+  File file = LittleFS.open(path, "a");
+  if (!file)
+  {
+    return false;
+  }
+  file.printf("%u,%d,%u\n", reading.timestamp, reading.temperature, reading.humidity);
+  indexFile(path, file.size());
+  file.close();
+  queue.spilled++;
+  return true;
+}
+
+/**
+ * @brief Read spilled readings back into the RAM queue, as far as it has room
+ */
+static void refill(NodeQueue& queue)
+{
+  if (queue.spilled == 0 || queue.count == NODE_QUEUE_DEPTH)
+  {
+    return;
+  }
+
+  char path[16];
+  spillPath(queue, path, sizeof(path));
+  File file = LittleFS.open(path, "r");
+  if (!file || !file.seek(queue.spillOffset))
+  {
+    // The spill file is gone, so are its readings
+    queue.dropped += queue.spilled;
+    queue.spilled = 0;
+    queue.spillOffset = 0;
+    queue.forwardOffset = 0;
+    return;
+  }
+
+  char line[32];
+  while (queue.spilled > 0 && queue.count < NODE_QUEUE_DEPTH && file.available())
+  {
+    size_t len = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[len] = '\0';
+    queue.spillOffset = file.position();
+    queue.spilled--;
+
+    unsigned timestamp, humidity;
+    int temperature;
+    if (sscanf(line, "%u,%d,%u", &timestamp, &temperature, &humidity) != 3)
+    {
+      queue.dropped++;
+      continue;
+    }
+    uint8_t index = (queue.head + queue.count) % NODE_QUEUE_DEPTH;
+    QueuedReading& slot = queue.ring[index];
+    slot.timestamp = timestamp;
+    slot.temperature = temperature;
+    slot.humidity = humidity;
+    queue.ringEnd[index] = queue.spillOffset;
+    queue.count++;
+  }
+  file.close();
+}
+
+/**
+ * @brief Take the forwarded readings off the spill file
+ *
+ * @details Once every reading read back was forwarded, the forward offset catches up with the read
+ * offset, which also skips lines that failed to parse. A spill file that was read and forwarded
+ * completely is deleted.
+ *
+ * @return true if the spill file was deleted
+ */
+static bool settle(NodeQueue& queue)
+{
+  if (!queue.listed)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < queue.count; i++)
+  {
+    if (queue.ringEnd[(queue.head + i) % NODE_QUEUE_DEPTH] != 0)
+    {
+      return false;
+    }
+  }
+  queue.forwardOffset = queue.spillOffset;
+  if (queue.spilled > 0)
+  {
+    return false;
+  }
+
+  char path[16];
+  spillPath(queue, path, sizeof(path));
+  deleteFile(path);
+  queue.spillOffset = 0;
+  queue.forwardOffset = 0;
+  queue.listed = false;
+  return true;
+}
+
+/**
+ * @brief Count the readings of a spill file from an offset on
+ */
+static uint32_t countSpilled(const NodeQueue& queue, uint32_t offset)
+{
+  char path[16];
+  spillPath(queue, path, sizeof(path));
+  File file = LittleFS.open(path, "r");
+  if (!file || !file.seek(offset))
+  {
+    return 0;
+  }
+  uint32_t lines = 0;
+  uint8_t buf[64];
+  size_t len;
+  while ((len = file.read(buf, sizeof(buf))) > 0)
+  {
+    for (size_t i = 0; i < len; i++)
+    {
+      lines += buf[i] == '\n';
+    }
+  }
+  file.close();
+  return lines;
+}
+
+void nodeQueueBegin()
+{
+  if (!startLittleFS())
+  {
+    return;
+  }
+  File file = LittleFS.open(nodeStatePath, "r");
+  if (!file)
+  {
+    return;
+  }
+
+  char line[24];
+  while (file.available())
+  {
+    size_t len = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[len] = '\0';
+    unsigned node, offset;
+    if (sscanf(line, "%x %u", &node, &offset) != 2)
+    {
+      continue;
+    }
+    NodeQueue* queue = findQueue(node);
+    if (queue == nullptr)
+    {
+      break;
+    }
+    queue->listed = true;
+    queue->spillOffset = offset;
+    queue->forwardOffset = offset;
+    queue->spilled = countSpilled(*queue, offset);
+    Serial.printf("Node %08x: %u spilled readings restored\n", node, queue->spilled);
+    refill(*queue);
+    if (queue->count > 0)
+    {
+      queue->oldest = queue->ring[queue->head].timestamp;
+    }
+  }
+  file.close();
+}
+
+bool nodeQueuePush(uint32_t node, const QueuedReading& reading)
+{
+  NodeQueue* queue = findQueue(node);
+  if (queue == nullptr)
+  {
+    unknownDropped++;
+    return false;
+  }
+  queue->lastSeen = millis();
+  if (!pending(*queue))
+  {
+    queue->oldest = reading.timestamp;
+  }
+
+  if (!NODE_QUEUE_DURABLE && queue->count < NODE_QUEUE_DEPTH && queue->spilled == 0)
+  {
+    uint8_t index = (queue->head + queue->count) % NODE_QUEUE_DEPTH;
+    queue->ring[index] = reading;
+    queue->ringEnd[index] = 0;
+    queue->count++;
+    return true;
+  }
+  if (!spill(*queue, reading))
+  {
+    queue->dropped++;
+    return false;
+  }
+  return true;
+}
+
+size_t nodeQueueDrain(size_t max, NodeReadingHandler handler)
+{
+  if (nodeCount == 0)
+  {
+    return 0;
+  }
+
+  uint32_t forwardOffsets[NODE_QUEUE_NODES];
+  for (uint8_t i = 0; i < nodeCount; i++)
+  {
+    forwardOffsets[i] = nodeQueues[i].forwardOffset;
+  }
+
+  size_t drained = 0;
+  bool progress = true;
+  while (drained < max && progress)
+  {
+    progress = false;
+    for (uint8_t i = 0; i < nodeCount && drained < max; i++)
+    {
+      NodeQueue& queue = nodeQueues[(drainStart + i) % nodeCount];
+      if (queue.count == 0)
+      {
+        refill(queue);
+      }
+      if (queue.count == 0)
+      {
+        continue;
+      }
+
+      handler(queue.node, queue.ring[queue.head]);
+      if (queue.ringEnd[queue.head] != 0)
+      {
+        queue.forwardOffset = queue.ringEnd[queue.head];
+        queue.ringEnd[queue.head] = 0;
+      }
+      queue.head = (queue.head + 1) % NODE_QUEUE_DEPTH;
+      queue.count--;
+      queue.forwarded++;
+      drained++;
+      progress = true;
+    }
+  }
+  drainStart = (drainStart + 1) % nodeCount;
+
+  // Read ahead what is left of the spill files, so the oldest pending reading of every node is known
+  for (uint8_t i = 0; i < nodeCount; i++)
+  {
+    NodeQueue& queue = nodeQueues[i];
+    if (queue.count == 0)
+    {
+      refill(queue);
+    }
+    if (queue.count > 0)
+    {
+      queue.oldest = queue.ring[queue.head].timestamp;
+    }
+  }
+
+  // The forward offsets are saved once per drain, after the readings went to the upload log
+  bool changed = false;
+  for (uint8_t i = 0; i < nodeCount; i++)
+  {
+    changed |= settle(nodeQueues[i]) || nodeQueues[i].forwardOffset != forwardOffsets[i];
+  }
+  if (changed)
+  {
+    saveState();
+  }
+  return drained;
+}
+
+void printNodeQueueStats(Print& out, uint32_t now)
+{
+  out.printf("Node queues: %u nodes, %u slots recycled, %u readings dropped for unknown nodes\r\n", nodeCount,
+    recycled, unknownDropped);
+  for (uint8_t i = 0; i < nodeCount; i++)
+  {
+    NodeQueue& queue = nodeQueues[i];
+    uint32_t lag = pending(queue) ? now - queue.oldest : 0;
+    out.printf("\t%08x queued %u (%u spilled), lag %u s, forwarded %u, dropped %u\r\n", queue.node,
+      queue.count + queue.spilled, queue.spilled, lag, queue.forwarded, queue.dropped);
+  }
+}
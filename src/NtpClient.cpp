@@ -0,0 +1,158 @@
+/**
+ * @file NtpClient.cpp
+ * @author Christoff Linde
+ * @brief Event driven NTP client implementation
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <lwip/pbuf.h>
+#include <lwip/udp.h>
+
+#include "NtpClient.h"
+#include "SpscQueue.h"
+
+/// Seconds from the NTP epoch, 1900, to the UNIX epoch, 1970
+static const uint32_t seventyYears = 2208988800UL;
+
+static struct udp_pcb* ntpPcb = nullptr;
+
+/// Transmit timestamp of the last request, the nonce its reply must echo
+static uint32_t requestSeconds = 0;
+static uint32_t requestFraction = 0;
+/// micros() at which the last request was sent
+static uint32_t requestSentUs = 0;
+static bool requestPending = false;
+
+static uint32_t ntpRequests = 0;
+static uint32_t ntpReplies = 0;
+static uint32_t ntpRejected = 0;
+static uint32_t lastRoundTrip = 0;
+
+/// Replies, pushed by the lwIP callback and popped by the main loop
+static SpscQueue<NtpSample, NTP_QUEUE_SIZE> ntpQueue;
+
+static uint32_t readUint32(const uint8_t* data)
+{
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void writeUint32(uint8_t* data, uint32_t value)
+{
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+/// Convert the fraction of an NTP timestamp to us
+static uint32_t fractionToMicros(uint32_t fraction)
+{
+  return ((uint64_t)fraction * 1000000) >> 32;
+}
+
+static void onReceive(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, u16_t port)
+{
+  uint32_t nowUs = micros();
+  uint32_t nowMs = millis();
+  uint8_t data[NTP_PACKET_SIZE];
+  bool complete = pbuf_copy_partial(p, data, sizeof(data), 0) == sizeof(data);
+  pbuf_free(p);
+
+  // Mode 4 is a server reply, and the originate timestamp must echo our last request
+  if (!complete || port != NTP_PORT || !requestPending || (data[0] & 0x07) != 4 ||
+      readUint32(data + 24) != requestSeconds || readUint32(data + 28) != requestFraction)
+  {
+    ntpRejected++;
+    return;
+  }
+  requestPending = false;
+  ntpReplies++;
+
+  uint32_t receiveSeconds = readUint32(data + 32);
+  uint32_t receiveUs = fractionToMicros(readUint32(data + 36));
+  uint32_t transmitSeconds = readUint32(data + 40);
+  uint32_t transmitUs = fractionToMicros(readUint32(data + 44));
+  int32_t held = (int32_t)(transmitSeconds - receiveSeconds) * 1000000 + (int32_t)(transmitUs - receiveUs);
+  uint32_t elapsed = nowUs - requestSentUs;
+  uint32_t roundTrip = held > 0 && (uint32_t)held < elapsed ? elapsed - held : elapsed;
+  lastRoundTrip = roundTrip;
+
+  uint32_t transitUs = transmitUs + roundTrip / 2;
+  NtpSample sample;
+  sample.seconds = transmitSeconds - seventyYears + transitUs / 1000000;
+  sample.milliseconds = (transitUs % 1000000) / 1000;
+  sample.receivedAt = nowMs;
+  sample.roundTrip = roundTrip;
+  ntpQueue.push(sample);
+}
+
+bool ntpBegin()
+{
+  if (ntpPcb)
+  {
+    return true;
+  }
+  ntpPcb = udp_new();
+  if (!ntpPcb)
+  {
+    return false;
+  }
+  if (udp_bind(ntpPcb, IP_ADDR_ANY, 0) != ERR_OK)
+  {
+    udp_remove(ntpPcb);
+    ntpPcb = nullptr;
+    return false;
+  }
+  udp_recv(ntpPcb, onReceive, nullptr);
+  return true;
+}
+
+bool ntpRequest(const IPAddress& server)
+{
+  if (!ntpPcb)
+  {
+    return false;
+  }
+  struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, NTP_PACKET_SIZE, PBUF_RAM);
+  if (!p)
+  {
+    return false;
+  }
+  uint8_t* data = static_cast<uint8_t*>(p->payload);
+  memset(data, 0, NTP_PACKET_SIZE);
+  // LI unknown, version 4, mode 3 (client)
+  data[0] = 0b11100011;
+
+  // The clock is unknown before the first reply, so the transmit timestamp is only a nonce
+  requestSentUs = micros();
+  requestSeconds = ++ntpRequests;
+  requestFraction = requestSentUs;
+  writeUint32(data + 40, requestSeconds);
+  writeUint32(data + 44, requestFraction);
+  requestPending = true;
+
+  ip_addr_t address = server;
+  err_t err = udp_sendto(ntpPcb, p, &address, NTP_PORT);
+  pbuf_free(p);
+  if (err != ERR_OK)
+  {
+    requestPending = false;
+    return false;
+  }
+  return true;
+}
+
+bool ntpPoll(NtpSample& sample)
+{
+  return ntpQueue.pop(sample);
+}
+
+void printNtpStats(Print& out)
+{
+  out.printf("NTP: %u requests, %u replies, %u rejected, last round trip %u us\r\n", ntpRequests, ntpReplies,
+    ntpRejected, lastRoundTrip);
+}
@@ -0,0 +1,428 @@
+/**
+ * @file Ota.cpp
+ * @author Christoff Linde
+ * @brief HTTP firmware update implementation
+ * @version 0.1
+ * @date 2021-03-24
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <ESP8266HTTPClient.h>
+#include <LittleFS.h>
+#include <WiFiClient.h>
+
+#include "CpuBoost.h"
+#include "DeltaPatch.h"
+#include "Ota.h"
+#include "ReadingPipeline.h"
+#include "ServerTime.h"
+#include "Storage.h"
+
+/// File holding the state of a pending update
+static const char* otaStatePath = "/ota.txt";
+
+/// Persisted state of the last update
+struct OtaState
+{
+  bool pending;
+  uint8_t boots;
+  /// Version that was installed by the last update
+  char version[16];
+  /// Version that was running before the last update
+  char previous[16];
+  uint32_t previousSize;
+  char previousMD5[33];
+  /// Version that was rolled back, and must not be installed again
+  char skip[16];
+};
+
+static OtaState otaState;
+
+/// Buffer the image is streamed through on its way to flash
+static uint8_t otaBuffer[OTA_CHUNK_SIZE];
+
+/**
+ * @brief Copy a version string, mapping the "-" placeholder used in the state file to an empty string
+ */
+static void copyField(char* dest, const char* src, size_t len)
+{
+  strlcpy(dest, strcmp(src, "-") == 0 ? "" : src, len);
+}
+
+static const char* fieldOrPlaceholder(const char* value)
+{
+  return value[0] ? value : "-";
+}
+
+static void loadState()
+{
+  memset(&otaState, 0, sizeof(otaState));
+  if (!startLittleFS())
+  {
+    return;
+  }
+
+  File file = LittleFS.open(otaStatePath, "r");
+  if (!file)
+  {
+    return;
+  }
+
+  char line[128];
+  size_t len = file.readBytesUntil('\n', line, sizeof(line) - 1);
+  line[len] = '\0';
+  file.close();
+
+  int pending;
+  unsigned boots;
+  char version[16], previous[16], previousMD5[33], skip[16];
+  if (sscanf(line, "%d %u %15s %15s %u %32s %15s", &pending, &boots, version, previous,
+    &otaState.previousSize, previousMD5, skip) != 7)
+  {
+    return;
+  }
+  otaState.pending = pending;
+  otaState.boots = boots;
+  copyField(otaState.version, version, sizeof(otaState.version));
+  copyField(otaState.previous, previous, sizeof(otaState.previous));
+  copyField(otaState.previousMD5, previousMD5, sizeof(otaState.previousMD5));
+  copyField(otaState.skip, skip, sizeof(otaState.skip));
+}
+
+static void saveState()
+{
+  File file = LittleFS.open(otaStatePath, "w");
+  if (!file)
+  {
+    Serial.println("Failed to write OTA state");
+    return;
+  }
+  file.printf("%d %u %s %s %u %s %s\n", otaState.pending, otaState.boots,
+    fieldOrPlaceholder(otaState.version), fieldOrPlaceholder(otaState.previous), otaState.previousSize,
+    fieldOrPlaceholder(otaState.previousMD5), fieldOrPlaceholder(otaState.skip));
+  indexFile(otaStatePath, file.size());
+  file.close();
+}
+
+/// A download in progress, resumed across connections
+struct OtaDownload
+{
+  const char* url;
+  /// Bytes received so far
+  uint32_t offset;
+  /// Total size, taken from the first response if 0
+  uint32_t size;
+  bool failed;
+  /// Called with every received chunk, in order
+  bool (*sink)(const uint8_t* data, size_t len, void* context);
+  void* context;
+};
+
+/**
+ * @brief Stream the download from its current offset onwards into its sink
+ */
+static void downloadFrom(OtaDownload& download)
+{
+  WiFiClient client;
+  HTTPClient http;
+  if (!http.begin(client, download.url))
+  {
+    return;
+  }
+
+  if (download.offset > 0)
+  {
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=%u-", download.offset);
+    http.addHeader("Range", range);
+    Serial.printf("Resuming download at %u bytes\n", download.offset);
+  }
+
+  int responseCode = http.GET();
+  // A server that ignores the Range header resends everything, so skip what we already have
+  uint32_t skip = 0;
+  if (responseCode == HTTP_CODE_OK)
+  {
+    skip = download.offset;
+    if (download.size == 0)
+    {
+      download.size = http.getSize() > 0 ? http.getSize() : 0;
+    }
+  }
+  else if (responseCode != HTTP_CODE_PARTIAL_CONTENT)
+  {
+    Serial.printf("OTA download of %s failed: %i\n", download.url, responseCode);
+    download.failed = download.offset == 0;
+    http.end();
+    return;
+  }
+  if (download.size == 0)
+  {
+    download.failed = true;
+    http.end();
+    return;
+  }
+
+  WiFiClient* stream = http.getStreamPtr();
+  unsigned long lastData = millis();
+  while (download.offset < download.size)
+  {
+    size_t available = stream->available();
+    if (available == 0)
+    {
+      if (!stream->connected() || millis() - lastData > OTA_STALL_TIMEOUT)
+      {
+        break;
+      }
+      delay(1);
+      continue;
+    }
+
+    size_t len = stream->read(otaBuffer, std::min<size_t>(available, OTA_CHUNK_SIZE));
+    lastData = millis();
+
+    size_t start = std::min<size_t>(skip, len);
+    skip -= start;
+    len = std::min<size_t>(len - start, download.size - download.offset);
+    if (len == 0)
+    {
+      continue;
+    }
+
+    if (!download.sink(otaBuffer + start, len, download.context))
+    {
+      download.failed = true;
+      break;
+    }
+    download.offset += len;
+  }
+
+  http.end();
+}
+
+/**
+ * @brief Run a download to completion, resuming up to OTA_MAX_ATTEMPTS times
+ *
+ * @return true if every byte was received and accepted by the sink
+ */
+static bool runDownload(OtaDownload& download)
+{
+  for (uint8_t attempt = 0; attempt < OTA_MAX_ATTEMPTS && !download.failed; attempt++)
+  {
+    downloadFrom(download);
+    if (download.size > 0 && download.offset == download.size)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool writeUpdate(const uint8_t* data, size_t len, void* context)
+{
+  if (Update.write(const_cast<uint8_t*>(data), len) != len)
+  {
+    Update.printError(Serial);
+    return false;
+  }
+  return true;
+}
+
+static bool readSketch(uint32_t offset, uint8_t* buf, size_t len, void* context)
+{
+  return ESP.flashRead(offset, buf, len);
+}
+
+static bool writePatch(const uint8_t* data, size_t len, void* context)
+{
+  DeltaPatcher* patcher = static_cast<DeltaPatcher*>(context);
+  cpuBoostStart(CPU_PATCH);
+  DeltaStatus status = patcher->write(data, len);
+  cpuBoostEnd(CPU_PATCH);
+  if (status != DeltaStatus::Ok && status != DeltaStatus::Done)
+  {
+    Serial.printf("OTA patch rejected: %u\n", (unsigned)status);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Download and activate an image
+ *
+ * @return true if the image was written and its MD5 matched
+ */
+static bool installImage(const char* version, uint32_t size, const char* md5)
+{
+  char url[128];
+  snprintf(url, sizeof(url), OTA_BASE_URL "/firmware-%s.bin", version);
+  Serial.printf("Installing firmware %s (%u bytes)\n", version, size);
+
+  if (!Update.begin(size))
+  {
+    Update.printError(Serial);
+    return false;
+  }
+  Update.setMD5(md5);
+
+  OtaDownload download = { url, 0, size, false, writeUpdate, nullptr };
+  runDownload(download);
+
+  // Ending an incomplete update discards it
+  if (!Update.end())
+  {
+    Update.printError(Serial);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Download a delta patch from the running firmware and apply it
+ *
+ * @return true if the patched image was written and its MD5 matched
+ */
+static bool installPatch(const char* version, uint32_t size, const char* md5)
+{
+  char url[128];
+  snprintf(url, sizeof(url), OTA_BASE_URL "/patch-%s-%s.bin", FIRMWARE_VERSION, version);
+
+  if (!Update.begin(size))
+  {
+    Update.printError(Serial);
+    return false;
+  }
+  Update.setMD5(md5);
+
+  // Hashing the whole running image is the costliest part of a patch
+  cpuBoostStart(CPU_PATCH);
+  String sketchMD5 = ESP.getSketchMD5();
+  cpuBoostEnd(CPU_PATCH);
+  DeltaPatcher patcher(readSketch, writeUpdate, nullptr);
+  patcher.expectOld(ESP.getSketchSize(), sketchMD5.c_str());
+
+  OtaDownload download = { url, 0, 0, false, writePatch, &patcher };
+  if (runDownload(download))
+  {
+    Serial.printf("Applied %u byte patch for firmware %s\n", download.size, version);
+  }
+
+  // Ending an incomplete update discards it, e.g. when no patch is published for this version
+  if (!Update.end())
+  {
+    Update.printError(Serial);
+    return false;
+  }
+  return true;
+}
+
+void otaBegin()
+{
+  loadState();
+  if (!otaState.pending)
+  {
+    return;
+  }
+
+  if (strcmp(otaState.version, FIRMWARE_VERSION) != 0)
+  {
+    // Either the update never activated, or the previous image was restored
+    otaState.pending = false;
+  }
+  else
+  {
+    otaState.boots++;
+    Serial.printf("Firmware %s pending confirmation, boot %u\n", otaState.version, otaState.boots);
+  }
+  saveState();
+}
+
+bool otaRollbackRequired()
+{
+  return otaState.pending && otaState.boots > OTA_MAX_BOOTS;
+}
+
+bool otaCheck()
+{
+  if (otaRollbackRequired())
+  {
+    Serial.printf("Firmware %s failed to confirm, rolling back to %s\n", otaState.version, otaState.previous);
+    strlcpy(otaState.skip, otaState.version, sizeof(otaState.skip));
+    saveState();
+    if (!installImage(otaState.previous, otaState.previousSize, otaState.previousMD5))
+    {
+      return false;
+    }
+    flushPipelines();
+    flushIndex();
+    ESP.restart();
+    return true;
+  }
+
+  WiFiClient client;
+  HTTPClient http;
+  if (!http.begin(client, OTA_BASE_URL "/manifest.txt"))
+  {
+    return false;
+  }
+  serverTimeCollect(http);
+  int responseCode = http.GET();
+  if (responseCode > 0)
+  {
+    serverTimeRecord(http);
+  }
+  if (responseCode != HTTP_CODE_OK)
+  {
+    Serial.printf("OTA manifest request failed: %i\n", responseCode);
+    http.end();
+    return false;
+  }
+  String manifest = http.getString();
+  http.end();
+
+  char version[16], md5[33];
+  uint32_t size;
+  if (sscanf(manifest.c_str(), "%15s %u %32s", version, &size, md5) != 3)
+  {
+    Serial.println("OTA manifest invalid");
+    return false;
+  }
+  if (strcmp(version, FIRMWARE_VERSION) == 0 || strcmp(version, otaState.skip) == 0)
+  {
+    return false;
+  }
+
+  if (!installPatch(version, size, md5) && !installImage(version, size, md5))
+  {
+    return false;
+  }
+
+  otaState.pending = true;
+  otaState.boots = 0;
+  strlcpy(otaState.version, version, sizeof(otaState.version));
+  strlcpy(otaState.previous, FIRMWARE_VERSION, sizeof(otaState.previous));
+  otaState.previousSize = ESP.getSketchSize();
+  strlcpy(otaState.previousMD5, ESP.getSketchMD5().c_str(), sizeof(otaState.previousMD5));
+  saveState();
+
+  Serial.println("Update installed, restarting");
+  flushPipelines();
+  flushIndex();
+  Serial.flush();
+  ESP.restart();
+  return true;
+}
+
+void otaConfirm()
+{
+  if (!otaState.pending)
+  {
+    return;
+  }
+  Serial.printf("Firmware %s confirmed\n", otaState.version);
+  otaState.pending = false;
+  otaState.boots = 0;
+  saveState();
+}
@@ -0,0 +1,127 @@
+/**
+ * @file PayloadSigner.cpp
+ * @author Christoff Linde
+ * @brief HMAC-SHA256 signing implementation
+ * @version 0.1
+ * @date 2021-03-29
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <LittleFS.h>
+
+#include "PayloadSigner.h"
+#include "Storage.h"
+
+#ifndef UPLOAD_HMAC_KEY
+#define UPLOAD_HMAC_KEY ""
+#endif
+
+/// File holding the end of the reserved counter block
+static const char* counterPath = "/counter.txt";
+
+static uint32_t counterNext = 0;
+static uint32_t counterReserved = 0;
+static bool counterLoaded = false;
+
+static br_hmac_key_context deviceKey;
+static bool deviceKeyReady = false;
+
+/**
+ * @brief Derive the key of this device from the fleet key and the chip id
+ */
+static const br_hmac_key_context& signingKey()
+{
+  if (!deviceKeyReady)
+  {
+    br_hmac_key_context fleetKey;
+    br_hmac_key_init(&fleetKey, &br_sha256_vtable, UPLOAD_HMAC_KEY, strlen(UPLOAD_HMAC_KEY));
+
+    char chipId[9];
+    snprintf(chipId, sizeof(chipId), "%x", ESP.getChipId());
+    br_hmac_context hmac;
+    br_hmac_init(&hmac, &fleetKey, 0);
+    br_hmac_update(&hmac, chipId, strlen(chipId));
+
+    uint8_t key[32];
+    br_hmac_out(&hmac, key);
+    br_hmac_key_init(&deviceKey, &br_sha256_vtable, key, sizeof(key));
+    deviceKeyReady = true;
+  }
+  return deviceKey;
+}
+
+bool nextUploadCounter(uint32_t& counter)
+{
+  if (!counterLoaded && startLittleFS())
+  {
+    File file = LittleFS.open(counterPath, "r");
+    if (file)
+    {
+      counterNext = file.parseInt();
+      file.close();
+    }
+    counterReserved = counterNext;
+    counterLoaded = true;
+  }
+
+  if (!counterLoaded)
+  {
+    return false;
+  }
+
+  if (counterNext >= counterReserved)
+  {
+    uint32_t reserved = counterNext + COUNTER_BLOCK;
+    File file = LittleFS.open(counterPath, "w");
+    if (!file)
+    {
+      Serial.println("Failed to reserve upload counters");
+      return false;
+    }
+    size_t written = file.println(reserved);
+    indexFile(counterPath, file.size());
+    file.close();
+    if (written == 0)
+    {
+      Serial.println("Failed to reserve upload counters");
+      return false;
+    }
+    counterReserved = reserved;
+  }
+  counter = counterNext++;
+  return true;
+}
+
+PayloadSigner::PayloadSigner(Print& out, uint32_t counter)
+  : _out(out)
+{
+  br_hmac_init(&_hmac, &signingKey(), 0);
+
+  char prefix[12];
+  int len = snprintf(prefix, sizeof(prefix), "%u\n", counter);
+  br_hmac_update(&_hmac, prefix, len);
+}
+
+size_t PayloadSigner::write(uint8_t c)
+{
+  br_hmac_update(&_hmac, &c, 1);
+  return _out.write(c);
+}
+
+size_t PayloadSigner::write(const uint8_t* buffer, size_t size)
+{
+  br_hmac_update(&_hmac, buffer, size);
+  return _out.write(buffer, size);
+}
+
+void PayloadSigner::signature(char hex[SIGNATURE_HEX_LENGTH + 1])
+{
+  uint8_t mac[32];
+  br_hmac_out(&_hmac, mac);
+  for (uint8_t i = 0; i < sizeof(mac); i++)
+  {
+    snprintf(hex + 2 * i, 3, "%02x", mac[i]);
+  }
+}
@@ -0,0 +1,52 @@
+/**
+ * @file ReadingPipeline.cpp
+ * @author Christoff Linde
+ * @brief Reading pipeline instances and storage
+ * @version 0.1
+ * @date 2021-04-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <LittleFS.h>
+
+#include "ReadingPipeline.h"
+#include "Storage.h"
+
+SamplePipeline samplePipeline;
+RelayPipeline relayPipeline;
+
+bool appendLogLine(const LogLine& line)
+{
+  Serial.print("\nAppending data to file: ");
+  Serial.write(line.data, line.len);
+
+  if (!startLittleFS())
+  {
+    return false;
+  }
+  File dataLog = LittleFS.open(UPLOAD_LOG_PATH, "a");
+  if (!dataLog)
+  {
+    return false;
+  }
+  size_t written = dataLog.write(reinterpret_cast<const uint8_t*>(line.data), line.len);
+  indexFile(UPLOAD_LOG_PATH, dataLog.size());
+  dataLog.close();
+  return written == line.len;
+}
+
+void flushPipelines()
+{
+  samplePipeline.flush();
+  relayPipeline.flush();
+}
+
+void printPipelineStats(Print& out)
+{
+  out.println("Sample pipeline:");
+  samplePipeline.printStats(out);
+  out.println("Relay pipeline:");
+  relayPipeline.printStats(out);
+}
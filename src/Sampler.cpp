@@ -0,0 +1,117 @@
+/**
+ * @file Sampler.cpp
+ * @author Christoff Linde
+ * @brief Timer driven sampling implementation
+ * @version 0.1
+ * @date 2021-04-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <Ticker.h>
+
+#include "Sampler.h"
+#include "SpscQueue.h"
+
+/// Upper bounds of the jitter buckets in us, the last bucket takes the rest
+static const uint32_t jitterBounds[SAMPLER_JITTER_BUCKETS - 1] = { 100, 1000, 10000, 100000, 1000000 };
+static const char* jitterLabels[SAMPLER_JITTER_BUCKETS] = { "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s" };
+
+static DHT22* sampleSensor = nullptr;
+static Ticker firstTicker;
+static Ticker deadlineTicker;
+static Ticker finishTicker;
+static uint32_t intervalUs = 0;
+/// micros() of the current deadline
+static uint32_t deadlineUs = 0;
+static bool running = false;
+
+/// The transaction in progress, only touched by the timer callbacks
+static Sample pending;
+static SpscQueue<Sample, SAMPLER_QUEUE_SIZE> samples;
+
+static uint32_t jitterHistogram[SAMPLER_JITTER_BUCKETS];
+static uint32_t jitterMax = 0;
+
+static void recordJitter(uint32_t jitter)
+{
+  size_t bucket = 0;
+  while (bucket < SAMPLER_JITTER_BUCKETS - 1 && jitter >= jitterBounds[bucket])
+  {
+    bucket++;
+  }
+  jitterHistogram[bucket]++;
+  jitterMax = max(jitterMax, jitter);
+}
+
+static void onFinish()
+{
+  pending.status = sampleSensor->finish(pending.reading);
+  samples.push(pending);
+}
+
+static void takeSample()
+{
+  pending.takenAt = millis();
+  pending.timestamp = 0;
+  pending.status = sampleSensor->start();
+  if (pending.status != DHT22Status::Ok)
+  {
+    samples.push(pending);
+    return;
+  }
+  finishTicker.once_ms(SAMPLER_START_MS, onFinish);
+}
+
+static void onDeadline()
+{
+  uint32_t now = micros();
+  deadlineUs += intervalUs;
+  int32_t late = now - deadlineUs;
+  recordJitter(late >= 0 ? late : -late);
+  takeSample();
+}
+
+static void onFirstDeadline()
+{
+  deadlineUs = micros();
+  deadlineTicker.attach_ms(intervalUs / 1000, onDeadline);
+  takeSample();
+}
+
+void samplerBegin(DHT22& sensor, unsigned long interval)
+{
+  sampleSensor = &sensor;
+  intervalUs = min(interval, SAMPLER_MAX_INTERVAL) * 1000;
+  deadlineTicker.detach();
+  running = true;
+  firstTicker.once_ms(DHT22_MIN_INTERVAL, onFirstDeadline);
+}
+
+bool samplerRunning()
+{
+  return running;
+}
+
+bool samplerPoll(Sample& sample)
+{
+  return samples.pop(sample);
+}
+
+void samplerTelemetry(SamplerTelemetry& telemetry)
+{
+  telemetry.jitterMaxUs = jitterMax;
+  memcpy(telemetry.jitter, jitterHistogram, sizeof(telemetry.jitter));
+  telemetry.lost = samples.overflows();
+}
+
+void printSamplerStats(Print& out)
+{
+  out.printf("Sampling deadline jitter, max %u us:", jitterMax);
+  for (size_t i = 0; i < SAMPLER_JITTER_BUCKETS; i++)
+  {
+    out.printf(" %s %u", jitterLabels[i], jitterHistogram[i]);
+  }
+  out.printf("\r\nSamples lost: %u\r\n", samples.overflows());
+}
@@ -0,0 +1,238 @@
+/**
+ * @file SerialExport.cpp
+ * @author Christoff Linde
+ * @brief Serial log export implementation
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <LittleFS.h>
+
+#include "ExportProtocol.h"
+#include "SerialExport.h"
+#include "Storage.h"
+
+/// Export stages, advanced by serialExportPoll()
+enum ExportState : uint8_t
+{
+  EXPORT_IDLE,
+  /// Waiting for a START frame
+  EXPORT_WAITING,
+  /// Writing READY, then switching the baud rate
+  EXPORT_SWITCHING,
+  EXPORT_SENDING,
+  /// Writing END or ABORT, then ending the export
+  EXPORT_CLOSING
+};
+
+static ExportState exportState = EXPORT_IDLE;
+static char exportPath[FS_NAME_LENGTH];
+static File exportFile;
+/// Offset of the next block, and size of the file when the export started
+static uint32_t exportOffset = 0;
+static uint32_t exportSize = 0;
+/// Baud rate of Serial outside of the export, and the one asked for by the last START
+static uint32_t baseBaud = 0;
+static uint32_t switchBaud = 0;
+static unsigned long stateSince = 0;
+
+/// The frame being written, and how much of it the UART took
+static uint8_t txFrame[EXPORT_HEADER_SIZE + EXPORT_MAX_PAYLOAD + EXPORT_TRAILER_SIZE];
+static size_t txLength = 0;
+static size_t txWritten = 0;
+static uint16_t txSeq = 0;
+
+/// The host only sends START and ABORT
+static ExportParser<8> rxParser;
+
+static uint32_t exportCount = 0;
+static uint32_t framesSent = 0;
+
+static void setState(ExportState state)
+{
+  exportState = state;
+  stateSince = millis();
+}
+
+static void queueFrame(ExportFrameType type, uint16_t length)
+{
+  txLength = exportFrame(txFrame, type, txSeq++, length);
+  txWritten = 0;
+  framesSent++;
+}
+
+/**
+ * @brief Write as much of the current frame as the UART takes
+ *
+ * @return true once the frame is written
+ */
+static bool writeFrame()
+{
+  while (txWritten < txLength)
+  {
+    size_t room = Serial.availableForWrite();
+    if (room == 0)
+    {
+      return false;
+    }
+    txWritten += Serial.write(txFrame + txWritten, min(room, txLength - txWritten));
+  }
+  return true;
+}
+
+static void endExport()
+{
+  if (exportFile)
+  {
+    exportFile.close();
+  }
+  Serial.flush();
+  if (Serial.baudRate() != (int)baseBaud)
+  {
+    Serial.updateBaudRate(baseBaud);
+  }
+  setState(EXPORT_IDLE);
+}
+
+static void abortExport()
+{
+  queueFrame(EXPORT_ABORT, 0);
+  setState(EXPORT_CLOSING);
+}
+
+static void handleStart(const uint8_t* payload)
+{
+  uint32_t offset = exportGet32(payload);
+  uint32_t baud = exportGet32(payload + 4);
+
+  if (!exportFile)
+  {
+    if (!startLittleFS() || !(exportFile = LittleFS.open(exportPath, "r")))
+    {
+      abortExport();
+      return;
+    }
+    // Lines appended from now on are left for the next export
+    exportSize = exportFile.size();
+  }
+  // A host holding more than the log has a different log
+  if (offset > exportSize || !exportFile.seek(offset))
+  {
+    abortExport();
+    return;
+  }
+  exportOffset = offset;
+
+  bool switching = baud != 0 && baud != (uint32_t)Serial.baudRate();
+  uint8_t* ready = txFrame + EXPORT_HEADER_SIZE;
+  exportPut32(ready, exportOffset);
+  exportPut32(ready + 4, exportSize);
+  exportPut32(ready + 8, switching ? baud : Serial.baudRate());
+  queueFrame(EXPORT_READY, 12);
+  switchBaud = baud;
+  setState(switching ? EXPORT_SWITCHING : EXPORT_SENDING);
+}
+
+static void queueNextBlock()
+{
+  if (exportOffset >= exportSize)
+  {
+    uint8_t* end = txFrame + EXPORT_HEADER_SIZE;
+    exportPut32(end, exportSize);
+    queueFrame(EXPORT_END, 4);
+    setState(EXPORT_CLOSING);
+    return;
+  }
+  uint8_t* data = txFrame + EXPORT_HEADER_SIZE;
+  size_t length = min((uint32_t)EXPORT_BLOCK_SIZE, exportSize - exportOffset);
+  if (exportFile.read(data + 4, length) != length)
+  {
+    abortExport();
+    return;
+  }
+  exportPut32(data, exportOffset);
+  exportOffset += length;
+  queueFrame(EXPORT_DATA, 4 + length);
+}
+
+void serialExportStart(const char* path)
+{
+  if (exportState != EXPORT_IDLE)
+  {
+    return;
+  }
+  strlcpy(exportPath, path, sizeof(exportPath));
+  baseBaud = Serial.baudRate();
+  txLength = 0;
+  txWritten = 0;
+  exportCount++;
+  setState(EXPORT_WAITING);
+}
+
+bool serialExportActive()
+{
+  return exportState != EXPORT_IDLE;
+}
+
+void serialExportPoll()
+{
+  if (exportState == EXPORT_IDLE || !writeFrame())
+  {
+    return;
+  }
+
+  switch (exportState)
+  {
+  case EXPORT_SWITCHING:
+    Serial.flush();
+    Serial.updateBaudRate(switchBaud);
+    setState(EXPORT_WAITING);
+    return;
+  case EXPORT_CLOSING:
+    endExport();
+    return;
+  case EXPORT_WAITING:
+    if (millis() - stateSince > EXPORT_TIMEOUT)
+    {
+      endExport();
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+
+  // Requests are only taken between frames, the UART buffers them meanwhile
+  while (Serial.available())
+  {
+    if (!rxParser.feed(Serial.read()))
+    {
+      continue;
+    }
+    if (rxParser.type() == EXPORT_ABORT)
+    {
+      endExport();
+      return;
+    }
+    if (rxParser.type() == EXPORT_START && rxParser.length() == 8)
+    {
+      handleStart(rxParser.payload());
+      return;
+    }
+  }
+
+  if (exportState == EXPORT_SENDING)
+  {
+    queueNextBlock();
+    writeFrame();
+  }
+}
+
+void printExportStats(Print& out)
+{
+  out.printf("Serial export: %u exports, %u frames sent, %u requests with a bad CRC\r\n", exportCount, framesSent,
+    rxParser.crcErrors());
+}
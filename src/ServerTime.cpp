@@ -0,0 +1,86 @@
+/**
+ * @file ServerTime.cpp
+ * @author Christoff Linde
+ * @brief HTTP Date header time source implementation
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "ServerTime.h"
+
+static const char* dateHeaders[] = { "Date" };
+static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static ServerTime latest;
+static bool recorded = false;
+
+/**
+ * @brief Get the number of days from 1970-01-01 to a date of the proleptic Gregorian calendar
+ */
+static int32_t daysFromCivil(int32_t year, uint32_t month, uint32_t day)
+{
+  year -= month <= 2;
+  int32_t era = (year >= 0 ? year : year - 399) / 400;
+  uint32_t yearOfEra = year - era * 400;
+  uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + (int32_t)dayOfEra - 719468;
+}
+
+bool parseHttpDate(const char* date, uint32_t& seconds)
+{
+  unsigned int day, year, hour, minute, second;
+  char month[4];
+  if (sscanf(date, "%*3s, %2u %3s %4u %2u:%2u:%2u GMT", &day, month, &year, &hour, &minute, &second) != 6)
+  {
+    return false;
+  }
+  const char* found = strstr(months, month);
+  if (strlen(month) != 3 || found == nullptr || (found - months) % 3 != 0)
+  {
+    return false;
+  }
+  uint32_t monthNumber = (found - months) / 3 + 1;
+  if (year < 1970 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+  {
+    return false;
+  }
+  seconds = (uint32_t)daysFromCivil(year, monthNumber, day) * 86400 + hour * 3600 + minute * 60 + second;
+  return true;
+}
+
+void serverTimeCollect(HTTPClient& http)
+{
+  http.collectHeaders(dateHeaders, 1);
+}
+
+void serverTimeRecord(HTTPClient& http)
+{
+  uint32_t receivedAt = millis();
+  if (!http.hasHeader("Date"))
+  {
+    return;
+  }
+  uint32_t seconds;
+  if (!parseHttpDate(http.header("Date").c_str(), seconds))
+  {
+    return;
+  }
+  latest.seconds = seconds;
+  latest.receivedAt = receivedAt;
+  recorded = true;
+}
+
+bool serverTimePoll(ServerTime& time)
+{
+  if (!recorded)
+  {
+    return false;
+  }
+  time = latest;
+  recorded = false;
+  return true;
+}
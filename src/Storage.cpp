@@ -0,0 +1,323 @@
+/**
+ * @file Storage.cpp
+ * @author Christoff Linde
+ * @brief LittleFS helpers and directory index implementation
+ * @version 0.1
+ * @date 2021-03-22
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <LittleFS.h>
+
+#include "BootProfile.h"
+#include "Storage.h"
+
+/// File holding the cached directory listing, one "name,size" line per file
+static const char* fsIndexPath = "/index.txt";
+
+/// A single file tracked in the directory index
+struct FileEntry
+{
+  char name[FS_NAME_LENGTH];
+  uint32_t size;
+};
+
+static FileEntry fsIndex[FS_INDEX_SIZE];
+static uint8_t fsIndexCount = 0;
+static bool fsMounted = false;
+/// True while the index file lags behind a size change in fsIndex
+static bool fsIndexDirty = false;
+/// millis() of the first size change not written to the index file
+static unsigned long fsIndexDirtySince = 0;
+
+/**
+ * @brief Strip the leading slash from a path, so both spellings map to the same index entry
+ */
+static const char* indexName(const char* path)
+{
+  return path[0] == '/' ? path + 1 : path;
+}
+
+static void saveIndex()
+{
+  File file = LittleFS.open(fsIndexPath, "w");
+  if (!file)
+  {
+    Serial.println("Failed to write directory index");
+    return;
+  }
+  for (uint8_t i = 0; i < fsIndexCount; i++)
+  {
+    file.printf("%s,%u\n", fsIndex[i].name, fsIndex[i].size);
+  }
+  file.close();
+  fsIndexDirty = false;
+}
+
+static void rebuildIndex()
+{
+  fsIndexCount = 0;
+  Dir dir = LittleFS.openDir("/");
+  while (dir.next() && fsIndexCount < FS_INDEX_SIZE)
+  {
+    if (dir.isDirectory() || dir.fileName() == indexName(fsIndexPath))
+    {
+      continue;
+    }
+    FileEntry& entry = fsIndex[fsIndexCount++];
+    strlcpy(entry.name, dir.fileName().c_str(), FS_NAME_LENGTH);
+    entry.size = dir.fileSize();
+  }
+  saveIndex();
+}
+
+static bool loadIndex()
+{
+  File file = LittleFS.open(fsIndexPath, "r");
+  if (!file)
+  {
+    return false;
+  }
+
+  char line[FS_NAME_LENGTH + 12];
+  fsIndexCount = 0;
+  while (file.available() && fsIndexCount < FS_INDEX_SIZE)
+  {
+    size_t len = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[len] = '\0';
+    char* separator = strrchr(line, ',');
+    if (separator == nullptr)
+    {
+      continue;
+    }
+    *separator = '\0';
+    FileEntry& entry = fsIndex[fsIndexCount++];
+    strlcpy(entry.name, line, FS_NAME_LENGTH);
+    entry.size = strtoul(separator + 1, nullptr, 10);
+  }
+  file.close();
+  return true;
+}
+
+static void unindexFile(const char* path)
+{
+  const char* name = indexName(path);
+  for (uint8_t i = 0; i < fsIndexCount; i++)
+  {
+    if (strcmp(fsIndex[i].name, name) == 0)
+    {
+      fsIndex[i] = fsIndex[--fsIndexCount];
+      saveIndex();
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Remove the files left by firmware older than the directory index
+ *
+ * @details Only run while the index file is missing, so once per device rather than at every mount.
+ */
+static void removeLegacyFiles()
+{
+  static const char* const legacyPaths[] = { "/data.json", "/data.ndjson", "/hello.txt" };
+  for (const char* path : legacyPaths)
+  {
+    if (LittleFS.exists(path) && LittleFS.remove(path))
+    {
+      Serial.printf("File at %s deleted\n", path);
+    }
+  }
+}
+
+bool startLittleFS()
+{
+  if (fsMounted)
+  {
+    return true;
+  }
+
+  bootPhaseStart(BOOT_STORAGE);
+  if (!LittleFS.begin())
+  {
+    Serial.printf("LittleFS mount failed\n");
+    bootPhaseEnd(BOOT_STORAGE);
+    return false;
+  }
+  fsMounted = true;
+
+  if (!loadIndex())
+  {
+    Serial.println("Directory index missing, rebuilding");
+    removeLegacyFiles();
+    rebuildIndex();
+  }
+  Serial.println("LittleFS started");
+  bootPhaseEnd(BOOT_STORAGE);
+
+  return true;
+}
+
+const char* formatBytes(size_t bytes, char* buf, size_t len)
+{
+  if (bytes < 1024) { snprintf(buf, len, "%uB", bytes); }
+  else if (bytes < (1024 * 1024)) { snprintf(buf, len, "%.2fKB", bytes / 1024.0); }
+  else if (bytes < (1024 * 1024 * 1024)) { snprintf(buf, len, "%.2fMB", bytes / 1024.0 / 1024.0); }
+  else { strlcpy(buf, "null", len); }
+  return buf;
+}
+
+void listDirectory(Print& out, bool rescan)
+{
+  if (!startLittleFS())
+  {
+    return;
+  }
+  if (rescan)
+  {
+    rebuildIndex();
+  }
+  else
+  {
+    flushIndex();
+  }
+
+  char size[16];
+  for (uint8_t i = 0; i < fsIndexCount; i++)
+  {
+    out.printf("\tFS File: %s, size: %s\r\n", fsIndex[i].name, formatBytes(fsIndex[i].size, size, sizeof(size)));
+  }
+  out.printf("\n");
+}
+
+void indexFile(const char* path, size_t size)
+{
+  const char* name = indexName(path);
+  for (uint8_t i = 0; i < fsIndexCount; i++)
+  {
+    if (strcmp(fsIndex[i].name, name) == 0)
+    {
+      // Appends change the size of a log with every reading, so the index file is written later
+      if (fsIndex[i].size != size && !fsIndexDirty)
+      {
+        fsIndexDirty = true;
+        fsIndexDirtySince = millis();
+      }
+      fsIndex[i].size = size;
+      return;
+    }
+  }
+
+  if (fsIndexCount < FS_INDEX_SIZE)
+  {
+    FileEntry& entry = fsIndex[fsIndexCount++];
+    strlcpy(entry.name, name, FS_NAME_LENGTH);
+    entry.size = size;
+    saveIndex();
+  }
+}
+
+void flushIndex()
+{
+  if (fsIndexDirty)
+  {
+    saveIndex();
+  }
+}
+
+void indexPoll(unsigned long now)
+{
+  if (fsIndexDirty && now - fsIndexDirtySince >= FS_INDEX_FLUSH_INTERVAL)
+  {
+    saveIndex();
+  }
+}
+
+void readFile(const char* path)
+{
+  if (!startLittleFS())
+  {
+    return;
+  }
+
+  File file = LittleFS.open(path, "r");
+  if (!file)
+  {
+    Serial.printf("Failed to open file %s for reading", path);
+    return;
+  };
+
+  uint8_t buf[256];
+  size_t len;
+  while ((len = file.read(buf, sizeof(buf))) > 0)
+  {
+    Serial.write(buf, len);
+  }
+
+  file.close();
+}
+
+size_t dumpLines(const char* path, Print& out, size_t first, size_t count)
+{
+  if (!startLittleFS())
+  {
+    return 0;
+  }
+
+  File file = LittleFS.open(path, "r");
+  if (!file)
+  {
+    out.printf("Failed to open file %s for reading\r\n", path);
+    return 0;
+  }
+
+  uint8_t buf[256];
+  size_t line = 0;
+  size_t len;
+  while (line < first + count && (len = file.read(buf, sizeof(buf))) > 0)
+  {
+    size_t start = 0;
+    for (size_t i = 0; i < len && line < first + count; i++)
+    {
+      if (buf[i] != '\n')
+      {
+        continue;
+      }
+      if (line >= first)
+      {
+        out.write(buf + start, i + 1 - start);
+      }
+      line++;
+      start = i + 1;
+    }
+    // The start of a line that continues in the next block
+    if (line >= first && line < first + count && start < len)
+    {
+      out.write(buf + start, len - start);
+    }
+  }
+
+  file.close();
+  return line > first ? line - first : 0;
+}
+
+void deleteFile(const char* path)
+{
+  if (!startLittleFS())
+  {
+    return;
+  }
+
+  if (LittleFS.remove(path))
+  {
+    unindexFile(path);
+    Serial.printf("File at %s deleted", path);
+    Serial.printf("\n\r");
+  }
+  else
+  {
+    Serial.println("File delete failed");
+  }
+}
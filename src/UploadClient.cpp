@@ -0,0 +1,129 @@
+/**
+ * @file UploadClient.cpp
+ * @author Christoff Linde
+ * @brief Upload connection implementation
+ * @version 0.1
+ * @date 2021-03-28
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "CpuBoost.h"
+#include "UploadClient.h"
+
+#ifdef UPLOAD_TLS
+#include <WiFiClientSecureBearSSL.h>
+#endif
+
+/// Cost of a single connection
+struct ConnectTiming
+{
+  uint32_t millis;
+  uint32_t heapUsed;
+};
+
+static uint32_t uploadConnects = 0;
+static ConnectTiming firstConnect;
+static ConnectTiming lastConnect;
+
+#ifdef UPLOAD_TLS
+static BearSSL::WiFiClientSecure uploadTLSClient;
+/// Kept across uploads so the next handshake can be resumed
+static BearSSL::Session uploadSession;
+#ifdef UPLOAD_TLS_PUBKEY
+static BearSSL::PublicKey uploadKey(UPLOAD_TLS_PUBKEY);
+#endif
+static bool uploadTLSConfigured = false;
+static bool uploadMFLN = false;
+
+static void configureTLS()
+{
+#ifdef UPLOAD_TLS_PUBKEY
+  uploadTLSClient.setKnownKey(&uploadKey);
+#else
+  uploadTLSClient.setFingerprint(UPLOAD_TLS_FINGERPRINT);
+#endif
+  uploadTLSClient.setSession(&uploadSession);
+
+  // The probe costs a partial handshake, so it is done once per boot
+  uploadMFLN = BearSSL::WiFiClientSecure::probeMaxFragmentLength(UPLOAD_HOST, UPLOAD_PORT, UPLOAD_TLS_BUFFER_SIZE);
+  if (uploadMFLN)
+  {
+    uploadTLSClient.setBufferSizes(UPLOAD_TLS_BUFFER_SIZE, UPLOAD_TLS_BUFFER_SIZE);
+  }
+  uploadTLSConfigured = true;
+}
+#endif
+static WiFiClient uploadPlainClient;
+
+WiFiClient* uploadConnect(const char* host, uint16_t port, bool secure)
+{
+  WiFiClient* client = &uploadPlainClient;
+#ifdef UPLOAD_TLS
+  if (secure)
+  {
+    if (!uploadTLSConfigured)
+    {
+      configureTLS();
+    }
+    client = &uploadTLSClient;
+  }
+#else
+  if (secure)
+  {
+    Serial.printf("HTTPS to %s needs UPLOAD_TLS\n", host);
+    return nullptr;
+  }
+#endif
+
+  uint32_t heapBefore = ESP.getFreeHeap();
+  unsigned long start = millis();
+  // The handshake is compute bound, a plain connect only waits for the network
+  if (secure)
+  {
+    cpuBoostStart(CPU_TLS);
+  }
+  bool connected = client->connect(host, port);
+  if (secure)
+  {
+    cpuBoostEnd(CPU_TLS);
+  }
+  if (!connected)
+  {
+    Serial.printf("Connection to %s:%u failed\n", host, port);
+    return nullptr;
+  }
+
+  lastConnect.millis = millis() - start;
+  uint32_t heapAfter = ESP.getFreeHeap();
+  lastConnect.heapUsed = heapBefore > heapAfter ? heapBefore - heapAfter : 0;
+  if (uploadConnects++ == 0)
+  {
+    firstConnect = lastConnect;
+  }
+
+#ifdef UPLOAD_TLS
+  if (secure)
+  {
+    Serial.printf("TLS handshake: %u ms, %u bytes heap\n", lastConnect.millis, lastConnect.heapUsed);
+  }
+#endif
+  return client;
+}
+
+void printUploadStats(Print& out)
+{
+  out.printf("Upload connections: %u\r\n", uploadConnects);
+  if (uploadConnects == 0)
+  {
+    return;
+  }
+#ifdef UPLOAD_TLS
+  out.printf("\tfirst handshake: %u ms, %u bytes heap\r\n", firstConnect.millis, firstConnect.heapUsed);
+  out.printf("\tlast handshake:  %u ms, %u bytes heap\r\n", lastConnect.millis, lastConnect.heapUsed);
+  out.printf("\trecord buffers:  %s\r\n", uploadMFLN ? "reduced" : "full size");
+#else
+  out.printf("\tlast connect: %u ms\r\n", lastConnect.millis);
+#endif
+}
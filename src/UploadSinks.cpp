@@ -0,0 +1,514 @@
+/**
+ * @file UploadSinks.cpp
+ * @author Christoff Linde
+ * @brief Upload fan-out implementation
+ * @version 0.1
+ * @date 2021-04-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifdef UPLOAD_ARDUINOJSON
+#include <ArduinoJson.h>
+#endif
+#include <ESP8266HTTPClient.h>
+#include <LittleFS.h>
+#include <StreamString.h>
+
+#include "CpuBoost.h"
+#include "Ota.h"
+#include "PayloadSigner.h"
+#include "Sampler.h"
+#include "ServerTime.h"
+#include "Storage.h"
+#include "UploadClient.h"
+#include "UploadSinks.h"
+
+#ifdef ANALYTICS_HOST
+#ifndef ANALYTICS_PORT
+#define ANALYTICS_PORT 80
+#endif
+#ifndef ANALYTICS_PATH
+#define ANALYTICS_PATH "/ingest"
+#endif
+#ifndef ANALYTICS_INTERVAL
+#define ANALYTICS_INTERVAL 900000UL
+#endif
+#endif
+
+/// The configured sinks. The .NET API is always present, further sinks are enabled with build flags
+static const UploadSink sinks[] = {
+  { "api", UPLOAD_HOST, UPLOAD_PORT, UPLOAD_PATH, UPLOAD_HTTPS, SinkFormat::Envelope, 3600000UL, 3600000UL },
+#ifdef ANALYTICS_HOST
+  { "analytics", ANALYTICS_HOST, ANALYTICS_PORT, ANALYTICS_PATH, false, SinkFormat::Csv, ANALYTICS_INTERVAL, 3600000UL },
+#endif
+};
+
+#define SINK_COUNT (sizeof(sinks) / sizeof(sinks[0]))
+
+/// File holding the sequence number of the next reading, from before sinks had their own cursors
+static const char* legacySeqPath = "/seq.txt";
+
+/// Cursor and schedule of a sink
+struct SinkState
+{
+  /// Offset in the log of the first reading not uploaded yet
+  uint32_t offset;
+  /// Sequence number of that reading
+  uint32_t seq;
+  unsigned long nextAttempt;
+  unsigned long retryDelay;
+  /// Readings logged since the last upload, as far as known since boot
+  uint32_t backlog;
+  uint32_t uploads;
+  uint32_t failures;
+  int lastCode;
+};
+
+static SinkState sinkStates[SINK_COUNT];
+static bool sinksScheduled = false;
+static bool cursorsLoaded = false;
+
+static void scheduleSinks()
+{
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    sinkStates[i].nextAttempt = sinks[i].interval;
+    sinkStates[i].retryDelay = UPLOAD_RETRY_MIN;
+  }
+  sinksScheduled = true;
+}
+
+static void cursorPath(const UploadSink& sink, char* path, size_t len)
+{
+  snprintf(path, len, "/c_%s.txt", sink.name);
+}
+
+static void loadCursors()
+{
+  uint32_t legacySeq = 0;
+  File file = LittleFS.open(legacySeqPath, "r");
+  if (file)
+  {
+    legacySeq = file.parseInt();
+    file.close();
+  }
+
+  char path[FS_NAME_LENGTH];
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    cursorPath(sinks[i], path, sizeof(path));
+    file = LittleFS.open(path, "r");
+    if (file)
+    {
+      sinkStates[i].offset = file.parseInt();
+      sinkStates[i].seq = file.parseInt();
+      file.close();
+    }
+    else
+    {
+      sinkStates[i].offset = 0;
+      sinkStates[i].seq = legacySeq;
+    }
+  }
+  cursorsLoaded = true;
+}
+
+static void saveCursor(size_t i)
+{
+  char path[FS_NAME_LENGTH];
+  cursorPath(sinks[i], path, sizeof(path));
+  File file = LittleFS.open(path, "w");
+  if (!file)
+  {
+    Serial.printf("Failed to write cursor of %s\n", sinks[i].name);
+    return;
+  }
+  file.printf("%u %u\n", sinkStates[i].offset, sinkStates[i].seq);
+  indexFile(path, file.size());
+  file.close();
+}
+
+/**
+ * @brief Read up to UPLOAD_BATCH_SIZE readings from the log, starting at the given offset
+ *
+ * @return size_t - the number of readings read. end is set to the offset after the last line read
+ */
+static size_t readBatch(File& log, uint32_t start, LogRecord* records, uint32_t& end)
+{
+  end = start;
+  if (!log.seek(start))
+  {
+    return 0;
+  }
+
+  char line[LOG_LINE_SIZE];
+  size_t count = 0;
+  while (count < UPLOAD_BATCH_SIZE && log.available())
+  {
+    uint32_t offset = log.position();
+    size_t len = log.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[len] = '\0';
+    if (parseLogLine(line, records[count]))
+    {
+      records[count].offset = offset;
+      count++;
+    }
+  }
+  end = log.position();
+  return count;
+}
+
+#ifdef UPLOAD_ARDUINOJSON
+/// The envelope built as an ArduinoJson document, kept to compare against the generated writer
+static void writeEnvelopeDocument(const char* deviceId, const LogRecord* records, size_t count, uint32_t firstSeq,
+  const SamplerTelemetry* sampler, Print& out)
+{
+  StaticJsonDocument<2048> doc;
+
+  doc["device"] = deviceId;
+  doc["firmware"] = FIRMWARE_VERSION;
+  doc["encoding"] = UPLOAD_ENCODING;
+  doc.createNestedArray("sensors").add(SENSOR_ID);
+  JsonArray seq = doc.createNestedArray("seq");
+  if (count > 0)
+  {
+    seq.add(firstSeq);
+    seq.add(firstSeq + count - 1);
+  }
+
+  JsonArray readings = doc.createNestedArray("readings");
+  for (size_t i = 0; i < count; i++)
+  {
+    JsonObject readingObject = readings.createNestedObject();
+    readingObject["timestamp"] = records[i].timestamp;
+    readingObject["humidity"] = records[i].humidity / 100.0f;
+    readingObject["temperature"] = records[i].temperature / 100.0f;
+    if (records[i].node != 0)
+    {
+      // A char array is copied into the document
+      char node[9];
+      snprintf(node, sizeof(node), "%x", records[i].node);
+      readingObject["node"] = node;
+    }
+  }
+
+  if (sampler != nullptr)
+  {
+    JsonObject sampling = doc.createNestedObject("sampling");
+    sampling["jitter_max_us"] = sampler->jitterMaxUs;
+    JsonArray jitter = sampling.createNestedArray("jitter");
+    for (size_t i = 0; i < SAMPLER_JITTER_BUCKETS; i++)
+    {
+      jitter.add(sampler->jitter[i]);
+    }
+    sampling["lost"] = sampler->lost;
+  }
+
+  serializeJson(doc, out);
+}
+#endif
+
+static void writeBody(const UploadSink& sink, const char* deviceId, const LogRecord* records, size_t count,
+  uint32_t firstSeq, Print& out)
+{
+  SamplerTelemetry telemetry;
+  const SamplerTelemetry* sampler = nullptr;
+  switch (sink.format)
+  {
+  case SinkFormat::Envelope:
+    if (samplerRunning())
+    {
+      samplerTelemetry(telemetry);
+      sampler = &telemetry;
+    }
+#ifdef UPLOAD_ARDUINOJSON
+    writeEnvelopeDocument(deviceId, records, count, firstSeq, sampler, out);
+#else
+    writeEnvelope(out, deviceId, FIRMWARE_VERSION, records, count, firstSeq, sampler);
+#endif
+    break;
+  case SinkFormat::Csv:
+    writeCsvBatch(out, records, count, firstSeq);
+    break;
+  }
+}
+
+int sendData(const UploadSink& sink, const LogRecord* records, size_t count, uint32_t firstSeq)
+{
+#ifdef UPLOAD_HMAC_KEY
+  uint32_t counter;
+  if (!nextUploadCounter(counter))
+  {
+    return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+  }
+#endif
+  HTTPClient http;
+
+  WiFiClient* client = uploadConnect(sink.host, sink.port, sink.https);
+  if (client == nullptr)
+  {
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  http.begin(*client, sink.host, sink.port, sink.path, sink.https);
+  serverTimeCollect(http);
+  char deviceId[9];
+  snprintf(deviceId, sizeof(deviceId), "%x", ESP.getChipId());
+  if (sink.format == SinkFormat::Csv)
+  {
+    http.addHeader("Content-Type", "text/csv");
+    http.addHeader("X-Device", deviceId);
+  }
+  else
+  {
+    http.addHeader("Content-Type", "application/json");
+  }
+
+  StreamString body;
+  cpuBoostStart(CPU_ENCODE);
+#ifdef UPLOAD_HMAC_KEY
+  PayloadSigner signer(body, counter);
+  writeBody(sink, deviceId, records, count, firstSeq, signer);
+
+  char signature[SIGNATURE_HEX_LENGTH + 1];
+  signer.signature(signature);
+#else
+  writeBody(sink, deviceId, records, count, firstSeq, body);
+#endif
+  cpuBoostEnd(CPU_ENCODE);
+#ifdef UPLOAD_HMAC_KEY
+  http.addHeader("X-Device-Counter", String(counter));
+  http.addHeader("X-Signature", signature);
+#endif
+
+  int responseCode = http.POST(body);
+  if (responseCode > 0)
+  {
+    serverTimeRecord(http);
+  }
+
+  http.end();
+
+  return responseCode;
+}
+
+void uploadLogged(unsigned long now)
+{
+  if (!sinksScheduled)
+  {
+    scheduleSinks();
+  }
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    SinkState& state = sinkStates[i];
+    state.backlog++;
+    if (state.backlog >= UPLOAD_BATCH_SIZE && state.retryDelay == UPLOAD_RETRY_MIN)
+    {
+      state.nextAttempt = now;
+    }
+  }
+}
+
+void uploadForce(unsigned long now)
+{
+  if (!sinksScheduled)
+  {
+    scheduleSinks();
+  }
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    sinkStates[i].nextAttempt = now;
+  }
+}
+
+bool uploadDue(unsigned long now)
+{
+  if (!sinksScheduled)
+  {
+    scheduleSinks();
+  }
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    if ((long)(now - sinkStates[i].nextAttempt) >= 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned long uploadIdleTime(unsigned long now)
+{
+  if (!sinksScheduled)
+  {
+    scheduleSinks();
+  }
+  unsigned long idle = ULONG_MAX;
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    long wait = (long)(sinkStates[i].nextAttempt - now);
+    if (wait <= 0)
+    {
+      return 0;
+    }
+    idle = min(idle, (unsigned long)wait);
+  }
+  return idle;
+}
+
+/**
+ * @brief Upload the readings of a batch from the sink's cursor on, and move the cursor past the batch
+ */
+static void serveSink(size_t i, const LogRecord* records, size_t count, uint32_t end, uint32_t logSize,
+  unsigned long now)
+{
+  const UploadSink& sink = sinks[i];
+  SinkState& state = sinkStates[i];
+
+  size_t first = 0;
+  while (first < count && records[first].offset < state.offset)
+  {
+    first++;
+  }
+
+  if (first < count)
+  {
+    Serial.printf("Sending %u readings to %s\n", count - first, sink.name);
+    int responseCode = sendData(sink, records + first, count - first, state.seq);
+    state.lastCode = responseCode;
+    if (responseCode < 200 || responseCode >= 300)
+    {
+      if (responseCode > 0)
+      {
+        Serial.printf("HTTP Response code: %i\n", responseCode);
+      }
+      else
+      {
+        Serial.printf("HTTP Error: %i\n", responseCode);
+      }
+      state.failures++;
+      state.nextAttempt = now + state.retryDelay;
+      state.retryDelay = min(state.retryDelay * 2, sink.retryMax);
+      return;
+    }
+    Serial.printf("HTTP Response code: %i\n", responseCode);
+    state.uploads++;
+    state.backlog -= min<uint32_t>(state.backlog, count - first);
+    otaConfirm();
+  }
+
+  state.offset = end;
+  state.seq += count - first;
+  state.retryDelay = UPLOAD_RETRY_MIN;
+  // A sink with a backlog is due again right away
+  state.nextAttempt = end < logSize ? now : now + sink.interval;
+  saveCursor(i);
+}
+
+void uploadRun(unsigned long now)
+{
+  if (!sinksScheduled)
+  {
+    scheduleSinks();
+  }
+  if (!startLittleFS())
+  {
+    return;
+  }
+  if (!cursorsLoaded)
+  {
+    loadCursors();
+  }
+
+  File log = LittleFS.open(UPLOAD_LOG_PATH, "r");
+  uint32_t logSize = log ? log.size() : 0;
+
+  bool pending[SINK_COUNT];
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    SinkState& state = sinkStates[i];
+    if (state.offset > logSize)
+    {
+      // The log was removed behind our back, start over at its beginning
+      state.offset = 0;
+    }
+    pending[i] = (long)(now - state.nextAttempt) >= 0;
+    if (pending[i] && state.offset == logSize)
+    {
+      // Caught up, nothing to send
+      pending[i] = false;
+      state.nextAttempt = now + sinks[i].interval;
+    }
+  }
+
+  LogRecord records[UPLOAD_BATCH_SIZE];
+  while (true)
+  {
+    // Read the batch at the lowest due cursor, and serve every due sink within it
+    size_t lowest = SINK_COUNT;
+    for (size_t i = 0; i < SINK_COUNT; i++)
+    {
+      if (pending[i] && (lowest == SINK_COUNT || sinkStates[i].offset < sinkStates[lowest].offset))
+      {
+        lowest = i;
+      }
+    }
+    if (lowest == SINK_COUNT)
+    {
+      break;
+    }
+
+    uint32_t end;
+    size_t count = readBatch(log, sinkStates[lowest].offset, records, end);
+    if (end <= sinkStates[lowest].offset)
+    {
+      Serial.println("Failed to read the reading log");
+      break;
+    }
+    for (size_t i = 0; i < SINK_COUNT; i++)
+    {
+      if (pending[i] && sinkStates[i].offset < end)
+      {
+        pending[i] = false;
+        serveSink(i, records, count, end, logSize, now);
+      }
+    }
+  }
+  if (log)
+  {
+    log.close();
+  }
+
+  // Compact once every sink has all of the log
+  if (logSize == 0)
+  {
+    return;
+  }
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    if (sinkStates[i].offset < logSize)
+    {
+      return;
+    }
+  }
+  deleteFile(UPLOAD_LOG_PATH);
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    sinkStates[i].offset = 0;
+    saveCursor(i);
+  }
+}
+
+void printSinkStats(Print& out)
+{
+  unsigned long now = millis();
+  for (size_t i = 0; i < SINK_COUNT; i++)
+  {
+    const SinkState& state = sinkStates[i];
+    long due = (long)(state.nextAttempt - now);
+    out.printf("Sink %s: cursor %u (seq %u), %u uploads, %u failures, last HTTP %i, due in %li s\r\n",
+      sinks[i].name, state.offset, state.seq, state.uploads, state.failures, state.lastCode,
+      due > 0 ? due / 1000 : 0);
+  }
+}
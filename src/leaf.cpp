@@ -0,0 +1,173 @@
+/**
+ * @file leaf.cpp
+ * @author Christoff Linde
+ * @brief Leaf node program, sending DHT-22 readings to a gateway over ESP-NOW
+ * @version 0.1
+ * @date 2021-04-02
+ *
+ * A leaf never associates with an Access Point and stores nothing. Readings are sent to the gateway as
+ * they are taken, with their age and, once the leaf has time, their timestamp. The leaf keeps time from
+ * the beacon the gateway answers every reading with, @see EspNowLink.h. The gateway timestamps only
+ * the readings sent before the first beacon arrived, from their age, and logs and uploads them all.
+ *
+ * Until a beacon arrives, readings are kept in RAM and sent again, oldest first, with their real age
+ * at the next reading, so a gateway still waiting for NTP does not lose them. A reading whose beacon
+ * alone was lost is sent twice. Between readings the leaf idles in delay(), which lets the SDK put
+ * the modem to sleep; deep sleep would lose the time and the readings kept.
+ *
+ * Built instead of main.cpp by the d1_mini_leaf environment.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#include "DHT22.h"
+#include "EspNowLink.h"
+
+/// Physical pin on ESP that maps to GPIO-05
+uint8_t DHTPIN = D1;
+
+/// DHT22 driver on the DHTPIN parameter
+DHT22 dht(DHTPIN);
+
+/// Read sensors every 15 min
+const unsigned long intervalTemp = 900000;
+unsigned long prevReading = 0;
+/// The first reading is taken once the sensor has settled
+bool dataRequested = true;
+/// Delay to cater for slow 2000ms polling rate of DHT22 sensor
+const unsigned long DS_delay = 2000;
+
+/// Readings kept until the gateway answers them, about two hours at 15 minutes
+#define LEAF_PENDING 8
+/// Time to wait for the beacon answering a reading, longer than the gateway idles its loop
+#define LEAF_ANSWER_TIMEOUT 1500
+
+/// A reading not yet answered, with the millis() it was taken at
+struct PendingReading
+{
+  DHT22Reading reading;
+  unsigned long takenAt;
+};
+
+/// Ring of the readings not yet answered, oldest first
+static PendingReading pending[LEAF_PENDING];
+static uint8_t pendingHead = 0;
+static uint8_t pendingCount = 0;
+
+/**
+ * @brief Run at every startup
+ *
+ * @details Starts the sensor and the ESP-NOW link. The radio is kept in station mode without
+ * associating, which is all ESP-NOW needs.
+ */
+void setup()
+{
+  Serial.begin(115200);
+  delay(10);
+  Serial.println("\r\n");
+
+  dht.begin();
+
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  linkBeginLeaf();
+}
+
+/**
+ * @brief Keep a reading until the gateway answers it, dropping the oldest when full
+ *
+ * @param reading The reading
+ * @param takenAt The millis() it was taken at
+ */
+static void keepReading(const DHT22Reading& reading, unsigned long takenAt)
+{
+  if (pendingCount == LEAF_PENDING)
+  {
+    Serial.println("Unanswered reading dropped");
+    pendingHead = (pendingHead + 1) % LEAF_PENDING;
+    pendingCount--;
+  }
+  pending[(pendingHead + pendingCount) % LEAF_PENDING] = { reading, takenAt };
+  pendingCount++;
+}
+
+/**
+ * @brief Send the readings kept, oldest first, until one is not answered
+ */
+static void sendPending()
+{
+  while (pendingCount > 0)
+  {
+    const PendingReading& next = pending[pendingHead];
+    if (!linkSendReading(next.reading, millis() - next.takenAt))
+    {
+      Serial.println("Sending reading to gateway failed");
+      return;
+    }
+    unsigned long sentAt = millis();
+    while (!linkAnswered() && millis() - sentAt < LEAF_ANSWER_TIMEOUT)
+    {
+      delay(1);
+    }
+    if (!linkAnswered())
+    {
+      return;
+    }
+    pendingHead = (pendingHead + 1) % LEAF_PENDING;
+    pendingCount--;
+  }
+}
+
+/**
+ * @brief Take a reading and send it, or keep it until the gateway has time
+ */
+static void takeReading()
+{
+  unsigned long takenAt = millis();
+  DHT22Reading reading;
+  DHT22Status status = dht.read(reading);
+  if (status != DHT22Status::Ok)
+  {
+    Serial.printf("DHT22 read failed: %s\n", dht22StatusName(status));
+    return;
+  }
+  uint32_t time;
+  if (!linkCurrentTime(time) || pendingCount > 0)
+  {
+    keepReading(reading, takenAt);
+    sendPending();
+  }
+  else if (!linkSendReading(reading, millis() - takenAt))
+  {
+    Serial.println("Sending reading to gateway failed");
+  }
+}
+
+void loop()
+{
+  unsigned long loopStart = millis();
+
+  if (loopStart - prevReading >= intervalTemp)
+  {
+    dataRequested = true;
+    prevReading = loopStart;
+  }
+  if (dataRequested && loopStart - prevReading >= DS_delay)
+  {
+    dataRequested = false;
+    takeReading();
+  }
+
+  // Idle until the sensor has settled or the next reading is due
+  unsigned long due = prevReading + (dataRequested ? DS_delay : intervalTemp);
+  unsigned long now = millis();
+  if ((long)(due - now) > 0)
+  {
+    delay(due - now);
+  }
+}
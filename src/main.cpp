@@ -13,143 +13,188 @@
  */
 
 #include <Arduino.h>
-#include <ArduinoJson.h>
-#include <DHT.h>
 #include <ESP8266WiFi.h>
 #include <ESP8266WiFiMulti.h>
-#include <ESP8266HTTPClient.h>
-#include <LittleFS.h>
 #include <WiFiClient.h>
-#include <WiFiUdp.h>
+
+#include "BootProfile.h"
+#include "Console.h"
+#include "CpuBoost.h"
+#include "DHT22.h"
+#include "EspNowLink.h"
+#include "NodeQueue.h"
+#include "NtpClient.h"
+#include "Ota.h"
+#include "ReadingPipeline.h"
+#include "Sampler.h"
+#include "SerialExport.h"
+#include "ServerTime.h"
+#include "Storage.h"
+#include "UploadClient.h"
+#include "UploadSinks.h"
 
  // Forward declarations
  /**
   * @brief Initialise WiFiMulti and start a WiFi Access Point.
   *
-  * @details This method intialises multiple Access Points. The most suitable one is then connected to.
-  * On successful connection, the IP Address assigned to the device is displayed
+  * @details This method intialises multiple Access Points and starts reconnecting to the Access Point
+  * stored by the SDK, without waiting for the association to complete. The connection is finished
+  * in the background by @see updateNetwork.
   */
 void startWiFi();
 
 /**
- * @brief Start listening for UDP messages
+ * @brief Advance the network bring-up
  *
- * @details This method initialises the WiFiUDP UDP object. On initialization, the UDP listens on port 123
- * by default. The local port is also printed to Serial console.
+ * @details This method is called from every loop() iteration until the network is ready. Once the
+ * device is associated, the IP Address is displayed, the NTP client is started, the time server is resolved
+ * and the first NTP request is sent. If the stored Access Point does not connect within
+ * WIFI_FAST_CONNECT_TIMEOUT, WiFiMulti scans for the most suitable one instead.
  */
-void startUDP();
-
-/**
- * @brief Start the LittleFS file system
- *
- * @details This method starts the file system for the device. After successfully starting, the contents
- * of the root directory is listed to Serial console.
- * 
- * @see LittleFS
- * @see listDirectory
- */
-void startLittleFS();
+void updateNetwork();
 
 /**
  * @brief Start the DHT sensor
  *
- * @details This method initialises the DHT object with the default global parameters.
+ * @details This method initialises the DHT22 driver on DHTPIN.
  */
 void startSensors();
 
 /**
- * @brief Convert sizes in bytes to KB and MB
+ * @brief Take the time from the NTP replies that arrived
  *
- * @details This helper method converts the passed in data to a more human readable format i.e. into KB and MB
+ * @details Replies are received in the background, @see NtpClient.h. This method sets timeUNIX and
+ * lastNTPResponse from the latest one, such that timeUNIX was the UNIX time at millis() lastNTPResponse.
  *
- * @see startLittleFS
- * 
- * @param bytes size_t size to be formated
- * @returns String - the formated string
+ * @returns bool - true if a reply was taken
  */
-String formatBytes(size_t bytes);
+bool updateTime();
 
 /**
- * @brief Get the UNIX time
+ * @brief Take the time from the Date header of the latest HTTP response
  *
- * @details This method checks if the time server has responded. If so,
- *  \li get the UNIX time
- *  otherwise
- *  \li return 0
+ * @details The header is only precise to the second, @see ServerTime.h, so it is a fallback for NTP:
+ *  \li while the time is unknown, it sets the time
+ *  \li while NTP has not answered for NTP_STALE_AFTER, a quarter of the difference of more than a
+ *  second is taken over, so a single wrong header cannot step the clock
+ *  \li otherwise it only confirms the clock is kept
  *
- * @returns unsigned long - UNIX time or 0
+ * Every sample taken while NTP is stale moves the anchor of timeUNIX up to it, so timeAt() keeps
+ * working on a device that goes without NTP for weeks.
+ *
+ * @returns bool - true if the time was set or adjusted
  */
-unsigned long getTime();
+bool updateServerTime();
 
 /**
  * @brief Send NTP packet to IPAddress
- * 
- * @details This method sends a NTP request to the given IPAddress. 
- * All bytes in the packetBuffer are set to 0, with the size determined by NTP_PACKET_SIZE.
- * 
- * A packet is then sent to the WiFiUDP object to the specified port.
- * 
- * @param address IPAddress of the UDP server
+ *
+ * @param address IPAddress of the NTP server
  */
 void sendNTPpacket(IPAddress& address);
 
 /**
- * @brief List contents of directory
- * 
- * @details This method steps recursively through all directories in the specified filepath,
- * and prints each file by name and size.
- * 
- * @param path the relative path to be listed
+ * @brief Set up the commands of the Serial console
+ *
+ * @details Supported commands, @see help on the console:
+ *  \li status - firmware, uptime, network and time
+ *  \li stats - upload, sink, pipeline, sampling, CPU, NTP, idle and export statistics
+ *  \li ls [-r] - list the files in the directory index, rescanning the file system first with -r
+ *  \li dump [first] [count] - print lines of the upload log
+ *  \li set [name value] - list the intervals, or set one in seconds until the next reboot
+ *  \li upload - make every upload sink due
+ *  \li ntp - send an NTP request
+ *  \li export - export the upload log in frames, @see SerialExport.h
  */
-void listDirectory(const char* path);
+void startConsole();
 
 /**
- * @brief Read contents of the specified file
- * 
- * @details This method reads all contents of the file at the specified filepath. If the file
- * does not exist,
- *  \li the file will not be created automatically.
- * If the file exists,
- * \li all contents will be printed to the Serial console.
- * 
- * @param path the relative filepath to the requested file
+ * @brief Handle console input received on Serial
+ *
+ * @details This method takes the input available without blocking, @see Console.h. While an export
+ * runs, Serial input belongs to the export.
  */
-void readFile(const char* path);
+void handleConsoleInput();
 
 /**
- * @brief Delete the specified file
- * 
- * @details This method deletes the file at the given filepath. If the file does not exist, the
- * delete will fail and a error message will accordingly be printed to the console.
- * 
- * @param path the relative filepath to the requested file
+ * @brief Get the current UNIX time
+ *
+ * @details This method adds the time elapsed since the last NTP response to the UNIX time it returned.
+ *
+ * @returns uint32_t - UNIX time, only valid once timeUNIX is set
  */
-void deleteFile(const char* path);
+uint32_t currentTime();
 
 /**
- * @brief Send data readings to API
- * 
- * @details This method initialises a HTTPClient and API endpoint. The data file storing the 
- * data readings will be opened and processed line by line with @see readStringUntil. This occur 
- * three times for each line of data. 
- * 
- * Read data is stored in a String buffer. For each endline delimitted line of the data file, a JsonObject
- * is created with the necessary data. The created object is then serialized and appended to a StaticJsonDocument
- * declared at the start of the loop.
- * 
- * After processing all lines of data, the data file is flushed and cleared.
- * 
- * An HTTP.POST request is made to the API endpoint with the serialized json data in the request body. The HTTP 
- * response code is returned
- * 
- * @return int - the HTTP response code
+ * @brief Get the UNIX time at a given millis()
+ *
+ * @param ms a millis() value, before or after the last NTP response
+ * @returns uint32_t - UNIX time, only valid once timeUNIX is set
+ */
+uint32_t timeAt(unsigned long ms);
+
+/**
+ * @brief Get the UNIX time at a given millis(), to the millisecond
+ *
+ * @details lastNTPResponse may lie ahead of ms, after the clock was slowed down, so the time since it
+ * is signed, and rounded down to the second.
+ *
+ * @param ms a millis() value, before or after the last NTP response
+ * @param millisecond set to the milliseconds into the second returned
+ * @returns uint32_t - UNIX time, only valid once timeUNIX is set
+ */
+uint32_t timeAt(unsigned long ms, uint16_t& millisecond);
+
+/**
+ * @brief Idle until the next task of the loop is due
+ *
+ * @details The loop idles in delay(), where the SDK puts the CPU and the radio into light sleep when
+ * WIFI_LIGHT_SLEEP is set. Timers, such as the sampler's, still run. The time idled is accounted for
+ * @see printIdleStats.
+ *
+ * @param now the millis() the loop iteration started at
+ */
+void idleUntilDue(unsigned long now);
+
+/**
+ * @brief Print the share of time the loop spent idle since boot
+ *
+ * @param out the Print to write the statistics to
  */
-int sendData();
+void printIdleStats(Print& out);
+
+#ifdef NODE_ROLE_GATEWAY
+/**
+ * @brief Append a reading relayed for a leaf node to the data file
+ *
+ * @details Handler for @see nodeQueueDrain, converting the reading from tenths for relayPipeline.
+ *
+ * @param node chip id of the leaf
+ * @param reading the relayed reading
+ */
+void logQueuedReading(uint32_t node, const QueuedReading& reading);
+#endif
 
 #define ONE_HOUR 3600000UL
 
-/// DHTTYPE variable specifying the sensor type
-#define DHTTYPE DHT22
+/// Time allowed for reconnecting to the stored Access Point before falling back to a scan
+#define WIFI_FAST_CONNECT_TIMEOUT 5000UL
+
+/// Longest the loop idles at once, so console commands are still picked up
+#define LOOP_MAX_IDLE 1000UL
+
+/// Time without an NTP reply after which the Date header of HTTP responses adjusts the clock
+#define NTP_STALE_AFTER (2 * ONE_HOUR + 60000UL)
+
+/// Time without an NTP reply after boot, after which the firmware check is brought forward so its
+/// response tells the time
+#define NTP_FALLBACK_DELAY 30000UL
+
+/// Share of the difference to a Date header taken over, as a divisor
+#define SERVER_TIME_WEIGHT 4
+
+/// Number of relayed readings added to each upload batch, shared round-robin between the leaf nodes
+#define NODE_BATCH_SIZE 24
 
 /// Physical pin on ESP that maps to GPIO-05
 uint8_t DHTPIN = D1;
@@ -157,28 +202,29 @@ uint8_t DHTPIN = D1;
 /**
  * @brief Initialise DHT config
  * 
- * @details Instantiate a DHT object with the DHTPIN and DHTTYPE parameters
- * 
- * @return DHT instantiated DHT object
+ * @details Instantiate a DHT22 driver on the DHTPIN parameter
  */
-DHT dht(DHTPIN, DHTTYPE);
+DHT22 dht(DHTPIN);
 
 /// Create an instance of the ESP8266WiFiMulti class, called 'wifiMulti'
 ESP8266WiFiMulti wifiMulti;
 
-/// Create an instance of the WiFiUDP class to send and receive UDP messages
-WiFiUDP UDP;
+/// Network bring-up stages, advanced by updateNetwork()
+enum NetworkState : uint8_t
+{
+  NET_ASSOCIATING,
+  NET_READY
+};
+NetworkState networkState = NET_ASSOCIATING;
+/// Timestamp at which the WiFi association was started
+unsigned long wifiStarted = 0;
+/// True while reconnecting to the Access Point stored by the SDK
+bool wifiReconnecting = false;
 
 /// The time.nist.gov NTP server's IP Address
 IPAddress timeServerIP;
 const char* ntpServerName = "time.nist.gov";
 
-/// NTP timestamp is in the first 48 bytes of the message
-const int NTP_PACKET_SIZE = 48;
-
-/// A buffer to hold incoming and outgoing UDP packets
-byte packetBuffer[NTP_PACKET_SIZE];
-
 /**
  * @brief Run at every startup
  * 
@@ -189,132 +235,202 @@ void setup()
   Serial.begin(115200);
   delay(10);
   Serial.println("\r\n");
+  startConsole();
 
-  startWiFi();
-
-  startLittleFS();
-
-  startUDP();
-
+  bootPhaseStart(BOOT_SENSORS);
   startSensors();
+  bootPhaseEnd(BOOT_SENSORS);
 
-  WiFi.hostByName(ntpServerName, timeServerIP);
-  Serial.print("Time server IP:\t");
-  Serial.println(timeServerIP);
+  otaBegin();
 
-  sendNTPpacket(timeServerIP);
-  delay(500);
+  startWiFi();
+
+#ifdef NODE_ROLE_GATEWAY
+  nodeQueueBegin();
+  linkBeginGateway();
+#endif
 }
 
 /// Update the NTP time every hour
-const unsigned long intervalNTP = ONE_HOUR;
+unsigned long intervalNTP = ONE_HOUR;
+/// Retry an unanswered NTP request every second until the time is known
+const unsigned long intervalNTPRetry = 1000;
 /// Store timestamp of previous NTP update
 unsigned long prevNTP = 0;
-/// Timestamp of lastNTP response initialized to current time
+/// millis() at which timeUNIX was the UNIX time, moved by every time sample
 unsigned long lastNTPResponse = millis();
+/// Timestamp of the last NTP reply
+unsigned long lastNTPReply = 0;
+/// Timestamp of the last NTP reply or Date header, initialized to current time
+unsigned long lastTimeSample = millis();
 
-/// Send POST requests every 1 Hour
-const unsigned long intervalPost = 3600000;
 /// Read sensors every 15 min
-const unsigned long intervalTemp = 900000;
-unsigned long prevReading = 0;
-unsigned long prevSend = 0;
-bool dataSent = false;
-bool dataRequested = false;
-/// Delay to cater for slow 2000ms polling rate of DHT22 sensor
-const unsigned long DS_delay = 2000;
+unsigned long intervalTemp = 900000;
+/// Check for firmware updates every 6 hours
+unsigned long intervalOTA = 6 * ONE_HOUR;
+/// Retry a required rollback every minute
+const unsigned long intervalOTARetry = 60000;
+unsigned long prevOTA = 0;
+
+/// Interval of the next firmware update check
+static unsigned long otaInterval()
+{
+  return otaRollbackRequired() ? intervalOTARetry : intervalOTA;
+}
 
 uint32_t timeUNIX = 0;
 
+/// Time spent idle in idleUntilDue()
+unsigned long idleMillis = 0;
+
 void loop()
 {
   unsigned long currentMillis = millis();
 
+  handleConsoleInput();
+  indexPoll(currentMillis);
+
+  if (networkState != NET_READY)
+  {
+    updateNetwork();
+    return;
+  }
+
+  if (currentMillis - prevOTA > otaInterval())
+  {
+    prevOTA = currentMillis;
+    otaCheck();
+  }
+
   if (currentMillis - prevNTP > intervalNTP)
   {
     prevNTP = currentMillis;
     sendNTPpacket(timeServerIP);
   }
 
-  uint32_t time = getTime();
-  if (time)
+  if (updateTime())
   {
-    timeUNIX = time;
+    bootPhaseEnd(BOOT_NTP);
     Serial.print("NTP response:\t");
     Serial.println(timeUNIX);
-    lastNTPResponse = millis();
   }
-  else if ((millis() - lastNTPResponse) > 24UL * ONE_HOUR)
+  else if (updateServerTime())
   {
-    Serial.println("More than 24 hours since last NTP response. Rebooting.");
+    bootPhaseEnd(BOOT_NTP);
+    Serial.print("Server time:\t");
+    Serial.println(currentTime());
+  }
+  else if ((millis() - lastTimeSample) > 24UL * ONE_HOUR)
+  {
+    Serial.println("More than 24 hours since last time sample. Rebooting.");
+    flushPipelines();
+    flushIndex();
     Serial.flush();
     ESP.reset();
   }
 
   if (timeUNIX != 0)
   {
-    if (currentMillis - prevReading > intervalTemp)
+    // Sampling starts once the time is known, and runs off timers from then on
+    if (!samplerRunning())
     {
-      dataRequested = true;
-      prevReading = currentMillis;
+      samplerBegin(dht, intervalTemp);
     }
-    if (currentMillis - prevReading > DS_delay && dataRequested)
+    Sample sample;
+    while (samplerPoll(sample))
     {
-      uint32_t actualTime = timeUNIX + (currentMillis - lastNTPResponse) / 1000;
-      dataRequested = false;
-      float humidity = dht.readHumidity();
-      humidity = round(humidity * 100.0) / 100.0;
-      float temperature = dht.readTemperature();
-      temperature = round(temperature * 100.0) / 100.0;
-
-      const size_t CAPACITY = JSON_OBJECT_SIZE(3);
-      StaticJsonDocument<CAPACITY> doc;
-
-      JsonObject reading = doc.to<JsonObject>();
-      reading["timestamp"] = actualTime;
-      reading["humidity"] = humidity;
-      reading["temperature"] = temperature;
-
-      Serial.printf("\nAppending data to file: %i\t", actualTime);
-      Serial.printf("Humidity: %f\tTemperature: %f\n", humidity, temperature);
+      sample.timestamp = timeAt(sample.takenAt);
+      samplePipeline.push(sample);
 
-      File dataLog = LittleFS.open("data.txt", "a");
+      if (sample.status == DHT22Status::Ok && !bootComplete())
+      {
+        bootPhaseEnd(BOOT_FIRST_SAMPLE);
+        printBootReport(Serial);
+      }
+    }
 
-      dataLog.print(actualTime);
-      dataLog.print(',');
-      dataLog.print(humidity);
-      dataLog.print(',');
-      dataLog.println(temperature);
+#ifdef NODE_ROLE_GATEWAY
+    LinkPacket packet;
+    while (linkReceive(packet))
+    {
+      uint16_t millisecond;
+      uint32_t seconds = timeAt(millis(), millisecond);
+      linkSendTime(packet, seconds, millisecond);
 
-      dataLog.close();
+      QueuedReading reading;
+      reading.timestamp = packet.reading.timestamp;
+      if (reading.timestamp == 0)
+      {
+        uint32_t age = linkPacketAge(packet);
+        reading.timestamp = currentTime() - age / 1000;
+      }
+      reading.temperature = packet.reading.temperature;
+      reading.humidity = packet.reading.humidity;
+      nodeQueuePush(packet.reading.node, reading);
     }
+#endif
 
-    if (currentMillis - prevSend > intervalPost)
+    if (uploadDue(currentMillis))
     {
-      dataSent = true;
-      prevSend = currentMillis;
+#ifdef NODE_ROLE_GATEWAY
+      nodeQueueDrain(NODE_BATCH_SIZE, logQueuedReading);
+#endif
+      uploadRun(currentMillis);
     }
-    if (currentMillis - prevSend && dataSent)
+  }
+  else
+  {
+    if (currentMillis - prevNTP > intervalNTPRetry)
     {
-      dataSent = false;
-      Serial.println("Sending data to .NET API");
-      int responseCode = sendData();
-      if (responseCode > 0)
-      {
-        Serial.printf("HTTP Response code: %i\n", responseCode);
-      }
-      else
-      {
-        Serial.printf("HTTP Error: %i\n", responseCode);
-      }
+      prevNTP = currentMillis;
+      sendNTPpacket(timeServerIP);
+    }
+    if (prevOTA == 0 && currentMillis > NTP_FALLBACK_DELAY)
+    {
+      prevOTA = currentMillis;
+      otaCheck();
     }
   }
-  else
+
+#ifndef NODE_ROLE_GATEWAY
+  // A gateway keeps its radio on for the leaf nodes
+  idleUntilDue(currentMillis);
+#endif
+}
+
+/**
+ * @brief Get the time from now until a task run every interval is due
+ */
+static unsigned long timeUntil(unsigned long prev, unsigned long interval, unsigned long now)
+{
+  unsigned long elapsed = now - prev;
+  return elapsed > interval ? 0 : interval - elapsed + 1;
+}
+
+void idleUntilDue(unsigned long now)
+{
+  unsigned long idle = LOOP_MAX_IDLE;
+  idle = min(idle, timeUntil(prevOTA, otaInterval(), now));
+  idle = min(idle, timeUntil(prevNTP, timeUNIX != 0 ? intervalNTP : intervalNTPRetry, now));
+  if (timeUNIX != 0)
   {
-    sendNTPpacket(timeServerIP);
-    delay(500);
+    idle = min(idle, uploadIdleTime(now));
   }
+  // Time spent in this iteration counts against the deadlines
+  unsigned long spent = millis() - now;
+  if (Serial.available() || serialExportActive() || idle <= spent)
+  {
+    return;
+  }
+  delay(idle - spent);
+  idleMillis += idle - spent;
+}
 
+void printIdleStats(Print& out)
+{
+  unsigned long uptime = millis();
+  out.printf("Idle: %u ms of %u ms, %u%%\r\n", idleMillis, uptime,
+    uptime > 0 ? (uint32_t)((uint64_t)idleMillis * 100 / uptime) : 0);
 }
 
 void startWiFi()
@@ -322,43 +438,63 @@ void startWiFi()
   wifiMulti.addAP("CL001", "Christo)(*");
   wifiMulti.addAP("Jagter", "Altus1912");
 
-  Serial.println("Connecting");
-  while (wifiMulti.run() != WL_CONNECTED)
+  bootPhaseStart(BOOT_WIFI);
+  wifiStarted = millis();
+
+  WiFi.mode(WIFI_STA);
+#ifndef NODE_ROLE_GATEWAY
+  // The radio only wakes for the beacons it must hear while the loop idles
+  WiFi.setSleepMode(WIFI_LIGHT_SLEEP);
+#endif
+  if (WiFi.SSID().length() > 0)
+  {
+    Serial.printf("Reconnecting to %s\n", WiFi.SSID().c_str());
+    WiFi.begin();
+    wifiReconnecting = true;
+  }
+}
+
+void updateNetwork()
+{
+  if (WiFi.status() != WL_CONNECTED)
   {
-    delay(250);
-    Serial.print('.');
+    if (wifiReconnecting && millis() - wifiStarted < WIFI_FAST_CONNECT_TIMEOUT)
+    {
+      return;
+    }
+    wifiReconnecting = false;
+    if (wifiMulti.run() != WL_CONNECTED)
+    {
+      return;
+    }
   }
+  bootPhaseEnd(BOOT_WIFI);
+
   Serial.println("\r\n");
   Serial.print("Connected to ");
   Serial.println(WiFi.SSID());
   Serial.print("IP address:\t");
   Serial.print(WiFi.localIP());
   Serial.println("\r\n");
-}
-
-void startUDP()
-{
-  Serial.println("Starting UDP");
-  UDP.begin(123);
-  Serial.print("Local port:\t");
-  Serial.println(UDP.localPort());
-}
 
-void startLittleFS()
-{
-  if (!LittleFS.begin())
+  bootPhaseStart(BOOT_UDP);
+  if (!ntpBegin())
   {
-    Serial.printf("LittleFS mount failed\n");
-    return;
+    Serial.println("Starting the NTP client failed");
   }
+  bootPhaseEnd(BOOT_UDP);
 
-  Serial.println("LittleFS started. Contents:");
-  listDirectory("/");
+  bootPhaseStart(BOOT_DNS);
+  WiFi.hostByName(ntpServerName, timeServerIP);
+  Serial.print("Time server IP:\t");
+  Serial.println(timeServerIP);
+  bootPhaseEnd(BOOT_DNS);
+
+  bootPhaseStart(BOOT_NTP);
+  prevNTP = millis();
+  sendNTPpacket(timeServerIP);
 
-  deleteFile("/data.json");
-  deleteFile("/data.ndjson");
-  deleteFile("/data.txt");
-  deleteFile("/hello.txt");
+  networkState = NET_READY;
 }
 
 void startSensors()
@@ -368,123 +504,253 @@ void startSensors()
   Serial.println("DHT22 initialised");
 }
 
-String formatBytes(size_t bytes)
+bool updateTime()
 {
-  if (bytes < 1024) { return String(bytes) + "B"; }
-  else if (bytes < (1024 * 1024)) { return String(bytes / 1024.0) + "KB"; }
-  else if (bytes < (1024 * 1024 * 1024)) { return String(bytes / 1024.0 / 1024.0) + "MB"; }
-  else { return "null"; }
+  NtpSample sample;
+  bool updated = false;
+  while (ntpPoll(sample))
+  {
+    timeUNIX = sample.seconds;
+    lastNTPResponse = sample.receivedAt - sample.milliseconds;
+    lastNTPReply = sample.receivedAt;
+    lastTimeSample = sample.receivedAt;
+    updated = true;
+  }
+  return updated;
 }
 
-unsigned long getTime()
+bool updateServerTime()
 {
-  if (UDP.parsePacket() == 0)
+  ServerTime sample;
+  if (!serverTimePoll(sample))
   {
-    return 0;
+    return false;
   }
-  UDP.read(packetBuffer, NTP_PACKET_SIZE);
-  uint32_t NTPTime = (packetBuffer[40] << 24) | (packetBuffer[41] << 16) | (packetBuffer[42] << 8) | packetBuffer[43];
-
-  const uint32_t seventyYears = 2208988800UL;
-  uint32_t UNIXTime = NTPTime - seventyYears;
-  return UNIXTime;
+  lastTimeSample = sample.receivedAt;
+  // The header is truncated, so the time at receipt is half a second later on average
+  if (timeUNIX == 0)
+  {
+    timeUNIX = sample.seconds;
+    lastNTPResponse = sample.receivedAt - 500;
+    return true;
+  }
+  if (lastNTPReply != 0 && sample.receivedAt - lastNTPReply < NTP_STALE_AFTER)
+  {
+    return false;
+  }
+  // Move the anchor up to the last whole second before the sample, keeping the fraction, so the time
+  // elapsed since it stays well within the int32_t of timeAt() however long NTP stays away
+  int32_t elapsed = (int32_t)(sample.receivedAt - lastNTPResponse) / 1000;
+  timeUNIX += elapsed;
+  lastNTPResponse += elapsed * 1000;
+
+  int32_t offset = (int32_t)(sample.seconds - timeUNIX) * 1000 + 500 - (int32_t)(sample.receivedAt - lastNTPResponse);
+  if (offset >= -1000 && offset <= 1000)
+  {
+    return false;
+  }
+  lastNTPResponse -= offset / SERVER_TIME_WEIGHT;
+  return true;
 }
 
 void sendNTPpacket(IPAddress& address)
 {
   Serial.println("Sending NTP request");
-  memset(packetBuffer, 0, NTP_PACKET_SIZE);
-  packetBuffer[0] = 0b11100011;
-
-  UDP.beginPacket(address, 123);
-  UDP.write(packetBuffer, NTP_PACKET_SIZE);
-  if (UDP.endPacket() == 0)
+  if (!ntpRequest(address))
+  {
     Serial.println("NTP request failed");
+  }
 }
 
-void listDirectory(const char* path)
+void handleConsoleInput()
 {
-  Dir dir = LittleFS.openDir(path);
-  while (dir.next())
+  if (serialExportActive())
   {
-    String fileName = dir.fileName();
-    size_t fileSize = dir.fileSize();
-    Serial.printf("\tFS File: %s, size: %s\r\n", fileName.c_str(), formatBytes(fileSize).c_str());
+    serialExportPoll();
+    return;
   }
-  Serial.printf("\n");
+  consolePoll(Serial, Serial);
 }
 
-void readFile(const char* path)
+/// Largest number of lines printed by dump, as Serial output blocks once its buffer is full
+#define CONSOLE_DUMP_MAX 100
+
+/// An interval that can be set from the console
+struct Setting
+{
+  const char* name;
+  unsigned long* value;
+  /// Limits, in seconds
+  unsigned long min;
+  unsigned long max;
+};
+
+static const Setting settings[] = {
+  { "sample", &intervalTemp, DHT22_MIN_INTERVAL / 1000, SAMPLER_MAX_INTERVAL / 1000 },
+  // A minute short of NTP_STALE_AFTER, so the Date header never adjusts a clock NTP keeps
+  { "ntp", &intervalNTP, 60, (NTP_STALE_AFTER - 60000UL) / 1000 },
+  { "ota", &intervalOTA, 60, 7 * 24 * 3600 },
+};
+
+static void cmdStatus(Print& out, const char*)
 {
-  File file = LittleFS.open(path, "r");
-  if (!file)
+  out.printf("Firmware: %s\r\nUptime: %lu s\r\nFree heap: %u\r\n", FIRMWARE_VERSION, millis() / 1000,
+    ESP.getFreeHeap());
+  if (networkState == NET_READY && WiFi.status() == WL_CONNECTED)
   {
-    Serial.printf("Failed to open file %s for reading", path);
-    return;
-  };
-
-  while (file.available())
+    out.printf("Network: %s, %s, %d dBm\r\n", WiFi.SSID().c_str(), WiFi.localIP().toString().c_str(),
+      WiFi.RSSI());
+  }
+  else
   {
-    Serial.write(file.read());
+    out.println("Network: not connected");
   }
-
-  file.close();
-}
-
-void deleteFile(const char* path)
-{
-  if (LittleFS.remove(path))
+  if (timeUNIX != 0)
   {
-    Serial.printf("File at %s deleted", path);
-    Serial.printf("\n\r");
+    out.printf("Time: %u\r\n", currentTime());
   }
   else
   {
-    Serial.println("File delete failed");
+    out.println("Time: unknown");
+  }
+  if (lastNTPReply != 0)
+  {
+    out.printf("Last NTP reply: %lu s ago\r\n", (millis() - lastNTPReply) / 1000);
   }
+  out.printf("Sampling: %s\r\n", samplerRunning() ? "running" : "waiting for the time");
 }
 
-int sendData()
+static void cmdStats(Print& out, const char*)
 {
-  HTTPClient http;
-
-  const char* URL = "http://192.168.0.108:5000/api/DataEntries/list";
+  printUploadStats(out);
+  printSinkStats(out);
+  printPipelineStats(out);
+  printSamplerStats(out);
+  printCpuStats(out);
+  printNtpStats(out);
+  printIdleStats(out);
+  printExportStats(out);
+#ifdef NODE_ROLE_GATEWAY
+  printLinkStats(out);
+  printNodeQueueStats(out, currentTime());
+#endif
+}
 
-  StaticJsonDocument<2048> doc;
+static void cmdList(Print& out, const char* args)
+{
+  listDirectory(out, strcmp(args, "-r") == 0);
+}
 
-  File dataFile;
-  String buf;
+static void cmdDump(Print& out, const char* args)
+{
+  unsigned long first = 0, count = 20;
+  sscanf(args, "%lu %lu", &first, &count);
+  dumpLines(UPLOAD_LOG_PATH, out, first, min(count, (unsigned long)CONSOLE_DUMP_MAX));
+}
 
-  dataFile = LittleFS.open("data.txt", "r");
-  while (dataFile.available())
+static void cmdSet(Print& out, const char* args)
+{
+  char name[16];
+  unsigned long seconds;
+  int fields = sscanf(args, "%15s %lu", name, &seconds);
+  for (const Setting& setting : settings)
   {
-    JsonObject readingObject = doc.createNestedObject();
-
-    buf = dataFile.readStringUntil(',');
-    readingObject["timestamp"] = buf.toInt();
-
-    buf = dataFile.readStringUntil(',');
-    readingObject["humidity"] = buf.toFloat();
-
-    buf = dataFile.readStringUntil('\n');
-    readingObject["temperature"] = buf.toFloat();
+    if (fields <= 0)
+    {
+      out.printf("%-8s %lu s\r\n", setting.name, *setting.value / 1000);
+      continue;
+    }
+    if (strcmp(name, setting.name) != 0)
+    {
+      continue;
+    }
+    if (fields != 2 || seconds < setting.min || seconds > setting.max)
+    {
+      out.printf("%s takes %lu to %lu s\r\n", setting.name, setting.min, setting.max);
+      return;
+    }
+    *setting.value = seconds * 1000;
+    if (setting.value == &intervalTemp && samplerRunning())
+    {
+      // The schedule restarts from a new first deadline
+      samplerBegin(dht, intervalTemp);
+    }
+    out.printf("%s set to %lu s\r\n", setting.name, seconds);
+    return;
   }
+  if (fields > 0)
+  {
+    out.printf("Unknown setting: %s\r\n", name);
+  }
+}
 
-  dataFile.flush();
+static void cmdUpload(Print& out, const char*)
+{
+  if (timeUNIX == 0)
+  {
+    out.println("Time unknown, uploads start once it is known");
+    return;
+  }
+  uploadForce(millis());
+  out.println("Upload due");
+}
 
-  dataFile.close();
+static void cmdNtp(Print& out, const char*)
+{
+  if (networkState != NET_READY)
+  {
+    out.println("Network not ready");
+    return;
+  }
+  prevNTP = millis();
+  sendNTPpacket(timeServerIP);
+}
 
-  // serializeJsonPretty(doc, Serial);
+static void cmdExport(Print&, const char*)
+{
+  serialExportStart(UPLOAD_LOG_PATH);
+}
 
-  http.begin(URL);
-  http.addHeader("Content-Type", "application/json");
+static const ConsoleCommand commands[] = {
+  { "status", "firmware, uptime, network and time", cmdStatus },
+  { "stats", "upload, pipeline, sampling, CPU, NTP and link statistics", cmdStats },
+  { "ls", "[-r] list the files, rescanning first with -r", cmdList },
+  { "dump", "[first] [count] print lines of the upload log", cmdDump },
+  { "set", "[name seconds] list the intervals, or set one until reboot", cmdSet },
+  { "upload", "upload to every sink now", cmdUpload },
+  { "ntp", "send an NTP request now", cmdNtp },
+  { "export", "export the upload log to export_receiver", cmdExport },
+};
+
+void startConsole()
+{
+  consoleBegin(commands, sizeof(commands) / sizeof(commands[0]));
+}
 
-  String serializedJSON;
-  serializeJson(doc, serializedJSON);
+uint32_t currentTime()
+{
+  return timeAt(millis());
+}
 
-  int responseCode = http.POST(serializedJSON);
+uint32_t timeAt(unsigned long ms)
+{
+  uint16_t millisecond;
+  return timeAt(ms, millisecond);
+}
 
-  http.end();
+uint32_t timeAt(unsigned long ms, uint16_t& millisecond)
+{
+  int32_t elapsed = (int32_t)(ms - lastNTPResponse);
+  int32_t seconds = elapsed >= 0 ? elapsed / 1000 : -((999 - elapsed) / 1000);
+  millisecond = elapsed - seconds * 1000;
+  return timeUNIX + seconds;
+}
 
-  return responseCode;
+#ifdef NODE_ROLE_GATEWAY
+void logQueuedReading(uint32_t node, const QueuedReading& reading)
+{
+  // Relayed readings are in tenths, the log keeps hundredths
+  LogRecord record = { 0, reading.timestamp, reading.humidity * 10, reading.temperature * 10, node };
+  relayPipeline.push(record);
 }
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file Arduino.h
+ * @author Christoff Linde
+ * @brief Host stand-in for the parts of the Arduino core the tested modules use
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * Only built by the native test environment. Time does not pass on its own: tests move it with
+ * simAdvance, so timing dependent code runs the same on every host.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+// As in the ESP8266 core
+using std::max;
+using std::min;
+
+/// The value of millis(), moved by the tests
+inline uint32_t simMillis = 0;
+
+inline uint32_t millis()
+{
+  return simMillis;
+}
+
+inline void simAdvance(uint32_t ms)
+{
+  simMillis += ms;
+}
+
+class Print
+{
+public:
+  virtual ~Print() = default;
+  virtual size_t write(uint8_t c) = 0;
+
+  virtual size_t write(const uint8_t* buffer, size_t size)
+  {
+    size_t written = 0;
+    while (size--)
+    {
+      written += write(*buffer++);
+    }
+    return written;
+  }
+
+  size_t print(const char* text)
+  {
+    return write(reinterpret_cast<const uint8_t*>(text), strlen(text));
+  }
+
+  size_t println(const char* text)
+  {
+    return print(text) + print("\r\n");
+  }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    return write(reinterpret_cast<const uint8_t*>(buf), len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+  }
+};
+
+/// Serial output goes to stdout
+class SimSerial : public Print
+{
+public:
+  using Print::write;
+
+  size_t write(uint8_t c) override
+  {
+    return fputc(c, stdout) == EOF ? 0 : 1;
+  }
+};
+
+inline SimSerial Serial;
+
+class SimEsp
+{
+public:
+  /// The chip id returned, set by the tests
+  uint32_t chipId = 0x00a1b2c3;
+
+  uint32_t getChipId()
+  {
+    return chipId;
+  }
+};
+
+inline SimEsp ESP;
+
+#endif
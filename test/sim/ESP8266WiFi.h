@@ -0,0 +1,26 @@
+/**
+ * @file ESP8266WiFi.h
+ * @author Christoff Linde
+ * @brief Host stand-in for the WiFi functions the tested modules use
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SIM_ESP8266_WIFI_H
+#define SIM_ESP8266_WIFI_H
+
+#include <Arduino.h>
+
+/// The channel the radio was put on
+inline uint8_t simChannel = 0;
+
+inline bool wifi_set_channel(uint8_t channel)
+{
+  simChannel = channel;
+  return true;
+}
+
+#endif
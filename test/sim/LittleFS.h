@@ -0,0 +1,145 @@
+/**
+ * @file LittleFS.h
+ * @author Christoff Linde
+ * @brief Host stand-in for the LittleFS file system, kept in memory
+ * @version 0.1
+ * @date 2021-04-20
+ *
+ * Files live in simFiles, so tests can seed them, look at them, and keep them across a simulated
+ * reset. Only the calls the tested modules make are there.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SIM_LITTLEFS_H
+#define SIM_LITTLEFS_H
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+/// Contents of the files, by path
+inline std::map<std::string, std::string> simFiles;
+
+class File : public Print
+{
+public:
+  File() : _data(nullptr), _position(0)
+  {
+  }
+
+  explicit File(std::string* data, size_t position) : _data(data), _position(position)
+  {
+  }
+
+  explicit operator bool() const
+  {
+    return _data != nullptr;
+  }
+
+  using Print::write;
+
+  size_t write(uint8_t c) override
+  {
+    if (_data == nullptr)
+    {
+      return 0;
+    }
+    _data->push_back(c);
+    _position = _data->size();
+    return 1;
+  }
+
+  size_t read(uint8_t* buf, size_t len)
+  {
+    size_t take = std::min(len, (size_t)available());
+    memcpy(buf, _data->data() + _position, take);
+    _position += take;
+    return take;
+  }
+
+  size_t readBytesUntil(char terminator, char* buf, size_t len)
+  {
+    size_t count = 0;
+    while (count < len && available() > 0)
+    {
+      char c = (*_data)[_position++];
+      if (c == terminator)
+      {
+        break;
+      }
+      buf[count++] = c;
+    }
+    return count;
+  }
+
+  int available() const
+  {
+    return _data == nullptr ? 0 : (int)(_data->size() - _position);
+  }
+
+  bool seek(uint32_t position)
+  {
+    if (_data == nullptr || position > _data->size())
+    {
+      return false;
+    }
+    _position = position;
+    return true;
+  }
+
+  size_t position() const
+  {
+    return _position;
+  }
+
+  size_t size() const
+  {
+    return _data == nullptr ? 0 : _data->size();
+  }
+
+  void close()
+  {
+    _data = nullptr;
+  }
+
+private:
+  std::string* _data;
+  size_t _position;
+};
+
+class SimLittleFS
+{
+public:
+  File open(const char* path, const char* mode)
+  {
+    auto file = simFiles.find(path);
+    if (mode[0] == 'r')
+    {
+      return file == simFiles.end() ? File() : File(&file->second, 0);
+    }
+    std::string& data = simFiles[path];
+    if (mode[0] == 'w')
+    {
+      data.clear();
+    }
+    return File(&data, data.size());
+  }
+
+  bool exists(const char* path)
+  {
+    return simFiles.count(path) > 0;
+  }
+
+  bool remove(const char* path)
+  {
+    return simFiles.erase(path) > 0;
+  }
+};
+
+inline SimLittleFS LittleFS;
+
+#endif
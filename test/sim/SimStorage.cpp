@@ -0,0 +1,28 @@
+/**
+ * @file SimStorage.cpp
+ * @author Christoff Linde
+ * @brief Host stand-in for the parts of Storage.h the tested modules use, on the LittleFS of the simulation
+ * @version 0.1
+ * @date 2021-04-20
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <LittleFS.h>
+
+#include "Storage.h"
+
+bool startLittleFS()
+{
+  return true;
+}
+
+void indexFile(const char*, size_t)
+{
+}
+
+void deleteFile(const char* path)
+{
+  LittleFS.remove(path);
+}
@@ -0,0 +1,181 @@
+/**
+ * @file espnow.h
+ * @author Christoff Linde
+ * @brief Host simulation of the ESP8266 ESP-NOW API
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * One process plays every node, one at a time: a node is the set of callbacks it registered, and the
+ * tests switch between nodes with simEspNowSelect. Sent frames are queued on simAir, and the tests
+ * deliver them to the callbacks of the node they are addressed to. Peers are kept per node, with the
+ * limit of the SDK, and sending to a MAC that is not a peer fails as on the device.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SIM_ESPNOW_H
+#define SIM_ESPNOW_H
+
+#include <Arduino.h>
+
+#include <deque>
+#include <vector>
+
+enum esp_now_role
+{
+  ESP_NOW_ROLE_IDLE = 0,
+  ESP_NOW_ROLE_CONTROLLER,
+  ESP_NOW_ROLE_SLAVE,
+  ESP_NOW_ROLE_COMBO,
+  ESP_NOW_ROLE_MAX
+};
+
+typedef void (*esp_now_recv_cb_t)(uint8_t* mac, uint8_t* data, uint8_t len);
+typedef void (*esp_now_send_cb_t)(uint8_t* mac, uint8_t status);
+
+/// Unencrypted peers the SDK takes
+#define SIM_ESPNOW_MAX_PEERS 20
+
+struct SimMac
+{
+  uint8_t bytes[6];
+
+  bool operator==(const SimMac& other) const
+  {
+    return memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+  }
+};
+
+struct SimNode
+{
+  SimMac mac;
+  esp_now_recv_cb_t onReceive = nullptr;
+  esp_now_send_cb_t onSent = nullptr;
+  std::vector<SimMac> peers;
+  /// Peers taken at most, lowered by tests to make esp_now_add_peer fail early
+  size_t maxPeers = SIM_ESPNOW_MAX_PEERS;
+  uint32_t peersDeleted = 0;
+};
+
+/// A frame in flight
+struct SimFrame
+{
+  SimMac from;
+  SimMac to;
+  std::vector<uint8_t> data;
+};
+
+inline std::deque<SimFrame> simAir;
+inline SimNode* simNode = nullptr;
+
+inline void simEspNowSelect(SimNode& node)
+{
+  simNode = &node;
+}
+
+inline SimMac simMac(const uint8_t* bytes)
+{
+  SimMac mac;
+  memcpy(mac.bytes, bytes, sizeof(mac.bytes));
+  return mac;
+}
+
+inline int esp_now_init()
+{
+  return 0;
+}
+
+inline int esp_now_set_self_role(uint8_t role)
+{
+  return role < ESP_NOW_ROLE_MAX ? 0 : -1;
+}
+
+inline int esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+  simNode->onReceive = cb;
+  return 0;
+}
+
+inline int esp_now_register_send_cb(esp_now_send_cb_t cb)
+{
+  simNode->onSent = cb;
+  return 0;
+}
+
+inline int esp_now_is_peer_exist(uint8_t* mac)
+{
+  for (const SimMac& peer : simNode->peers)
+  {
+    if (peer == simMac(mac))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+inline int esp_now_add_peer(uint8_t* mac, uint8_t /* role */, uint8_t /* channel */, uint8_t* /* key */,
+  uint8_t /* keyLength */)
+{
+  if (esp_now_is_peer_exist(mac) || simNode->peers.size() >= simNode->maxPeers)
+  {
+    return -1;
+  }
+  simNode->peers.push_back(simMac(mac));
+  return 0;
+}
+
+inline int esp_now_del_peer(uint8_t* mac)
+{
+  for (size_t i = 0; i < simNode->peers.size(); i++)
+  {
+    if (simNode->peers[i] == simMac(mac))
+    {
+      simNode->peers.erase(simNode->peers.begin() + i);
+      simNode->peersDeleted++;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+inline int esp_now_send(uint8_t* mac, uint8_t* data, int len)
+{
+  if (len > 250 || !esp_now_is_peer_exist(mac))
+  {
+    return -1;
+  }
+  simAir.push_back({ simNode->mac, simMac(mac), std::vector<uint8_t>(data, data + len) });
+  return 0;
+}
+
+/**
+ * @brief Deliver the oldest frame in flight to the node it is addressed to, or to every other node
+ * if it was broadcast
+ *
+ * @return true if a frame was in flight
+ */
+inline bool simDeliver(std::initializer_list<SimNode*> nodes)
+{
+  if (simAir.empty())
+  {
+    return false;
+  }
+  SimFrame frame = simAir.front();
+  simAir.pop_front();
+  static const SimMac broadcast = { { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } };
+  SimNode* sender = simNode;
+  for (SimNode* node : nodes)
+  {
+    if (node->onReceive != nullptr && !(node->mac == frame.from) && (frame.to == broadcast || frame.to == node->mac))
+    {
+      simEspNowSelect(*node);
+      node->onReceive(frame.from.bytes, frame.data.data(), frame.data.size());
+    }
+  }
+  simEspNowSelect(*sender);
+  return true;
+}
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * @file patch.h
+ * @brief Patch from the old to the new image of test_main.cpp
+ *
+ * Written by tools/test_delta.py --fixture, do not edit.
+ *
+ */
+
+#ifndef TEST_DELTA_PATCH_H
+#define TEST_DELTA_PATCH_H
+
+#include <stdint.h>
+
+static const uint8_t fixturePatch[] = {
+  0x4d, 0x44, 0x50, 0x31, 0x00, 0x10, 0x00, 0x00, 0xa4, 0x0e, 0x00, 0x00, 0x64, 0x66, 0x35, 0x39,
+  0x37, 0x32, 0x31, 0x30, 0x66, 0x61, 0x61, 0x39, 0x63, 0x39, 0x61, 0x36, 0x64, 0x38, 0x65, 0x65,
+  0x66, 0x36, 0x34, 0x65, 0x34, 0x32, 0x62, 0x37, 0x61, 0x61, 0x65, 0x62, 0x00, 0x41, 0x02, 0x05,
+  0x12, 0x1f, 0x2c, 0x39, 0x46, 0x53, 0x60, 0x6d, 0x7a, 0x87, 0x94, 0xa1, 0xae, 0xbb, 0xc8, 0xd5,
+  0xe2, 0xef, 0xfc, 0x09, 0x16, 0x23, 0x30, 0x3d, 0x4a, 0x57, 0x64, 0x71, 0x7e, 0x8b, 0x98, 0xa5,
+  0xb2, 0xbf, 0xcc, 0xd9, 0xe6, 0xf3, 0x00, 0x0d, 0x1a, 0x27, 0x34, 0x41, 0x4e, 0x5b, 0x68, 0x75,
+  0x82, 0x8f, 0x9c, 0xa9, 0xb6, 0xc3, 0xd0, 0xdd, 0xea, 0xf7, 0x04, 0x11, 0x1e, 0x2b, 0x38, 0xca,
+  0xff, 0x07, 0x64, 0x80, 0x10, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03,
+  0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04,
+  0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e,
+  0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03,
+  0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04,
+  0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e, 0x03, 0x04, 0x3e,
+  0x03, 0x04, 0x3e, 0x01, 0x1e, 0x3b, 0x58, 0x75, 0x92, 0xaf, 0xcc, 0xe9, 0x06, 0x23, 0x40, 0x5d,
+  0x7a, 0x97, 0xb4, 0xd1, 0xee, 0x0b, 0x28, 0x45, 0x62, 0x7f, 0x9c, 0xb9, 0xd6, 0xf3, 0x10, 0x2d,
+  0x4a, 0x67, 0x84, 0xa1, 0xbe, 0xdb, 0xf8, 0x15, 0x32, 0x4f, 0x6c, 0x89, 0xa6, 0xc3, 0xe0, 0xfd,
+  0x1a, 0x37, 0x54, 0x71, 0x8e, 0xab, 0xc8, 0xe5, 0x02, 0x1f, 0x3c, 0x59, 0x76, 0x93, 0xb0, 0xcd,
+  0xea, 0x07, 0x24, 0x41, 0x5e, 0x7b, 0x98, 0xb5, 0xd2, 0xef, 0x0c, 0x29, 0x46, 0x63, 0x80, 0x9d,
+  0xba, 0xd7, 0xf4, 0x11, 0x2e, 0x4b, 0x68, 0x85, 0xa2, 0xbf, 0xdc, 0xf9, 0x16, 0x33, 0x50, 0x6d,
+  0x8a, 0xa7, 0xc4, 0xe1, 0xfe, 0x1b, 0x38, 0x80, 0x10, 0x00, 0xff, 0x3b, 0x80, 0x20, 0x80, 0x04,
+  0x00, 0x00, 0x80, 0x08,
+};
+
+#endif
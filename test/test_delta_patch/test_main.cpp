@@ -0,0 +1,257 @@
+/**
+ * @file test_main.cpp
+ * @author Christoff Linde
+ * @brief Host tests of the streaming delta patcher, @see DeltaPatch.h
+ * @version 0.1
+ * @date 2021-04-26
+ *
+ * The images are built the way fixture_images() of tools/test_delta.py builds them, and patch.h is
+ * the patch delta.py makes between them. It holds copy and add tokens, literal bytes, and a forward
+ * and a backward seek. The broken patches are built by hand.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "DeltaPatch.h"
+#include "patch.h"
+
+#define OLD_SIZE 4096
+#define NEW_SIZE 3748
+
+static uint8_t oldImage[OLD_SIZE];
+static uint8_t newImage[NEW_SIZE];
+
+/// The old image and the output of the patcher
+struct Target
+{
+  const uint8_t* old;
+  uint32_t oldSize;
+  uint8_t out[NEW_SIZE];
+  uint32_t length;
+};
+
+static Target target;
+
+static bool readOld(uint32_t offset, uint8_t* buf, size_t len, void* context)
+{
+  Target* t = (Target*)context;
+  if (offset + len > t->oldSize)
+  {
+    return false;
+  }
+  memcpy(buf, t->old + offset, len);
+  return true;
+}
+
+static bool writeNew(const uint8_t* buf, size_t len, void* context)
+{
+  Target* t = (Target*)context;
+  if (t->length + len > NEW_SIZE)
+  {
+    return false;
+  }
+  memcpy(t->out + t->length, buf, len);
+  t->length += len;
+  return true;
+}
+
+static void buildImages()
+{
+  uint32_t state = 1;
+  for (uint32_t i = 0; i < OLD_SIZE; i++)
+  {
+    state = state * 1103515245 + 12345;
+    oldImage[i] = (state >> 16) & 0xFF;
+  }
+
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < 64; i++)
+  {
+    newImage[n++] = (i * 13 + 5) & 0xFF;
+  }
+  // Shifted addresses: every 32nd byte differs
+  for (uint32_t i = 0; i < 1024; i++)
+  {
+    newImage[n++] = i % 32 == 0 ? oldImage[i] + 4 : oldImage[i];
+  }
+  for (uint32_t i = 0; i < 100; i++)
+  {
+    newImage[n++] = (i * 29 + 1) & 0xFF;
+  }
+  memcpy(newImage + n, oldImage + 2048, 2048);
+  n += 2048;
+  memcpy(newImage + n, oldImage + 256, 512);
+}
+
+/// Header of a patch against the 16 byte old image of the hand built patches
+static size_t handHeader(uint8_t* patch, uint32_t newSize)
+{
+  memcpy(patch, "MDP1", 4);
+  patch[4] = 16;
+  patch[5] = patch[6] = patch[7] = 0;
+  patch[8] = newSize;
+  patch[9] = patch[10] = patch[11] = 0;
+  memset(patch + 12, '0', 32);
+  return DELTA_HEADER_SIZE;
+}
+
+void setUp()
+{
+  memset(&target, 0, sizeof(target));
+  target.old = oldImage;
+  target.oldSize = OLD_SIZE;
+}
+
+void tearDown()
+{
+}
+
+static void test_fixture_in_one_chunk()
+{
+  DeltaPatcher patcher(readOld, writeNew, &target);
+  TEST_ASSERT_EQUAL(DeltaStatus::Done, patcher.write(fixturePatch, sizeof(fixturePatch)));
+  TEST_ASSERT_EQUAL_UINT32(NEW_SIZE, patcher.newSize());
+  TEST_ASSERT_EQUAL_UINT32(NEW_SIZE, target.length);
+  TEST_ASSERT_EQUAL_MEMORY(newImage, target.out, NEW_SIZE);
+}
+
+static void test_fixture_in_uneven_chunks()
+{
+  // Chunks that split the header, varints, tokens and literal runs at every offset
+  static const size_t sizes[] = { 1, 2, 3, 5, 7, 11, 13, 31, 64, 257 };
+  for (size_t first = 0; first < sizeof(sizes) / sizeof(sizes[0]); first++)
+  {
+    setUp();
+    DeltaPatcher patcher(readOld, writeNew, &target);
+    size_t offset = 0;
+    size_t k = first;
+    DeltaStatus status = DeltaStatus::Ok;
+    while (offset < sizeof(fixturePatch))
+    {
+      size_t n = sizes[k++ % (sizeof(sizes) / sizeof(sizes[0]))];
+      if (n > sizeof(fixturePatch) - offset)
+      {
+        n = sizeof(fixturePatch) - offset;
+      }
+      TEST_ASSERT_EQUAL(DeltaStatus::Ok, status);
+      status = patcher.write(fixturePatch + offset, n);
+      offset += n;
+    }
+    TEST_ASSERT_EQUAL(DeltaStatus::Done, status);
+    TEST_ASSERT_EQUAL_UINT32(NEW_SIZE, target.length);
+    TEST_ASSERT_EQUAL_MEMORY(newImage, target.out, NEW_SIZE);
+  }
+}
+
+static void test_expected_old_image()
+{
+  char md5[33];
+  memcpy(md5, fixturePatch + 12, 32);
+  md5[32] = '\0';
+
+  DeltaPatcher patcher(readOld, writeNew, &target);
+  patcher.expectOld(OLD_SIZE, md5);
+  TEST_ASSERT_EQUAL(DeltaStatus::Done, patcher.write(fixturePatch, sizeof(fixturePatch)));
+
+  DeltaPatcher otherSize(readOld, writeNew, &target);
+  otherSize.expectOld(OLD_SIZE + 1, md5);
+  TEST_ASSERT_EQUAL(DeltaStatus::BadHeader, otherSize.write(fixturePatch, sizeof(fixturePatch)));
+
+  md5[5] = md5[5] == '0' ? '1' : '0';
+  DeltaPatcher otherImage(readOld, writeNew, &target);
+  otherImage.expectOld(OLD_SIZE, md5);
+  TEST_ASSERT_EQUAL(DeltaStatus::BadHeader, otherImage.write(fixturePatch, sizeof(fixturePatch)));
+  TEST_ASSERT_EQUAL_UINT32(0, otherImage.written());
+}
+
+static void test_bad_magic()
+{
+  uint8_t patch[sizeof(fixturePatch)];
+  memcpy(patch, fixturePatch, sizeof(patch));
+  patch[3] = '2';
+
+  DeltaPatcher patcher(readOld, writeNew, &target);
+  TEST_ASSERT_EQUAL(DeltaStatus::Ok, patcher.write(patch, DELTA_HEADER_SIZE - 1));
+  TEST_ASSERT_EQUAL(DeltaStatus::BadHeader, patcher.write(patch + DELTA_HEADER_SIZE - 1, 1));
+  // The patcher stays failed
+  TEST_ASSERT_EQUAL(DeltaStatus::BadHeader, patcher.write(patch + DELTA_HEADER_SIZE, 16));
+  TEST_ASSERT_EQUAL_UINT32(0, target.length);
+}
+
+static void test_seek_past_old_image()
+{
+  uint8_t old[16] = { 0 };
+  target.old = old;
+  target.oldSize = sizeof(old);
+
+  // Copy 8 bytes, then seek 9 bytes forward from offset 8
+  uint8_t patch[DELTA_HEADER_SIZE + 8];
+  size_t n = handHeader(patch, 16);
+  patch[n++] = 8;
+  patch[n++] = 0;
+  patch[n++] = 9 << 1;
+  patch[n++] = 8 << 1;
+  DeltaPatcher forward(readOld, writeNew, &target);
+  TEST_ASSERT_EQUAL(DeltaStatus::Corrupt, forward.write(patch, n));
+
+  // Seek 1 byte back from offset 0
+  n = handHeader(patch, 16);
+  patch[n++] = 0;
+  patch[n++] = 0;
+  patch[n++] = 1;
+  DeltaPatcher backward(readOld, writeNew, &target);
+  TEST_ASSERT_EQUAL(DeltaStatus::Corrupt, backward.write(patch, n));
+
+  // A diff longer than the old image
+  n = handHeader(patch, 20);
+  patch[n++] = 17;
+  DeltaPatcher diff(readOld, writeNew, &target);
+  TEST_ASSERT_EQUAL(DeltaStatus::Ok, diff.write(patch, n));
+  static const uint8_t rest[] = { 0, 0 };
+  TEST_ASSERT_EQUAL(DeltaStatus::Corrupt, diff.write(rest, sizeof(rest)));
+}
+
+static void test_truncated_stream()
+{
+  DeltaPatcher patcher(readOld, writeNew, &target);
+  TEST_ASSERT_EQUAL(DeltaStatus::Ok, patcher.write(fixturePatch, sizeof(fixturePatch) - 1));
+  TEST_ASSERT_LESS_THAN_UINT32(NEW_SIZE, patcher.written());
+  TEST_ASSERT_EQUAL(DeltaStatus::Done, patcher.write(fixturePatch + sizeof(fixturePatch) - 1, 1));
+
+  // Data after the end of the image
+  TEST_ASSERT_EQUAL(DeltaStatus::Corrupt, patcher.write(fixturePatch, 1));
+
+  // A stream cut off in the header never completes
+  setUp();
+  DeltaPatcher header(readOld, writeNew, &target);
+  TEST_ASSERT_EQUAL(DeltaStatus::Ok, header.write(fixturePatch, 20));
+  TEST_ASSERT_EQUAL_UINT32(0, header.newSize());
+  TEST_ASSERT_EQUAL_UINT32(0, target.length);
+}
+
+static void test_varint_overflow()
+{
+  uint8_t patch[DELTA_HEADER_SIZE + 5];
+  size_t n = handHeader(patch, 16);
+  memset(patch + n, 0x80, 5);
+  DeltaPatcher patcher(readOld, writeNew, &target);
+  TEST_ASSERT_EQUAL(DeltaStatus::Corrupt, patcher.write(patch, sizeof(patch)));
+}
+
+int main()
+{
+  buildImages();
+  UNITY_BEGIN();
+  RUN_TEST(test_fixture_in_one_chunk);
+  RUN_TEST(test_fixture_in_uneven_chunks);
+  RUN_TEST(test_expected_old_image);
+  RUN_TEST(test_bad_magic);
+  RUN_TEST(test_seek_past_old_image);
+  RUN_TEST(test_truncated_stream);
+  RUN_TEST(test_varint_overflow);
+  return UNITY_END();
+}
@@ -0,0 +1,164 @@
+/**
+ * @file test_main.cpp
+ * @author Christoff Linde
+ * @brief Host tests of the DHT-22 decoder, @see DHT22.h
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * The waveforms are pulse widths in the form DHT22::finish records them. They encode the example
+ * frames of the AM2302 datasheet, 65.2 %RH at 35.1 and at -10.1 degrees, with pulse widths spread
+ * over the tolerances of the datasheet timing.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <unity.h>
+
+#include "DHT22.h"
+
+/// 65.2 %RH, 35.1 C: 02 8C 01 5F EE
+static const uint16_t warmLow[DHT22_FRAME_BITS] = {
+  56, 56, 52, 54, 48, 48, 56, 50, 49, 54,
+  56, 51, 56, 53, 49, 54, 53, 52, 48, 55,
+  56, 54, 49, 49, 51, 54, 50, 54, 56, 51,
+  50, 53, 54, 55, 54, 50, 55, 52, 52, 50,
+};
+static const uint16_t warmHigh[DHT22_FRAME_BITS] = {
+  23, 25, 24, 26, 28, 25, 69, 28, 71, 26,
+  29, 24, 72, 71, 24, 23, 28, 27, 27, 23,
+  24, 28, 26, 68, 24, 73, 29, 68, 68, 69,
+  74, 72, 73, 72, 73, 24, 74, 71, 72, 25,
+};
+
+/// 65.2 %RH, -10.1 C: 02 8C 80 65 73
+static const uint16_t freezingLow[DHT22_FRAME_BITS] = {
+  52, 54, 56, 50, 53, 51, 53, 52, 54, 50,
+  54, 51, 55, 52, 56, 50, 51, 48, 55, 48,
+  50, 49, 51, 51, 52, 51, 50, 53, 51, 48,
+  52, 55, 51, 52, 55, 52, 54, 56, 51, 49,
+};
+static const uint16_t freezingHigh[DHT22_FRAME_BITS] = {
+  26, 24, 29, 27, 23, 26, 68, 26, 72, 27,
+  22, 30, 69, 72, 28, 25, 69, 29, 23, 29,
+  27, 27, 26, 26, 24, 72, 71, 24, 30, 75,
+  27, 73, 24, 69, 75, 73, 22, 22, 70, 68,
+};
+
+/// The frame of warm, with bit 29 read as 0 instead of 1
+static const uint16_t corruptLow[DHT22_FRAME_BITS] = {
+  52, 54, 56, 50, 54, 51, 49, 55, 53, 53,
+  48, 52, 56, 53, 48, 55, 55, 48, 52, 53,
+  52, 54, 51, 48, 48, 51, 53, 50, 51, 50,
+  52, 53, 52, 49, 54, 48, 53, 56, 54, 52,
+};
+static const uint16_t corruptHigh[DHT22_FRAME_BITS] = {
+  22, 24, 29, 30, 24, 23, 71, 28, 72, 22,
+  30, 24, 75, 73, 23, 22, 22, 29, 26, 24,
+  23, 28, 29, 71, 23, 70, 24, 73, 69, 24,
+  74, 74, 72, 75, 68, 24, 69, 75, 69, 25,
+};
+
+/// The frame of warm, from a sensor at the slow end of the timing
+static const uint16_t slowLow[DHT22_FRAME_BITS] = {
+  58, 59, 59, 64, 66, 63, 58, 63, 59, 60,
+  59, 59, 58, 64, 65, 63, 60, 66, 60, 58,
+  63, 66, 60, 63, 61, 62, 66, 59, 61, 65,
+  64, 59, 61, 60, 61, 66, 63, 60, 59, 64,
+};
+static const uint16_t slowHigh[DHT22_FRAME_BITS] = {
+  35, 37, 33, 34, 39, 36, 88, 34, 84, 39,
+  38, 36, 85, 85, 40, 37, 35, 40, 33, 34,
+  35, 35, 37, 87, 33, 84, 38, 80, 80, 88,
+  86, 80, 80, 87, 81, 40, 88, 80, 88, 36,
+};
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_decodes_datasheet_frame()
+{
+  uint8_t frame[5];
+  dht22DecodePulses(warmLow, warmHigh, frame);
+  const uint8_t expected[5] = { 0x02, 0x8C, 0x01, 0x5F, 0xEE };
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, frame, 5);
+
+  DHT22Reading reading;
+  TEST_ASSERT_EQUAL(DHT22Status::Ok, dht22DecodeCapture(warmLow, warmHigh, DHT22_FRAME_BITS, reading));
+  TEST_ASSERT_EQUAL_UINT16(652, reading.humidity);
+  TEST_ASSERT_EQUAL_INT16(351, reading.temperature);
+}
+
+static void test_decodes_negative_temperature()
+{
+  DHT22Reading reading;
+  TEST_ASSERT_EQUAL(DHT22Status::Ok, dht22DecodeCapture(freezingLow, freezingHigh, DHT22_FRAME_BITS, reading));
+  TEST_ASSERT_EQUAL_UINT16(652, reading.humidity);
+  TEST_ASSERT_EQUAL_INT16(-101, reading.temperature);
+}
+
+static void test_decodes_slow_sensor()
+{
+  DHT22Reading reading;
+  TEST_ASSERT_EQUAL(DHT22Status::Ok, dht22DecodeCapture(slowLow, slowHigh, DHT22_FRAME_BITS, reading));
+  TEST_ASSERT_EQUAL_UINT16(652, reading.humidity);
+  TEST_ASSERT_EQUAL_INT16(351, reading.temperature);
+}
+
+static void test_rejects_flipped_bit()
+{
+  DHT22Reading reading = { 123, 456 };
+  TEST_ASSERT_EQUAL(DHT22Status::Checksum, dht22DecodeCapture(corruptLow, corruptHigh, DHT22_FRAME_BITS, reading));
+  // A failed decode leaves the previous reading alone
+  TEST_ASSERT_EQUAL_INT16(123, reading.temperature);
+  TEST_ASSERT_EQUAL_UINT16(456, reading.humidity);
+}
+
+static void test_checksum_wraps()
+{
+  // 100.0 %RH, -20.0 C: the bytes add up to 0x233
+  const uint8_t frame[5] = { 0x03, 0xE8, 0x80, 0xC8, 0x33 };
+  DHT22Reading reading;
+  TEST_ASSERT_EQUAL(DHT22Status::Ok, dht22DecodeFrame(frame, reading));
+  TEST_ASSERT_EQUAL_UINT16(1000, reading.humidity);
+  TEST_ASSERT_EQUAL_INT16(-200, reading.temperature);
+
+  const uint8_t unwrapped[5] = { 0x03, 0xE8, 0x80, 0xC8, 0x00 };
+  TEST_ASSERT_EQUAL(DHT22Status::Checksum, dht22DecodeFrame(unwrapped, reading));
+}
+
+static void test_rejects_truncated_capture()
+{
+  DHT22Reading reading;
+  // The sensor stopped answering after 23 bits
+  TEST_ASSERT_EQUAL(DHT22Status::Timeout, dht22DecodeCapture(warmLow, warmHigh, 23, reading));
+  // One bit short, the checksum byte is incomplete
+  TEST_ASSERT_EQUAL(DHT22Status::Timeout, dht22DecodeCapture(warmLow, warmHigh, DHT22_FRAME_BITS - 1, reading));
+  TEST_ASSERT_EQUAL(DHT22Status::Timeout, dht22DecodeCapture(warmLow, warmHigh, 0, reading));
+}
+
+static void test_status_names()
+{
+  TEST_ASSERT_EQUAL_STRING("ok", dht22StatusName(DHT22Status::Ok));
+  TEST_ASSERT_EQUAL_STRING("timeout", dht22StatusName(DHT22Status::Timeout));
+  TEST_ASSERT_EQUAL_STRING("checksum", dht22StatusName(DHT22Status::Checksum));
+  TEST_ASSERT_EQUAL_STRING("too soon", dht22StatusName(DHT22Status::TooSoon));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_decodes_datasheet_frame);
+  RUN_TEST(test_decodes_negative_temperature);
+  RUN_TEST(test_decodes_slow_sensor);
+  RUN_TEST(test_rejects_flipped_bit);
+  RUN_TEST(test_checksum_wraps);
+  RUN_TEST(test_rejects_truncated_capture);
+  RUN_TEST(test_status_names);
+  return UNITY_END();
+}
@@ -0,0 +1,275 @@
+/**
+ * @file test_main.cpp
+ * @author Christoff Linde
+ * @brief Host tests of the ESP-NOW link, on the simulated radio of test/sim/espnow.h
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * A gateway and up to 25 leaves share the simulated air. The gateway side does what the main loop of
+ * the gateway does: it takes the received readings and answers each with a time beacon.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <unity.h>
+
+#include <ESP8266WiFi.h>
+#include <espnow.h>
+
+#include "EspNowLink.h"
+
+#define LEAF_COUNT 25
+
+static SimNode gateway;
+static SimNode leaves[LEAF_COUNT];
+
+/// UNIX time of the gateway at millis() 0
+static const uint32_t gatewayEpoch = 1617000000;
+
+static void selectLeaf(size_t i)
+{
+  simEspNowSelect(leaves[i]);
+  ESP.chipId = 0x00c0ffee + i;
+}
+
+/// Deliver every frame in flight
+static void deliverAll()
+{
+  std::initializer_list<SimNode*> nodes = { &gateway, &leaves[0], &leaves[1], &leaves[2], &leaves[3], &leaves[4],
+    &leaves[5], &leaves[6], &leaves[7], &leaves[8], &leaves[9], &leaves[10], &leaves[11], &leaves[12], &leaves[13],
+    &leaves[14], &leaves[15], &leaves[16], &leaves[17], &leaves[18], &leaves[19], &leaves[20], &leaves[21],
+    &leaves[22], &leaves[23], &leaves[24] };
+  while (simDeliver(nodes))
+  {
+  }
+}
+
+/// Answer the received readings, as the main loop of the gateway does
+static size_t serveLeaves()
+{
+  simEspNowSelect(gateway);
+  size_t served = 0;
+  LinkPacket packet;
+  while (linkReceive(packet))
+  {
+    uint32_t now = millis();
+    linkSendTime(packet, gatewayEpoch + now / 1000, now % 1000);
+    served++;
+  }
+  return served;
+}
+
+/// Number of frames in flight addressed to a node
+static size_t framesTo(const SimNode& node)
+{
+  size_t count = 0;
+  for (const SimFrame& frame : simAir)
+  {
+    count += frame.to == node.mac;
+  }
+  return count;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_begin()
+{
+  gateway.mac = { { 0x5C, 0xCF, 0x7F, 0x00, 0x00, 0x01 } };
+  simEspNowSelect(gateway);
+  TEST_ASSERT_TRUE(linkBeginGateway());
+
+  for (size_t i = 0; i < LEAF_COUNT; i++)
+  {
+    leaves[i].mac = { { 0x5C, 0xCF, 0x7F, 0x01, 0x00, (uint8_t)i } };
+    selectLeaf(i);
+    TEST_ASSERT_TRUE(linkBeginLeaf());
+  }
+  TEST_ASSERT_EQUAL(LINK_CHANNEL, simChannel);
+
+  // A leaf whose stack refuses the gateway as a peer reports it
+  SimNode full;
+  full.maxPeers = 0;
+  simEspNowSelect(full);
+  TEST_ASSERT_FALSE(linkBeginLeaf());
+}
+
+static void test_leaf_takes_time_from_beacon()
+{
+  simMillis = 100000;
+  uint32_t time;
+  selectLeaf(0);
+  TEST_ASSERT_FALSE(linkCurrentTime(time));
+
+  DHT22Reading reading = { 215, 652 };
+  TEST_ASSERT_TRUE(linkSendReading(reading, 0));
+  TEST_ASSERT_FALSE(linkAnswered());
+  simAdvance(4);
+  deliverAll();
+
+  // The reading waits 6 ms on the gateway, and the beacon takes 4 ms back
+  simAdvance(6);
+  simEspNowSelect(gateway);
+  LinkPacket packet;
+  TEST_ASSERT_TRUE(linkReceive(packet));
+  TEST_ASSERT_EQUAL_UINT32(0x00c0ffee, packet.reading.node);
+  TEST_ASSERT_EQUAL_UINT32(0, packet.reading.timestamp);
+  TEST_ASSERT_EQUAL_INT16(215, packet.reading.temperature);
+  TEST_ASSERT_EQUAL_UINT16(652, packet.reading.humidity);
+  TEST_ASSERT_EQUAL_UINT32(6, linkPacketAge(packet));
+  linkSendTime(packet, gatewayEpoch + 100, 10);
+  TEST_ASSERT_EQUAL(1, framesTo(leaves[0]));
+  simAdvance(4);
+  deliverAll();
+
+  // Round trip of 14 ms, less 6 ms held: the beacon sent at 100.010 s took 4 ms
+  selectLeaf(0);
+  TEST_ASSERT_TRUE(linkAnswered());
+  TEST_ASSERT_TRUE(linkCurrentTime(time));
+  TEST_ASSERT_EQUAL_UINT32(gatewayEpoch + 100, time);
+  simAdvance(985);
+  TEST_ASSERT_TRUE(linkCurrentTime(time));
+  TEST_ASSERT_EQUAL_UINT32(gatewayEpoch + 100, time);
+  simAdvance(1);
+  TEST_ASSERT_TRUE(linkCurrentTime(time));
+  TEST_ASSERT_EQUAL_UINT32(gatewayEpoch + 101, time);
+
+  // From now on the leaf timestamps its readings, less their age
+  TEST_ASSERT_TRUE(linkSendReading(reading, 5000));
+  deliverAll();
+  simEspNowSelect(gateway);
+  TEST_ASSERT_TRUE(linkReceive(packet));
+  TEST_ASSERT_EQUAL_UINT32(gatewayEpoch + 96, packet.reading.timestamp);
+  TEST_ASSERT_EQUAL_UINT32(5000, packet.reading.age);
+}
+
+static void test_beacon_for_other_reading_ignored()
+{
+  uint32_t before;
+  selectLeaf(0);
+  TEST_ASSERT_TRUE(linkCurrentTime(before));
+
+  DHT22Reading reading = { 215, 652 };
+  TEST_ASSERT_TRUE(linkSendReading(reading, 0));
+  deliverAll();
+  simEspNowSelect(gateway);
+  LinkPacket packet;
+  TEST_ASSERT_TRUE(linkReceive(packet));
+  // A late beacon for an earlier reading carries a stale round trip
+  packet.reading.seq--;
+  linkSendTime(packet, gatewayEpoch + 5000, 0);
+  deliverAll();
+
+  uint32_t after;
+  selectLeaf(0);
+  TEST_ASSERT_FALSE(linkAnswered());
+  TEST_ASSERT_TRUE(linkCurrentTime(after));
+  TEST_ASSERT_EQUAL_UINT32(before, after);
+}
+
+static void test_packet_age_counts_from_now()
+{
+  // The main loop takes its timestamp before the reading is received
+  uint32_t loopStarted = millis();
+  simAdvance(3);
+  selectLeaf(1);
+  DHT22Reading reading = { 200, 500 };
+  TEST_ASSERT_TRUE(linkSendReading(reading, 1500));
+  deliverAll();
+
+  simEspNowSelect(gateway);
+  LinkPacket packet;
+  TEST_ASSERT_TRUE(linkReceive(packet));
+  TEST_ASSERT_GREATER_THAN(loopStarted, packet.received);
+  TEST_ASSERT_EQUAL_UINT32(1500, linkPacketAge(packet));
+  simAdvance(250);
+  TEST_ASSERT_EQUAL_UINT32(1750, linkPacketAge(packet));
+  serveLeaves();
+  deliverAll();
+}
+
+static void test_peers_evicted_beyond_limit()
+{
+  // Every leaf gets its beacon, though only LINK_MAX_PEERS fit in the stack
+  for (size_t i = 0; i < LEAF_COUNT; i++)
+  {
+    simAdvance(1000);
+    selectLeaf(i);
+    DHT22Reading reading = { (int16_t)(200 + i), 500 };
+    TEST_ASSERT_TRUE(linkSendReading(reading, 0));
+    deliverAll();
+    TEST_ASSERT_EQUAL(1, serveLeaves());
+    TEST_ASSERT_EQUAL(1, framesTo(leaves[i]));
+    TEST_ASSERT_LESS_OR_EQUAL(LINK_MAX_PEERS, gateway.peers.size());
+    deliverAll();
+  }
+  TEST_ASSERT_EQUAL(LINK_MAX_PEERS, gateway.peers.size());
+  TEST_ASSERT_EQUAL(LEAF_COUNT - LINK_MAX_PEERS, gateway.peersDeleted);
+
+  // The leaves answered least recently were evicted
+  simEspNowSelect(gateway);
+  for (size_t i = 0; i < LEAF_COUNT; i++)
+  {
+    TEST_ASSERT_EQUAL(i >= LEAF_COUNT - LINK_MAX_PEERS, esp_now_is_peer_exist(leaves[i].mac.bytes) == 1);
+  }
+
+  // A leaf that comes back evicts the oldest one in turn
+  simAdvance(1000);
+  selectLeaf(0);
+  DHT22Reading reading = { 215, 652 };
+  TEST_ASSERT_TRUE(linkSendReading(reading, 0));
+  deliverAll();
+  TEST_ASSERT_EQUAL(1, serveLeaves());
+  TEST_ASSERT_EQUAL(1, framesTo(leaves[0]));
+  deliverAll();
+  simEspNowSelect(gateway);
+  TEST_ASSERT_EQUAL(1, esp_now_is_peer_exist(leaves[0].mac.bytes));
+  TEST_ASSERT_EQUAL(0, esp_now_is_peer_exist(leaves[LEAF_COUNT - LINK_MAX_PEERS].mac.bytes));
+}
+
+static void test_add_peer_failure()
+{
+  // The stack runs out of room before LINK_MAX_PEERS, the gateway makes room and retries
+  gateway.maxPeers = LINK_MAX_PEERS - 1;
+  uint32_t deleted = gateway.peersDeleted;
+  simAdvance(1000);
+  selectLeaf(1);
+  DHT22Reading reading = { 215, 652 };
+  TEST_ASSERT_TRUE(linkSendReading(reading, 0));
+  deliverAll();
+  TEST_ASSERT_EQUAL(1, serveLeaves());
+  TEST_ASSERT_EQUAL(1, framesTo(leaves[1]));
+  // One evicted for LINK_MAX_PEERS, one more for the retry
+  TEST_ASSERT_EQUAL(deleted + 2, gateway.peersDeleted);
+  TEST_ASSERT_EQUAL(LINK_MAX_PEERS - 1, gateway.peers.size());
+  deliverAll();
+
+  // A stack that takes no peers at all gets no beacons sent to it
+  gateway.maxPeers = 0;
+  simAdvance(1000);
+  selectLeaf(2);
+  TEST_ASSERT_TRUE(linkSendReading(reading, 0));
+  deliverAll();
+  TEST_ASSERT_EQUAL(1, serveLeaves());
+  TEST_ASSERT_EQUAL(0, framesTo(leaves[2]));
+  TEST_ASSERT_TRUE(simAir.empty());
+  gateway.maxPeers = SIM_ESPNOW_MAX_PEERS;
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_begin);
+  RUN_TEST(test_leaf_takes_time_from_beacon);
+  RUN_TEST(test_beacon_for_other_reading_ignored);
+  RUN_TEST(test_packet_age_counts_from_now);
+  RUN_TEST(test_peers_evicted_beyond_limit);
+  RUN_TEST(test_add_peer_failure);
+  return UNITY_END();
+}
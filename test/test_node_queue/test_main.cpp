@@ -0,0 +1,183 @@
+/**
+ * @file test_main.cpp
+ * @author Christoff Linde
+ * @brief Host tests of the per-node queues of the gateway, @see NodeQueue.h
+ * @version 0.1
+ * @date 2021-04-20
+ *
+ * The spill files and the state file are kept by the in-memory LittleFS of test/sim/LittleFS.h. The
+ * queues cannot be reset between tests, so the tests run in order, each draining what it queued.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <unity.h>
+
+#include <LittleFS.h>
+#include <string>
+#include <vector>
+
+#include "NodeQueue.h"
+
+static const uint32_t epoch = 1617000000;
+
+struct Forwarded
+{
+  uint32_t node;
+  QueuedReading reading;
+};
+
+static std::vector<Forwarded> forwarded;
+
+static void collect(uint32_t node, const QueuedReading& reading)
+{
+  forwarded.push_back({ node, reading });
+}
+
+/// Captures the statistics printed
+class StringPrint : public Print
+{
+public:
+  using Print::write;
+
+  size_t write(uint8_t c) override
+  {
+    text += (char)c;
+    return 1;
+  }
+
+  std::string text;
+};
+
+static std::string stats(uint32_t now)
+{
+  StringPrint out;
+  printNodeQueueStats(out, now);
+  return out.text;
+}
+
+static bool contains(const std::string& text, const char* part)
+{
+  return text.find(part) != std::string::npos;
+}
+
+static size_t drainAll()
+{
+  size_t total = 0;
+  size_t drained;
+  while ((drained = nodeQueueDrain(NODE_QUEUE_NODES * NODE_QUEUE_DEPTH, collect)) > 0)
+  {
+    total += drained;
+  }
+  return total;
+}
+
+void setUp()
+{
+  forwarded.clear();
+}
+
+void tearDown()
+{
+}
+
+static void test_restore_after_reset()
+{
+  // Left by the previous boot: the first reading of node a1 was forwarded, two were not
+  simFiles["/na1.txt"] = "1617000000,215,652\n1617000900,216,650\n1617001800,217,648\n";
+  simFiles["/nodes.txt"] = "a1 19\n";
+  nodeQueueBegin();
+  TEST_ASSERT_TRUE(contains(stats(epoch + 3600), "000000a1 queued 2 (0 spilled), lag 2700 s"));
+
+  TEST_ASSERT_EQUAL(2, drainAll());
+  TEST_ASSERT_EQUAL(2, forwarded.size());
+  TEST_ASSERT_EQUAL_UINT32(0xa1, forwarded[0].node);
+  TEST_ASSERT_EQUAL_UINT32(epoch + 900, forwarded[0].reading.timestamp);
+  TEST_ASSERT_EQUAL_INT16(216, forwarded[0].reading.temperature);
+  TEST_ASSERT_EQUAL_UINT16(650, forwarded[0].reading.humidity);
+  TEST_ASSERT_EQUAL_UINT32(epoch + 1800, forwarded[1].reading.timestamp);
+
+  // Everything forwarded, so the spill file goes and the node is no longer listed
+  TEST_ASSERT_FALSE(LittleFS.exists("/na1.txt"));
+  TEST_ASSERT_EQUAL_STRING("", simFiles["/nodes.txt"].c_str());
+}
+
+static void test_readings_journaled_before_queued()
+{
+  QueuedReading reading = { epoch, 200, 500 };
+  TEST_ASSERT_TRUE(nodeQueuePush(0xb1, reading));
+  // On flash before the drain, so a reset now loses nothing
+  TEST_ASSERT_EQUAL_STRING("1617000000,200,500\n", simFiles["/nb1.txt"].c_str());
+  TEST_ASSERT_TRUE(contains(simFiles["/nodes.txt"], "b1 0\n"));
+
+  TEST_ASSERT_EQUAL(1, drainAll());
+  TEST_ASSERT_FALSE(LittleFS.exists("/nb1.txt"));
+}
+
+static void test_lag_counts_spilled_readings()
+{
+  for (uint32_t i = 0; i < 3 * NODE_QUEUE_DEPTH; i++)
+  {
+    QueuedReading reading = { epoch + i * 900, 200, 500 };
+    TEST_ASSERT_TRUE(nodeQueuePush(0xc1, reading));
+  }
+  char expected[64];
+  snprintf(expected, sizeof(expected), "000000c1 queued %u (%u spilled), lag 36000 s", 3 * NODE_QUEUE_DEPTH,
+    3 * NODE_QUEUE_DEPTH);
+  TEST_ASSERT_TRUE(contains(stats(epoch + 36000), expected));
+
+  // Once the first readings went, the lag counts from the oldest one left
+  TEST_ASSERT_EQUAL(2, nodeQueueDrain(2, collect));
+  TEST_ASSERT_TRUE(contains(stats(epoch + 36000), "lag 34200 s"));
+
+  TEST_ASSERT_EQUAL(3 * NODE_QUEUE_DEPTH - 2, drainAll());
+  TEST_ASSERT_TRUE(contains(stats(epoch + 36000), "000000c1 queued 0 (0 spilled), lag 0 s"));
+}
+
+static void test_more_leaves_than_slots()
+{
+  // Leaves come and go, more of them than there are slots, and each is forwarded before the next
+  const uint32_t leaves = NODE_QUEUE_NODES + 8;
+  for (uint32_t i = 0; i < leaves; i++)
+  {
+    simAdvance(1000);
+    QueuedReading reading = { epoch + i, (int16_t)i, 500 };
+    TEST_ASSERT_TRUE(nodeQueuePush(0x1000 + i, reading));
+    TEST_ASSERT_EQUAL(1, drainAll());
+    TEST_ASSERT_EQUAL_UINT32(0x1000 + i, forwarded.back().node);
+    TEST_ASSERT_EQUAL_INT16(i, forwarded.back().reading.temperature);
+  }
+  TEST_ASSERT_TRUE(contains(stats(epoch), "0 readings dropped for unknown nodes"));
+
+  // With a reading pending in every slot, a further leaf has nowhere to go
+  for (uint32_t i = 0; i < NODE_QUEUE_NODES; i++)
+  {
+    simAdvance(1000);
+    QueuedReading reading = { epoch, 0, 500 };
+    TEST_ASSERT_TRUE(nodeQueuePush(0x2000 + i, reading));
+  }
+  QueuedReading late = { epoch, 0, 500 };
+  TEST_ASSERT_FALSE(nodeQueuePush(0x3000, late));
+  TEST_ASSERT_TRUE(contains(stats(epoch), "1 readings dropped for unknown nodes"));
+
+  // Once forwarded, the node idle longest gives up its slot
+  TEST_ASSERT_EQUAL(NODE_QUEUE_NODES, drainAll());
+  simAdvance(1000);
+  TEST_ASSERT_TRUE(nodeQueuePush(0x3000, late));
+  std::string text = stats(epoch);
+  TEST_ASSERT_TRUE(contains(text, "00003000 queued 1"));
+  TEST_ASSERT_FALSE(contains(text, "00002000 queued"));
+  TEST_ASSERT_TRUE(contains(text, "00002001 queued"));
+  TEST_ASSERT_EQUAL(1, drainAll());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_restore_after_reset);
+  RUN_TEST(test_readings_journaled_before_queued);
+  RUN_TEST(test_lag_counts_spilled_readings);
+  RUN_TEST(test_more_leaves_than_slots);
+  return UNITY_END();
+}
@@ -0,0 +1,277 @@
+/**
+ * @file test_main.cpp
+ * @author Christoff Linde
+ * @brief Host tests of the filter stages of the reading pipeline, @see ReadingPipeline.h
+ * @version 0.1
+ * @date 2021-04-26
+ *
+ * The stages are fed directly, with a functor collecting what they emit, and connected in a Pipeline
+ * to check the counts and flush(). Values are in hundredths, as in the log.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+#include "ReadingPipeline.h"
+
+/// Collects what a stage emits
+struct Collect
+{
+  std::vector<LogRecord> records;
+
+  void operator()(const LogRecord& record)
+  {
+    records.push_back(record);
+  }
+};
+
+/// Last stage of the test pipelines
+static std::vector<LogRecord> collected;
+
+class CollectStage : public PipelineStage
+{
+public:
+  static const char* name()
+  {
+    return "collect";
+  }
+
+  template <typename Emit>
+  void process(const LogRecord& record, Emit& emit)
+  {
+    collected.push_back(record);
+    emit(record);
+  }
+};
+
+/// Captures the statistics printed by a pipeline
+class StringPrint : public Print
+{
+public:
+  std::string text;
+
+  size_t write(uint8_t c) override
+  {
+    text += (char)c;
+    return 1;
+  }
+};
+
+static LogRecord reading(uint32_t timestamp, int32_t humidity, int32_t temperature)
+{
+  LogRecord record = { 0, timestamp, humidity, temperature, 0 };
+  return record;
+}
+
+void setUp()
+{
+  collected.clear();
+}
+
+void tearDown()
+{
+}
+
+static void test_outlier_range()
+{
+  OutlierFilter<2000, 1000> filter;
+  Collect emit;
+  // Out of the range of the DHT-22, each on its own
+  filter.process(reading(1, -1, 2000), emit);
+  filter.process(reading(2, 10001, 2000), emit);
+  filter.process(reading(3, 5000, -4001), emit);
+  filter.process(reading(4, 5000, 8001), emit);
+  TEST_ASSERT_EQUAL(0, emit.records.size());
+
+  // The limits themselves are in range, and the first reading is taken whatever its level
+  filter.process(reading(5, 0, -4000), emit);
+  TEST_ASSERT_EQUAL(1, emit.records.size());
+  OutlierFilter<20000, 20000> wide;
+  wide.process(reading(6, 10000, 8000), emit);
+  TEST_ASSERT_EQUAL(2, emit.records.size());
+  TEST_ASSERT_EQUAL_UINT32(6, emit.records[1].timestamp);
+}
+
+static void test_outlier_spike()
+{
+  OutlierFilter<2000, 1000> filter;
+  Collect emit;
+  filter.process(reading(1, 5000, 2000), emit);
+  // A step of exactly the maximum is accepted, one more is not
+  filter.process(reading(2, 7000, 2000), emit);
+  filter.process(reading(3, 9001, 2000), emit);
+  filter.process(reading(4, 7000, 3000), emit);
+  filter.process(reading(5, 7000, 4001), emit);
+  filter.process(reading(6, 7000, -1000), emit);
+  TEST_ASSERT_EQUAL(3, emit.records.size());
+  TEST_ASSERT_EQUAL_UINT32(1, emit.records[0].timestamp);
+  TEST_ASSERT_EQUAL_UINT32(2, emit.records[1].timestamp);
+  TEST_ASSERT_EQUAL_UINT32(4, emit.records[2].timestamp);
+}
+
+static void test_outlier_level_change()
+{
+  OutlierFilter<2000, 1000> filter;
+  Collect emit;
+  filter.process(reading(1, 5000, 2000), emit);
+  // A real change is rejected OUTLIER_MAX_REJECTS times, then taken as the new level
+  for (uint32_t t = 2; t < 2 + OUTLIER_MAX_REJECTS; t++)
+  {
+    filter.process(reading(t, 5000, 3500), emit);
+  }
+  TEST_ASSERT_EQUAL(1, emit.records.size());
+  filter.process(reading(10, 5000, 3500), emit);
+  filter.process(reading(11, 5000, 3600), emit);
+  TEST_ASSERT_EQUAL(3, emit.records.size());
+  TEST_ASSERT_EQUAL_INT32(3500, emit.records[1].temperature);
+
+  // An accepted reading resets the count
+  filter.process(reading(12, 5000, 1000), emit);
+  filter.process(reading(13, 5000, 3700), emit);
+  filter.process(reading(14, 5000, 1000), emit);
+  TEST_ASSERT_EQUAL(4, emit.records.size());
+  TEST_ASSERT_EQUAL_UINT32(13, emit.records[3].timestamp);
+}
+
+static void test_deadband()
+{
+  Deadband<50, 20, 4> deadband;
+  Collect emit;
+  deadband.process(reading(1, 5000, 2000), emit);
+  // Changes below either band are dropped, measured from the last reading passed on
+  deadband.process(reading(2, 5030, 2010), emit);
+  deadband.process(reading(3, 5049, 2019), emit);
+  deadband.process(reading(4, 5050, 2000), emit);
+  deadband.process(reading(5, 5050, 1980), emit);
+  deadband.process(reading(6, 5051, 1981), emit);
+  TEST_ASSERT_EQUAL(3, emit.records.size());
+  TEST_ASSERT_EQUAL_UINT32(1, emit.records[0].timestamp);
+  TEST_ASSERT_EQUAL_UINT32(4, emit.records[1].timestamp);
+  TEST_ASSERT_EQUAL_UINT32(5, emit.records[2].timestamp);
+}
+
+static void test_deadband_max_skip()
+{
+  Deadband<50, 20, 4> deadband;
+  Collect emit;
+  // A steady sensor is still heard from after MaxSkip readings dropped in a row
+  for (uint32_t t = 0; t < 11; t++)
+  {
+    deadband.process(reading(t, 5000, 2000), emit);
+  }
+  TEST_ASSERT_EQUAL(3, emit.records.size());
+  TEST_ASSERT_EQUAL_UINT32(0, emit.records[0].timestamp);
+  TEST_ASSERT_EQUAL_UINT32(5, emit.records[1].timestamp);
+  TEST_ASSERT_EQUAL_UINT32(10, emit.records[2].timestamp);
+
+  // Bands of 0 pass every reading
+  Deadband<0, 0, 4> off;
+  Collect all;
+  for (uint32_t t = 0; t < 10; t++)
+  {
+    off.process(reading(t, 5000, 2000), all);
+  }
+  TEST_ASSERT_EQUAL(10, all.records.size());
+}
+
+static void test_aggregator()
+{
+  Aggregator<3> aggregator;
+  Collect emit;
+  aggregator.process(reading(100, 5000, -100), emit);
+  aggregator.process(reading(200, 5001, -200), emit);
+  TEST_ASSERT_EQUAL(0, emit.records.size());
+  aggregator.process(reading(400, 5001, -200), emit);
+  TEST_ASSERT_EQUAL(1, emit.records.size());
+  // Halfway between the first and the last, means rounded half away from zero
+  TEST_ASSERT_EQUAL_UINT32(250, emit.records[0].timestamp);
+  TEST_ASSERT_EQUAL_INT32(5001, emit.records[0].humidity);
+  TEST_ASSERT_EQUAL_INT32(-167, emit.records[0].temperature);
+
+  aggregator.process(reading(500, 4000, 10), emit);
+  aggregator.process(reading(600, 4001, 11), emit);
+  aggregator.process(reading(700, 4001, 11), emit);
+  TEST_ASSERT_EQUAL(2, emit.records.size());
+  TEST_ASSERT_EQUAL_UINT32(600, emit.records[1].timestamp);
+  TEST_ASSERT_EQUAL_INT32(4001, emit.records[1].humidity);
+  TEST_ASSERT_EQUAL_INT32(11, emit.records[1].temperature);
+}
+
+static void test_aggregator_flush()
+{
+  Aggregator<4> aggregator;
+  Collect emit;
+  aggregator.flush(emit);
+  TEST_ASSERT_EQUAL(0, emit.records.size());
+
+  aggregator.process(reading(1000, 5000, -5), emit);
+  aggregator.process(reading(1901, 5003, -6), emit);
+  aggregator.flush(emit);
+  TEST_ASSERT_EQUAL(1, emit.records.size());
+  TEST_ASSERT_EQUAL_UINT32(1450, emit.records[0].timestamp);
+  TEST_ASSERT_EQUAL_INT32(5002, emit.records[0].humidity);
+  TEST_ASSERT_EQUAL_INT32(-6, emit.records[0].temperature);
+
+  // The next window starts empty
+  aggregator.flush(emit);
+  TEST_ASSERT_EQUAL(1, emit.records.size());
+  for (uint32_t t = 0; t < 4; t++)
+  {
+    aggregator.process(reading(3000 + t, 100, 100), emit);
+  }
+  TEST_ASSERT_EQUAL(2, emit.records.size());
+  TEST_ASSERT_EQUAL_INT32(100, emit.records[1].humidity);
+
+  Aggregator<1> single;
+  single.process(reading(7, 1234, -1234), emit);
+  TEST_ASSERT_EQUAL(3, emit.records.size());
+  TEST_ASSERT_EQUAL_UINT32(7, emit.records[2].timestamp);
+  TEST_ASSERT_EQUAL_INT32(-1234, emit.records[2].temperature);
+}
+
+static void test_pipeline_flush_and_stats()
+{
+  Pipeline<OutlierFilter<2000, 1000>, Deadband<50, 20, 4>, Aggregator<2>, CollectStage> pipeline;
+  pipeline.push(reading(0, 5000, 2000));
+  pipeline.push(reading(1, 9000, 2000));
+  pipeline.push(reading(2, 5100, 2000));
+  pipeline.push(reading(3, 5110, 2000));
+  pipeline.push(reading(4, 5200, 2000));
+  TEST_ASSERT_EQUAL(1, collected.size());
+  TEST_ASSERT_EQUAL_INT32(5050, collected[0].humidity);
+
+  // The partial window is only passed on by flush
+  pipeline.flush();
+  TEST_ASSERT_EQUAL(2, collected.size());
+  TEST_ASSERT_EQUAL_UINT32(4, collected[1].timestamp);
+  TEST_ASSERT_EQUAL_INT32(5200, collected[1].humidity);
+  pipeline.flush();
+  TEST_ASSERT_EQUAL(2, collected.size());
+
+  StringPrint out;
+  pipeline.printStats(out);
+  TEST_ASSERT_EQUAL_STRING("Stage outlier           5 in        4 out\r\n"
+                           "Stage deadband          4 in        3 out\r\n"
+                           "Stage aggregate         3 in        2 out\r\n"
+                           "Stage collect           2 in        2 out\r\n",
+    out.text.c_str());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_outlier_range);
+  RUN_TEST(test_outlier_spike);
+  RUN_TEST(test_outlier_level_change);
+  RUN_TEST(test_deadband);
+  RUN_TEST(test_deadband_max_skip);
+  RUN_TEST(test_aggregator);
+  RUN_TEST(test_aggregator_flush);
+  RUN_TEST(test_pipeline_flush_and_stats);
+  return UNITY_END();
+}
@@ -0,0 +1,183 @@
+/**
+ * @file test_main.cpp
+ * @author Christoff Linde
+ * @brief Host tests of the single producer, single consumer queue, @see SpscQueue.h
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * The stress tests run the producer and the consumer on their own threads, as a callback and the main
+ * loop are on the device, through a small queue so the indices wrap around the buffer many times. Each
+ * item carries its sequence number in every field, so a torn or stale slot shows up as well as a lost,
+ * repeated or reordered item.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <unity.h>
+
+#include <atomic>
+#include <thread>
+
+#include "SpscQueue.h"
+
+/// Items passed through the queue by each stress test
+#define STRESS_ITEMS 2000000UL
+
+struct StressItem
+{
+  uint32_t seq;
+  uint32_t inverted;
+  uint64_t squared;
+};
+
+static StressItem makeItem(uint32_t seq)
+{
+  return { seq, ~seq, (uint64_t)seq * seq };
+}
+
+static bool itemIntact(const StressItem& item)
+{
+  return item.inverted == ~item.seq && item.squared == (uint64_t)item.seq * item.seq;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_fill_and_drain()
+{
+  SpscQueue<uint32_t, 4> queue;
+  uint32_t item;
+  TEST_ASSERT_FALSE(queue.pop(item));
+
+  // Several times around the buffer, filled up each time
+  for (uint32_t round = 0; round < 5; round++)
+  {
+    for (uint32_t i = 0; i < 4; i++)
+    {
+      TEST_ASSERT_TRUE(queue.push(round * 10 + i));
+    }
+    TEST_ASSERT_EQUAL(4, queue.size());
+    TEST_ASSERT_FALSE(queue.push(99));
+    TEST_ASSERT_EQUAL_UINT32(round + 1, queue.overflows());
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+      TEST_ASSERT_TRUE(queue.pop(item));
+      TEST_ASSERT_EQUAL_UINT32(round * 10 + i, item);
+    }
+    TEST_ASSERT_FALSE(queue.pop(item));
+    TEST_ASSERT_EQUAL(0, queue.size());
+  }
+
+  // Partly filled, so the items straddle the end of the buffer
+  TEST_ASSERT_TRUE(queue.push(1));
+  TEST_ASSERT_TRUE(queue.push(2));
+  TEST_ASSERT_TRUE(queue.pop(item));
+  TEST_ASSERT_TRUE(queue.push(3));
+  TEST_ASSERT_TRUE(queue.push(4));
+  TEST_ASSERT_TRUE(queue.push(5));
+  for (uint32_t expected = 2; expected <= 5; expected++)
+  {
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL_UINT32(expected, item);
+  }
+}
+
+/**
+ * @brief Pass STRESS_ITEMS items from a producer thread to the consumer
+ *
+ * @param retry whether the producer pushes a rejected item again, or drops it as a callback would
+ */
+template <size_t Capacity>
+static void stress(bool retry)
+{
+  SpscQueue<StressItem, Capacity> queue;
+  uint32_t rejected = 0;
+  std::atomic<bool> done(false);
+
+  std::thread producer([&]() {
+    for (uint32_t seq = 0; seq < STRESS_ITEMS; seq++)
+    {
+      while (!queue.push(makeItem(seq)))
+      {
+        rejected++;
+        if (!retry)
+        {
+          break;
+        }
+        std::this_thread::yield();
+      }
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  uint32_t received = 0;
+  uint32_t torn = 0;
+  uint32_t outOfOrder = 0;
+  int64_t last = -1;
+  StressItem item;
+  while (true)
+  {
+    // Read before the pop, so an empty queue after the producer finished means it was drained
+    bool finished = done.load(std::memory_order_acquire);
+    if (!queue.pop(item))
+    {
+      if (finished)
+      {
+        break;
+      }
+      std::this_thread::yield();
+      continue;
+    }
+    received++;
+    torn += !itemIntact(item);
+    // Dropped items leave gaps, but never reorder the rest
+    outOfOrder += retry ? item.seq != last + 1 : item.seq <= last;
+    last = item.seq;
+  }
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_EQUAL_UINT32(0, outOfOrder);
+  TEST_ASSERT_EQUAL_UINT32(rejected, queue.overflows());
+  if (retry)
+  {
+    TEST_ASSERT_EQUAL_UINT32(STRESS_ITEMS, received);
+  }
+  else
+  {
+    // Only the items refused for a full queue are missing
+    TEST_ASSERT_EQUAL_UINT32(STRESS_ITEMS, received + rejected);
+  }
+}
+
+static void test_threads_lose_nothing()
+{
+  stress<16>(true);
+}
+
+static void test_threads_lose_nothing_in_tiny_queue()
+{
+  stress<2>(true);
+}
+
+static void test_threads_only_drop_refused_items()
+{
+  stress<16>(false);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fill_and_drain);
+  RUN_TEST(test_threads_lose_nothing);
+  RUN_TEST(test_threads_lose_nothing_in_tiny_queue);
+  RUN_TEST(test_threads_only_drop_refused_items);
+  return UNITY_END();
+}
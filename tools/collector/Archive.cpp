@@ -0,0 +1,435 @@
+/**
+ * @file Archive.cpp
+ * @author Christoff Linde
+ * @brief Columnar archive implementation
+ * @version 0.1
+ * @date 2021-04-11
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "Archive.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(ArchiveChunkHeader) == 44, "ArchiveChunkHeader must not be padded");
+
+#define SECONDS_PER_DAY 86400
+
+struct CrcTable
+{
+  uint32_t entries[256];
+
+  CrcTable()
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++)
+      {
+        crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+static uint32_t crc32(const uint8_t* data, size_t len)
+{
+  // Built once on first use, safely even when several worker threads get here together
+  static const CrcTable table;
+  const uint32_t* crcTable = table.entries;
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static inline uint64_t zigzag(int64_t value)
+{
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+static inline uint8_t bitWidth(uint64_t value)
+{
+  uint8_t width = 0;
+  while (value != 0)
+  {
+    width++;
+    value >>= 1;
+  }
+  return width;
+}
+
+static int32_t quantize(float value)
+{
+  if (std::isnan(value))
+  {
+    return ARCHIVE_MISSING;
+  }
+  return static_cast<int32_t>(std::lround(value * 100.0f));
+}
+
+static float dequantize(int32_t value)
+{
+  return value == ARCHIVE_MISSING ? NAN : value / 100.0f;
+}
+
+/// Packs values of a fixed bit width, least significant bit first. Widths stay below 57 bits
+class BitWriter
+{
+public:
+  explicit BitWriter(std::vector<uint8_t>& out) : _out(out), _bits(0), _used(0)
+  {
+  }
+
+  void write(uint64_t value, uint8_t width)
+  {
+    _bits |= value << _used;
+    _used += width;
+    while (_used >= 8)
+    {
+      _out.push_back(static_cast<uint8_t>(_bits));
+      _bits >>= 8;
+      _used -= 8;
+    }
+  }
+
+  /// Pad to the next byte boundary
+  void flush()
+  {
+    if (_used > 0)
+    {
+      _out.push_back(static_cast<uint8_t>(_bits));
+      _bits = 0;
+      _used = 0;
+    }
+  }
+
+private:
+  std::vector<uint8_t>& _out;
+  uint64_t _bits;
+  uint8_t _used;
+};
+
+/// Unpacks values written by BitWriter
+class BitReader
+{
+public:
+  BitReader(const uint8_t* data, size_t len) : _data(data), _len(len), _bit(0)
+  {
+  }
+
+  uint64_t read(uint8_t width)
+  {
+    size_t byte = _bit >> 3;
+    uint64_t word = 0;
+    if (byte < _len)
+    {
+      memcpy(&word, _data + byte, std::min<size_t>(sizeof(word), _len - byte));
+    }
+    uint64_t value = (word >> (_bit & 7)) & ((uint64_t(1) << width) - 1);
+    _bit += width;
+    return value;
+  }
+
+  /// Skip to the next byte boundary
+  void align()
+  {
+    _bit = (_bit + 7) & ~static_cast<size_t>(7);
+  }
+
+private:
+  const uint8_t* _data;
+  size_t _len;
+  size_t _bit;
+};
+
+/// Relative path of the file holding a sensor's readings of a day
+static std::string dayFile(uint32_t sensor, uint32_t day)
+{
+  time_t midnight = static_cast<time_t>(day) * SECONDS_PER_DAY;
+  struct tm date;
+  gmtime_r(&midnight, &date);
+  char name[32];
+  snprintf(name, sizeof(name), "%x/%04d%02d%02d.mca", sensor, date.tm_year + 1900, date.tm_mon + 1, date.tm_mday);
+  return name;
+}
+
+ArchiveWriter::ArchiveWriter(const std::string& root) : _root(root), _bytesWritten(0)
+{
+}
+
+size_t ArchiveWriter::append(uint32_t device, const ReadingColumns& columns)
+{
+  // Rows of every sensor and day, in upload order
+  std::map<std::pair<uint32_t, uint32_t>, std::vector<size_t>> parts;
+  for (size_t row = 0; row < columns.size(); row++)
+  {
+    uint32_t sensor = columns.node[row] != 0 ? columns.node[row] : device;
+    parts[{ sensor, columns.timestamp[row] / SECONDS_PER_DAY }].push_back(row);
+  }
+
+  size_t written = 0;
+  for (const auto& part : parts)
+  {
+    if (appendChunk(part.first.first, part.first.second, columns, part.second.data(), part.second.size()))
+    {
+      written += part.second.size();
+    }
+  }
+  return written;
+}
+
+IngestResult ArchiveWriter::appendEnvelope(const char* data, size_t len)
+{
+  BatchHeader header;
+  _scratch.clear();
+  IngestResult result = parseEnvelope(data, len, header, _scratch);
+  if (result.status == IngestStatus::Ok)
+  {
+    append(header.device, _scratch);
+  }
+  return result;
+}
+
+bool ArchiveWriter::appendChunk(uint32_t sensor, uint32_t day, const ReadingColumns& columns, const size_t* rows,
+  size_t count)
+{
+  std::vector<int64_t> values[4];
+  for (auto& column : values)
+  {
+    column.reserve(count);
+  }
+  ArchiveChunkHeader header = {};
+  header.magic = ARCHIVE_MAGIC;
+  header.count = static_cast<uint32_t>(count);
+  header.minTimestamp = UINT32_MAX;
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t row = rows[i];
+    uint32_t timestamp = columns.timestamp[row];
+    header.minTimestamp = std::min(header.minTimestamp, timestamp);
+    header.maxTimestamp = std::max(header.maxTimestamp, timestamp);
+    values[0].push_back(columns.seq[row]);
+    values[1].push_back(timestamp);
+    values[2].push_back(quantize(columns.humidity[row]));
+    values[3].push_back(quantize(columns.temperature[row]));
+  }
+  header.firstSeq = static_cast<uint32_t>(values[0][0]);
+  header.firstTimestamp = static_cast<uint32_t>(values[1][0]);
+  header.firstHumidity = static_cast<int32_t>(values[2][0]);
+  header.firstTemperature = static_cast<int32_t>(values[3][0]);
+
+  std::vector<uint8_t> chunk(sizeof(ArchiveChunkHeader));
+  BitWriter writer(chunk);
+  for (int c = 0; c < 4; c++)
+  {
+    uint64_t widest = 0;
+    for (size_t i = 1; i < count; i++)
+    {
+      widest |= zigzag(values[c][i] - values[c][i - 1]);
+    }
+    header.widths[c] = bitWidth(widest);
+    for (size_t i = 1; i < count; i++)
+    {
+      writer.write(zigzag(values[c][i] - values[c][i - 1]), header.widths[c]);
+    }
+    writer.flush();
+  }
+  header.payloadSize = static_cast<uint32_t>(chunk.size() - sizeof(ArchiveChunkHeader));
+  header.crc = crc32(chunk.data() + sizeof(ArchiveChunkHeader), header.payloadSize);
+  memcpy(chunk.data(), &header, sizeof(header));
+
+  std::filesystem::path path = std::filesystem::path(_root) / dayFile(sensor, day);
+
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+  // A single write, so a crash leaves at most one partial chunk at the end of the file
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0)
+  {
+    perror(path.c_str());
+    return false;
+  }
+  ssize_t written = ::write(fd, chunk.data(), chunk.size());
+  ::close(fd);
+  if (written != static_cast<ssize_t>(chunk.size()))
+  {
+    perror(path.c_str());
+    return false;
+  }
+  _bytesWritten += chunk.size();
+  return true;
+}
+
+ArchiveReader::ArchiveReader() : _data(nullptr), _size(0), _damaged(false)
+{
+}
+
+ArchiveReader::~ArchiveReader()
+{
+  close();
+}
+
+bool ArchiveReader::open(const std::string& path)
+{
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+  _data = static_cast<const uint8_t*>(data);
+  _size = info.st_size;
+  return true;
+}
+
+void ArchiveReader::close()
+{
+  if (_data != nullptr)
+  {
+    munmap(const_cast<uint8_t*>(_data), _size);
+    _data = nullptr;
+    _size = 0;
+  }
+}
+
+size_t ArchiveReader::read(uint32_t from, uint32_t to, ReadingColumns& columns)
+{
+  _damaged = false;
+  size_t appended = 0;
+  size_t pos = 0;
+  while (pos < _size)
+  {
+    ArchiveChunkHeader header;
+    if (_size - pos < sizeof(header))
+    {
+      _damaged = true;
+      break;
+    }
+    memcpy(&header, _data + pos, sizeof(header));
+    const uint8_t* payload = _data + pos + sizeof(header);
+    if (header.magic != ARCHIVE_MAGIC || header.count == 0 || header.payloadSize > _size - pos - sizeof(header)
+      || crc32(payload, header.payloadSize) != header.crc)
+    {
+      // Resume at the next chunk appended after the damaged one
+      _damaged = true;
+      pos++;
+      while (pos + sizeof(uint32_t) <= _size)
+      {
+        uint32_t magic;
+        memcpy(&magic, _data + pos, sizeof(magic));
+        if (magic == ARCHIVE_MAGIC)
+        {
+          break;
+        }
+        pos++;
+      }
+      continue;
+    }
+    pos += sizeof(header) + header.payloadSize;
+    if (header.maxTimestamp < from || header.minTimestamp > to)
+    {
+      continue;
+    }
+
+    // Decode column by column, keeping the running values of every row
+    std::vector<int64_t> values[4];
+    int64_t first[4] = { header.firstSeq, header.firstTimestamp, header.firstHumidity, header.firstTemperature };
+    BitReader reader(payload, header.payloadSize);
+    for (int c = 0; c < 4; c++)
+    {
+      values[c].resize(header.count);
+      int64_t value = first[c];
+      values[c][0] = value;
+      for (uint32_t i = 1; i < header.count; i++)
+      {
+        value += unzigzag(reader.read(header.widths[c]));
+        values[c][i] = value;
+      }
+      reader.align();
+    }
+
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+      uint32_t timestamp = static_cast<uint32_t>(values[1][i]);
+      if (timestamp < from || timestamp > to)
+      {
+        continue;
+      }
+      columns.seq.push_back(static_cast<uint32_t>(values[0][i]));
+      columns.timestamp.push_back(timestamp);
+      columns.humidity.push_back(dequantize(static_cast<int32_t>(values[2][i])));
+      columns.temperature.push_back(dequantize(static_cast<int32_t>(values[3][i])));
+      columns.node.push_back(0);
+      appended++;
+    }
+  }
+  return appended;
+}
+
+size_t archiveQuery(const std::string& root, uint32_t sensor, uint32_t from, uint32_t to, ReadingColumns& columns)
+{
+  // List the day files of the sensor instead of probing every day of a long range
+  char directory[16];
+  snprintf(directory, sizeof(directory), "%x", sensor);
+  std::error_code error;
+  std::vector<std::string> files;
+  std::string first = dayFile(sensor, from / SECONDS_PER_DAY);
+  std::string last = dayFile(sensor, to / SECONDS_PER_DAY);
+  for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(root) / directory, error))
+  {
+    // Day files are named yyyymmdd.mca, so they sort by date
+    std::string name = std::string(directory) + "/" + entry.path().filename().string();
+    if (name >= first && name <= last)
+    {
+      files.push_back(name);
+    }
+  }
+  std::sort(files.begin(), files.end());
+
+  size_t appended = 0;
+  ArchiveReader reader;
+  for (const std::string& file : files)
+  {
+    if (reader.open((std::filesystem::path(root) / file).string()))
+    {
+      appended += reader.read(from, to, columns);
+    }
+  }
+  return appended;
+}
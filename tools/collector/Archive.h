@@ -0,0 +1,166 @@
+/**
+ * @file Archive.h
+ * @author Christoff Linde
+ * @brief Append-only columnar archive of readings, one file per device per day
+ * @version 0.1
+ * @date 2021-04-11
+ *
+ * Readings are stored under <root>/<device>/<yyyymmdd>.mca, where device is the chip id in hex of
+ * the sensor the reading came from: the leaf for relayed readings, the uploading device otherwise. The
+ * day is taken in UTC from the timestamp of the reading.
+ *
+ * A file is a sequence of chunks, one per appended batch and day. Each chunk starts with an
+ * ArchiveChunkHeader, followed by the columns:
+ *  \li seq and timestamp as zigzag deltas from the previous reading
+ *  \li humidity and temperature quantized to hundredths, as zigzag deltas from the previous reading
+ * Each column is bit-packed at the width of its largest delta and starts on a byte boundary. A
+ * missing value is stored as ARCHIVE_MISSING before quantizing.
+ *
+ * Chunks are only ever appended, each with a single write. A chunk cut short by a crash fails its
+ * length or CRC check. Readers skip it and resume at the next chunk magic, so only that chunk is lost.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Ingest.h"
+
+/// Magic number at the start of every chunk
+#define ARCHIVE_MAGIC 0x3141434d
+
+/// Quantized value of a missing reading
+#define ARCHIVE_MISSING INT32_MIN
+
+/// Header of a chunk, stored little-endian
+struct ArchiveChunkHeader
+{
+  uint32_t magic;
+  uint32_t count;
+  uint32_t minTimestamp;
+  uint32_t maxTimestamp;
+  /// First value of every column, the rest are deltas
+  uint32_t firstSeq;
+  uint32_t firstTimestamp;
+  int32_t firstHumidity;
+  int32_t firstTemperature;
+  /// Bit width of the seq, timestamp, humidity and temperature deltas
+  uint8_t widths[4];
+  /// Size of the packed columns following the header
+  uint32_t payloadSize;
+  /// CRC-32 of the packed columns
+  uint32_t crc;
+};
+
+/// Appends readings to the archive
+class ArchiveWriter
+{
+public:
+  /**
+   * @brief Create a writer
+   *
+   * @param root the directory the archive is kept in, created on the first append
+   */
+  explicit ArchiveWriter(const std::string& root);
+
+  /**
+   * @brief Append readings uploaded by a device
+   *
+   * @details The readings are split by sensor and day, and each part is appended as one chunk. May be
+   * called from several threads at once, as long as they append for different devices.
+   *
+   * @param device chip id of the uploading device
+   * @param columns the readings
+   * @return size_t - the number of readings written
+   */
+  size_t append(uint32_t device, const ReadingColumns& columns);
+
+  /**
+   * @brief Parse a JSON batch envelope and append its readings
+   *
+   * @param data the body
+   * @param len the length of the body
+   * @return IngestResult - the outcome of parsing. Nothing is written if the body does not parse
+   */
+  IngestResult appendEnvelope(const char* data, size_t len);
+
+  /// Number of bytes written to chunks, headers included
+  uint64_t bytesWritten() const
+  {
+    return _bytesWritten;
+  }
+
+private:
+  bool appendChunk(uint32_t sensor, uint32_t day, const ReadingColumns& columns, const size_t* rows, size_t count);
+
+  std::string _root;
+  std::atomic<uint64_t> _bytesWritten;
+  ReadingColumns _scratch;
+};
+
+/// Reads the chunks of a single archive file through a memory mapping
+class ArchiveReader
+{
+public:
+  ArchiveReader();
+  ~ArchiveReader();
+  ArchiveReader(const ArchiveReader&) = delete;
+  ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+  /**
+   * @brief Map an archive file
+   *
+   * @param path the file to map
+   * @return true if the file was mapped
+   */
+  bool open(const std::string& path);
+
+  /// Unmap the file
+  void close();
+
+  /**
+   * @brief Append the readings within a time range to the columns
+   *
+   * @details Chunks outside the range are skipped on their header. Damaged chunks are skipped.
+   *
+   * @param from the first timestamp to include
+   * @param to the last timestamp to include
+   * @param columns the columns to append to. The node column is set to 0
+   * @return size_t - the number of readings appended
+   */
+  size_t read(uint32_t from, uint32_t to, ReadingColumns& columns);
+
+  /// True if the last read skipped a damaged or truncated chunk
+  bool damaged() const
+  {
+    return _damaged;
+  }
+
+private:
+  const uint8_t* _data;
+  size_t _size;
+  bool _damaged;
+};
+
+/**
+ * @brief Read the readings of a sensor within a time range
+ *
+ * @details Only the day files overlapping the range are opened, in date order.
+ *
+ * @param root the directory of the archive
+ * @param sensor chip id of the sensor
+ * @param from the first timestamp to include
+ * @param to the last timestamp to include
+ * @param columns the columns to append to
+ * @return size_t - the number of readings appended
+ */
+size_t archiveQuery(const std::string& root, uint32_t sensor, uint32_t from, uint32_t to, ReadingColumns& columns);
+
+#endif
@@ -0,0 +1,278 @@
+/**
+ * @file ArchiveTest.cpp
+ * @author Christoff Linde
+ * @brief Tests of the columnar archive, @see Archive.h
+ * @version 0.1
+ * @date 2021-04-26
+ *
+ * A gateway uploads batches holding its own readings and those of two leaves, every 15 minutes across
+ * midnight UTC. The batches are written as envelopes by the firmware's writers from
+ * include/ReadingSchema.h and appended to an archive in a temporary directory, then queried back.
+ *
+ * Run with ctest, or directly: archive_test
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Archive.h"
+#include "ReadingSchema.h"
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+  if (!condition)
+  {
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+/// Collects the output of the firmware's writers
+struct StringSink
+{
+  std::string text;
+
+  size_t write(const uint8_t* data, size_t len)
+  {
+    text.append(reinterpret_cast<const char*>(data), len);
+    return len;
+  }
+};
+
+#define GATEWAY 0xe1f0c2
+#define MIDNIGHT 1616457600
+#define BATCHES 8
+#define BATCH_SIZE 6
+
+static const uint32_t sensors[] = { GATEWAY, 0xa1b2c3, 0x1 };
+
+/// A reading as it should come back from the archive
+struct Expected
+{
+  uint32_t sensor;
+  uint32_t seq;
+  uint32_t timestamp;
+  int32_t humidity;
+  int32_t temperature;
+};
+
+static std::vector<Expected> expected;
+
+static int32_t centi(float value)
+{
+  return static_cast<int32_t>(lroundf(value * 100));
+}
+
+/// Readings of a sensor within a time range, in the order they were uploaded
+static std::vector<Expected> expectedFor(uint32_t sensor, uint32_t from, uint32_t to)
+{
+  std::vector<Expected> readings;
+  for (const Expected& reading : expected)
+  {
+    if (reading.sensor == sensor && reading.timestamp >= from && reading.timestamp <= to)
+    {
+      readings.push_back(reading);
+    }
+  }
+  return readings;
+}
+
+/// Check that a query returns exactly the readings expected
+static bool queryMatches(const std::string& root, uint32_t sensor, uint32_t from, uint32_t to)
+{
+  ReadingColumns columns;
+  size_t count = archiveQuery(root, sensor, from, to, columns);
+  std::vector<Expected> readings = expectedFor(sensor, from, to);
+  if (count != readings.size() || columns.size() != readings.size())
+  {
+    fprintf(stderr, "sensor %x: %zu readings, expected %zu\n", sensor, count, readings.size());
+    return false;
+  }
+  for (size_t i = 0; i < readings.size(); i++)
+  {
+    if (columns.seq[i] != readings[i].seq || columns.timestamp[i] != readings[i].timestamp
+      || centi(columns.humidity[i]) != readings[i].humidity || centi(columns.temperature[i]) != readings[i].temperature
+      || columns.node[i] != 0)
+    {
+      fprintf(stderr, "sensor %x: reading %zu differs\n", sensor, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Upload the batches, two hours before to two hours after midnight
+static void writeBatches(ArchiveWriter& writer)
+{
+  uint32_t seq = 100;
+  uint32_t timestamp = MIDNIGHT - 2 * 3600;
+  for (int batch = 0; batch < BATCHES; batch++)
+  {
+    LogRecord records[BATCH_SIZE];
+    for (int i = 0; i < BATCH_SIZE; i++)
+    {
+      uint32_t sensor = sensors[i % 3];
+      // Falling through zero, so deltas of both signs are packed
+      int32_t temperature = 150 - static_cast<int32_t>(seq) * 7 % 400;
+      int32_t humidity = 5000 + static_cast<int32_t>(seq % 13) * 111;
+      records[i] = { 0, timestamp, humidity, temperature, sensor == GATEWAY ? 0 : sensor };
+      expected.push_back({ sensor, seq, timestamp, humidity, temperature });
+      seq++;
+      // Leaf readings are relayed as they arrive, the gateway samples every 15 minutes
+      timestamp += sensor == GATEWAY ? 0 : 450;
+    }
+    StringSink sink;
+    writeEnvelope(sink, "e1f0c2", "0.5", records, BATCH_SIZE, seq - BATCH_SIZE);
+    IngestResult result = writer.appendEnvelope(sink.text.data(), sink.text.size());
+    check(result.status == IngestStatus::Ok && result.count == BATCH_SIZE, "batch appended");
+  }
+}
+
+static void testQuery(const std::string& root)
+{
+  ArchiveWriter writer(root);
+  writeBatches(writer);
+
+  namespace fs = std::filesystem;
+  check(fs::exists(fs::path(root) / "e1f0c2" / "20210322.mca") && fs::exists(fs::path(root) / "e1f0c2" / "20210323.mca"),
+    "gateway day files");
+  check(fs::exists(fs::path(root) / "a1b2c3" / "20210322.mca") && fs::exists(fs::path(root) / "1" / "20210323.mca"),
+    "leaf day files");
+  check(!fs::exists(fs::path(root) / "0"), "no files for node 0");
+
+  for (uint32_t sensor : sensors)
+  {
+    check(queryMatches(root, sensor, 0, UINT32_MAX), "whole archive");
+    check(queryMatches(root, sensor, MIDNIGHT - 3600, MIDNIGHT + 3600), "across midnight");
+    check(queryMatches(root, sensor, MIDNIGHT - 3600, MIDNIGHT - 1), "before midnight");
+    check(queryMatches(root, sensor, MIDNIGHT, MIDNIGHT), "at midnight");
+    check(queryMatches(root, sensor, MIDNIGHT + 1, MIDNIGHT + 7 * 86400), "after midnight");
+  }
+  ReadingColumns columns;
+  check(archiveQuery(root, 0xbad, 0, UINT32_MAX, columns) == 0, "unknown sensor");
+  check(archiveQuery(root, GATEWAY, MIDNIGHT + 86400, UINT32_MAX, columns) == 0, "after the last day");
+
+  // Missing values are kept
+  ReadingColumns missing;
+  missing.seq = { 900 };
+  missing.timestamp = { MIDNIGHT + 5 * 3600 };
+  missing.humidity = { NAN };
+  missing.temperature = { -12.5f };
+  missing.node = { 0 };
+  check(writer.append(GATEWAY, missing) == 1, "missing value appended");
+  columns.clear();
+  archiveQuery(root, GATEWAY, MIDNIGHT + 5 * 3600, MIDNIGHT + 5 * 3600, columns);
+  check(columns.size() == 1 && std::isnan(columns.humidity[0]) && centi(columns.temperature[0]) == -1250,
+    "missing value read back");
+}
+
+/// Append a batch of the gateway, returning the size of the day file before it
+static uintmax_t appendTrailing(const std::string& root, const std::string& path)
+{
+  uintmax_t size = std::filesystem::file_size(path);
+  ReadingColumns columns;
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    columns.seq.push_back(2000 + i);
+    columns.timestamp.push_back(MIDNIGHT + 6 * 3600 + i * 900);
+    columns.humidity.push_back(40.0f);
+    columns.temperature.push_back(-1.0f);
+    columns.node.push_back(0);
+  }
+  ArchiveWriter writer(root);
+  check(writer.append(GATEWAY, columns) == 4, "trailing chunk appended");
+  return size;
+}
+
+/// Check that the day file of the gateway holds what it held before the trailing chunk
+static void checkTrailingSkipped(const std::string& root, const std::string& path, const char* what)
+{
+  ArchiveReader reader;
+  ReadingColumns columns;
+  check(reader.open(path), what);
+  size_t count = reader.read(0, UINT32_MAX, columns);
+  check(reader.damaged(), what);
+  // The readings of the day before the damaged chunk, and the one with a missing value
+  check(count == expectedFor(GATEWAY, MIDNIGHT, UINT32_MAX).size() + 1, what);
+  check(queryMatches(root, GATEWAY, 0, MIDNIGHT + 5 * 3600 - 1), what);
+}
+
+static void testDamagedChunks(const std::string& root)
+{
+  std::string path = root + "/e1f0c2/20210323.mca";
+
+  ArchiveReader reader;
+  ReadingColumns columns;
+  check(reader.open(path), "day file opened");
+  reader.read(0, UINT32_MAX, columns);
+  check(!reader.damaged(), "undamaged file");
+  reader.close();
+
+  // A flipped bit in the packed columns of the last chunk
+  uintmax_t size = appendTrailing(root, path);
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(size + sizeof(ArchiveChunkHeader));
+    char byte = static_cast<char>(file.get());
+    file.seekp(size + sizeof(ArchiveChunkHeader));
+    file.put(static_cast<char>(byte ^ 0x10));
+  }
+  checkTrailingSkipped(root, path, "corrupted trailing chunk skipped");
+
+  // Cut off within its packed columns, and within its header
+  std::filesystem::resize_file(path, size);
+  size = appendTrailing(root, path);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  checkTrailingSkipped(root, path, "truncated trailing chunk skipped");
+  std::filesystem::resize_file(path, size + sizeof(ArchiveChunkHeader) - 4);
+  checkTrailingSkipped(root, path, "truncated trailing header skipped");
+
+  // Chunks appended after a damaged one are read again
+  std::filesystem::resize_file(path, size + 10);
+  ReadingColumns later;
+  later.seq = { 3000 };
+  later.timestamp = { MIDNIGHT + 7 * 3600 };
+  later.humidity = { 55.5f };
+  later.temperature = { 20.25f };
+  later.node = { 0 };
+  ArchiveWriter writer(root);
+  writer.append(GATEWAY, later);
+  columns.clear();
+  archiveQuery(root, GATEWAY, MIDNIGHT + 6 * 3600, UINT32_MAX, columns);
+  check(columns.size() == 1 && columns.seq[0] == 3000 && centi(columns.temperature[0]) == 2025,
+    "chunk after a damaged one read");
+}
+
+int main()
+{
+  char directory[] = "/tmp/archive_test.XXXXXX";
+  if (mkdtemp(directory) == nullptr)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string root = std::string(directory) + "/archive";
+
+  testQuery(root);
+  testDamagedChunks(root);
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  if (failures > 0)
+  {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file ArchiveTool.cpp
+ * @author Christoff Linde
+ * @brief Command line access to the columnar archive
+ * @version 0.1
+ * @date 2021-04-11
+ *
+ * Usage:
+ *  \li archive add ROOT BODY... - append the readings of JSON batch envelopes saved to files
+ *  \li archive query ROOT SENSOR FROM TO - print the readings of a sensor (chip id in hex) between two
+ *      UNIX times as CSV
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "Archive.h"
+
+static int add(const char* root, int count, char** files)
+{
+  ArchiveWriter writer(root);
+  size_t bytesRead = 0;
+  for (int i = 0; i < count; i++)
+  {
+    std::ifstream file(files[i], std::ios::binary);
+    if (!file)
+    {
+      fprintf(stderr, "%s: cannot open\n", files[i]);
+      return 1;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string body = contents.str();
+    bytesRead += body.size();
+
+    IngestResult result = writer.appendEnvelope(body.data(), body.size());
+    if (result.status != IngestStatus::Ok)
+    {
+      fprintf(stderr, "%s: %s at offset %zu\n", files[i], ingestStatusName(result.status), result.offset);
+    }
+  }
+  fprintf(stderr, "%zu bytes of envelopes, %llu bytes archived\n", bytesRead,
+    static_cast<unsigned long long>(writer.bytesWritten()));
+  return 0;
+}
+
+static int query(const char* root, uint32_t sensor, uint32_t from, uint32_t to)
+{
+  ReadingColumns columns;
+  auto start = std::chrono::steady_clock::now();
+  size_t count = archiveQuery(root, sensor, from, to, columns);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  printf("seq,timestamp,humidity,temperature\n");
+  for (size_t i = 0; i < count; i++)
+  {
+    printf("%u,%u,%.2f,%.2f\n", columns.seq[i], columns.timestamp[i], columns.humidity[i], columns.temperature[i]);
+  }
+  fprintf(stderr, "%zu readings in %.3f ms\n", count, elapsed.count() * 1e3);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc >= 4 && strcmp(argv[1], "add") == 0)
+  {
+    return add(argv[2], argc - 3, argv + 3);
+  }
+  if (argc == 6 && strcmp(argv[1], "query") == 0)
+  {
+    return query(argv[2], strtoul(argv[3], nullptr, 16), strtoul(argv[4], nullptr, 10),
+      strtoul(argv[5], nullptr, 10));
+  }
+  fprintf(stderr, "Usage: %s add ROOT BODY...\n       %s query ROOT SENSOR FROM TO\n", argv[0], argv[0]);
+  return 2;
+}
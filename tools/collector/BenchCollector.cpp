@@ -0,0 +1,140 @@
+/**
+ * @file BenchCollector.cpp
+ * @author Christoff Linde
+ * @brief Scaling benchmark of the parallel collector against a simulated fleet
+ * @version 0.1
+ * @date 2021-04-13
+ *
+ * Simulates a fleet coming back after an outage: every device uploads a backlog of hourly batches,
+ * and the batches of all devices arrive interleaved. The batches are collected with 1, 2, 4, ... up to
+ * one worker per core, and the throughput and speedup over a single worker are reported.
+ *
+ * Without an archive directory only decoding and the per-device handoff are measured. With one, the
+ * readings are also archived, which makes the result depend on the disk.
+ *
+ * Usage: bench_collector [devices] [batches per device] [archive directory]
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Collector.h"
+
+/// Readings per batch, matches UPLOAD_BATCH_SIZE of the firmware
+#define BATCH_SIZE 24
+
+/// Seconds between readings, matches the 15 minute sampling interval of the firmware
+#define READING_INTERVAL 900
+
+/**
+ * @brief Generate the backlog of a device
+ *
+ * @details Every fourth device is a gateway, relaying the readings of a leaf in every other slot.
+ */
+static void simulateDevice(uint32_t device, size_t batches, std::mt19937& random,
+  std::vector<std::shared_ptr<const std::string>>& bodies)
+{
+  std::uniform_real_distribution<float> noise(-0.2f, 0.2f);
+  bool gateway = device % 4 == 0;
+  uint32_t seq = 0;
+  uint32_t timestamp = 1617000000;
+  float humidity = 50.0f + device % 20;
+  float temperature = 18.0f + device % 7;
+  char buf[160];
+  for (size_t b = 0; b < batches; b++)
+  {
+    std::string body;
+    snprintf(buf, sizeof(buf), "{\"device\":\"%x\",\"firmware\":\"0.4\",\"encoding\":1,\"sensors\":[\"dht22\"],"
+      "\"seq\":[%u,%u],\"readings\":[", device, seq, seq + BATCH_SIZE - 1);
+    body += buf;
+    for (int i = 0; i < BATCH_SIZE; i++)
+    {
+      humidity += noise(random);
+      temperature += noise(random);
+      snprintf(buf, sizeof(buf), "%s{\"timestamp\":%u,\"humidity\":%.9g,\"temperature\":%.9g", i > 0 ? "," : "",
+        timestamp, humidity, temperature);
+      body += buf;
+      if (gateway && i % 2 == 1)
+      {
+        snprintf(buf, sizeof(buf), ",\"node\":\"%x\"", device | 0x800000);
+        body += buf;
+      }
+      else
+      {
+        timestamp += READING_INTERVAL;
+      }
+      body += '}';
+    }
+    body += "]}";
+    seq += BATCH_SIZE;
+    bodies.push_back(std::make_shared<const std::string>(std::move(body)));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  size_t devices = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+  size_t batches = argc > 2 ? strtoul(argv[2], nullptr, 10) : 48;
+  const char* archiveRoot = argc > 3 ? argv[3] : nullptr;
+
+  std::mt19937 random(1);
+  std::vector<std::shared_ptr<const std::string>> bodies;
+  bodies.reserve(devices * batches);
+  for (size_t d = 0; d < devices; d++)
+  {
+    simulateDevice(0x100000 + static_cast<uint32_t>(d), batches, random, bodies);
+  }
+  // The backlogs of all devices arrive at the same time
+  std::shuffle(bodies.begin(), bodies.end(), random);
+  printf("%zu devices, %zu batches of %d readings\n", devices, bodies.size(), BATCH_SIZE);
+
+  size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<size_t> workerCounts;
+  for (size_t threads = 1; threads < cores; threads *= 2)
+  {
+    workerCounts.push_back(threads);
+  }
+  workerCounts.push_back(cores);
+
+  double single = 0;
+  for (size_t threads : workerCounts)
+  {
+    std::unique_ptr<ArchiveWriter> archive;
+    if (archiveRoot != nullptr)
+    {
+      std::filesystem::remove_all(archiveRoot);
+      archive.reset(new ArchiveWriter(archiveRoot));
+    }
+
+    ThreadPool pool(threads);
+    Collector collector(pool, archive.get());
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& body : bodies)
+    {
+      collector.submit(body);
+    }
+    collector.wait();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    CollectorStats stats = collector.stats();
+    double rate = stats.readings / elapsed.count();
+    if (threads == 1)
+    {
+      single = rate;
+    }
+    printf("%3zu workers %12.0f readings/s  speedup %5.2f  steals %8llu  devices %llu  rejected %llu\n", threads,
+      rate, rate / single, static_cast<unsigned long long>(pool.steals()),
+      static_cast<unsigned long long>(stats.devices), static_cast<unsigned long long>(stats.rejected));
+  }
+  return 0;
+}
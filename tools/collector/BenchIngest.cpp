@@ -0,0 +1,137 @@
+/**
+ * @file BenchIngest.cpp
+ * @author Christoff Linde
+ * @brief Throughput benchmark of the upload format parsers
+ * @version 0.1
+ * @date 2021-04-09
+ *
+ * Generates bodies shaped like the ones the firmware posts, UPLOAD_BATCH_SIZE readings each, and
+ * parses them repeatedly on a single thread. Reports readings per second, which is the rate per core.
+ *
+ * Usage: bench_ingest [batches]
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Ingest.h"
+
+/// Readings per body, matches UPLOAD_BATCH_SIZE of the firmware
+#define BATCH_SIZE 24
+
+/// Number of times the bodies are parsed
+#define ROUNDS 5
+
+static std::string makeEnvelope(uint32_t device, uint32_t seq, uint32_t timestamp, bool relayed)
+{
+  char buf[160];
+  std::string body;
+  snprintf(buf, sizeof(buf), "{\"device\":\"%x\",\"firmware\":\"0.4\",\"encoding\":1,\"sensors\":[\"dht22\"],"
+    "\"seq\":[%u,%u],\"readings\":[", device, seq, seq + BATCH_SIZE - 1);
+  body += buf;
+  for (int i = 0; i < BATCH_SIZE; i++)
+  {
+    // ArduinoJson prints floats with up to 9 significant digits
+    float humidity = 40.0f + (rand() % 4000) / 100.0f;
+    float temperature = 15.0f + (rand() % 1500) / 100.0f;
+    snprintf(buf, sizeof(buf), "%s{\"timestamp\":%u,\"humidity\":%.9g,\"temperature\":%.9g", i > 0 ? "," : "",
+      timestamp + i * 900, humidity, temperature);
+    body += buf;
+    if (relayed)
+    {
+      snprintf(buf, sizeof(buf), ",\"node\":\"%x\"", device ^ 0x5a5a);
+      body += buf;
+    }
+    body += '}';
+  }
+  body += "]}";
+  return body;
+}
+
+/// A CSV upload names its device in the X-Device header, not in the body
+static std::string makeCsv(uint32_t seq, uint32_t timestamp)
+{
+  char buf[96];
+  std::string body = "seq,timestamp,humidity,temperature,node\n";
+  for (int i = 0; i < BATCH_SIZE; i++)
+  {
+    snprintf(buf, sizeof(buf), "%u,%u,%.2f,%.2f,\n", seq + i, timestamp + i * 900,
+      40.0f + (rand() % 4000) / 100.0f, 15.0f + (rand() % 1500) / 100.0f);
+    body += buf;
+  }
+  return body;
+}
+
+template <typename Parse>
+static void run(const char* name, const std::vector<std::string>& bodies, Parse parse)
+{
+  size_t bytes = 0;
+  for (const std::string& body : bodies)
+  {
+    bytes += body.size();
+  }
+
+  ReadingColumns columns;
+  columns.reserve(bodies.size() * BATCH_SIZE);
+  double best = 0;
+  size_t failed = 0;
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    columns.clear();
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& body : bodies)
+    {
+      if (parse(body, columns).status != IngestStatus::Ok)
+      {
+        failed++;
+      }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double rate = columns.size() / elapsed.count();
+    if (rate > best)
+    {
+      best = rate;
+    }
+  }
+  double seconds = columns.size() / best;
+  printf("%-9s %8zu bodies %10zu readings %8.1f MB/s %12.0f readings/s per core%s\n", name, bodies.size(),
+    columns.size(), bytes / seconds / 1e6, best, failed > 0 ? "  (failures!)" : "");
+}
+
+int main(int argc, char** argv)
+{
+  size_t batches = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+
+  srand(1);
+  std::vector<std::string> envelopes;
+  std::vector<std::string> relayed;
+  std::vector<std::string> csv;
+  for (size_t i = 0; i < batches; i++)
+  {
+    uint32_t device = 0x100000 + static_cast<uint32_t>(i % 1000);
+    uint32_t seq = static_cast<uint32_t>(i / 1000) * BATCH_SIZE;
+    uint32_t timestamp = 1617000000 + static_cast<uint32_t>(i / 1000) * BATCH_SIZE * 900;
+    envelopes.push_back(makeEnvelope(device, seq, timestamp, false));
+    relayed.push_back(makeEnvelope(device, seq, timestamp, true));
+    csv.push_back(makeCsv(seq, timestamp));
+  }
+
+  run("envelope", envelopes, [](const std::string& body, ReadingColumns& columns) {
+    BatchHeader header;
+    return parseEnvelope(body.data(), body.size(), header, columns);
+  });
+  run("relayed", relayed, [](const std::string& body, ReadingColumns& columns) {
+    BatchHeader header;
+    return parseEnvelope(body.data(), body.size(), header, columns);
+  });
+  run("csv", csv, [](const std::string& body, ReadingColumns& columns) {
+    return parseCsv(body.data(), body.size(), columns);
+  });
+  return 0;
+}
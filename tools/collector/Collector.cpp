@@ -0,0 +1,99 @@
+/**
+ * @file Collector.cpp
+ * @author Christoff Linde
+ * @brief Parallel collector implementation
+ * @version 0.1
+ * @date 2021-04-13
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "Collector.h"
+
+#include <thread>
+
+Collector::Collector(ThreadPool& pool, ArchiveWriter* archive)
+  : _pool(pool), _archive(archive), _batches(0), _rejected(0), _readings(0), _devices(0)
+{
+}
+
+void Collector::submit(std::shared_ptr<const std::string> body)
+{
+  _pool.submit([this, body] { decode(*body); });
+}
+
+void Collector::wait()
+{
+  _pool.wait();
+}
+
+CollectorStats Collector::stats() const
+{
+  return { _batches.load(), _rejected.load(), _readings.load(), _devices.load() };
+}
+
+void Collector::decode(const std::string& body)
+{
+  BatchHeader header;
+  DecodedBatch batch;
+  IngestResult result = parseEnvelope(body.data(), body.size(), header, batch.columns);
+  _batches.fetch_add(1, std::memory_order_relaxed);
+  if (result.status != IngestStatus::Ok)
+  {
+    _rejected.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  batch.device = header.device;
+
+  DeviceQueue& queue = deviceQueue(header.device);
+  // Counted before it is pushed, so a drain never pops more batches than were counted. Only the
+  // producer that finds the device idle schedules a drain
+  bool idle = queue.queued.fetch_add(1) == 0;
+  queue.batches.push(std::move(batch));
+  if (idle)
+  {
+    _pool.submit([this, &queue] { drain(queue); });
+  }
+}
+
+Collector::DeviceQueue& Collector::deviceQueue(uint32_t device)
+{
+  Shard& shard = _shards[device % COLLECTOR_SHARDS];
+  std::lock_guard<std::mutex> guard(shard.lock);
+  std::unique_ptr<DeviceQueue>& queue = shard.devices[device];
+  if (!queue)
+  {
+    queue.reset(new DeviceQueue(device));
+    _devices.fetch_add(1, std::memory_order_relaxed);
+  }
+  return *queue;
+}
+
+void Collector::drain(DeviceQueue& queue)
+{
+  DecodedBatch batch;
+  size_t drained = 0;
+  while (true)
+  {
+    if (!queue.batches.pop(batch))
+    {
+      // Done once every counted batch is drained. The queue is not touched after that, as the next
+      // drain task may already be running
+      if (queue.queued.fetch_sub(drained) == drained)
+      {
+        return;
+      }
+      // Counted, but its producer has not pushed it yet
+      drained = 0;
+      std::this_thread::yield();
+      continue;
+    }
+    if (_archive != nullptr)
+    {
+      _archive->append(batch.device, batch.columns);
+    }
+    _readings.fetch_add(batch.columns.size(), std::memory_order_relaxed);
+    drained++;
+  }
+}
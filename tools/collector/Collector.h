@@ -0,0 +1,107 @@
+/**
+ * @file Collector.h
+ * @author Christoff Linde
+ * @brief Parallel decoding of uploaded batches into per-device append queues
+ * @version 0.1
+ * @date 2021-04-13
+ *
+ * When a fleet comes back after an outage, every device uploads its backlog at once. Batches are
+ * decoded and validated in parallel on a ThreadPool, in whatever order the workers get to them. The
+ * decoded readings are handed to a lock-free queue per device. A device's queue is drained by a single
+ * task at a time, which appends to the archive, so files are never written concurrently and the
+ * workers never block on each other's devices.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Archive.h"
+#include "Ingest.h"
+#include "MpscQueue.h"
+#include "ThreadPool.h"
+
+/// Number of independently locked parts of the device table
+#define COLLECTOR_SHARDS 64
+
+/// Counters of a Collector
+struct CollectorStats
+{
+  uint64_t batches;
+  uint64_t rejected;
+  uint64_t readings;
+  uint64_t devices;
+};
+
+class Collector
+{
+public:
+  /**
+   * @brief Create a collector
+   *
+   * @param pool the pool to decode and append on
+   * @param archive the archive to append to, or nullptr to only decode and count
+   */
+  Collector(ThreadPool& pool, ArchiveWriter* archive);
+
+  /**
+   * @brief Decode a JSON batch envelope on the pool, and append its readings
+   *
+   * @param body the body as posted by the device
+   */
+  void submit(std::shared_ptr<const std::string> body);
+
+  /// Wait until every submitted batch has been appended
+  void wait();
+
+  CollectorStats stats() const;
+
+private:
+  struct DecodedBatch
+  {
+    uint32_t device;
+    ReadingColumns columns;
+  };
+
+  struct DeviceQueue
+  {
+    explicit DeviceQueue(uint32_t id) : device(id), queued(0)
+    {
+    }
+
+    uint32_t device;
+    MpscQueue<DecodedBatch> batches;
+    /// Batches pushed and not drained yet. A drain task is queued or running while it is not zero
+    std::atomic<size_t> queued;
+  };
+
+  struct Shard
+  {
+    std::mutex lock;
+    std::unordered_map<uint32_t, std::unique_ptr<DeviceQueue>> devices;
+  };
+
+  void decode(const std::string& body);
+  DeviceQueue& deviceQueue(uint32_t device);
+  void drain(DeviceQueue& queue);
+
+  ThreadPool& _pool;
+  ArchiveWriter* _archive;
+  Shard _shards[COLLECTOR_SHARDS];
+  std::atomic<uint64_t> _batches;
+  std::atomic<uint64_t> _rejected;
+  std::atomic<uint64_t> _readings;
+  std::atomic<uint64_t> _devices;
+};
+
+#endif
@@ -0,0 +1,329 @@
+/**
+ * @file ExportReceiver.cpp
+ * @author Christoff Linde
+ * @brief Receives the upload log of a device over a serial port, @see SerialExport.h
+ * @version 0.1
+ * @date 2021-04-18
+ *
+ * Usage:
+ *  \li export_receiver DEVICE OUTPUT [BAUD] - append the log of the device on the serial port DEVICE to
+ *      OUTPUT, switching to BAUD (default 921600) for the transfer
+ *
+ * The export resumes from the size of OUTPUT, so running the receiver again after an interrupted
+ * transfer only fetches the rest. Frames that are lost or fail their CRC are asked for again.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "ExportProtocol.h"
+
+/// Baud rate of the device outside of an export
+#define BASE_BAUD 115200
+
+/// Time without a frame after which a request is sent again
+#define FRAME_TIMEOUT_MS 1500
+
+/// Requests sent without an answer before the receiver gives up
+#define MAX_RETRIES 5
+
+/// Time the device waits for a request, after which it drops back to the base baud rate
+#define DEVICE_TIMEOUT_MS 3500
+
+static int port = -1;
+static ExportParser<EXPORT_MAX_PAYLOAD> parser;
+static uint8_t rxBuffer[4096];
+static size_t rxLength = 0;
+static size_t rxPos = 0;
+static uint16_t txSeq = 0;
+static uint32_t portBaud = 0;
+static bool deviceAborted = false;
+
+static speed_t speedOf(uint32_t baud)
+{
+  switch (baud)
+  {
+  case 115200:
+    return B115200;
+  case 230400:
+    return B230400;
+  case 460800:
+    return B460800;
+  case 500000:
+    return B500000;
+  case 921600:
+    return B921600;
+  case 1000000:
+    return B1000000;
+  case 1500000:
+    return B1500000;
+  case 2000000:
+    return B2000000;
+  default:
+    return B0;
+  }
+}
+
+static bool setBaud(uint32_t baud)
+{
+  termios tio;
+  if (tcgetattr(port, &tio) != 0)
+  {
+    return false;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~CRTSCTS;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  cfsetispeed(&tio, speedOf(baud));
+  cfsetospeed(&tio, speedOf(baud));
+  if (tcsetattr(port, TCSADRAIN, &tio) != 0)
+  {
+    return false;
+  }
+  portBaud = baud;
+  return true;
+}
+
+static void sendStart(uint32_t offset, uint32_t baud)
+{
+  uint8_t frame[EXPORT_HEADER_SIZE + 8 + EXPORT_TRAILER_SIZE];
+  exportPut32(frame + EXPORT_HEADER_SIZE, offset);
+  exportPut32(frame + EXPORT_HEADER_SIZE + 4, baud);
+  size_t length = exportFrame(frame, EXPORT_START, txSeq++, 8);
+  if (write(port, frame, length) != (ssize_t)length)
+  {
+    perror("write");
+  }
+}
+
+/**
+ * @brief Read until a frame with a valid CRC is complete
+ *
+ * @return true if a frame is available from the parser, false on a timeout
+ */
+static bool readFrame(int timeoutMs)
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  for (;;)
+  {
+    while (rxPos < rxLength)
+    {
+      if (parser.feed(rxBuffer[rxPos++]))
+      {
+        return true;
+      }
+    }
+    int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0)
+    {
+      return false;
+    }
+    pollfd pfd = { port, POLLIN, 0 };
+    if (poll(&pfd, 1, remaining) <= 0)
+    {
+      continue;
+    }
+    ssize_t count = read(port, rxBuffer, sizeof(rxBuffer));
+    rxLength = count > 0 ? count : 0;
+    rxPos = 0;
+  }
+}
+
+/**
+ * @brief Wait for the device to answer a request with READY
+ *
+ * @return true if the device is ready to send from offset
+ */
+static bool waitReady(uint32_t offset, uint32_t& size, uint32_t& readyBaud)
+{
+  while (readFrame(FRAME_TIMEOUT_MS))
+  {
+    if (parser.type() == EXPORT_ABORT)
+    {
+      deviceAborted = true;
+      return false;
+    }
+    // Frames sent before the request are skipped
+    if (parser.type() == EXPORT_READY && parser.length() == 12 && exportGet32(parser.payload()) == offset)
+    {
+      size = exportGet32(parser.payload() + 4);
+      readyBaud = exportGet32(parser.payload() + 8);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Ask the device for the log from an offset, and wait for it to be ready
+ *
+ * @details Enters the export with the console command first, in case the device is not exporting yet,
+ * and follows the device to the baud rate it answers with.
+ *
+ * @return true if the device is sending from offset
+ */
+static bool requestFrom(uint32_t offset, uint32_t baud, uint32_t& size)
+{
+  for (int attempt = 0; attempt < MAX_RETRIES; attempt++)
+  {
+    if (portBaud == BASE_BAUD && write(port, "\nexport\n", 8) != 8)
+    {
+      perror("write");
+    }
+    sendStart(offset, portBaud == baud ? 0 : baud);
+
+    uint32_t readyBaud;
+    if (waitReady(offset, size, readyBaud))
+    {
+      if (readyBaud == portBaud)
+      {
+        return true;
+      }
+      // The device switched after READY, and waits for the request again at the new rate
+      tcdrain(port);
+      if (!setBaud(readyBaud))
+      {
+        fprintf(stderr, "Cannot set %u baud\n", readyBaud);
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      tcflush(port, TCIFLUSH);
+      rxLength = rxPos = 0;
+      sendStart(offset, 0);
+      if (waitReady(offset, size, readyBaud) && readyBaud == portBaud)
+      {
+        return true;
+      }
+    }
+    if (deviceAborted)
+    {
+      fprintf(stderr, "Device aborted the export\n");
+      return false;
+    }
+    // Once the device gives up waiting, it is back at the base rate
+    std::this_thread::sleep_for(std::chrono::milliseconds(DEVICE_TIMEOUT_MS));
+    setBaud(BASE_BAUD);
+    tcflush(port, TCIOFLUSH);
+    rxLength = rxPos = 0;
+  }
+  fprintf(stderr, "No answer from the device\n");
+  return false;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 3 || argc > 4)
+  {
+    fprintf(stderr, "Usage: %s DEVICE OUTPUT [BAUD]\n", argv[0]);
+    return 2;
+  }
+  uint32_t baud = argc == 4 ? strtoul(argv[3], nullptr, 10) : 921600;
+  if (speedOf(baud) == B0)
+  {
+    fprintf(stderr, "Unsupported baud rate %u\n", baud);
+    return 2;
+  }
+
+  port = open(argv[1], O_RDWR | O_NOCTTY);
+  if (port < 0 || !setBaud(BASE_BAUD))
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  tcflush(port, TCIOFLUSH);
+
+  FILE* output = fopen(argv[2], "ab");
+  if (!output)
+  {
+    perror(argv[2]);
+    return 1;
+  }
+  fseek(output, 0, SEEK_END);
+  uint32_t offset = ftell(output);
+  uint32_t resumedAt = offset;
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t size = 0;
+  uint32_t resends = 0;
+  bool done = false;
+  bool complete = false;
+  if (requestFrom(offset, baud, size))
+  {
+    while (!done)
+    {
+      if (!readFrame(FRAME_TIMEOUT_MS))
+      {
+        resends++;
+        if (!requestFrom(offset, baud, size))
+        {
+          break;
+        }
+        continue;
+      }
+      uint32_t frameOffset = parser.length() >= 4 ? exportGet32(parser.payload()) : 0;
+      switch (parser.type())
+      {
+      case EXPORT_DATA:
+        if (frameOffset == offset)
+        {
+          uint32_t length = parser.length() - 4;
+          fwrite(parser.payload() + 4, 1, length, output);
+          offset += length;
+        }
+        else if (frameOffset > offset)
+        {
+          // A frame was lost, the device restarts from the last one received
+          resends++;
+          if (!requestFrom(offset, baud, size))
+          {
+            done = true;
+          }
+        }
+        break;
+      case EXPORT_END:
+        if (offset >= size)
+        {
+          complete = true;
+          done = true;
+        }
+        else
+        {
+          resends++;
+          if (!requestFrom(offset, baud, size))
+          {
+            done = true;
+          }
+        }
+        break;
+      case EXPORT_ABORT:
+        fprintf(stderr, "Device aborted the export\n");
+        done = true;
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  fclose(output);
+  close(port);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  uint32_t received = offset - resumedAt;
+  fprintf(stderr, "%u of %u bytes, %u received in %.2f s (%.1f KB/s), %u frames asked again, %u CRC errors\n",
+    offset, size, received, elapsed.count(), received / elapsed.count() / 1024, resends, parser.crcErrors());
+  return complete ? 0 : 1;
+}
@@ -0,0 +1,689 @@
+/**
+ * @file Ingest.cpp
+ * @author Christoff Linde
+ * @brief Upload format parser implementation
+ * @version 0.1
+ * @date 2021-04-09
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "Ingest.h"
+
+#include <cmath>
+#include <cstring>
+
+void ReadingColumns::reserve(size_t count)
+{
+  seq.reserve(count);
+  timestamp.reserve(count);
+  humidity.reserve(count);
+  temperature.reserve(count);
+  node.reserve(count);
+}
+
+void ReadingColumns::clear()
+{
+  truncate(0);
+}
+
+void ReadingColumns::truncate(size_t count)
+{
+  seq.resize(count);
+  timestamp.resize(count);
+  humidity.resize(count);
+  temperature.resize(count);
+  node.resize(count);
+}
+
+const char* ingestStatusName(IngestStatus status)
+{
+  switch (status)
+  {
+  case IngestStatus::Ok:
+    return "ok";
+  case IngestStatus::Syntax:
+    return "syntax error";
+  case IngestStatus::Schema:
+    return "schema mismatch";
+  case IngestStatus::Encoding:
+    return "unsupported encoding";
+  }
+  return "unknown";
+}
+
+/// Position in the body being parsed
+struct Cursor
+{
+  const char* p;
+  const char* end;
+};
+
+/// Powers of ten that are exact as double
+static const double exactPowers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isDigit(char c)
+{
+  return static_cast<unsigned char>(c - '0') < 10;
+}
+
+static inline void skipSpace(Cursor& c)
+{
+  while (c.p < c.end && (*c.p == ' ' || *c.p == '\n' || *c.p == '\r' || *c.p == '\t'))
+  {
+    c.p++;
+  }
+}
+
+/// Skip whitespace, then consume ch if it is next
+static inline bool accept(Cursor& c, char ch)
+{
+  skipSpace(c);
+  if (c.p < c.end && *c.p == ch)
+  {
+    c.p++;
+    return true;
+  }
+  return false;
+}
+
+static bool parseUint(Cursor& c, uint32_t& value)
+{
+  const char* start = c.p;
+  uint64_t result = 0;
+  while (c.p < c.end && isDigit(*c.p))
+  {
+    result = result * 10 + (*c.p - '0');
+    if (result > UINT32_MAX)
+    {
+      return false;
+    }
+    c.p++;
+  }
+  value = static_cast<uint32_t>(result);
+  return c.p != start;
+}
+
+static bool parseHex(const char* p, const char* end, uint32_t& value)
+{
+  if (p == end || end - p > 8)
+  {
+    return false;
+  }
+  uint32_t result = 0;
+  for (; p < end; p++)
+  {
+    char ch = *p;
+    uint32_t digit;
+    if (isDigit(ch))
+    {
+      digit = ch - '0';
+    }
+    else if (ch >= 'a' && ch <= 'f')
+    {
+      digit = ch - 'a' + 10;
+    }
+    else if (ch >= 'A' && ch <= 'F')
+    {
+      digit = ch - 'A' + 10;
+    }
+    else
+    {
+      return false;
+    }
+    result = result << 4 | digit;
+  }
+  value = result;
+  return true;
+}
+
+/**
+ * @brief Parse a JSON number
+ *
+ * @details Up to 19 significant digits are accumulated in an integer, and scaled by a single exact power
+ * of ten where possible, which is exact to within an ulp for the short numbers the firmware prints.
+ */
+static bool parseNumber(Cursor& c, double& value)
+{
+  const char* p = c.p;
+  bool negative = false;
+  if (p < c.end && *p == '-')
+  {
+    negative = true;
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  const char* start = p;
+  for (; p < c.end && isDigit(*p); p++)
+  {
+    if (digits < 19)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa != 0;
+    }
+    else
+    {
+      exponent++;
+    }
+  }
+  if (p == start)
+  {
+    return false;
+  }
+  if (p < c.end && *p == '.')
+  {
+    const char* fraction = ++p;
+    for (; p < c.end && isDigit(*p); p++)
+    {
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa != 0;
+        exponent--;
+      }
+    }
+    if (p == fraction)
+    {
+      return false;
+    }
+  }
+  if (p < c.end && (*p == 'e' || *p == 'E'))
+  {
+    p++;
+    bool negativeExponent = false;
+    if (p < c.end && (*p == '-' || *p == '+'))
+    {
+      negativeExponent = *p == '-';
+      p++;
+    }
+    const char* exponentStart = p;
+    int explicitExponent = 0;
+    for (; p < c.end && isDigit(*p); p++)
+    {
+      if (explicitExponent < 1000)
+      {
+        explicitExponent = explicitExponent * 10 + (*p - '0');
+      }
+    }
+    if (p == exponentStart)
+    {
+      return false;
+    }
+    exponent += negativeExponent ? -explicitExponent : explicitExponent;
+  }
+
+  double result = static_cast<double>(mantissa);
+  if (exponent < 0 && exponent >= -22)
+  {
+    result /= exactPowers[-exponent];
+  }
+  else if (exponent > 0 && exponent <= 22)
+  {
+    result *= exactPowers[exponent];
+  }
+  else if (exponent != 0)
+  {
+    result *= std::pow(10.0, exponent);
+  }
+  value = negative ? -result : result;
+  c.p = p;
+  return true;
+}
+
+/// Parse a number, or the NaN and null the firmware prints for a missing value
+static bool parseValue(Cursor& c, float& value)
+{
+  double number;
+  if (parseNumber(c, number))
+  {
+    value = static_cast<float>(number);
+    return true;
+  }
+  size_t left = c.end - c.p;
+  if (left >= 3 && memcmp(c.p, "NaN", 3) == 0)
+  {
+    c.p += 3;
+  }
+  else if (left >= 4 && memcmp(c.p, "null", 4) == 0)
+  {
+    c.p += 4;
+  }
+  else
+  {
+    return false;
+  }
+  value = NAN;
+  return true;
+}
+
+/**
+ * @brief Parse a string, leaving start and end around its contents
+ *
+ * @details Escapes are skipped over but not decoded, none of the fields read from a string need them.
+ */
+static bool parseString(Cursor& c, const char*& start, const char*& end)
+{
+  if (!accept(c, '"'))
+  {
+    return false;
+  }
+  start = c.p;
+  while (true)
+  {
+    const char* quote = static_cast<const char*>(memchr(c.p, '"', c.end - c.p));
+    if (quote == nullptr)
+    {
+      return false;
+    }
+    // The quote is escaped if an odd number of backslashes precede it
+    const char* backslash = quote;
+    while (backslash > start && backslash[-1] == '\\')
+    {
+      backslash--;
+    }
+    c.p = quote + 1;
+    if ((quote - backslash) % 2 == 0)
+    {
+      end = quote;
+      return true;
+    }
+  }
+}
+
+static inline bool keyIs(const char* start, const char* end, const char* key, size_t len)
+{
+  return static_cast<size_t>(end - start) == len && memcmp(start, key, len) == 0;
+}
+
+#define KEY_IS(key) keyIs(keyStart, keyEnd, key, sizeof(key) - 1)
+
+/// Skip any JSON value
+static bool skipValue(Cursor& c, int depth = 0)
+{
+  if (depth > 32)
+  {
+    return false;
+  }
+  skipSpace(c);
+  if (c.p == c.end)
+  {
+    return false;
+  }
+  const char* start;
+  const char* end;
+  switch (*c.p)
+  {
+  case '"':
+    return parseString(c, start, end);
+  case '{':
+    c.p++;
+    if (accept(c, '}'))
+    {
+      return true;
+    }
+    do
+    {
+      if (!parseString(c, start, end) || !accept(c, ':') || !skipValue(c, depth + 1))
+      {
+        return false;
+      }
+    } while (accept(c, ','));
+    return accept(c, '}');
+  case '[':
+    c.p++;
+    if (accept(c, ']'))
+    {
+      return true;
+    }
+    do
+    {
+      if (!skipValue(c, depth + 1))
+      {
+        return false;
+      }
+    } while (accept(c, ','));
+    return accept(c, ']');
+  case 't':
+  case 'f':
+  case 'n':
+  case 'N':
+    while (c.p < c.end && ((*c.p >= 'a' && *c.p <= 'z') || (*c.p >= 'A' && *c.p <= 'Z')))
+    {
+      c.p++;
+    }
+    return true;
+  default:
+    double number;
+    return parseNumber(c, number);
+  }
+}
+
+static IngestStatus parseReading(Cursor& c, ReadingColumns& columns)
+{
+  enum
+  {
+    HAS_TIMESTAMP = 1,
+    HAS_HUMIDITY = 2,
+    HAS_TEMPERATURE = 4,
+    HAS_ALL = 7
+  };
+
+  if (!accept(c, '{'))
+  {
+    return IngestStatus::Syntax;
+  }
+  uint32_t timestamp = 0;
+  float humidity = 0;
+  float temperature = 0;
+  uint32_t node = 0;
+  int seen = 0;
+  if (!accept(c, '}'))
+  {
+    do
+    {
+      const char* keyStart;
+      const char* keyEnd;
+      if (!parseString(c, keyStart, keyEnd) || !accept(c, ':'))
+      {
+        return IngestStatus::Syntax;
+      }
+      skipSpace(c);
+      bool ok;
+      if (KEY_IS("timestamp"))
+      {
+        ok = parseUint(c, timestamp);
+        seen |= HAS_TIMESTAMP;
+      }
+      else if (KEY_IS("humidity"))
+      {
+        ok = parseValue(c, humidity);
+        seen |= HAS_HUMIDITY;
+      }
+      else if (KEY_IS("temperature"))
+      {
+        ok = parseValue(c, temperature);
+        seen |= HAS_TEMPERATURE;
+      }
+      else if (KEY_IS("node"))
+      {
+        const char* start;
+        const char* end;
+        ok = parseString(c, start, end);
+        if (ok && !parseHex(start, end, node))
+        {
+          return IngestStatus::Schema;
+        }
+      }
+      else
+      {
+        ok = skipValue(c);
+      }
+      if (!ok)
+      {
+        return IngestStatus::Syntax;
+      }
+    } while (accept(c, ','));
+    if (!accept(c, '}'))
+    {
+      return IngestStatus::Syntax;
+    }
+  }
+  if (seen != HAS_ALL)
+  {
+    return IngestStatus::Schema;
+  }
+
+  columns.timestamp.push_back(timestamp);
+  columns.humidity.push_back(humidity);
+  columns.temperature.push_back(temperature);
+  columns.node.push_back(node);
+  return IngestStatus::Ok;
+}
+
+static IngestStatus parseEnvelopeBody(Cursor& c, BatchHeader& header, ReadingColumns& columns, size_t first)
+{
+  bool hasSeq = false;
+  bool hasDevice = false;
+  if (!accept(c, '{'))
+  {
+    return IngestStatus::Syntax;
+  }
+  if (accept(c, '}'))
+  {
+    return IngestStatus::Schema;
+  }
+  do
+  {
+    const char* keyStart;
+    const char* keyEnd;
+    if (!parseString(c, keyStart, keyEnd) || !accept(c, ':'))
+    {
+      return IngestStatus::Syntax;
+    }
+    skipSpace(c);
+    if (KEY_IS("readings"))
+    {
+      if (!accept(c, '['))
+      {
+        return IngestStatus::Syntax;
+      }
+      if (!accept(c, ']'))
+      {
+        do
+        {
+          IngestStatus status = parseReading(c, columns);
+          if (status != IngestStatus::Ok)
+          {
+            return status;
+          }
+        } while (accept(c, ','));
+        if (!accept(c, ']'))
+        {
+          return IngestStatus::Syntax;
+        }
+      }
+    }
+    else if (KEY_IS("device"))
+    {
+      const char* start;
+      const char* end;
+      if (!parseString(c, start, end))
+      {
+        return IngestStatus::Syntax;
+      }
+      if (!parseHex(start, end, header.device))
+      {
+        return IngestStatus::Schema;
+      }
+      hasDevice = true;
+    }
+    else if (KEY_IS("encoding"))
+    {
+      if (!parseUint(c, header.encoding))
+      {
+        return IngestStatus::Syntax;
+      }
+      if (header.encoding > INGEST_ENCODING)
+      {
+        return IngestStatus::Encoding;
+      }
+    }
+    else if (KEY_IS("seq"))
+    {
+      if (!accept(c, '['))
+      {
+        return IngestStatus::Syntax;
+      }
+      if (!accept(c, ']'))
+      {
+        skipSpace(c);
+        if (!parseUint(c, header.firstSeq) || !accept(c, ','))
+        {
+          return IngestStatus::Syntax;
+        }
+        skipSpace(c);
+        if (!parseUint(c, header.lastSeq) || !accept(c, ']'))
+        {
+          return IngestStatus::Syntax;
+        }
+        hasSeq = true;
+      }
+    }
+    else if (KEY_IS("firmware"))
+    {
+      const char* start;
+      const char* end;
+      if (!parseString(c, start, end))
+      {
+        return IngestStatus::Syntax;
+      }
+      header.firmware.assign(start, end);
+    }
+    else if (!skipValue(c))
+    {
+      return IngestStatus::Syntax;
+    }
+  } while (accept(c, ','));
+  if (!accept(c, '}'))
+  {
+    return IngestStatus::Syntax;
+  }
+  skipSpace(c);
+  if (c.p != c.end)
+  {
+    return IngestStatus::Syntax;
+  }
+
+  // The sequence numbers may come after the readings, so they are filled in last
+  size_t count = columns.size() - first;
+  if (!hasDevice || (count > 0 && (!hasSeq || header.lastSeq - header.firstSeq + 1 != count)))
+  {
+    return IngestStatus::Schema;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    columns.seq.push_back(header.firstSeq + static_cast<uint32_t>(i));
+  }
+  return IngestStatus::Ok;
+}
+
+IngestResult parseEnvelope(const char* data, size_t len, BatchHeader& header, ReadingColumns& columns)
+{
+  Cursor c = { data, data + len };
+  size_t first = columns.size();
+  header = BatchHeader();
+  IngestStatus status = parseEnvelopeBody(c, header, columns, first);
+  if (status != IngestStatus::Ok)
+  {
+    columns.truncate(first);
+    return { status, static_cast<size_t>(c.p - data), 0 };
+  }
+  return { status, len, columns.size() - first };
+}
+
+/**
+ * @brief Parse "[seq,]timestamp,humidity,temperature[,node]" lines
+ *
+ * @details With hasSeq, every line carries a sequence number and a, possibly empty, node field, and a
+ * header line starting with "seq" is skipped.
+ */
+static IngestResult parseLines(const char* data, size_t len, bool hasSeq, uint32_t seq, ReadingColumns& columns)
+{
+  const char* p = data;
+  const char* end = data + len;
+  size_t first = columns.size();
+  IngestStatus status = IngestStatus::Ok;
+  if (hasSeq && len >= 3 && memcmp(data, "seq", 3) == 0)
+  {
+    const char* newline = static_cast<const char*>(memchr(p, '\n', len));
+    if (newline == nullptr)
+    {
+      return { IngestStatus::Syntax, 0, 0 };
+    }
+    p = newline + 1;
+  }
+
+  while (p < end)
+  {
+    const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+    const char* lineEnd = newline != nullptr ? newline : end;
+    Cursor c = { p, lineEnd > p && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd };
+    if (c.p == c.end)
+    {
+      p = lineEnd + 1;
+      continue;
+    }
+    // Every line written by the firmware ends with a line end, without one the body was cut off
+    if (newline == nullptr)
+    {
+      status = IngestStatus::Syntax;
+      break;
+    }
+
+    uint32_t timestamp;
+    float humidity;
+    float temperature;
+    uint32_t node = 0;
+    if (hasSeq && (!parseUint(c, seq) || !accept(c, ',')))
+    {
+      status = IngestStatus::Syntax;
+      break;
+    }
+    if (!parseUint(c, timestamp) || !accept(c, ',') || !parseValue(c, humidity) || !accept(c, ',')
+      || !parseValue(c, temperature))
+    {
+      status = IngestStatus::Syntax;
+      break;
+    }
+    if (accept(c, ','))
+    {
+      if (c.p != c.end && !parseHex(c.p, c.end, node))
+      {
+        status = IngestStatus::Schema;
+        break;
+      }
+      c.p = c.end;
+    }
+    else if (hasSeq)
+    {
+      status = IngestStatus::Schema;
+      break;
+    }
+    if (c.p != c.end)
+    {
+      status = IngestStatus::Syntax;
+      break;
+    }
+
+    columns.seq.push_back(seq++);
+    columns.timestamp.push_back(timestamp);
+    columns.humidity.push_back(humidity);
+    columns.temperature.push_back(temperature);
+    columns.node.push_back(node);
+    p = lineEnd + 1;
+  }
+
+  if (status != IngestStatus::Ok)
+  {
+    columns.truncate(first);
+    return { status, static_cast<size_t>(p - data), 0 };
+  }
+  return { status, len, columns.size() - first };
+}
+
+IngestResult parseCsv(const char* data, size_t len, ReadingColumns& columns)
+{
+  return parseLines(data, len, true, 0, columns);
+}
+
+IngestResult parseLog(const char* data, size_t len, uint32_t firstSeq, ReadingColumns& columns)
+{
+  return parseLines(data, len, false, firstSeq, columns);
+}
@@ -0,0 +1,136 @@
+/**
+ * @file Ingest.h
+ * @author Christoff Linde
+ * @brief Host side parsers for the upload formats of the firmware
+ * @version 0.1
+ * @date 2021-04-09
+ *
+ * Parses the bodies posted by the firmware's sendData() straight into columnar buffers, without
+ * building a document tree first:
+ *  \li the JSON batch envelope sent to the API, see README.md
+ *  \li the CSV sent to the analytics sink
+ *  \li the raw reading log, /data.txt, as copied off a device
+ *
+ * The JSON parser is driven by the envelope schema. It makes a single pass over the body, matches keys
+ * by length and content, and converts numbers in place. Unknown keys are skipped, so fields added to
+ * the envelope without an encoding change do not break older collectors.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Highest envelope encoding understood, matches UPLOAD_ENCODING of the firmware
+#define INGEST_ENCODING 1
+
+/// Outcome of parsing a body
+enum class IngestStatus
+{
+  Ok,
+  /// The body is not well formed
+  Syntax,
+  /// The body is well formed, but does not match the schema
+  Schema,
+  /// The envelope has an encoding newer than INGEST_ENCODING
+  Encoding
+};
+
+/// Readings stored column by column, one entry per reading in every column
+struct ReadingColumns
+{
+  std::vector<uint32_t> seq;
+  std::vector<uint32_t> timestamp;
+  std::vector<float> humidity;
+  std::vector<float> temperature;
+  /// Chip id of the leaf the reading came from, or 0 for the uploading device
+  std::vector<uint32_t> node;
+
+  size_t size() const
+  {
+    return timestamp.size();
+  }
+
+  void reserve(size_t count);
+  void clear();
+  /// Drop every reading from index count on
+  void truncate(size_t count);
+};
+
+/// The per batch fields of an envelope
+struct BatchHeader
+{
+  /// Chip id of the uploading device
+  uint32_t device = 0;
+  std::string firmware;
+  uint32_t encoding = 0;
+  uint32_t firstSeq = 0;
+  uint32_t lastSeq = 0;
+};
+
+/// Result of parsing a body
+struct IngestResult
+{
+  IngestStatus status;
+  /// Offset in the body at which parsing stopped
+  size_t offset;
+  /// Number of readings appended to the columns
+  size_t count;
+};
+
+/**
+ * @brief Get a readable name for a status
+ *
+ * @param status the status to name
+ * @return const char* - the name of the status
+ */
+const char* ingestStatusName(IngestStatus status);
+
+/**
+ * @brief Parse a JSON batch envelope
+ *
+ * @details The readings are appended to the columns, with sequence numbers counted from the first
+ * sequence number of the envelope. If the body does not parse, nothing is appended.
+ *
+ * @param data the body
+ * @param len the length of the body
+ * @param header set to the per batch fields of the envelope
+ * @param columns the columns to append the readings to
+ * @return IngestResult - the outcome
+ */
+IngestResult parseEnvelope(const char* data, size_t len, BatchHeader& header, ReadingColumns& columns);
+
+/**
+ * @brief Parse a CSV body sent to the analytics sink
+ *
+ * @details The header line is optional. Every line must end with a line end, so a body that was cut off
+ * is rejected. If the body does not parse, nothing is appended.
+ *
+ * @param data the body
+ * @param len the length of the body
+ * @param columns the columns to append the readings to
+ * @return IngestResult - the outcome
+ */
+IngestResult parseCsv(const char* data, size_t len, ReadingColumns& columns);
+
+/**
+ * @brief Parse a reading log copied off a device
+ *
+ * @details The log holds no sequence numbers, so they are counted from firstSeq. As with parseCsv, a log
+ * whose last line has no line end is rejected. If the log does not parse, nothing is appended.
+ *
+ * @param data the log
+ * @param len the length of the log
+ * @param firstSeq the sequence number of the first reading in the log
+ * @param columns the columns to append the readings to
+ * @return IngestResult - the outcome
+ */
+IngestResult parseLog(const char* data, size_t len, uint32_t firstSeq, ReadingColumns& columns);
+
+#endif
@@ -0,0 +1,351 @@
+/**
+ * @file IngestTest.cpp
+ * @author Christoff Linde
+ * @brief Tests of the upload format parsers, @see Ingest.h
+ * @version 0.1
+ * @date 2021-04-26
+ *
+ * The envelopes, CSV bodies and log lines are written by the firmware's own writers from
+ * include/ReadingSchema.h, so the parsers are checked against what the devices send. Values are
+ * compared in hundredths, the fixed point the firmware keeps them in.
+ *
+ * Run with ctest, or directly: ingest_test
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "Ingest.h"
+#include "ReadingSchema.h"
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+  if (!condition)
+  {
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+/// Collects the output of the firmware's writers
+struct StringSink
+{
+  std::string text;
+
+  size_t write(const uint8_t* data, size_t len)
+  {
+    text.append(reinterpret_cast<const char*>(data), len);
+    return len;
+  }
+};
+
+/// Readings around zero and at the ends of the sensor range, from this device and from leaves
+static const LogRecord records[] = {
+  { 0, 1616400000, 6520, 2140, 0 },
+  { 0, 1616400900, 0, -1010, 0xa1b2c3 },
+  { 0, 1616401800, 10000, -5, 0 },
+  { 0, 1616402700, 5, 0, 0x1 },
+  { 0, 1616403600, 9999, -4000, 0xffffffff },
+  { 0, 1616404500, 3333, 8000, 0 },
+};
+static const size_t recordCount = sizeof(records) / sizeof(records[0]);
+
+static int32_t centi(float value)
+{
+  return static_cast<int32_t>(lroundf(value * 100));
+}
+
+/// Check that the columns from index first on hold records, with sequence numbers from firstSeq
+static bool matches(const ReadingColumns& columns, size_t first, uint32_t firstSeq)
+{
+  if (columns.size() != first + recordCount || columns.seq.size() != columns.size()
+    || columns.node.size() != columns.size())
+  {
+    return false;
+  }
+  for (size_t i = 0; i < recordCount; i++)
+  {
+    size_t k = first + i;
+    if (columns.seq[k] != firstSeq + i || columns.timestamp[k] != records[i].timestamp
+      || centi(columns.humidity[k]) != records[i].humidity || centi(columns.temperature[k]) != records[i].temperature
+      || columns.node[k] != records[i].node)
+    {
+      fprintf(stderr, "reading %zu differs\n", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string envelope()
+{
+  StringSink sink;
+  SamplerTelemetry sampler = { 1834, { 95, 3, 1, 0, 0, 0 }, 0 };
+  writeEnvelope(sink, "e1f0c2", "0.4", records, recordCount, 120, &sampler);
+  return sink.text;
+}
+
+static std::string csv()
+{
+  StringSink sink;
+  writeCsvBatch(sink, records, recordCount, 7);
+  return sink.text;
+}
+
+static std::string logLines()
+{
+  StringSink sink;
+  for (size_t i = 0; i < recordCount; i++)
+  {
+    writeLogLine(sink, records[i]);
+  }
+  return sink.text;
+}
+
+static void testEnvelope()
+{
+  std::string body = envelope();
+  BatchHeader header;
+  ReadingColumns columns;
+  IngestResult result = parseEnvelope(body.data(), body.size(), header, columns);
+  check(result.status == IngestStatus::Ok, "envelope parsed");
+  check(result.count == recordCount && result.offset == body.size(), "envelope count and offset");
+  check(header.device == 0xe1f0c2 && header.firmware == "0.4" && header.encoding == UPLOAD_ENCODING,
+    "envelope header");
+  check(header.firstSeq == 120 && header.lastSeq == 120 + recordCount - 1, "envelope seq");
+  check(matches(columns, 0, 120), "envelope readings");
+
+  // Appended after the readings already held
+  result = parseEnvelope(body.data(), body.size(), header, columns);
+  check(result.status == IngestStatus::Ok && matches(columns, recordCount, 120), "envelope appended");
+
+  // Keys in another order, with whitespace, and the sequence numbers after the readings
+  const char* reordered = "{ \"readings\" : [ {\"temperature\": -0.05, \"node\": \"a1\", \"timestamp\": 5,"
+                          " \"humidity\": 1e1, \"extra\": [1, {\"a\": null}]} ],\n \"seq\": [ 9, 9 ],"
+                          " \"device\": \"A1B2C3\" }\n";
+  columns.clear();
+  result = parseEnvelope(reordered, strlen(reordered), header, columns);
+  check(result.status == IngestStatus::Ok && columns.size() == 1, "reordered envelope");
+  check(header.device == 0xa1b2c3 && columns.seq[0] == 9 && columns.timestamp[0] == 5 && columns.node[0] == 0xa1
+      && centi(columns.temperature[0]) == -5 && centi(columns.humidity[0]) == 1000,
+    "reordered envelope values");
+
+  const char* empty = "{\"device\":\"a1\",\"encoding\":1,\"seq\":[],\"readings\":[]}";
+  columns.clear();
+  result = parseEnvelope(empty, strlen(empty), header, columns);
+  check(result.status == IngestStatus::Ok && result.count == 0, "envelope without readings");
+
+  const char* missing = "{\"device\":\"a1\",\"seq\":[1,1],\"readings\":[{\"timestamp\":1,\"humidity\":NaN,"
+                        "\"temperature\":null}]}";
+  result = parseEnvelope(missing, strlen(missing), header, columns);
+  check(result.status == IngestStatus::Ok && std::isnan(columns.humidity[0]) && std::isnan(columns.temperature[0]),
+    "missing values");
+}
+
+static void testCsv()
+{
+  std::string body = csv();
+  ReadingColumns columns;
+  IngestResult result = parseCsv(body.data(), body.size(), columns);
+  check(result.status == IngestStatus::Ok && result.count == recordCount, "csv parsed");
+  check(matches(columns, 0, 7), "csv readings");
+
+  // Without the header line, with CRLF line ends and blank lines
+  const char* lines = "3,1616400000,65.20,-21.40,\r\n\r\n4,1616400900,0.05,-0.01,a1b2c3\r\n";
+  columns.clear();
+  result = parseCsv(lines, strlen(lines), columns);
+  check(result.status == IngestStatus::Ok && columns.size() == 2, "csv without header");
+  check(columns.seq[1] == 4 && centi(columns.temperature[0]) == -2140 && centi(columns.humidity[1]) == 5
+      && centi(columns.temperature[1]) == -1 && columns.node[0] == 0 && columns.node[1] == 0xa1b2c3,
+    "csv without header values");
+
+  // Every line of a CSV body carries the node column
+  const char* noNode = "3,1616400000,65.20,21.40\n";
+  columns.clear();
+  check(parseCsv(noNode, strlen(noNode), columns).status == IngestStatus::Schema && columns.size() == 0,
+    "csv without node column");
+}
+
+static void testLog()
+{
+  std::string body = logLines();
+  ReadingColumns columns;
+  IngestResult result = parseLog(body.data(), body.size(), 500, columns);
+  check(result.status == IngestStatus::Ok && result.count == recordCount, "log parsed");
+  check(matches(columns, 0, 500), "log readings");
+
+  // Lines written before the node column was added
+  const char* old = "1616400000,65.20,21.40\n1616400900,65.30,-1.50\n";
+  columns.clear();
+  result = parseLog(old, strlen(old), 0, columns);
+  check(result.status == IngestStatus::Ok && columns.size() == 2 && centi(columns.temperature[1]) == -150
+      && columns.node[1] == 0,
+    "log without node column");
+}
+
+enum Format
+{
+  ENVELOPE,
+  CSV,
+  LOG
+};
+
+static IngestResult parsePrefix(const std::string& body, size_t len, Format format, ReadingColumns& columns)
+{
+  BatchHeader header;
+  switch (format)
+  {
+  case ENVELOPE:
+    return parseEnvelope(body.data(), len, header, columns);
+  case CSV:
+    return parseCsv(body.data(), len, columns);
+  case LOG:
+    break;
+  }
+  return parseLog(body.data(), len, 0, columns);
+}
+
+/**
+ * @brief Check that a body cut off anywhere but after a line end is rejected
+ *
+ * @details The columns already hold readings, which a rejected body must leave alone.
+ */
+static void checkPrefixes(const std::string& body, Format format, const char* what)
+{
+  ReadingColumns columns;
+  std::string held = envelope();
+  BatchHeader header;
+  parseEnvelope(held.data(), held.size(), header, columns);
+  size_t count = columns.size();
+
+  bool ok = true;
+  for (size_t len = 0; len < body.size(); len++)
+  {
+    IngestResult result = parsePrefix(body, len, format, columns);
+    // A CSV body or log cut after a line end holds fewer, complete lines
+    if (format != ENVELOPE && (len == 0 || body[len - 1] == '\n'))
+    {
+      columns.truncate(count);
+      continue;
+    }
+    if (result.status == IngestStatus::Ok || result.count != 0 || columns.size() != count || result.offset > len)
+    {
+      fprintf(stderr, "%s cut to %zu bytes: %s\n", what, len, ingestStatusName(result.status));
+      ok = false;
+    }
+  }
+  check(ok, what);
+}
+
+static void testTruncated()
+{
+  checkPrefixes(envelope(), ENVELOPE, "envelope truncated");
+  checkPrefixes(csv(), CSV, "csv truncated");
+  checkPrefixes(logLines(), LOG, "log truncated");
+
+  // Parsing stops at the line that was cut off
+  std::string body = logLines();
+  body.resize(body.size() - 4);
+  ReadingColumns columns;
+  IngestResult result = parseLog(body.data(), body.size(), 0, columns);
+  check(result.status == IngestStatus::Syntax && result.offset == body.rfind('\n') + 1, "log cut in the last line");
+}
+
+static void testGarbage()
+{
+  struct Case
+  {
+    const char* body;
+    IngestStatus status;
+  };
+  static const Case envelopes[] = {
+    { "", IngestStatus::Syntax },
+    { "[]", IngestStatus::Syntax },
+    { "{}", IngestStatus::Schema },
+    { "{\"device\":\"a1\"} x", IngestStatus::Syntax },
+    { "{\"device\":\"a1\",}", IngestStatus::Syntax },
+    { "{\"device\":\"xyz\"}", IngestStatus::Schema },
+    { "{\"device\":\"123456789\"}", IngestStatus::Schema },
+    { "{\"device\":\"a1\",\"encoding\":2}", IngestStatus::Encoding },
+    { "{\"device\":\"a1\",\"seq\":[1,2],\"readings\":[{\"timestamp\":1,\"humidity\":1,\"temperature\":1}]}",
+      IngestStatus::Schema },
+    { "{\"device\":\"a1\",\"readings\":[{\"timestamp\":1,\"humidity\":1,\"temperature\":1}]}", IngestStatus::Schema },
+    { "{\"device\":\"a1\",\"seq\":[1,1],\"readings\":[{\"timestamp\":1,\"humidity\":1}]}", IngestStatus::Schema },
+    { "{\"device\":\"a1\",\"seq\":[1,1],\"readings\":[{\"timestamp\":4294967296,\"humidity\":1,\"temperature\":1}]}",
+      IngestStatus::Syntax },
+    { "{\"device\":\"a1\",\"seq\":[1,1],\"readings\":[{\"timestamp\":1,\"humidity\":1e,\"temperature\":1}]}",
+      IngestStatus::Syntax },
+    { "{\"device\":\"a1\",\"seq\":[1,1],\"readings\":[{\"timestamp\":1,\"humidity\":-,\"temperature\":1}]}",
+      IngestStatus::Syntax },
+    { "{\"device\":\"a1\",\"seq\":[1,1],\"readings\":[{\"timestamp\":1,\"humidity\":1,\"temperature\":1,"
+      "\"node\":\"leaf\"}]}",
+      IngestStatus::Schema },
+    { "{\"device\":\"a1\",\"firmware\":\"0.4\\\"}", IngestStatus::Syntax },
+    { "{\"device\":\"a1\",\"x\":[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]}",
+      IngestStatus::Syntax },
+  };
+  for (const Case& test : envelopes)
+  {
+    BatchHeader header;
+    ReadingColumns columns;
+    IngestResult result = parseEnvelope(test.body, strlen(test.body), header, columns);
+    check(result.status == test.status && columns.size() == 0, test.body);
+  }
+
+  static const Case lines[] = {
+    { "seq,timestamp,humidity,temperature,node\nx,1,2,3,\n", IngestStatus::Syntax },
+    { "1,1616400000,65.20,21.40,\n2,1616400900,65.20,21.40,zz\n", IngestStatus::Schema },
+    { "1,1616400000,65.20,21.40,,\n", IngestStatus::Schema },
+    { "1,1616400000,65.20;21.40,\n", IngestStatus::Syntax },
+    { "1,1616400000,--1,21.40,\n", IngestStatus::Syntax },
+  };
+  for (const Case& test : lines)
+  {
+    ReadingColumns columns;
+    IngestResult result = parseCsv(test.body, strlen(test.body), columns);
+    check(result.status == test.status && columns.size() == 0, test.body);
+  }
+
+  // Bytes that are not text at all
+  std::string noise;
+  uint32_t state = 1;
+  for (size_t i = 0; i < 4096; i++)
+  {
+    state = state * 1103515245 + 12345;
+    noise.push_back(static_cast<char>(state >> 16));
+  }
+  bool rejected = true;
+  for (size_t len = 1; len <= noise.size(); len *= 2)
+  {
+    BatchHeader header;
+    ReadingColumns columns;
+    rejected &= parseEnvelope(noise.data(), len, header, columns).status != IngestStatus::Ok;
+    rejected &= parseCsv(noise.data(), len, columns).status != IngestStatus::Ok;
+    rejected &= parseLog(noise.data(), len, 0, columns).status != IngestStatus::Ok;
+    rejected &= columns.size() == 0;
+  }
+  check(rejected, "random bytes rejected");
+}
+
+int main()
+{
+  testEnvelope();
+  testCsv();
+  testLog();
+  testTruncated();
+  testGarbage();
+  if (failures > 0)
+  {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
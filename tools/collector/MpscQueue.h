@@ -0,0 +1,107 @@
+/**
+ * @file MpscQueue.h
+ * @author Christoff Linde
+ * @brief Lock-free multiple producer, single consumer queue
+ * @version 0.1
+ * @date 2021-04-13
+ *
+ * An unbounded intrusive linked list queue. A push is a single atomic exchange on the head, followed by
+ * linking the previous node, so producers never wait on each other or on the consumer. The consumer
+ * owns the tail and needs no atomic read-modify-write at all.
+ *
+ * Between a producer's exchange and its link, the queue looks empty to the consumer from that node on.
+ * Consumers must therefore treat an empty pop as "nothing yet", and count pushes separately if they
+ * need to know what is still coming, as Collector does.
+ *
+ * The consumer may change threads, as long as the handover between consumers is synchronized.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+template <typename T>
+class MpscQueue
+{
+public:
+  MpscQueue() : _head(&_stub), _tail(&_stub)
+  {
+  }
+
+  ~MpscQueue()
+  {
+    T value;
+    while (pop(value))
+    {
+    }
+    if (_tail != &_stub)
+    {
+      delete _tail;
+    }
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  /**
+   * @brief Append a value, from any thread
+   *
+   * @param value the value to append
+   */
+  void push(T value)
+  {
+    Node* node = new Node(std::move(value));
+    Node* previous = _head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_seq_cst);
+  }
+
+  /**
+   * @brief Take the oldest value, from the consumer thread only
+   *
+   * @param value set to the value taken
+   * @return true if a value was taken
+   */
+  bool pop(T& value)
+  {
+    Node* tail = _tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+    {
+      return false;
+    }
+    // next becomes the new dummy node, its value is moved out
+    value = std::move(next->value);
+    _tail = next;
+    if (tail != &_stub)
+    {
+      delete tail;
+    }
+    return true;
+  }
+
+private:
+  struct Node
+  {
+    Node() : next(nullptr)
+    {
+    }
+
+    explicit Node(T&& item) : next(nullptr), value(std::move(item))
+    {
+    }
+
+    std::atomic<Node*> next;
+    T value;
+  };
+
+  Node _stub;
+  std::atomic<Node*> _head;
+  Node* _tail;
+};
+
+#endif
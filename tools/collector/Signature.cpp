@@ -0,0 +1,259 @@
+/**
+ * @file Signature.cpp
+ * @author Christoff Linde
+ * @brief Upload signature verification implementation
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "Signature.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const uint32_t sha256K[64] = { 0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7,
+  0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85,
+  0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c,
+  0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+static inline uint32_t rotr(uint32_t value, int bits)
+{
+  return (value >> bits) | (value << (32 - bits));
+}
+
+Sha256::Sha256()
+  : _state { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+    _buffered(0), _length(0)
+{
+}
+
+void Sha256::block(const uint8_t* data)
+{
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = ((uint32_t)data[4 * i] << 24) | ((uint32_t)data[4 * i + 1] << 16) | ((uint32_t)data[4 * i + 2] << 8)
+      | data[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++)
+  {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+  uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  _state[0] += a;
+  _state[1] += b;
+  _state[2] += c;
+  _state[3] += d;
+  _state[4] += e;
+  _state[5] += f;
+  _state[6] += g;
+  _state[7] += h;
+}
+
+void Sha256::update(const void* data, size_t len)
+{
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  _length += len;
+  while (len > 0)
+  {
+    if (_buffered == 0 && len >= sizeof(_buffer))
+    {
+      block(bytes);
+      bytes += sizeof(_buffer);
+      len -= sizeof(_buffer);
+      continue;
+    }
+    size_t take = std::min(len, sizeof(_buffer) - _buffered);
+    memcpy(_buffer + _buffered, bytes, take);
+    _buffered += take;
+    bytes += take;
+    len -= take;
+    if (_buffered == sizeof(_buffer))
+    {
+      block(_buffer);
+      _buffered = 0;
+    }
+  }
+}
+
+void Sha256::final(uint8_t digest[SHA256_SIZE])
+{
+  uint64_t bits = _length * 8;
+  uint8_t pad = 0x80;
+  update(&pad, 1);
+  pad = 0;
+  while (_buffered != 56)
+  {
+    update(&pad, 1);
+  }
+  uint8_t length[8];
+  for (int i = 0; i < 8; i++)
+  {
+    length[i] = bits >> (56 - 8 * i);
+  }
+  update(length, sizeof(length));
+  for (int i = 0; i < 8; i++)
+  {
+    digest[4 * i] = _state[i] >> 24;
+    digest[4 * i + 1] = _state[i] >> 16;
+    digest[4 * i + 2] = _state[i] >> 8;
+    digest[4 * i + 3] = _state[i];
+  }
+}
+
+HmacSha256::HmacSha256(const void* key, size_t len)
+{
+  uint8_t block[64] = {};
+  if (len > sizeof(block))
+  {
+    Sha256 hash;
+    hash.update(key, len);
+    hash.final(block);
+  }
+  else
+  {
+    memcpy(block, key, len);
+  }
+
+  uint8_t innerPad[64];
+  for (size_t i = 0; i < sizeof(block); i++)
+  {
+    innerPad[i] = block[i] ^ 0x36;
+    _outerPad[i] = block[i] ^ 0x5c;
+  }
+  _inner.update(innerPad, sizeof(innerPad));
+}
+
+void HmacSha256::update(const void* data, size_t len)
+{
+  _inner.update(data, len);
+}
+
+void HmacSha256::final(uint8_t mac[SHA256_SIZE])
+{
+  uint8_t innerDigest[SHA256_SIZE];
+  _inner.final(innerDigest);
+  Sha256 outer;
+  outer.update(_outerPad, sizeof(_outerPad));
+  outer.update(innerDigest, sizeof(innerDigest));
+  outer.final(mac);
+}
+
+const char* signatureStatusName(SignatureStatus status)
+{
+  switch (status)
+  {
+  case SignatureStatus::Ok: return "ok";
+  case SignatureStatus::Malformed: return "malformed";
+  case SignatureStatus::Mismatch: return "mismatch";
+  case SignatureStatus::Replayed: return "replayed";
+  }
+  return "unknown";
+}
+
+void deviceKey(const std::string& fleetKey, uint32_t device, uint8_t key[SHA256_SIZE])
+{
+  // The firmware prints the chip id as lower case hex without leading zeroes
+  char chipId[9];
+  int len = snprintf(chipId, sizeof(chipId), "%x", device);
+  HmacSha256 hmac(fleetKey.data(), fleetKey.size());
+  hmac.update(chipId, len);
+  hmac.final(key);
+}
+
+static int hexValue(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+SignatureVerifier::SignatureVerifier(const std::string& fleetKey)
+  : _fleetKey(fleetKey)
+{
+}
+
+SignatureStatus SignatureVerifier::verify(uint32_t device, const char* counter, const char* signature,
+  const char* body, size_t len)
+{
+  if (counter == nullptr || signature == nullptr || *counter < '0' || *counter > '9'
+    || strlen(signature) != 2 * SHA256_SIZE)
+  {
+    return SignatureStatus::Malformed;
+  }
+  char* end;
+  unsigned long long value = strtoull(counter, &end, 10);
+  if (*end != '\0' || value > UINT32_MAX)
+  {
+    return SignatureStatus::Malformed;
+  }
+  uint8_t expected[SHA256_SIZE];
+  for (size_t i = 0; i < SHA256_SIZE; i++)
+  {
+    int high = hexValue(signature[2 * i]);
+    int low = hexValue(signature[2 * i + 1]);
+    if (high < 0 || low < 0)
+    {
+      return SignatureStatus::Malformed;
+    }
+    expected[i] = (high << 4) | low;
+  }
+
+  uint8_t key[SHA256_SIZE];
+  deviceKey(_fleetKey, device, key);
+  HmacSha256 hmac(key, sizeof(key));
+  char prefix[12];
+  int prefixLength = snprintf(prefix, sizeof(prefix), "%llu\n", value);
+  hmac.update(prefix, prefixLength);
+  hmac.update(body, len);
+  uint8_t mac[SHA256_SIZE];
+  hmac.final(mac);
+
+  // Compare every byte, so the time taken does not tell how much of a forged signature was right
+  uint8_t difference = 0;
+  for (size_t i = 0; i < SHA256_SIZE; i++)
+  {
+    difference |= mac[i] ^ expected[i];
+  }
+  if (difference != 0)
+  {
+    return SignatureStatus::Mismatch;
+  }
+
+  // Only a valid signature moves the counter, so forged uploads cannot lock a device out
+  std::lock_guard<std::mutex> guard(_lock);
+  auto last = _counters.find(device);
+  if (last != _counters.end() && value <= last->second)
+  {
+    return SignatureStatus::Replayed;
+  }
+  _counters[device] = value;
+  return SignatureStatus::Ok;
+}
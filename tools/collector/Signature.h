@@ -0,0 +1,118 @@
+/**
+ * @file Signature.h
+ * @author Christoff Linde
+ * @brief Server side verification of the HMAC-SHA256 signed uploads, @see PayloadSigner.h
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * A signed upload carries X-Device-Counter and X-Signature, the hex HMAC-SHA256 of "<counter>\n"
+ * followed by the body, under the key of the device. The key of a device is derived from the fleet key
+ * and its chip id, so the verifier only needs the fleet key the firmware was built with.
+ *
+ * The verifier remembers the last counter accepted per device, and rejects counters that are not
+ * larger, so a recorded upload cannot be replayed. The firmware skips counters it reserved before a
+ * reboot, so gaps are expected.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef SIGNATURE_H
+#define SIGNATURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/// Size of a SHA-256 digest
+#define SHA256_SIZE 32
+
+/// Outcome of verifying an upload
+enum class SignatureStatus
+{
+  Ok,
+  /// The counter or signature header is missing or malformed
+  Malformed,
+  /// The signature does not match the body
+  Mismatch,
+  /// The counter is not larger than the last one accepted for the device
+  Replayed
+};
+
+/// Incremental SHA-256
+class Sha256
+{
+public:
+  Sha256();
+  void update(const void* data, size_t len);
+  void final(uint8_t digest[SHA256_SIZE]);
+
+private:
+  void block(const uint8_t* data);
+
+  uint32_t _state[8];
+  uint8_t _buffer[64];
+  size_t _buffered;
+  uint64_t _length;
+};
+
+/// Incremental HMAC-SHA256
+class HmacSha256
+{
+public:
+  HmacSha256(const void* key, size_t len);
+  void update(const void* data, size_t len);
+  void final(uint8_t mac[SHA256_SIZE]);
+
+private:
+  Sha256 _inner;
+  uint8_t _outerPad[64];
+};
+
+/**
+ * @brief Get a readable name for a status
+ *
+ * @param status the status to name
+ * @return const char* - the name of the status
+ */
+const char* signatureStatusName(SignatureStatus status);
+
+/**
+ * @brief Derive the key of a device, as the firmware does
+ *
+ * @param fleetKey the UPLOAD_HMAC_KEY the firmware was built with
+ * @param device the chip id of the device
+ * @param key receives the key of the device
+ */
+void deviceKey(const std::string& fleetKey, uint32_t device, uint8_t key[SHA256_SIZE]);
+
+class SignatureVerifier
+{
+public:
+  explicit SignatureVerifier(const std::string& fleetKey);
+
+  /**
+   * @brief Verify an upload, and accept its counter if it is valid
+   *
+   * @details Safe to call from several threads. The device is the chip id from the envelope, or from
+   * the X-Device header of a CSV upload.
+   *
+   * @param device the chip id of the uploading device
+   * @param counter the X-Device-Counter header
+   * @param signature the X-Signature header
+   * @param body the body
+   * @param len the length of the body
+   * @return SignatureStatus - the outcome
+   */
+  SignatureStatus verify(uint32_t device, const char* counter, const char* signature, const char* body, size_t len);
+
+private:
+  std::string _fleetKey;
+  std::mutex _lock;
+  /// Last counter accepted per device
+  std::unordered_map<uint32_t, uint32_t> _counters;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * @file SignatureTest.cpp
+ * @author Christoff Linde
+ * @brief Tests of the upload signature verification, @see Signature.h
+ * @version 0.1
+ * @date 2021-04-19
+ *
+ * The digests are the FIPS 180-2 and RFC 4231 test vectors. The signed upload was computed with
+ * Python's hmac module, following the key derivation and signed data of PayloadSigner.cpp.
+ *
+ * Run with ctest, or directly: signature_test
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "Ingest.h"
+#include "Signature.h"
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+  if (!condition)
+  {
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+static std::string hex(const uint8_t* data, size_t len)
+{
+  std::string out;
+  char digit[3];
+  for (size_t i = 0; i < len; i++)
+  {
+    snprintf(digit, sizeof(digit), "%02x", data[i]);
+    out += digit;
+  }
+  return out;
+}
+
+static std::string sha256Hex(const std::string& data, size_t chunk)
+{
+  Sha256 hash;
+  for (size_t i = 0; i < data.size(); i += chunk)
+  {
+    hash.update(data.data() + i, std::min(chunk, data.size() - i));
+  }
+  uint8_t digest[SHA256_SIZE];
+  hash.final(digest);
+  return hex(digest, sizeof(digest));
+}
+
+static std::string hmacHex(const std::string& key, const std::string& data)
+{
+  HmacSha256 hmac(key.data(), key.size());
+  hmac.update(data.data(), data.size());
+  uint8_t mac[SHA256_SIZE];
+  hmac.final(mac);
+  return hex(mac, sizeof(mac));
+}
+
+static void testSha256()
+{
+  check(sha256Hex("", 1) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", "sha256 empty");
+  check(sha256Hex("abc", 1) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", "sha256 abc");
+  check(sha256Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 7)
+      == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    "sha256 two blocks");
+  // Whole blocks straight from the input and partial ones through the buffer
+  std::string million(1000000, 'a');
+  check(sha256Hex(million, 1000) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+    "sha256 a million a");
+  check(sha256Hex(million, 77) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+    "sha256 a million a, odd chunks");
+}
+
+static void testHmac()
+{
+  check(hmacHex(std::string(20, '\x0b'), "Hi There")
+      == "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7",
+    "RFC 4231 case 1");
+  check(hmacHex("Jefe", "what do ya want for nothing?")
+      == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+    "RFC 4231 case 2");
+  check(hmacHex(std::string(131, '\xaa'), "Test Using Larger Than Block-Size Key - Hash Key First")
+      == "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+    "RFC 4231 case 6, key longer than a block");
+}
+
+static void testUpload()
+{
+  uint8_t key[SHA256_SIZE];
+  deviceKey("change me", 0xa1b2c3, key);
+  check(hex(key, sizeof(key)) == "974c9a2e6be445d26e2bedbf5ed75b0c9a40e061d8c5dcc7344af31006f70b17", "device key");
+
+  const std::string body = "{\"device\":\"a1b2c3\",\"firmware\":\"0.4\",\"encoding\":1,\"sensors\":[\"dht22\"],"
+    "\"seq\":[120,120],\"readings\":[{\"timestamp\":1616400000,\"humidity\":65.20,\"temperature\":21.40}]}";
+  const char* signature = "1f57be6224231cbfbb26eea05680d89833f7c032857a61b7f12c249da3974e0d";
+
+  // The device is taken from the envelope, as a server would
+  BatchHeader header;
+  ReadingColumns columns;
+  check(parseEnvelope(body.data(), body.size(), header, columns).status == IngestStatus::Ok, "envelope parses");
+  check(header.device == 0xa1b2c3, "envelope device");
+
+  SignatureVerifier verifier("change me");
+  check(verifier.verify(header.device, "17", signature, body.data(), body.size()) == SignatureStatus::Ok,
+    "signed upload accepted");
+  check(verifier.verify(header.device, "17", signature, body.data(), body.size()) == SignatureStatus::Replayed,
+    "same counter replayed");
+
+  SignatureVerifier fresh("change me");
+  std::string upper = signature;
+  for (char& c : upper)
+  {
+    c = toupper(c);
+  }
+  check(fresh.verify(header.device, "17", upper.c_str(), body.data(), body.size()) == SignatureStatus::Ok,
+    "upper case signature accepted");
+
+  SignatureVerifier other("change me");
+  std::string tampered = body;
+  tampered.replace(tampered.find("21.40"), 5, "31.40");
+  check(other.verify(header.device, "17", signature, tampered.data(), tampered.size()) == SignatureStatus::Mismatch,
+    "tampered body rejected");
+  check(other.verify(header.device, "18", signature, body.data(), body.size()) == SignatureStatus::Mismatch,
+    "changed counter rejected");
+  check(other.verify(0xa1b2c4, "17", signature, body.data(), body.size()) == SignatureStatus::Mismatch,
+    "other device rejected");
+  check(SignatureVerifier("other key").verify(header.device, "17", signature, body.data(), body.size())
+      == SignatureStatus::Mismatch,
+    "other fleet key rejected");
+  // Rejected uploads leave the counter alone
+  check(other.verify(header.device, "17", signature, body.data(), body.size()) == SignatureStatus::Ok,
+    "counter not moved by rejected uploads");
+
+  SignatureVerifier malformed("change me");
+  check(malformed.verify(header.device, nullptr, signature, body.data(), body.size()) == SignatureStatus::Malformed,
+    "missing counter");
+  check(malformed.verify(header.device, "17", nullptr, body.data(), body.size()) == SignatureStatus::Malformed,
+    "missing signature");
+  check(malformed.verify(header.device, "-1", signature, body.data(), body.size()) == SignatureStatus::Malformed,
+    "negative counter");
+  check(malformed.verify(header.device, "17x", signature, body.data(), body.size()) == SignatureStatus::Malformed,
+    "counter with trailing text");
+  check(malformed.verify(header.device, "4294967296", signature, body.data(), body.size())
+      == SignatureStatus::Malformed,
+    "counter out of range");
+  check(malformed.verify(header.device, "17", "1f57", body.data(), body.size()) == SignatureStatus::Malformed,
+    "short signature");
+  std::string notHex = signature;
+  notHex[10] = 'g';
+  check(malformed.verify(header.device, "17", notHex.c_str(), body.data(), body.size()) == SignatureStatus::Malformed,
+    "signature not hex");
+}
+
+int main()
+{
+  testSha256();
+  testHmac();
+  testUpload();
+  if (failures > 0)
+  {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
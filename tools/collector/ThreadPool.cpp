@@ -0,0 +1,138 @@
+/**
+ * @file ThreadPool.cpp
+ * @author Christoff Linde
+ * @brief Work-stealing thread pool implementation
+ * @version 0.1
+ * @date 2021-04-13
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+/// The pool and worker index of the calling thread, if it is a worker
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+ThreadPool::ThreadPool(size_t threads) : _pending(0), _queued(0), _sleeping(0), _next(0), _steals(0), _stopping(false)
+{
+  if (threads == 0)
+  {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < threads; i++)
+  {
+    _workers.emplace_back(new Worker());
+  }
+  for (size_t i = 0; i < threads; i++)
+  {
+    _threads.emplace_back(&ThreadPool::run, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  wait();
+  {
+    std::lock_guard<std::mutex> guard(_sleepLock);
+    _stopping = true;
+  }
+  _wake.notify_all();
+  for (std::thread& thread : _threads)
+  {
+    thread.join();
+  }
+}
+
+void ThreadPool::submit(Task task)
+{
+  size_t index = currentPool == this ? currentWorker : _next.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+  _pending.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> guard(_workers[index]->lock);
+    _workers[index]->tasks.push_back(std::move(task));
+  }
+  _queued.fetch_add(1);
+  // A worker going to sleep counts itself before checking _queued, so one of the two sees the other
+  if (_sleeping.load() > 0)
+  {
+    std::lock_guard<std::mutex> guard(_sleepLock);
+    _wake.notify_one();
+  }
+}
+
+void ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> guard(_sleepLock);
+  _finished.wait(guard, [this] { return _pending.load() == 0; });
+}
+
+bool ThreadPool::take(size_t index, Task& task)
+{
+  {
+    Worker& own = *_workers[index];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.tasks.empty())
+    {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < _workers.size(); i++)
+  {
+    Worker& victim = *_workers[(index + i) % _workers.size()];
+    std::unique_lock<std::mutex> guard(victim.lock, std::try_to_lock);
+    if (guard.owns_lock() && !victim.tasks.empty())
+    {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      _steals.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(size_t index)
+{
+  currentPool = this;
+  currentWorker = index;
+  Task task;
+  while (true)
+  {
+    if (take(index, task))
+    {
+      _queued.fetch_sub(1);
+      task();
+      task = nullptr;
+      if (_pending.fetch_sub(1) == 1)
+      {
+        std::lock_guard<std::mutex> guard(_sleepLock);
+        _finished.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(_sleepLock);
+    _sleeping.fetch_add(1);
+    if (_queued.load() > 0)
+    {
+      // Queued somewhere, possibly behind a deque that was busy when we tried to steal
+      _sleeping.fetch_sub(1);
+      guard.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    if (_stopping)
+    {
+      _sleeping.fetch_sub(1);
+      return;
+    }
+    _wake.wait(guard, [this] { return _stopping || _queued.load() > 0; });
+    _sleeping.fetch_sub(1);
+  }
+}
@@ -0,0 +1,99 @@
+/**
+ * @file ThreadPool.h
+ * @author Christoff Linde
+ * @brief Work-stealing thread pool
+ * @version 0.1
+ * @date 2021-04-13
+ *
+ * Every worker has its own task deque. A worker takes tasks from the back of its own deque, so tasks
+ * it submits itself run while their data is still in its cache. When its deque is empty, it steals from
+ * the front of the others. Tasks submitted from outside the pool are spread round-robin over the
+ * workers. Each deque has its own lock, which is only contended while stealing.
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  typedef std::function<void()> Task;
+
+  /**
+   * @brief Start the workers
+   *
+   * @param threads the number of workers, 0 for one per core
+   */
+  explicit ThreadPool(size_t threads);
+
+  /// Run the queued tasks to completion, then stop the workers
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * @brief Queue a task
+   *
+   * @details Called from a worker, the task goes to that worker's own deque.
+   *
+   * @param task the task to run
+   */
+  void submit(Task task);
+
+  /// Wait until every submitted task has run, including the tasks they submitted
+  void wait();
+
+  /// Number of workers
+  size_t size() const
+  {
+    return _threads.size();
+  }
+
+  /// Number of tasks taken from another worker's deque
+  uint64_t steals() const
+  {
+    return _steals.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Worker
+  {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  void run(size_t index);
+  bool take(size_t index, Task& task);
+
+  std::vector<std::unique_ptr<Worker>> _workers;
+  std::vector<std::thread> _threads;
+  /// Tasks submitted and not finished yet
+  std::atomic<size_t> _pending;
+  /// Tasks queued and not taken by a worker yet
+  std::atomic<size_t> _queued;
+  /// Workers waiting for a task
+  std::atomic<size_t> _sleeping;
+  std::atomic<size_t> _next;
+  std::atomic<uint64_t> _steals;
+  std::mutex _sleepLock;
+  std::condition_variable _wake;
+  std::condition_variable _finished;
+  bool _stopping;
+};
+
+#endif
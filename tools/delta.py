@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Generate a delta patch between two firmware images.
+
+The patch format is described in include/DeltaPatch.h. Matching follows the
+bsdiff approach: regions of the new image are paired with similar regions of
+the old image, and only the byte differences are stored. Code that moved or
+whose addresses shifted still yields mostly zero differences, which are sent
+as copy tokens.
+
+Usage: delta.py OLD NEW PATCH
+"""
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b"MDP1"
+SEED = 8
+MIN_MATCH = 24
+MAX_CANDIDATES = 8
+# Stop extending a match after this many bytes without improvement
+EXTEND_SLACK = 64
+# Zero runs shorter than this are cheaper to send as explicit diff bytes
+MIN_COPY_RUN = 4
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) ^ (value >> 31)
+
+
+def build_index(old):
+    index = {}
+    for pos in range(0, len(old) - SEED + 1):
+        positions = index.setdefault(old[pos:pos + SEED], [])
+        if len(positions) < MAX_CANDIDATES:
+            positions.append(pos)
+    return index
+
+
+def extend(old, new, old_pos, new_pos):
+    """Approximate forward extension, maximising 2 * matches - length."""
+    score = best_score = 0
+    length = best_length = 0
+    limit = min(len(old) - old_pos, len(new) - new_pos)
+    while length < limit and length - best_length < EXTEND_SLACK:
+        if old[old_pos + length] == new[new_pos + length]:
+            score += 1
+        length += 1
+        if 2 * score - length > 2 * best_score - best_length:
+            best_score, best_length = score, length
+    return best_length
+
+
+def find_matches(old, new):
+    """Return (new_pos, old_pos, length) tuples in order of new_pos."""
+    index = build_index(old)
+    matches = []
+    displacement = 0
+    pos = 0
+    while pos < len(new) - SEED:
+        candidates = []
+        # Prefer continuing at the displacement of the previous match
+        if 0 <= pos + displacement < len(old):
+            candidates.append(pos + displacement)
+        candidates.extend(index.get(new[pos:pos + SEED], ()))
+
+        best_old = best_length = 0
+        for candidate in candidates:
+            length = extend(old, new, candidate, pos)
+            if length > best_length:
+                best_old, best_length = candidate, length
+
+        if best_length >= MIN_MATCH:
+            matches.append((pos, best_old, best_length))
+            displacement = best_old - pos
+            pos += best_length
+        else:
+            pos += 1
+    return matches
+
+
+def diff_tokens(old, new, old_pos, new_pos, length):
+    out = bytearray()
+    diff = bytes((new[new_pos + i] - old[old_pos + i]) & 0xFF for i in range(length))
+    i = 0
+    while i < length:
+        j = i
+        while j < length and diff[j] == 0:
+            j += 1
+        if j - i >= MIN_COPY_RUN or j == length:
+            out += varint((j - i) << 1)
+            i = j
+            continue
+        # Explicit run: continue until a zero run long enough to be worth a copy token
+        j = i
+        while j < length:
+            zeros = 0
+            while j + zeros < length and diff[j + zeros] == 0:
+                zeros += 1
+            if zeros >= MIN_COPY_RUN or j + zeros == length:
+                break
+            j += zeros + 1
+        out += varint(((j - i) << 1) | 1)
+        out += diff[i:j]
+        i = j
+    return bytes(out)
+
+
+def make_patch(old, new):
+    out = bytearray(MAGIC)
+    out += struct.pack("<II", len(old), len(new))
+    out += hashlib.md5(old).hexdigest().encode()
+
+    matches = find_matches(old, new)
+    old_pos = 0
+    new_pos = 0
+
+    # Literal prefix before the first match, and the seek to it
+    first_new, first_old = (matches[0][0], matches[0][1]) if matches else (len(new), 0)
+    if new:
+        out += varint(0) + varint(first_new) + varint(zigzag(first_old))
+        out += new[:first_new]
+        new_pos = first_new
+        old_pos = first_old
+
+    for i, (match_new, match_old, length) in enumerate(matches):
+        next_new, next_old = (matches[i + 1][0], matches[i + 1][1]) if i + 1 < len(matches) else (len(new), match_old + length)
+        extra = next_new - (match_new + length)
+        seek = next_old - (match_old + length)
+        out += varint(length) + varint(extra) + varint(zigzag(seek))
+        out += diff_tokens(old, new, old_pos, new_pos, length)
+        out += new[match_new + length:next_new]
+        new_pos = next_new
+        old_pos = next_old
+    return bytes(out)
+
+
+def main(argv):
+    if len(argv) != 4:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+    with open(argv[1], "rb") as f:
+        old = f.read()
+    with open(argv[2], "rb") as f:
+        new = f.read()
+    patch = make_patch(old, new)
+    with open(argv[3], "wb") as f:
+        f.write(patch)
+    print("Patch %s: %d bytes (new image %d bytes)" % (argv[3], len(patch), len(new)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,36 @@
+"""PlatformIO post-build script producing an OTA delta patch.
+
+If custom_delta_base points at the image of a previous release, a patch from
+that image to the freshly built firmware is written next to firmware.bin as
+patch-<custom_delta_base_version>-<FIRMWARE_VERSION>.bin, ready to be served
+from OTA_BASE_URL.
+"""
+
+import os
+import sys
+
+Import("env")  # noqa: F821 - provided by PlatformIO
+
+sys.path.insert(0, os.path.join(env.subst("$PROJECT_DIR"), "tools"))  # noqa: F821
+import delta  # noqa: E402
+
+
+def firmware_version(env):
+    for define in env.get("CPPDEFINES", []):
+        if isinstance(define, (list, tuple)) and define[0] == "FIRMWARE_VERSION":
+            return str(define[1]).strip('"\\')
+    return "unknown"
+
+
+def make_patch(source, target, env):
+    base = env.GetProjectOption("custom_delta_base", "")
+    if not base:
+        return
+    base_version = env.GetProjectOption("custom_delta_base_version", "base")
+    base = os.path.join(env.subst("$PROJECT_DIR"), base)
+    image = target[0].get_abspath()
+    patch = os.path.join(os.path.dirname(image), "patch-%s-%s.bin" % (base_version, firmware_version(env)))
+    delta.main(["delta.py", base, image, patch])
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin", make_patch)  # noqa: F821
@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+"""Stand-in for the firmware update server and upload API, for testing on the bench.
+
+Serves the files of a directory under /firmware, as include/Ota.h expects
+them at OTA_BASE_URL: manifest.txt, firmware-<version>.bin and
+patch-<running>-<version>.bin. Range requests are answered with 206, so
+interrupted downloads resume. The manifest is written from the newest image
+with --publish.
+
+To exercise the resume and fallback paths of the firmware:
+  --drop-after BYTES  close every download after BYTES of the body
+  --ignore-range      answer Range requests with the whole file
+
+Uploads posted to any other path are answered with 200. With --hmac-key,
+signed uploads are verified as include/PayloadSigner.h describes: 401 if
+the signature does not match, 409 if the counter is not larger than the
+last one accepted for the device.
+
+With --tls CERT KEY the server speaks HTTPS instead, for the UPLOAD_TLS
+builds. It is held to TLS 1.2, as BearSSL on the ESP8266, and keeps a
+session cache, so the firmware resumes its sessions and can negotiate a
+maximum fragment length. Every handshake is logged with its duration and
+whether it resumed a session, see bench/tls/README.md.
+
+Build the firmware with OTA_BASE_URL and UPLOAD_HOST pointing at this
+machine, e.g. '-D OTA_BASE_URL="http://192.168.0.108:5000/firmware"'.
+
+Usage: stand_in_server.py DIR [--port PORT] [--publish VERSION] [--drop-after BYTES] [--ignore-range]
+                          [--hmac-key KEY] [--tls CERT KEY]
+"""
+
+import argparse
+import hashlib
+import hmac
+import http.server
+import json
+import os
+import re
+import ssl
+import sys
+import threading
+import time
+
+PREFIX = "/firmware/"
+RANGE = re.compile(r"bytes=(\d+)-(\d*)$")
+
+
+class UploadVerifier:
+    """Checks X-Device-Counter and X-Signature, keeping the last counter accepted per device."""
+
+    def __init__(self, fleet_key):
+        self.fleet_key = fleet_key.encode()
+        self.counters = {}
+        self.lock = threading.Lock()
+
+    def device_key(self, device):
+        return hmac.new(self.fleet_key, device.encode(), hashlib.sha256).digest()
+
+    def verify(self, device, counter, signature, body):
+        """Return the HTTP status for a signed upload."""
+        if not device or not counter or not counter.isdigit() or int(counter) > 0xFFFFFFFF or not signature:
+            return 401
+        expected = hmac.new(self.device_key(device), b"%d\n" % int(counter) + body, hashlib.sha256).hexdigest()
+        if not hmac.compare_digest(expected, signature.lower()):
+            return 401
+        with self.lock:
+            if int(counter) <= self.counters.get(device, -1):
+                return 409
+            self.counters[device] = int(counter)
+        return 200
+
+
+def upload_device(headers, body):
+    """The chip id of the uploading device, from the envelope or the X-Device header of a CSV upload."""
+    if headers.get("X-Device"):
+        return headers["X-Device"]
+    try:
+        return str(json.loads(body)["device"])
+    except (ValueError, KeyError, TypeError):
+        return None
+
+
+def publish(directory, version):
+    """Write manifest.txt for firmware-<version>.bin."""
+    with open(os.path.join(directory, "firmware-%s.bin" % version), "rb") as f:
+        image = f.read()
+    line = "%s %d %s\n" % (version, len(image), hashlib.md5(image).hexdigest())
+    with open(os.path.join(directory, "manifest.txt"), "w") as f:
+        f.write(line)
+    return line
+
+
+class StandInHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    # Set by make_server
+    directory = "."
+    drop_after = None
+    ignore_range = False
+    verifier = None
+
+    def log_message(self, fmt, *args):
+        sys.stderr.write("%s %s\n" % (self.address_string(), fmt % args))
+
+    def send_body(self, status, body, headers=()):
+        self.send_response(status)
+        self.send_header("Content-Length", str(len(body)))
+        for name, value in headers:
+            self.send_header(name, value)
+        self.end_headers()
+        if self.command == "HEAD":
+            return
+        if self.drop_after is not None and len(body) > self.drop_after:
+            self.wfile.write(body[:self.drop_after])
+            self.close_connection = True
+            return
+        self.wfile.write(body)
+
+    def do_GET(self):
+        name = self.path[len(PREFIX):] if self.path.startswith(PREFIX) else ""
+        if not name or "/" in name or name.startswith("."):
+            self.send_body(404, b"")
+            return
+        try:
+            with open(os.path.join(self.directory, name), "rb") as f:
+                data = f.read()
+        except OSError:
+            self.send_body(404, b"")
+            return
+
+        match = RANGE.match(self.headers.get("Range", ""))
+        if match is None or self.ignore_range:
+            self.send_body(200, data)
+            return
+        first = int(match.group(1))
+        last = int(match.group(2)) if match.group(2) else len(data) - 1
+        if first >= len(data) or last < first:
+            self.send_body(416, b"", [("Content-Range", "bytes */%d" % len(data))])
+            return
+        last = min(last, len(data) - 1)
+        self.send_body(206, data[first:last + 1],
+                       [("Content-Range", "bytes %d-%d/%d" % (first, last, len(data)))])
+
+    do_HEAD = do_GET
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        status = 200
+        if self.verifier is not None:
+            device = upload_device(self.headers, body)
+            status = self.verifier.verify(device, self.headers.get("X-Device-Counter"),
+                                          self.headers.get("X-Signature"), body)
+            self.log_message("upload from %s, counter %s: %d", device, self.headers.get("X-Device-Counter"), status)
+        self.send_body(status, b"")
+
+
+def tls_context(cert, key):
+    """A server context as the firmware expects it: TLS 1.2 and session IDs kept in the server cache."""
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(cert, key)
+    context.minimum_version = ssl.TLSVersion.TLSv1_2
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    # BearSSL resumes by session ID, not by ticket
+    context.options |= ssl.OP_NO_TICKET
+    # A client that closes without close_notify would otherwise make OpenSSL drop the session
+    context.options |= getattr(ssl, "OP_IGNORE_UNEXPECTED_EOF", 0)
+    return context
+
+
+class TlsServer(http.server.ThreadingHTTPServer):
+    """Does the handshake on the thread of the connection, and records how long each took."""
+
+    context = None
+
+    def __init__(self, address, handler, context):
+        super().__init__(address, handler)
+        self.context = context
+        self.handshakes = []
+        self.lock = threading.Lock()
+
+    def finish_request(self, request, client_address):
+        start = time.perf_counter()
+        try:
+            request = self.context.wrap_socket(request, server_side=True)
+        except (ssl.SSLError, OSError) as e:
+            sys.stderr.write("%s TLS handshake failed: %s\n" % (client_address[0], e))
+            return
+        elapsed = (time.perf_counter() - start) * 1000
+        with self.lock:
+            self.handshakes.append((elapsed, request.session_reused))
+        sys.stderr.write("%s TLS handshake %.1f ms, %s\n"
+                         % (client_address[0], elapsed, "resumed" if request.session_reused else "full"))
+        try:
+            super().finish_request(request, client_address)
+        finally:
+            # OpenSSL drops the session from its cache unless the connection is shut down cleanly
+            try:
+                request.settimeout(1)
+                request.unwrap()
+            except (ssl.SSLError, OSError):
+                pass
+            request.close()
+
+
+def make_server(directory, port, drop_after=None, ignore_range=False, hmac_key=None, tls=None):
+    """tls is a (cert, key) pair of PEM files to serve HTTPS, or None for HTTP."""
+    handler = type("Handler", (StandInHandler,), {
+        "directory": directory,
+        "drop_after": drop_after,
+        "ignore_range": ignore_range,
+        "verifier": UploadVerifier(hmac_key) if hmac_key is not None else None,
+    })
+    if tls is not None:
+        return TlsServer(("", port), handler, tls_context(*tls))
+    return http.server.ThreadingHTTPServer(("", port), handler)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Stand-in firmware update server and upload API")
+    parser.add_argument("directory")
+    parser.add_argument("--port", type=int, default=5000)
+    parser.add_argument("--publish", metavar="VERSION")
+    parser.add_argument("--drop-after", type=int, metavar="BYTES")
+    parser.add_argument("--ignore-range", action="store_true")
+    parser.add_argument("--hmac-key", metavar="KEY", help="the UPLOAD_HMAC_KEY of the firmware")
+    parser.add_argument("--tls", nargs=2, metavar=("CERT", "KEY"), help="serve HTTPS with these PEM files")
+    args = parser.parse_args(argv[1:])
+
+    if args.publish:
+        print("Manifest: " + publish(args.directory, args.publish), end="")
+    server = make_server(args.directory, args.port, args.drop_after, args.ignore_range, args.hmac_key, args.tls)
+    print("Serving %s on port %d%s" % (os.path.abspath(args.directory), args.port, " with TLS" if args.tls else ""))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
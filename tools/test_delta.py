@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Round trip tests of delta.py.
+
+apply() is a reference decoder of the patch format of include/DeltaPatch.h,
+written from the format description rather than from DeltaPatch.cpp. Every
+patch is checked to rebuild the new image from the old one.
+
+The images of fixture_images() are also built by test/test_delta_patch, which
+applies their patch, checked in as test/test_delta_patch/patch.h, with the
+firmware's DeltaPatcher. test_fixture_is_current fails once delta.py no longer
+produces that patch; --fixture writes it again.
+
+Usage: python3 tools/test_delta.py [--fixture]
+"""
+
+import hashlib
+import os
+import struct
+import sys
+import unittest
+
+import delta
+
+FIXTURE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "test", "test_delta_patch", "patch.h")
+
+
+def fixture_images():
+    """The old and new image of the fixture, see test/test_delta_patch/test_main.cpp."""
+    old = bytearray()
+    state = 1
+    for _ in range(4096):
+        state = (state * 1103515245 + 12345) & 0xFFFFFFFF
+        old.append((state >> 16) & 0xFF)
+    new = bytearray()
+    new += bytes((i * 13 + 5) & 0xFF for i in range(64))
+    # Shifted addresses: every 32nd byte differs
+    new += bytes((b + 4) & 0xFF if i % 32 == 0 else b for i, b in enumerate(old[:1024]))
+    new += bytes((i * 29 + 1) & 0xFF for i in range(100))
+    new += old[2048:]
+    new += old[256:768]
+    return bytes(old), bytes(new)
+
+
+def read_varint(patch, pos):
+    value = shift = 0
+    while True:
+        byte = patch[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def apply(old, patch):
+    if patch[:4] != delta.MAGIC:
+        raise ValueError("bad magic")
+    old_size, new_size = struct.unpack("<II", patch[4:12])
+    if old_size != len(old) or patch[12:44] != hashlib.md5(old).hexdigest().encode():
+        raise ValueError("patch for another image")
+    new = bytearray()
+    old_pos = 0
+    pos = 44
+    while len(new) < new_size:
+        diff, pos = read_varint(patch, pos)
+        extra, pos = read_varint(patch, pos)
+        seek, pos = read_varint(patch, pos)
+        seek = (seek >> 1) ^ -(seek & 1)
+        end = len(new) + diff
+        while len(new) < end:
+            token, pos = read_varint(patch, pos)
+            run = token >> 1
+            if token & 1:
+                new += bytes((old[old_pos + i] + patch[pos + i]) & 0xFF for i in range(run))
+                pos += run
+            else:
+                new += old[old_pos:old_pos + run]
+            old_pos += run
+        old_pos += seek
+        if not 0 <= old_pos <= len(old):
+            raise ValueError("seek out of the old image")
+        new += patch[pos:pos + extra]
+        pos += extra
+    if pos != len(patch) or len(new) != new_size:
+        raise ValueError("length mismatch")
+    return bytes(new)
+
+
+def fixture_header(patch):
+    lines = ["/**",
+             " * @file patch.h",
+             " * @brief Patch from the old to the new image of test_main.cpp",
+             " *",
+             " * Written by tools/test_delta.py --fixture, do not edit.",
+             " *",
+             " */",
+             "",
+             "#ifndef TEST_DELTA_PATCH_H",
+             "#define TEST_DELTA_PATCH_H",
+             "",
+             "#include <stdint.h>",
+             "",
+             "static const uint8_t fixturePatch[] = {"]
+    for i in range(0, len(patch), 16):
+        lines.append("  " + ", ".join("0x%02x" % b for b in patch[i:i + 16]) + ",")
+    lines += ["};", "", "#endif"]
+    return "\n".join(lines) + "\n"
+
+
+class DeltaTest(unittest.TestCase):
+    def round_trip(self, old, new):
+        patch = delta.make_patch(old, new)
+        self.assertEqual(apply(old, patch), new)
+        return patch
+
+    def test_fixture_images(self):
+        old, new = fixture_images()
+        patch = self.round_trip(old, new)
+        self.assertLess(len(patch), len(new) // 4)
+
+    def test_fixture_is_current(self):
+        with open(FIXTURE) as f:
+            self.assertEqual(f.read(), fixture_header(delta.make_patch(*fixture_images())),
+                             "run python3 tools/test_delta.py --fixture")
+
+    def test_identical_images(self):
+        old, _ = fixture_images()
+        patch = self.round_trip(old, old)
+        self.assertLess(len(patch), 64)
+
+    def test_unrelated_images(self):
+        self.round_trip(bytes(range(256)) * 4, bytes((i * 97) & 0xFF for i in range(3000)))
+
+    def test_empty_images(self):
+        old, _ = fixture_images()
+        self.assertEqual(len(self.round_trip(old, b"")), 44)
+        self.round_trip(b"", bytes(range(200)))
+
+    def test_rejects_other_image(self):
+        old, new = fixture_images()
+        patch = delta.make_patch(old, new)
+        with self.assertRaises(ValueError):
+            apply(old[:-1] + b"\0", patch)
+
+
+if __name__ == "__main__":
+    if sys.argv[1:] == ["--fixture"]:
+        with open(FIXTURE, "w") as f:
+            f.write(fixture_header(delta.make_patch(*fixture_images())))
+        sys.exit(0)
+    unittest.main()
@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""Tests of the stand-in server against the download logic of src/Ota.cpp, and
+of its upload signature checks.
+
+download() follows downloadFrom() and runDownload(): it resumes with a Range
+request from the bytes it has, skips what it has when the server answers 200,
+and gives up after OTA_MAX_ATTEMPTS connections.
+
+The signed upload is the one of tools/collector/SignatureTest.cpp, so both
+verifiers are checked against the same signature.
+
+The TLS tests make a throwaway certificate with the openssl command, and are
+skipped without it.
+
+Usage: python3 tools/test_stand_in_server.py
+"""
+
+import hashlib
+import hmac
+import http.client
+import os
+import shutil
+import socket
+import ssl
+import subprocess
+import tempfile
+import threading
+import unittest
+
+import stand_in_server
+
+OTA_MAX_ATTEMPTS = 5
+
+ENVELOPE = (b'{"device":"a1b2c3","firmware":"0.4","encoding":1,"sensors":["dht22"],'
+            b'"seq":[120,120],"readings":[{"timestamp":1616400000,"humidity":65.20,"temperature":21.40}]}')
+SIGNATURE = "1f57be6224231cbfbb26eea05680d89833f7c032857a61b7f12c249da3974e0d"
+
+
+def make_certificate(directory):
+    """Write a self-signed EC certificate for localhost, returning the (cert, key) paths."""
+    cert = os.path.join(directory, "cert.pem")
+    key = os.path.join(directory, "key.pem")
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:prime256v1",
+                    "-nodes", "-days", "1", "-subj", "/CN=localhost", "-keyout", key, "-out", cert],
+                   check=True, capture_output=True)
+    return cert, key
+
+
+def download(port, name):
+    """Fetch /firmware/<name> like the firmware, returning (data, connections)."""
+    data = b""
+    size = 0
+    for attempt in range(OTA_MAX_ATTEMPTS):
+        connection = http.client.HTTPConnection("localhost", port, timeout=5)
+        headers = {"Range": "bytes=%d-" % len(data)} if data else {}
+        connection.request("GET", stand_in_server.PREFIX + name, headers=headers)
+        response = connection.getresponse()
+        skip = 0
+        if response.status == 200:
+            skip = len(data)
+            size = size or int(response.getheader("Content-Length"))
+        elif response.status != 206:
+            connection.close()
+            return None, attempt + 1
+        try:
+            while len(data) < size:
+                chunk = response.read1(1024)
+                if not chunk:
+                    break
+                start = min(skip, len(chunk))
+                skip -= start
+                data += chunk[start:][:size - len(data)]
+        except http.client.IncompleteRead:
+            pass
+        connection.close()
+        if size and len(data) == size:
+            return data, attempt + 1
+    return None, OTA_MAX_ATTEMPTS
+
+
+class StandInServerTest(unittest.TestCase):
+    def setUp(self):
+        self.directory = tempfile.TemporaryDirectory()
+        self.image = bytes((i * 7 + (i >> 8)) & 0xFF for i in range(20000))
+        with open(os.path.join(self.directory.name, "firmware-0.5.bin"), "wb") as f:
+            f.write(self.image)
+        self.servers = []
+
+    def tearDown(self):
+        for server in self.servers:
+            server.shutdown()
+            server.server_close()
+        self.directory.cleanup()
+
+    def serve(self, **options):
+        server = stand_in_server.make_server(self.directory.name, 0, **options)
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        self.servers.append(server)
+        return server.server_address[1]
+
+    def test_manifest_matches_image(self):
+        stand_in_server.publish(self.directory.name, "0.5")
+        port = self.serve()
+        manifest, _ = download(port, "manifest.txt")
+        version, size, md5 = manifest.decode().split()
+        self.assertEqual(version, "0.5")
+        self.assertEqual(int(size), len(self.image))
+        self.assertEqual(md5, hashlib.md5(self.image).hexdigest())
+
+    def test_download_in_one_connection(self):
+        data, connections = download(self.serve(), "firmware-0.5.bin")
+        self.assertEqual(data, self.image)
+        self.assertEqual(connections, 1)
+
+    def test_resumes_dropped_download(self):
+        data, connections = download(self.serve(drop_after=6000), "firmware-0.5.bin")
+        self.assertEqual(data, self.image)
+        self.assertEqual(connections, 4)
+
+    def test_skips_resent_bytes_without_range(self):
+        # Every connection starts over and breaks off within the bytes already received
+        data, _ = download(self.serve(drop_after=6000, ignore_range=True), "firmware-0.5.bin")
+        self.assertIsNone(data)
+        data, connections = download(self.serve(ignore_range=True), "firmware-0.5.bin")
+        self.assertEqual(data, self.image)
+        self.assertEqual(connections, 1)
+
+    def test_gives_up_after_max_attempts(self):
+        data, connections = download(self.serve(drop_after=1000), "firmware-0.5.bin")
+        self.assertIsNone(data)
+        self.assertEqual(connections, OTA_MAX_ATTEMPTS)
+
+    def test_range_past_end(self):
+        connection = http.client.HTTPConnection("localhost", self.serve(), timeout=5)
+        connection.request("GET", "/firmware/firmware-0.5.bin", headers={"Range": "bytes=20000-"})
+        response = connection.getresponse()
+        response.read()
+        self.assertEqual(response.status, 416)
+        self.assertEqual(response.getheader("Content-Range"), "bytes */20000")
+        connection.close()
+
+    def test_missing_file(self):
+        data, connections = download(self.serve(), "patch-0.4-0.5.bin")
+        self.assertIsNone(data)
+        self.assertEqual(connections, 1)
+        data, _ = download(self.serve(), "../firmware-0.5.bin")
+        self.assertIsNone(data)
+
+
+    def post(self, port, body, headers):
+        connection = http.client.HTTPConnection("localhost", port, timeout=5)
+        connection.request("POST", "/api/DataEntries/list", body=body, headers=headers)
+        response = connection.getresponse()
+        response.read()
+        connection.close()
+        return response.status
+
+    def test_signed_upload(self):
+        port = self.serve(hmac_key="change me")
+        signed = {"X-Device-Counter": "17", "X-Signature": SIGNATURE}
+        self.assertEqual(self.post(port, ENVELOPE, signed), 200)
+        self.assertEqual(self.post(port, ENVELOPE, signed), 409)
+        self.assertEqual(self.post(port, ENVELOPE.replace(b"21.40", b"31.40"),
+                                   {"X-Device-Counter": "18", "X-Signature": SIGNATURE}), 401)
+        self.assertEqual(self.post(port, ENVELOPE, {"X-Device-Counter": "18"}), 401)
+        self.assertEqual(self.post(port, ENVELOPE, {}), 401)
+
+    def test_signed_csv_upload(self):
+        port = self.serve(hmac_key="change me")
+        body = b"timestamp,humidity,temperature\n1616400000,65.20,21.40\n"
+        key = hmac.new(b"change me", b"a1b2c3", hashlib.sha256).digest()
+        signature = hmac.new(key, b"3\n" + body, hashlib.sha256).hexdigest()
+        headers = {"X-Device": "a1b2c3", "X-Device-Counter": "3", "X-Signature": signature}
+        self.assertEqual(self.post(port, body, headers), 200)
+        headers["X-Device"] = "a1b2c4"
+        self.assertEqual(self.post(port, body, headers), 401)
+
+    def test_unsigned_upload_without_key(self):
+        self.assertEqual(self.post(self.serve(), ENVELOPE, {}), 200)
+
+    @unittest.skipIf(shutil.which("openssl") is None, "needs the openssl command")
+    def test_tls_sessions_resume(self):
+        cert, key = make_certificate(self.directory.name)
+        stand_in_server.publish(self.directory.name, "0.5")
+        server = stand_in_server.make_server(self.directory.name, 0, tls=(cert, key))
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        self.servers.append(server)
+        port = server.server_address[1]
+
+        context = ssl.create_default_context(cafile=cert)
+        session = None
+        for _ in range(3):
+            # Resumed like the firmware does, by passing the session of the last connection
+            raw = socket.create_connection(("localhost", port), timeout=5)
+            connection = http.client.HTTPConnection("localhost", port)
+            connection.sock = context.wrap_socket(raw, server_hostname="localhost", session=session)
+            self.assertEqual(connection.sock.version(), "TLSv1.2")
+            connection.request("GET", "/firmware/manifest.txt")
+            response = connection.getresponse()
+            self.assertEqual(response.status, 200)
+            self.assertTrue(response.read().startswith(b"0.5 20000 "))
+            session = connection.sock.session
+            connection.close()
+
+        self.assertEqual([reused for _, reused in server.handshakes], [False, True, True])
+
+
+if __name__ == "__main__":
+    unittest.main()